@@ -6,6 +6,12 @@
 #include <mutex>     //multithread constant access 
 #include <algorithm> //search algorithm 
 #include <atomic>    //boolean control for multithreading
+#include <map>       //Fragment buffer
+#include <deque>     //Audio playback queue
+#include <condition_variable> //Wake playback thread
+#include <memory>    //Optional recorder
+#include <string>    //Command line values
+#include <random>    //Refresh requester id
 
  //Sytem libraries
 #include <unistd.h>  //API functions; system calls 
@@ -16,26 +22,42 @@
 #include <cstddef>        // size_t
 
  //Audio 
-#include <alsa/asoundlib.h> //Audio capture and playback 
+#include "../common/audio_io.h" //Audio capture and playback (ALSA, synthetic, file or null)
 
 //Video (OpenCV)
 #include <opencv2/opencv.hpp> //Main OpenCV Library
 #include <opencv2/imgproc.hpp> //Image processing Library
 #include <opencv2/highgui.hpp> //GUI 
 #include <opencv2/imgcodecs.hpp> //encode/decode library 
+#include <turbojpeg.h>            //JPEG encode straight from YUV planes 
 
  //Timing and synchronization 
  #include <chrono>     //Timestamps
 
+ //Playout
+#include "video_playout.h" //Frame-clock video playout buffer
+#include "video_packetizer.h" //Fragmentation and reassembly (Reorder_Frames lives there)
+
+ //Sender preprocessing
+#include "preprocess.h"    //SIMD colour conversion and downscale 
+#include "strip_encoder.h" //Strip-parallel JPEG encoding 
+
+ //Recording
+#include "../common/session_recorder.h" //Off-thread session recording
+
+ //Wire format
+#include "../common/av_packets.h" //Audio, video, feedback and SFU datagrams
+
+ //Test networks
+#include "../common/netsim.h" //Loss, delay and jitter on loopback (--netsim / --netsim-in), capture and replay
+#include "../common/trace.h"  //Per-stage latency timeline (--trace)
+#include "../common/cli_args.h" //Option values
 
 
 //Global constants
-//Audio format
+//Audio format (Buff_Size and Channels are part of the wire format, av_packets.h)
 #define S_Rate 48000   //Sample rate HZ
-#define Channels 2     //Stereo audio
-
-//Audio buffer
-#define Buff_Size 1024 
+#define Audio_Latency_us 10000 //Device buffer
 
 //Video format 
 #define Width 320
@@ -44,6 +66,9 @@
 //Video Quality 
 #define V_Quality 50 
 
+//Parallel encoding
+#define Encode_Strips 4   //Independent JPEG strips per frame (one encoder thread each)
+
 //Video packet size
 #define Max_Size 65507
 
@@ -53,63 +78,97 @@
 //Connection check 
 #define Broadcast_Int 5 //Time (s) between HELLO messages 
 
+//Video playout buffer
+#define Playout_Min_ms 20    //Lowest target delay 
+#define Playout_Max_ms 250   //Highest target delay 
+#define Playout_Frames 8     //Frames held before skipping ahead 
+
+//Receive path
+#define Recv_Timeout_ms 200  //Socket read timeout so threads can stop
+#define Audio_Queue_Max 8    //Audio packets held for playback 
+
+//Refresh (PLI/FIR) feedback
+#define Refresh_Min_ms 100   //Minimum time between refresh requests/forced refreshes
+#define Intra_Only true      //JPEG frames never reference earlier frames
 
+//Session recording
+#define Record_Segment_s 60  //Seconds per recording segment
 
-//Audio packet structure
-struct Audio_Packet {
-    uint32_t a_sequence; 
-    uint64_t timestamp;
-    int16_t audio_data[Buff_Size * Channels]; 
 
+//Every datagram goes through here; a plain sendto/recvfrom unless --netsim/--netsim-in/--capture/--replay
+netsim::UdpShim net;
+
+//Datagram capture (--capture), for replaying the session offline (--replay)
+pcap::Writer capture_log;
+
+//Per-stage tags; one load and a branch each unless --trace
+tracing::Tracer tracer;
+
+//Our id in refresh requests, so a video sender can tell its receivers apart
+const uint32_t Requester_Id = std::random_device{}();
+
+
+
+//Received audio waiting for playback (Queued_Audio is in av_packets.h)
+struct Audio_Queue {
+    std::mutex mute;
+    std::condition_variable ready;
+    std::deque<Queued_Audio> packets;
 };
 
+//Sender side of the refresh channel
+struct Refresh_State {
+    std::atomic<bool> pending{false};                    //Next frame must be a key frame
+    std::chrono::steady_clock::time_point last_forced{}; //Last honored request (receive thread only)
+    std::map<uint32_t, uint32_t> fir_seq;                //Last FIR request_seq per requester (receive thread only)
+};
 
-//Video packet structure
-struct Video_Fragment{
-    uint32_t frame_seq;        //Video frame sequence
-    uint32_t fragment_i;       //Video fragment index
-    uint32_t total_fragments;      //Total fragments
-    bool last_fragment;        //Last fragment
-    size_t fragment_s;         //Fragment size
-    unsigned char Fdata[1400];  //Fragment data
+//Client side of an SFU session (--sfu); used by the receive thread once started
+struct Sfu_Session {
+    bool enabled = false;
+    sockaddr_in server = {};
+    uint32_t self = 0;                 //Our member id, 0 until welcomed
+    uint32_t video_from = SFU_All;     //Requested video source, SFU_All = first other member
+    uint32_t following = 0;            //Video source subscribed to, 0 = none
+    std::vector<uint32_t> members;     //Other members of the room
+    std::string room;                  //Requested room, empty = the SFU's main room
+    std::string current_room;          //Room named in the last welcome
 };
 
-//Setup Alsa
-bool ALSAset(snd_pcm_t* &captureman, snd_pcm_t* &playbackman) {
+//Setup audio (backends from --audio-in / --audio-out, ALSA by default)
+bool AudioSet(const std::string& in_spec, const std::string& out_spec, std::unique_ptr<audio::Source>& captureman, std::unique_ptr<audio::Sink>& playbackman) {
     
     //Start audio capture; send message if failed
-    if (snd_pcm_open(&captureman, "default", SND_PCM_STREAM_CAPTURE, 0) < 0){
+    captureman = audio::openSource(in_spec, {S_Rate, Channels, Audio_Latency_us});
+    if (!captureman){
         std::cerr << "Capturing error.\n";
         return false; 
     }
 
     //Start audio playback; send message if failed 
-    if(snd_pcm_open(&playbackman, "default", SND_PCM_STREAM_PLAYBACK, 0) < 0) {
+    playbackman = audio::openSink(out_spec, {S_Rate, Channels, Audio_Latency_us});
+    if (!playbackman) {
         std::cerr << "Playback error. \n";
         return false;
     }
 
-
-    //Set audio stream parameters
-    snd_pcm_set_params(captureman, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, Channels, S_Rate, 1, 10000);
-    snd_pcm_set_params(playbackman, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, Channels, S_Rate, 1, 10000);
     return true; //Successful setup
 
 }
 
 
 //Audio capture and send function
-void AudioRecAndSend(snd_pcm_t* captureman, std::vector<sockaddr_in>& peerIP, int sockfd, std::atomic<bool>& running, std::mutex& peer_mute) {
+void AudioRecAndSend(audio::Source* captureman, std::vector<sockaddr_in>& peerIP, int sockfd, std::atomic<bool>& running, std::mutex& peer_mute, recording::SessionRecorder* recorder) {
     
     //Initialize
     Audio_Packet packet = {};
     uint32_t sequence = 0; 
 
     while(running) {
-        int FrameNum = snd_pcm_readi(captureman, packet.audio_data, Buff_Size);
+        int FrameNum = captureman->read(packet.audio_data, Buff_Size);
         if (FrameNum < 0) {
-            std::cerr << "Audio rec error" << snd_strerror(FrameNum) << "\n";
-            if (snd_pcm_prepare(captureman) < 0) {
+            std::cerr << "Audio rec error" << audio::errorText(FrameNum) << "\n";
+            if (captureman->recover(FrameNum) < 0) {
                 std::cerr << "Audio device error. \n";
                 running = false;
                 break;
@@ -117,8 +176,16 @@ void AudioRecAndSend(snd_pcm_t* captureman, std::vector<sockaddr_in>& peerIP, in
             continue;
         }
 
-        //Set sequence number
+        //Set sequence number and capture time (us)
         packet.a_sequence = sequence++; 
+        packet.timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::system_clock::now().time_since_epoch()).count();
+        tracer.mark(tracing::Stage_Capture, tracing::Flow_Audio_Out, packet.a_sequence);
+
+        //Hand a copy to the recorder (never blocks)
+        if (recorder) {
+            recorder->pushAudio(packet.timestamp, packet.audio_data, size_t(FrameNum) * Channels * sizeof(int16_t));
+        }
 
         //Access peer IP address 
         std::lock_guard<std::mutex> lock(peer_mute);
@@ -126,16 +193,33 @@ void AudioRecAndSend(snd_pcm_t* captureman, std::vector<sockaddr_in>& peerIP, in
 
         //Send Audio to each peer
         for (const auto& peer : peersList) {
-            ssize_t Audio_size = sendto(sockfd, &packet, sizeof(packet), 0, (struct sockaddr*)&peer, sizeof(peer));
+            ssize_t Audio_size = net.sendto(sockfd, &packet, sizeof(packet), 0, (struct sockaddr*)&peer, sizeof(peer));
             if (Audio_size < 0) {
                 std::cerr << "Audio stream error. \n";
             }
         }
+        tracer.mark(tracing::Stage_Send, tracing::Flow_Audio_Out, packet.a_sequence);
 
     }
 }
 
-void VideoRecandSend(std::vector<sockaddr_in>& peer_List, int sockfd, std::atomic<bool>& running, std::mutex& peer_mute) {
+//Fragment one encoded strip and send it to every peer; called from the encoder threads
+void SendStrip(int sockfd, std::vector<sockaddr_in>& peer_List, std::mutex& peer_mute, uint32_t frame_seq, uint64_t capture_ts,
+               bool key_frame, int strip_i, int total_strips, const unsigned char* enc_strip, size_t strip_size) {
+
+    FragmentStrip(frame_seq, capture_ts, key_frame, strip_i, total_strips, enc_strip, strip_size, [&](const Video_Fragment& fragment) {
+        std::lock_guard<std::mutex> lock(peer_mute);
+        for (const auto& peer : peer_List) {
+            ssize_t s_Bytes = net.sendto(sockfd, &fragment, sizeof(fragment), 0, (struct sockaddr*)&peer, sizeof(peer));
+            if (s_Bytes < 0) {
+                std::cerr << "Transmission error: " << strerror(errno) << "\n";
+
+            }
+        }
+    });
+}
+
+void VideoRecandSend(std::vector<sockaddr_in>& peer_List, int sockfd, std::atomic<bool>& running, std::mutex& peer_mute, Refresh_State& refresh, recording::SessionRecorder* recorder) {
     cv::VideoCapture cap(0, cv::CAP_V4L2); //Open Webcam
     if (!cap.isOpened()) {
         std::cerr << "Video device error. \n";
@@ -144,13 +228,36 @@ void VideoRecandSend(std::vector<sockaddr_in>& peer_List, int sockfd, std::atomi
 
     }
 
-    //Initialize video parameters
+    //Initialize video parameters; ask for raw YUYV so OpenCV does not convert
+    cap.set(cv::CAP_PROP_FOURCC, cv::VideoWriter::fourcc('Y', 'U', 'Y', 'V'));
+    cap.set(cv::CAP_PROP_CONVERT_RGB, 0);
     cap.set(cv::CAP_PROP_FRAME_WIDTH, Width);
     cap.set(cv::CAP_PROP_FRAME_HEIGHT, Heighth);
     cap.set(cv::CAP_PROP_FPS, 30);
 
+    //Cameras without YUYV (MJPEG only, say) keep their format; have OpenCV decode those to BGR
+    bool bgr_fallback = static_cast<int>(cap.get(cv::CAP_PROP_FOURCC)) != cv::VideoWriter::fourcc('Y', 'U', 'Y', 'V');
+    if (bgr_fallback) {
+        cap.set(cv::CAP_PROP_CONVERT_RGB, 1);
+        std::cout << "Camera does not deliver YUYV, using BGR frames.\n";
+    }
+
+    //Camera may ignore the requested size; the preprocessor scales to Width x Heighth
+    int cam_w = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_WIDTH));
+    int cam_h = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
+    FramePreprocessor preprocessor(Width, Heighth);
+    std::cout << "Camera " << cam_w << "x" << cam_h << ", SIMD level " << static_cast<int>(preprocessor.simd()) << "\n";
+
     //Initialize sequence
     uint32_t frame_seq = 0;
+    uint64_t capture_ts = 0;
+    bool key_frame = true;
+
+    //Strip encoders packetize and send from their own threads as each strip finishes
+    StripEncoderPool encoder(Encode_Strips, Width, Heighth, V_Quality,
+        [&](int strip_i, int total_strips, const unsigned char* data, size_t size) {
+            SendStrip(sockfd, peer_List, peer_mute, frame_seq, capture_ts, key_frame, strip_i, total_strips, data, size);
+        });
 
     while (running) { 
         cv::Mat frame;
@@ -160,66 +267,79 @@ void VideoRecandSend(std::vector<sockaddr_in>& peer_List, int sockfd, std::atomi
 
         }
 
-        //Encode frame data
-        std::vector<uchar> enc_frame;
-        std::vector<int> comp_params = {cv::IMWRITE_JPEG_QUALITY, V_Quality} ;
-        if(!cv::imencode(".jpg", frame,enc_frame, comp_params)) {
-            std::cerr << "Video Encode error. \n";
+        //Capture timestamp shared by all fragments of this frame
+        capture_ts = std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::system_clock::now().time_since_epoch()).count();
+        tracer.mark(tracing::Stage_Capture, tracing::Flow_Video_Out, frame_seq);
+
+        //Key frame on request; JPEG frames are all key frames today, an inter-frame encoder forces its refresh here
+        key_frame = refresh.pending.exchange(false) || Intra_Only;
+
+        //Convert and scale into the encoder planes
+        const YUV420Planes* planes = nullptr;
+        if (frame.type() == CV_8UC3) {
+            planes = &preprocessor.fromBGR(frame.data, static_cast<int>(frame.step), frame.cols, frame.rows);
+        } else if (frame.total() * frame.elemSize() == size_t(cam_w) * cam_h * 2) {
+            planes = &preprocessor.fromYUYV(frame.data, cam_w * 2, cam_w, cam_h);
+        } else if (!bgr_fallback) {
+            //Reported YUYV but sent something else: let OpenCV convert from now on
+            cap.set(cv::CAP_PROP_CONVERT_RGB, 1);
+            bgr_fallback = true;
+            std::cerr << "Camera frames are not YUYV, switching to BGR. \n";
+            continue;
+        } else {
+            std::cerr << "Unsupported camera format. \n";
             continue;
-
         }
 
-        size_t frame_size = enc_frame.size();
-        size_t max_fragment_s = sizeof(Video_Fragment::Fdata);
-        uint32_t total_fragments = (frame_size + max_fragment_s - 1) / max_fragment_s;
-
-       //Send fragments 
-        for (uint32_t fragment_i = 0; fragment_i < total_fragments; ++fragment_i) {
-            Video_Fragment fragment = {};
-            fragment.frame_seq = frame_seq;
-            fragment.fragment_i = fragment_i;
-            fragment.total_fragments = total_fragments;
-            fragment.last_fragment = (fragment_i == total_fragments - 1);
-
-
-            size_t offset = fragment_i * max_fragment_s;
-            fragment.fragment_s = std::min(max_fragment_s, frame_size - offset);
-            std::memcpy(fragment.Fdata , enc_frame.data() + offset, fragment.fragment_s);
-
-            std::lock_guard<std::mutex> lock(peer_mute);
-            for (const auto& peer : peer_List) {
-                ssize_t s_Bytes = sendto(sockfd, &fragment, sizeof(fragment), 0, (struct sockaddr*)&peer, sizeof(peer));
-                if (s_Bytes < 0) {
-                    std::cerr << "Transmission error: " << strerror(errno) << "\n";
-
-                }
+        //Encode and send; returns when the last strip is out
+        tracer.mark(tracing::Stage_Encode, tracing::Flow_Video_Out, frame_seq);
+        if (!encoder.encode(*planes)) {
+            std::cerr << "Video Encode error. \n";
+        }
+        tracer.mark(tracing::Stage_Send, tracing::Flow_Video_Out, frame_seq);
+
+        //Encoded strips go to the recorder as is
+        if (recorder) {
+            std::vector<uchar> record;
+            for (int i = 0; i < encoder.strips(); i++) {
+                uint32_t size = static_cast<uint32_t>(encoder.stripSize(i));
+                record.insert(record.end(), reinterpret_cast<const uchar*>(&size), reinterpret_cast<const uchar*>(&size) + sizeof(size));
+                record.insert(record.end(), encoder.stripData(i), encoder.stripData(i) + size);
             }
+            recorder->pushVideo(capture_ts, std::move(record), recording::Record_Video_Strips);
         }
 
         frame_seq++;
     }
 }
 
-//Receive and playback audio function
-void AudioPlayback(snd_pcm_t* playbackman, int sockfd, std::atomic<bool>& runnning){
+//Playback audio handed over by the receive thread
+void AudioPlayback(audio::Sink* playbackman, Audio_Queue& audio_q, std::atomic<bool>& runnning){
 
     //Initialize
-    Audio_Packet packet = {};
+    Queued_Audio queued = {};
+    const Audio_Packet& packet = queued.packet;
     uint32_t last_sequ = 0;
     uint16_t silence[Buff_Size * Channels] = {0}; //Buffer of 0s for lost packets 
 
     while (runnning) { 
-        ssize_t Audio_rec = recv(sockfd, &packet, sizeof(packet), 0);
-        if (Audio_rec < 0) {
-            std::cerr << "Error receiving audio. \n";
-            continue;
+        {
+            std::unique_lock<std::mutex> lock(audio_q.mute);
+            if (!audio_q.ready.wait_for(lock, std::chrono::milliseconds(Recv_Timeout_ms), [&audio_q] { return !audio_q.packets.empty(); })) {
+                continue;
+            }
+            queued = audio_q.packets.front();
+            audio_q.packets.pop_front();
         }
+        tracer.mark(tracing::Stage_Dequeue, tracing::Flow_Audio_In, packet.a_sequence, queued.source);
 
 
-        int Frames_r = snd_pcm_writei(playbackman, packet.audio_data, Buff_Size);
+        int Frames_r = playbackman->write(packet.audio_data, Buff_Size);
         if (Frames_r < 0) {
-            snd_pcm_prepare(playbackman);
+            playbackman->recover(Frames_r);
         }
+        tracer.mark(tracing::Stage_Playback, tracing::Flow_Audio_In, packet.a_sequence, queued.source);
 
         //Update sequence
         last_sequ = packet.a_sequence;
@@ -227,61 +347,106 @@ void AudioPlayback(snd_pcm_t* playbackman, int sockfd, std::atomic<bool>& runnni
 
 }
 
-//Recieve and play video 
-void VideoPlayback(int sockfd, std::atomic<bool>& running) {
-
-    //Open playback window 
-    cv::namedWindow("Stream", cv::WINDOW_AUTOSIZE);
-
-    uint32_t current_frame_seq = 0;
-    std::vector<uchar> reassembled_frame;
-    std::map<uint32_t, std::vector<Video_Fragment>> fragment_buffer;
-
-    while(running) {
-        Video_Fragment fragment = {};
-        ssize_t received_bytes = recv(sockfd, &fragment, sizeof(fragment), 0);
-        if (received_bytes < 0) {
-            std::cerr << "Receiving error. \n";
-            continue;
+//Ask the video sender for a key frame (rate limited)
+void RequestRefresh(int sockfd, Video_Receiver& video_rx, const sockaddr_in& source) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - video_rx.last_request < std::chrono::milliseconds(Refresh_Min_ms)) {
+        return;
+    }
+    video_rx.last_request = now;
+
+    //Repeated requests for the same loss escalate to FIR
+    Feedback_Packet feedback = {};
+    feedback.magic = FB_Magic;
+    feedback.type = (video_rx.unanswered++ > 0) ? FB_FIR : FB_PLI;
+    feedback.frame_seq = video_rx.last_complete;
+    feedback.request_seq = ++video_rx.request_seq;
+    feedback.requester = Requester_Id;
+
+    if (net.sendto(sockfd, &feedback, sizeof(feedback), 0, (const struct sockaddr*)&source, sizeof(source)) < 0) {
+        std::cerr << "Feedback send error: " << strerror(errno) << "\n";
+    }
+}
 
+//Sender: a PLI forces a key frame at most once per Refresh_Min_ms; a FIR forces
+//one right away, once per request (duplicates and replays carry the same request_seq)
+void HandleFeedback(const Feedback_Packet& feedback, Refresh_State& refresh) {
+    auto now = std::chrono::steady_clock::now();
+    if (feedback.type == FB_FIR) {
+        auto seen = refresh.fir_seq.find(feedback.requester);
+        if (seen != refresh.fir_seq.end() && seen->second == feedback.request_seq) {
+            return;
         }
+        refresh.fir_seq[feedback.requester] = feedback.request_seq;
+    } else if (feedback.type != FB_PLI || now - refresh.last_forced < std::chrono::milliseconds(Refresh_Min_ms)) {
+        return;
+    }
+    refresh.last_forced = now;
+    refresh.pending = true;
+}
 
+//Reassemble video; completed frames go to the playout buffer 
+void VideoPlayback(int sockfd, Video_Receiver& video_rx, const Video_Fragment& fragment, const sockaddr_in& source, VideoPlayoutBuffer& playout) {
 
-        //Load fragment in buffer
-        fragment_buffer[fragment.frame_seq].push_back(fragment);
+    PlayoutFrame frame;
+    Reassembly result = ReassembleFragment(video_rx, fragment, frame);
+    if (result.refresh) {
+        RequestRefresh(sockfd, video_rx, source);
+    }
+    if (!result.complete) {
+        return;
+    }
 
-        //Check if fragments are received
-        if (fragment.last_fragment) {
-            auto& fragments = fragment_buffer[fragment.frame_seq];
-            if (fragments.size() == fragment.total_fragments) {
+    //Hand over to the display clock; the frame counts as received with its last fragment
+    frame.source = tracing::sourceOf(source);
+    tracer.mark(tracing::Stage_Receive, tracing::Flow_Video_In, frame.frame_seq, frame.source);
+    playout.push(std::move(frame));
 
-                //Re-form frame 
-                reassembled_frame.clear();
-                std::sort(fragments.begin(), fragments.end(), [](const Video_Fragment& a, const Video_Fragment& b) {
-                    return a.fragment_i < b.fragment_i; 
-                });
+}
 
-                for (const auto& frag : fragments) {
-                    reassembled_frame.insert(reassembled_frame.end(), frag.Fdata, frag.Fdata + frag.fragment_s);
-                }
+//Show video frames when the playout buffer releases them; one window per sender
+void VideoDisplay(VideoPlayoutBuffer& playout, std::atomic<bool>& running) {
 
-                //Decode and display frame 
-                cv::Mat frame = cv::imdecode(reassembled_frame, cv::IMREAD_COLOR);
-                if (!frame.empty()) {
-                    cv::imshow("Stream", frame);
-                    if (cv::waitKey(1) == 27) {
-                        running = false;
-                    } 
-                }
+    std::map<uint32_t, std::string> windows;   //Sender -> playback window
 
-                //Clear buffer 
-                fragment_buffer.erase(fragment.frame_seq);
+    PlayoutFrame frame;
+    while (running && playout.waitNext(frame)) {
+        tracer.mark(tracing::Stage_Dequeue, tracing::Flow_Video_In, frame.frame_seq, frame.source);
 
+        //Decode strips and stack them into the frame 
+        std::vector<cv::Mat> strips;
+        for (const auto& strip : frame.strips) {
+            cv::Mat decoded = cv::imdecode(strip, cv::IMREAD_COLOR);
+            if (decoded.empty()) {
+                strips.clear();
+                break;
+            }
+            strips.push_back(decoded);
+        }
+        cv::Mat image;
+        if (!strips.empty()) {
+            cv::vconcat(strips, image);
+        }
+        if (!image.empty()) {
+            auto window = windows.find(frame.source);
+            if (window == windows.end()) {
+                window = windows.emplace(frame.source, "Stream " + std::to_string(windows.size() + 1)).first;
+                cv::namedWindow(window->second, cv::WINDOW_AUTOSIZE);
             }
+            cv::imshow(window->second, image);
+            tracer.mark(tracing::Stage_Playback, tracing::Flow_Video_In, frame.frame_seq, frame.source);
+            if (cv::waitKey(1) == 27) {
+                running = false;
+            } 
         }
     }
 
-    cv::destroyWindow("Stream");
+    std::cout << "Video frames shown: " << playout.played() << ", skipped: " << playout.skipped()
+              << ", late: " << playout.late() << ", delay: " << playout.targetDelayMs() << " ms\n";
+
+    for (const auto& window : windows) {
+        cv::destroyWindow(window.second);
+    }
 
 }
 
@@ -294,7 +459,7 @@ void sendHELLO (int sockfd, sockaddr_in& boradcast_ad, std::atomic<bool>& runnin
 
     //repetedly send message to constantly check peers
     while (running) {
-        if (sendto(sockfd, message, strlen(message), 0, (struct sockaddr*)&boradcast_ad, sizeof(boradcast_ad)) < 0) {
+        if (net.sendto(sockfd, message, strlen(message), 0, (struct sockaddr*)&boradcast_ad, sizeof(boradcast_ad)) < 0) {
 
             std::cerr << "Failed to broadcast message " << strerror(errno) << "\n";      
         }
@@ -307,45 +472,243 @@ void sendHELLO (int sockfd, sockaddr_in& boradcast_ad, std::atomic<bool>& runnin
 
 
 //UDP Find peers function 
-void LookForPeers(int sockfd, std::vector<sockaddr_in>& peer_List, std::mutex& peer_mute, std::atomic<bool>& running) {
+void LookForPeers(const sockaddr_in& peer_addr, std::vector<sockaddr_in>& peer_List, std::mutex& peer_mute) {
 
-     //Initialize
-     char buffer[1024];
-     sockaddr_in peer_addr{};
-     socklen_t addr_l = sizeof(peer_addr);
-    
+    std::lock_guard<std::mutex> lock(peer_mute);
+    auto it = std::find_if(peer_List.begin(), peer_List.end(), [&peer_addr](const sockaddr_in& addr) {
+        return addr.sin_addr.s_addr == peer_addr.sin_addr.s_addr && addr.sin_port == peer_addr.sin_port;
+    });
+
+    //Add Peer to list
+    if (it == peer_List.end()) {
+        peer_List.push_back(peer_addr);
+        std::cout << "Peer: " <<inet_ntoa(peer_addr.sin_addr) << "\n";
+    }
+}
+
+
+//Send one control message to the SFU
+void SendSfuControl(int sockfd, const Sfu_Session& sfu, uint32_t op, uint32_t member, uint32_t kinds) {
+    Sfu_Control control = {};
+    control.magic = SFU_Magic;
+    control.op = op;
+    control.member = member;
+    control.kinds = kinds;
+    if (op == SFU_Join) {
+        memcpy(control.room, sfu.room.data(), std::min(sfu.room.size(), size_t(SFU_Room_Max)));  //NUL padded by the zeroed struct
+    }
+    if (net.sendto(sockfd, &control, sizeof(control), 0, (const struct sockaddr*)&sfu.server, sizeof(sfu.server)) < 0) {
+        std::cerr << "SFU control send error: " << strerror(errno) << "\n";
+    }
+}
+
+//The display shows one stream: take video from a single member only
+void FollowVideo(int sockfd, Sfu_Session& sfu, std::map<uint32_t, Video_Receiver>& video_rx, VideoPlayoutBuffer& playout) {
+    uint32_t source = sfu.video_from;
+    if (source == SFU_All) {
+        source = sfu.members.empty() ? 0 : sfu.members.front();
+    }
+
+    //Repeated on every welcome in case a request was lost
+    SendSfuControl(sockfd, sfu, SFU_Unsubscribe, SFU_All, SFU_Video);
+    if (source != 0) {
+        SendSfuControl(sockfd, sfu, SFU_Subscribe, source, SFU_Video);
+    }
+
+    //A new sender numbers its frames from its own start; all of it arrives from the SFU's address
+    if (source != sfu.following) {
+        sfu.following = source;
+        video_rx.clear();
+        playout.reset(tracing::sourceOf(sfu.server));
+        if (source != 0) {
+            std::cout << "SFU: showing video of member " << source << "\n";
+        }
+    }
+}
+
+//Membership changes from the SFU steer the video subscription
+void HandleSfuControl(int sockfd, const Sfu_Control& control, Sfu_Session& sfu,
+                      std::map<uint32_t, Video_Receiver>& video_rx, VideoPlayoutBuffer& playout) {
+    auto known = std::find(sfu.members.begin(), sfu.members.end(), control.member);
+
+    std::string room(control.room, strnlen(control.room, SFU_Room_Max));
+    bool in_room = sfu.room.empty() || sfu.current_room == sfu.room;
+
+    if (control.op == SFU_Welcome) {
+        if (sfu.self != control.member || sfu.current_room != room) {
+            //First welcome, a room change, or the SFU restarted
+            std::cout << "SFU: joined as member " << control.member << " in room " << room
+                      << " (" << control.members << " in room)\n";
+            sfu.self = control.member;
+            sfu.current_room = room;
+            sfu.members.clear();
+        }
+        if (!sfu.room.empty() && room != sfu.room) {
+            //New members start in the main room; repeated on every welcome in case it was lost
+            SendSfuControl(sockfd, sfu, SFU_Join, sfu.self, 0);
+            return;
+        }
+        FollowVideo(sockfd, sfu, video_rx, playout);
+
+    } else if (!in_room) {
+        //Members of the main room, before our join takes effect
+
+    } else if (control.op == SFU_Joined && control.member != sfu.self && known == sfu.members.end()) {
+        std::cout << "SFU: member " << control.member << " joined (" << control.members << " in room)\n";
+        sfu.members.push_back(control.member);
+        if (sfu.following == 0) {
+            FollowVideo(sockfd, sfu, video_rx, playout);
+        }
+
+    } else if (control.op == SFU_Left && known != sfu.members.end()) {
+        std::cout << "SFU: member " << control.member << " left\n";
+        sfu.members.erase(known);
+        if (control.member == sfu.following && sfu.video_from == SFU_All) {
+            FollowVideo(sockfd, sfu, video_rx, playout);
+        }
+    }
+}
+
+//Single reader of the shared socket: routes HELLO, audio, video, feedback and SFU datagrams
+void ReceiveDispatch(int sockfd, std::vector<sockaddr_in>& peer_List, std::mutex& peer_mute, Audio_Queue& audio_q,
+                     VideoPlayoutBuffer& playout, Refresh_State& refresh, Sfu_Session& sfu, std::atomic<bool>& running) {
+
+    //Initialize
+    union {
+        Audio_Packet audio;
+        Video_Fragment video;
+        Feedback_Packet feedback;
+        Sfu_Control control;
+        char text[64];
+    } datagram;
+    std::map<uint32_t, Video_Receiver> video_rx;   //Reassembly, loss and refresh state per sender
+    sockaddr_in peer_addr{};
 
     while (running) {
-        //Get message
-        ssize_t Audio_rec = recvfrom(sockfd, buffer, sizeof(buffer) - 1, 0, (struct sockaddr*)&peer_addr, &addr_l);
-        if (Audio_rec > 0) {
-            buffer[Audio_rec] = '\0';
-            if (strcmp(buffer, "HELLO") == 0) {
-                std::lock_guard<std::mutex> lock(peer_mute);
-                auto it = std::find_if(peer_List.begin(), peer_List.end(), [&peer_addr](const sockaddr_in& addr) {
-                    return addr.sin_addr.s_addr == peer_addr.sin_addr.s_addr && addr.sin_port == peer_addr.sin_port;
-                });
-                
-                //Add Peer to list
-                if (it == peer_List.end()) {
-                    peer_List.push_back(peer_addr);
-                    std::cout << "Peer: " <<inet_ntoa(peer_addr.sin_addr) << "\n";
-                }
-                }
+        socklen_t addr_l = sizeof(peer_addr);
+        ssize_t received = net.recvfrom(sockfd, &datagram, sizeof(datagram), 0, (struct sockaddr*)&peer_addr, &addr_l);
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                std::cerr << "Receiving error: " << strerror(errno) << "\n";
+            }
+            continue;
+        }
+
+        if (received == 5 && memcmp(datagram.text, "HELLO", 5) == 0) {
+            //With an SFU the server is the only peer
+            if (!sfu.enabled) {
+                LookForPeers(peer_addr, peer_List, peer_mute);
+            }
 
+        } else if (received == sizeof(Audio_Packet)) {
+            uint32_t source = tracing::sourceOf(peer_addr);
+            tracer.mark(tracing::Stage_Receive, tracing::Flow_Audio_In, datagram.audio.a_sequence, source);
+            std::lock_guard<std::mutex> lock(audio_q.mute);
+            if (audio_q.packets.size() >= Audio_Queue_Max) {
+                audio_q.packets.pop_front(); //Playback fell behind: drop oldest
             }
+            audio_q.packets.push_back({datagram.audio, source});
+            audio_q.ready.notify_one();
+
+        } else if (received == sizeof(Video_Fragment)) {
+            VideoPlayback(sockfd, video_rx[tracing::sourceOf(peer_addr)], datagram.video, peer_addr, playout);
 
+        } else if (received == sizeof(Feedback_Packet) && datagram.feedback.magic == FB_Magic) {
+            HandleFeedback(datagram.feedback, refresh);
+
+        } else if (received == sizeof(Sfu_Control) && datagram.control.magic == SFU_Magic && sfu.enabled) {
+            HandleSfuControl(sockfd, datagram.control, sfu, video_rx, playout);
         }
     }
+}
 
 
 
-int main() {
+int main(int argc, char* argv[]) {
+
+    //Options: session recording (--record <prefix>); send through an SFU
+    //instead of to every peer (--sfu <ip[:port]>, optionally --room <name> and --video-from <member>);
+    //audio backends (--audio-in / --audio-out <spec>: alsa[:device], synth, file:path, null);
+    //impaired links for testing (--netsim <spec> on sends, --netsim-in <spec> on receives, see netsim.h);
+    //per-stage latency timeline (--trace <file>, see trace.h and trace_report.py);
+    //datagram capture (--capture <file.pcapng>) and offline replay of what a capture received
+    //(--replay <file>, --replay-speed <x>: 1 as recorded, 0 as fast as possible)
+    std::unique_ptr<recording::SessionRecorder> recorder;
+    Sfu_Session sfu;
+    std::string audio_in = "alsa";
+    std::string audio_out = "alsa";
+    netsim::Impairment egress, ingress;
+    std::string capture_path, replay_path;
+    double replay_speed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            if (!tracer.start(argv[++i])) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--netsim") == 0 && has_value) {
+            if (!netsim::parseImpairment(argv[++i], egress)) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--netsim-in") == 0 && has_value) {
+            if (!netsim::parseImpairment(argv[++i], ingress)) {
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--capture") == 0 && has_value) {
+            capture_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay-speed") == 0 && has_value && cli::parseDouble(argv[i + 1], replay_speed, 0, 1000)) {
+            i++;
+        } else if (strcmp(argv[i], "--audio-in") == 0 && has_value) {
+            audio_in = argv[++i];
+        } else if (strcmp(argv[i], "--audio-out") == 0 && has_value) {
+            audio_out = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+            const char* prefix = argv[++i];
+            recorder.reset(new recording::SessionRecorder(prefix, Record_Segment_s, S_Rate, Channels));
+            if (!recorder->start()) {
+                return 1;
+            }
+            std::cout << "Recording to " << prefix << "_NNNN.oavr\n";
+        } else if (strcmp(argv[i], "--sfu") == 0 && has_value) {
+            std::string server = argv[++i];
+            size_t colon = server.find(':');
+            uint16_t port = UDP_port;
+            if (colon != std::string::npos && !cli::parsePort(server.substr(colon + 1), port)) {
+                std::cerr << "Invalid SFU port: " << server << "\n";
+                return 1;
+            }
+            sfu.server.sin_family = AF_INET;
+            sfu.server.sin_port = htons(port);
+            if (inet_pton(AF_INET, server.substr(0, colon).c_str(), &sfu.server.sin_addr) <= 0) {
+                std::cerr << "Invalid SFU address: " << server << "\n";
+                return 1;
+            }
+            sfu.enabled = true;
+        } else if (strcmp(argv[i], "--room") == 0 && has_value) {
+            sfu.room = argv[++i];
+            if (sfu.room.empty() || sfu.room.size() > SFU_Room_Max) {
+                std::cerr << "Room names are 1 to " << SFU_Room_Max << " characters.\n";
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--video-from") == 0 && has_value && cli::parseInt(argv[i + 1], sfu.video_from)) {
+            i++;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--record <prefix>] [--sfu <ip[:port]> [--room <name>] [--video-from <member>]]"
+                      << " [--audio-in <spec>] [--audio-out <spec>] [--netsim <spec>] [--netsim-in <spec>] [--trace <file>]"
+                      << " [--capture <file>] [--replay <file> [--replay-speed <x>]]\n";
+            return 1;
+        }
+    }
 
     //Initialize coommon variables 
     std::vector<sockaddr_in> peer_List; //List of discovered peers
     std::mutex peer_mute;               //Protecting peer List 
     std::atomic<bool> running(true);    //Flag to control threads
+    VideoPlayoutBuffer playout(Playout_Min_ms, Playout_Max_ms, Playout_Frames); //Received video frames
+    Audio_Queue audio_q;                //Received audio
+    Refresh_State refresh;              //Key frame requests from peers
 
     //UDP scoket init 
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -362,6 +725,12 @@ int main() {
         return 1;
     }
 
+    //Read timeout so the receive thread notices shutdown
+    struct timeval recv_timeout = {0, Recv_Timeout_ms * 1000};
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &recv_timeout, sizeof(recv_timeout)) < 0) {
+        std::cerr << "Failed to set receive timeout: " << strerror(errno) << "\n";
+    }
+
     //Set socket address and port
     sockaddr_in local_address = {};
     local_address.sin_family = AF_INET;
@@ -374,6 +743,21 @@ int main() {
         return 1;
 
     }
+    net.attach(sockfd, egress, ingress);
+    if (!capture_path.empty()) {
+        if (!capture_log.start(capture_path)) {
+            close(sockfd);
+            return 1;
+        }
+        net.record(&capture_log);
+    }
+    if (!replay_path.empty()) {
+        if (!net.replay(replay_path, replay_speed)) {
+            close(sockfd);
+            return 1;
+        }
+        std::cout << "Replaying " << replay_path << "; nothing is sent.\n";
+    }
 
 
     //Set Broadcast address
@@ -382,14 +766,22 @@ int main() {
     brd_address.sin_port = htons(UDP_port);
     brd_address.sin_addr.s_addr = INADDR_BROADCAST;
 
+    //With an SFU, HELLO goes to the server (keeping the membership and any NAT
+    //binding alive) and so does all media
+    sockaddr_in hello_address = sfu.enabled ? sfu.server : brd_address;
+    if (sfu.enabled) {
+        peer_List.push_back(sfu.server);
+        std::cout << "Sending through the SFU at " << inet_ntoa(sfu.server.sin_addr) << ":" << ntohs(sfu.server.sin_port) << "\n";
+    }
+
 
-    //Init ALSA 
-    snd_pcm_t* captureman = nullptr;
-    snd_pcm_t* playbackman = nullptr;
+    //Init audio 
+    std::unique_ptr<audio::Source> captureman;
+    std::unique_ptr<audio::Sink> playbackman;
 
 
-    if(!ALSAset(captureman, playbackman)) {
-        std::cerr << "Failed to initialize ALSA. \n";
+    if(!AudioSet(audio_in, audio_out, captureman, playbackman)) {
+        std::cerr << "Failed to initialize audio. \n";
         close(sockfd);
         return 1;
 
@@ -397,12 +789,12 @@ int main() {
 
 
     //Start threads
-    std::thread broadcast(sendHELLO, sockfd, std::ref(brd_address), std::ref(running));
-    std::thread listen(LookForPeers, sockfd, std::ref(peer_List), std::ref(peer_mute), std::ref(running));
-    std::thread send_audio(AudioRecAndSend, captureman, std::ref(peer_List), sockfd, std::ref(running), std::ref(peer_mute));
-    std::thread play_audio(AudioPlayback, playbackman, sockfd, std::ref(running));
-    std::thread send_video(VideoRecandSend, std::ref(peer_List), sockfd, std::ref(running), std::ref(peer_mute));
-    std::thread play_video(VideoPlayback, sockfd, std::ref(running));
+    std::thread broadcast(sendHELLO, sockfd, std::ref(hello_address), std::ref(running));
+    std::thread receive(ReceiveDispatch, sockfd, std::ref(peer_List), std::ref(peer_mute), std::ref(audio_q), std::ref(playout), std::ref(refresh), std::ref(sfu), std::ref(running));
+    std::thread send_audio(AudioRecAndSend, captureman.get(), std::ref(peer_List), sockfd, std::ref(running), std::ref(peer_mute), recorder.get());
+    std::thread play_audio(AudioPlayback, playbackman.get(), std::ref(audio_q), std::ref(running));
+    std::thread send_video(VideoRecandSend, std::ref(peer_List), sockfd, std::ref(running), std::ref(peer_mute), std::ref(refresh), recorder.get());
+    std::thread show_video(VideoDisplay, std::ref(playout), std::ref(running));
 
 
     //End program
@@ -411,21 +803,36 @@ int main() {
 
     //stop threads
     running = false; 
+    playout.stop();
 
     //join threads 
     broadcast.join();
-    listen.join();
+    receive.join();
     send_audio.join();
     play_audio.join();
     send_video.join();
-    play_video.join();
+    show_video.join();
+
+    //Flush recording
+    if (recorder) {
+        recorder->stop();
+    }
+
+    //Leave the SFU room now rather than by timeout
+    if (sfu.enabled) {
+        SendSfuControl(sockfd, sfu, SFU_Left, sfu.self, 0);
+    }
 
 
 
 
     //clean up buffer
-    snd_pcm_close(captureman);
-    snd_pcm_close(playbackman);
+    captureman.reset();
+    playbackman.reset();
+    net.detach();
+    std::cout << net.summary();
+    tracer.stop();
+    capture_log.stop();
     close(sockfd);
 
 
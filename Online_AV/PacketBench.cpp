@@ -0,0 +1,313 @@
+// Packet path microbenchmarks: the per-datagram work of Online_AV without the
+// camera, the codec or the network.
+//
+//   BM_Fragment      an encoded strip cut into Video_Fragment datagrams (SendStrip)
+//   BM_Reassemble    fragments of a frame stream, with loss and reorder, back into
+//                    frames (VideoPlayback)
+//   BM_AudioQueue    a Queued_Audio through the receive queue and out to playback
+//                    (ReceiveDispatch -> AudioPlayback)
+//
+// Built on Google Benchmark. Besides time, every case reports time/pkt,
+// allocs/frame (heap allocations per frame, or per audio packet) and, where
+// perf events are allowed, llc_miss/frame (last-level cache misses). Loss
+// and reorder are per mille arguments; --loss and --reorder (percent) add one
+// more case to the grid, and --capture adds one on the video fragments an
+// Online_AV --capture session received, to compare reassembly changes on
+// recorded traffic.
+//
+// Build: g++ -std=c++17 -O2 -o PacketBench PacketBench.cpp -lbenchmark -pthread
+// Run:   ./PacketBench [--loss 2] [--reorder 5] [--capture session.pcapng] [--benchmark_filter=Reassemble ...]
+
+// Include Libraries
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+
+#include "../common/av_packets.h"
+#include "../common/cli_args.h"
+#include "../common/pcap_capture.h"
+#include "video_packetizer.h"
+
+#define Strips 4               //As Encode_Strips in Online_AV
+#define Stream_Frames 256      //Frames per reassembly pass
+#define Strip_Bytes 6000       //Encoded strip size for the reassembly stream (~5 fragments)
+#define Audio_Queue_Max 8      //As in Online_AV
+#define Max_Reorder 8          //A reordered fragment arrives up to this many datagrams late
+
+
+//Every heap allocation of the process passes here
+std::atomic<uint64_t> allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+
+//Last-level cache misses of this thread, user space only; -1 when perf events are not allowed
+class CacheMisses {
+public:
+    CacheMisses() {
+        perf_event_attr attr = {};
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~CacheMisses() {
+        if (fd_ >= 0) close(fd_);
+    }
+
+    void start() {
+        if (fd_ < 0) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    int64_t stop() {
+        if (fd_ < 0) return -1;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        int64_t count = 0;
+        if (read(fd_, &count, sizeof(count)) != sizeof(count)) return -1;
+        return count;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+
+//Allocation and cache miss counters around the timed loop of one case
+struct Counters {
+    CacheMisses misses;
+    uint64_t allocs_before = 0;
+
+    void start() {
+        allocs_before = allocations.load(std::memory_order_relaxed);
+        misses.start();
+    }
+
+    //per: frames (or packets) the loop handled
+    void report(benchmark::State& state, double per, double packets) {
+        int64_t missed = misses.stop();
+        double allocs = double(allocations.load(std::memory_order_relaxed) - allocs_before);
+        state.counters["allocs/frame"] = per > 0 ? allocs / per : 0;
+        if (missed >= 0) {
+            state.counters["llc_miss/frame"] = per > 0 ? double(missed) / per : 0;
+        }
+        state.counters["time/pkt"] = benchmark::Counter(packets, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    }
+};
+
+
+//Encoded strip stand-in: incompressible bytes
+std::vector<unsigned char> MakeStrip(size_t bytes) {
+    std::vector<unsigned char> strip(bytes);
+    std::mt19937 rng(1);
+    for (auto& b : strip) b = static_cast<unsigned char>(rng());
+    return strip;
+}
+
+
+//Sender: one frame of Strips strips per iteration; the send copies each datagram like sendto would
+void BM_Fragment(benchmark::State& state) {
+    std::vector<unsigned char> strip = MakeStrip(size_t(state.range(0)));
+    static Video_Fragment wire[64];
+    size_t sent = 0;
+    uint32_t frame_seq = 0;
+
+    Counters counters;
+    counters.start();
+    for (auto _ : state) {
+        for (int strip_i = 0; strip_i < Strips; strip_i++) {
+            FragmentStrip(frame_seq, 0, true, strip_i, Strips, strip.data(), strip.size(), [&](const Video_Fragment& fragment) {
+                std::memcpy(&wire[sent++ % 64], &fragment, sizeof(fragment));
+            });
+        }
+        frame_seq++;
+        benchmark::ClobberMemory();
+    }
+    counters.report(state, double(state.iterations()), double(sent));
+    state.SetBytesProcessed(int64_t(state.iterations()) * Strips * state.range(0));
+}
+BENCHMARK(BM_Fragment)->Arg(2000)->Arg(6000)->Arg(20000)->Arg(60000);
+
+
+//A stream of frames as the receiver sees it: fragments with loss and reorder applied
+std::vector<Video_Fragment> MakeStream(int loss_pm, int reorder_pm) {
+    std::vector<unsigned char> strip = MakeStrip(Strip_Bytes);
+    std::vector<Video_Fragment> sent;
+    for (uint32_t frame_seq = 0; frame_seq < Stream_Frames; frame_seq++) {
+        for (int strip_i = 0; strip_i < Strips; strip_i++) {
+            FragmentStrip(frame_seq, frame_seq * 33333ULL, true, strip_i, Strips, strip.data(), strip.size(),
+                          [&](const Video_Fragment& fragment) { sent.push_back(fragment); });
+        }
+    }
+
+    //Loss drops a datagram; reorder holds one back for 1..Max_Reorder datagrams
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> per_mille(0, 999);
+    std::uniform_int_distribution<int> lateness(1, Max_Reorder);
+    std::vector<std::pair<size_t, Video_Fragment>> held;
+    std::vector<Video_Fragment> received;
+    for (size_t i = 0; i < sent.size(); i++) {
+        if (per_mille(rng) < loss_pm) continue;
+        if (per_mille(rng) < reorder_pm) {
+            held.push_back({i + size_t(lateness(rng)), sent[i]});
+        } else {
+            received.push_back(sent[i]);
+        }
+        for (auto it = held.begin(); it != held.end();) {
+            if (it->first <= i) {
+                received.push_back(it->second);
+                it = held.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& late : held) received.push_back(late.second);
+    return received;
+}
+
+//Video fragments a capture received, in arrival order
+bool LoadCapture(const std::string& path, std::vector<Video_Fragment>& stream) {
+    pcap::Reader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    pcap::Packet packet;
+    while (reader.next(packet)) {
+        if (packet.direction != pcap::Outbound && packet.payload.size() == sizeof(Video_Fragment)) {
+            stream.emplace_back();
+            std::memcpy(&stream.back(), packet.payload.data(), sizeof(Video_Fragment));
+        }
+    }
+    if (stream.empty()) {
+        std::cerr << path << " holds no received video fragments.\n";
+        return false;
+    }
+    return true;
+}
+
+//Receiver: the whole stream per iteration, into a fresh receiver; sent_frames for the delivered ratio
+void Reassemble(benchmark::State& state, const std::vector<Video_Fragment>& stream, double sent_frames) {
+    double frames = 0, refreshes = 0;
+
+    Counters counters;
+    counters.start();
+    for (auto _ : state) {
+        Video_Receiver video_rx;
+        PlayoutFrame frame;
+        for (const auto& fragment : stream) {
+            Reassembly result = ReassembleFragment(video_rx, fragment, frame);
+            frames += result.complete;
+            refreshes += result.refresh;
+            if (result.complete) {
+                benchmark::DoNotOptimize(frame.strips.data());
+                frame = PlayoutFrame();  //Moved to the playout buffer in Online_AV
+            }
+        }
+    }
+    counters.report(state, frames, double(state.iterations()) * double(stream.size()));
+    state.counters["delivered"] = frames / double(state.iterations()) / sent_frames;
+    state.counters["refresh/frame"] = frames > 0 ? refreshes / frames : 0;
+}
+
+void BM_Reassemble(benchmark::State& state) {
+    Reassemble(state, MakeStream(int(state.range(0)), int(state.range(1))), Stream_Frames);
+}
+BENCHMARK(BM_Reassemble)->ArgNames({"loss_pm", "reorder_pm"})->ArgsProduct({{0, 10, 50}, {0, 50}});
+
+
+//Audio: receive thread copies in, playback thread copies out
+void BM_AudioQueue(benchmark::State& state) {
+    Audio_Packet datagram = {};
+    Queued_Audio out = {};
+    std::deque<Queued_Audio> packets;
+    uint32_t sequence = 0;
+    uint32_t source = 0x0100007f;      //What tracing::sourceOf gives for a peer
+
+    Counters counters;
+    counters.start();
+    for (auto _ : state) {
+        datagram.a_sequence = sequence++;
+        if (packets.size() >= Audio_Queue_Max) {
+            packets.pop_front();
+        }
+        packets.push_back({datagram, source});
+        out = packets.front();
+        packets.pop_front();
+        benchmark::DoNotOptimize(out.packet.audio_data[0]);
+    }
+    counters.report(state, double(state.iterations()), double(state.iterations()));
+    state.SetBytesProcessed(int64_t(state.iterations()) * int64_t(sizeof(Queued_Audio)) * 2);
+}
+BENCHMARK(BM_AudioQueue);
+
+
+int main(int argc, char* argv[]) {
+    //--loss / --reorder (percent) add a case; everything else goes to Google Benchmark
+    double loss = -1, reorder = 0;
+    std::vector<Video_Fragment> captured;
+    std::vector<char*> rest = {argv[0]};
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--loss" && i + 1 < argc && cli::parseDouble(argv[i + 1], loss, 0, 100)) {
+            i++;
+        } else if (arg == "--reorder" && i + 1 < argc && cli::parseDouble(argv[i + 1], reorder, 0, 100)) {
+            i++;
+            loss = std::max(loss, 0.0);
+        } else if (arg == "--capture" && i + 1 < argc) {
+            if (!LoadCapture(argv[++i], captured)) {
+                return 1;
+            }
+        } else {
+            rest.push_back(argv[i]);
+        }
+    }
+    if (loss >= 0) {
+        benchmark::RegisterBenchmark("BM_Reassemble/custom", BM_Reassemble)->Args({int64_t(loss * 10), int64_t(reorder * 10)});
+    }
+    if (!captured.empty()) {
+        std::set<uint32_t> frames;
+        for (const auto& fragment : captured) frames.insert(fragment.frame_seq);
+        double sent_frames = double(frames.size());
+        benchmark::RegisterBenchmark("BM_Reassemble/capture", [&captured, sent_frames](benchmark::State& state) {
+            Reassemble(state, captured, sent_frames);
+        });
+    }
+
+    int rest_argc = int(rest.size());
+    benchmark::Initialize(&rest_argc, rest.data());
+    if (benchmark::ReportUnrecognizedArguments(rest_argc, rest.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
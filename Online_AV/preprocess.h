@@ -0,0 +1,536 @@
+#ifndef PREPROCESS_H
+#define PREPROCESS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <immintrin.h>
+
+// Sender preprocessing stage.
+// Converts camera frames (packed BGR or YUYV) to planar YUV 4:2:0 and scales
+// them down to the stream size, writing into planes allocated once up front.
+// The planes feed the JPEG encoder directly (tjCompressFromYUVPlanes), so no
+// further colour conversion happens in the encoder.
+//
+// Colour conversion uses full-range JFIF coefficients in fixed point:
+//   Y  = (77 R + 150 G + 29 B + 128) >> 8
+//   Cb = ((-22 R - 42 G + 64 B + 64) >> 7) + 128   (on the 2x2 average)
+//   Cr = (( 64 R - 54 G - 10 B + 64) >> 7) + 128
+// The AVX2 and SSE4.1 kernels produce bit-identical output to the scalar path
+// and are picked at runtime from the CPU features.
+
+// One 4:2:0 picture; rows are padded to a multiple of 32 bytes
+struct YUV420Planes {
+    int width = 0;
+    int height = 0;
+    int stride[3] = {0, 0, 0};
+    std::vector<uint8_t> plane[3];   // Y, Cb, Cr
+
+    void allocate(int w, int h) {
+        width = w;
+        height = h;
+        stride[0] = (w + 31) & ~31;
+        stride[1] = stride[2] = ((w + 1) / 2 + 31) & ~31;
+        plane[0].assign(size_t(stride[0]) * h, 0);
+        plane[1].assign(size_t(stride[1]) * ((h + 1) / 2), 128);
+        plane[2].assign(size_t(stride[2]) * ((h + 1) / 2), 128);
+    }
+
+    uint8_t* row(int p, int y) { return plane[p].data() + size_t(stride[p]) * y; }
+    const uint8_t* row(int p, int y) const { return plane[p].data() + size_t(stride[p]) * y; }
+};
+
+enum class SimdLevel { Scalar, SSE41, AVX2 };
+
+inline SimdLevel detectSimd() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.1")) return SimdLevel::SSE41;
+    return SimdLevel::Scalar;
+}
+
+namespace preprocess_detail {
+
+inline uint8_t clamp8(int v) { return uint8_t(v < 0 ? 0 : (v > 255 ? 255 : v)); }
+
+inline uint8_t lumaOf(int b, int g, int r) { return uint8_t((77 * r + 150 * g + 29 * b + 128) >> 8); }
+inline uint8_t cbOf(int b, int g, int r) { return clamp8(((-22 * r - 42 * g + 64 * b + 64) >> 7) + 128); }
+inline uint8_t crOf(int b, int g, int r) { return clamp8(((64 * r - 54 * g - 10 * b + 64) >> 7) + 128); }
+
+// Scalar BGR -> I420 for columns [x0, w) of the row pair (y, y + 1)
+inline void bgrRowPairScalar(const uint8_t* top, const uint8_t* bottom, int x0, int w,
+                             uint8_t* y_top, uint8_t* y_bottom, uint8_t* cb, uint8_t* cr) {
+    for (int x = x0; x < w; x += 2) {
+        int x1 = std::min(x + 1, w - 1);
+        const uint8_t* p[4] = {top + 3 * x, top + 3 * x1, bottom + 3 * x, bottom + 3 * x1};
+        y_top[x] = lumaOf(p[0][0], p[0][1], p[0][2]);
+        if (x + 1 < w) y_top[x + 1] = lumaOf(p[1][0], p[1][1], p[1][2]);
+        if (y_bottom) {
+            y_bottom[x] = lumaOf(p[2][0], p[2][1], p[2][2]);
+            if (x + 1 < w) y_bottom[x + 1] = lumaOf(p[3][0], p[3][1], p[3][2]);
+        }
+        int b = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+        int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+        int r = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+        cb[x / 2] = cbOf(b, g, r);
+        cr[x / 2] = crOf(b, g, r);
+    }
+}
+
+// Scalar YUYV -> I420 for columns [x0, w) of the row pair
+inline void yuyvRowPairScalar(const uint8_t* top, const uint8_t* bottom, int x0, int w,
+                              uint8_t* y_top, uint8_t* y_bottom, uint8_t* cb, uint8_t* cr) {
+    for (int x = x0; x < w; x += 2) {
+        const uint8_t* t = top + 2 * x;
+        const uint8_t* b = bottom + 2 * x;
+        y_top[x] = t[0];
+        if (x + 1 < w) y_top[x + 1] = t[2];
+        if (y_bottom) {
+            y_bottom[x] = b[0];
+            if (x + 1 < w) y_bottom[x + 1] = b[2];
+        }
+        cb[x / 2] = uint8_t((t[1] + b[1] + 1) >> 1);
+        cr[x / 2] = uint8_t((t[3] + b[3] + 1) >> 1);
+    }
+}
+
+// pshufb masks pulling channel c of 16 packed BGR pixels out of 16-byte part k
+struct BgrMasks {
+    alignas(16) int8_t mask[3][3][16];
+    BgrMasks() {
+        for (int c = 0; c < 3; c++) {
+            for (int k = 0; k < 3; k++) {
+                for (int j = 0; j < 16; j++) {
+                    int src = 3 * j + c;
+                    mask[c][k][j] = (src / 16 == k) ? int8_t(src - 16 * k) : int8_t(-128);
+                }
+            }
+        }
+    }
+};
+
+inline const BgrMasks& bgrMasks() {
+    static const BgrMasks masks;
+    return masks;
+}
+
+__attribute__((target("sse4.1")))
+inline void deinterleave16(const uint8_t* p, __m128i& b, __m128i& g, __m128i& r) {
+    const BgrMasks& m = bgrMasks();
+    __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+    __m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32));
+    __m128i* out[3] = {&b, &g, &r};
+    for (int c = 0; c < 3; c++) {
+        __m128i v0 = _mm_shuffle_epi8(a0, _mm_load_si128(reinterpret_cast<const __m128i*>(m.mask[c][0])));
+        __m128i v1 = _mm_shuffle_epi8(a1, _mm_load_si128(reinterpret_cast<const __m128i*>(m.mask[c][1])));
+        __m128i v2 = _mm_shuffle_epi8(a2, _mm_load_si128(reinterpret_cast<const __m128i*>(m.mask[c][2])));
+        *out[c] = _mm_or_si128(_mm_or_si128(v0, v1), v2);
+    }
+}
+
+// 8 lanes of Y from 16-bit B, G, R
+__attribute__((target("sse4.1")))
+inline __m128i luma8(__m128i b, __m128i g, __m128i r) {
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(77)), _mm_mullo_epi16(g, _mm_set1_epi16(150)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(29)));
+    return _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+}
+
+// Cb/Cr from 16-bit averaged B, G, R (signed fixed point, offset 128)
+__attribute__((target("sse4.1")))
+inline void chroma8(__m128i b, __m128i g, __m128i r, __m128i& cb, __m128i& cr) {
+    const __m128i round = _mm_set1_epi16(64), offset = _mm_set1_epi16(128);
+    cb = _mm_sub_epi16(_mm_slli_epi16(b, 6), _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(22)), _mm_mullo_epi16(g, _mm_set1_epi16(42))));
+    cb = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(cb, round), 7), offset);
+    cr = _mm_sub_epi16(_mm_slli_epi16(r, 6), _mm_add_epi16(_mm_mullo_epi16(g, _mm_set1_epi16(54)), _mm_mullo_epi16(b, _mm_set1_epi16(10))));
+    cr = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(cr, round), 7), offset);
+}
+
+__attribute__((target("avx2")))
+inline void chroma16(__m256i b, __m256i g, __m256i r, __m256i& cb, __m256i& cr) {
+    const __m256i round = _mm256_set1_epi16(64), offset = _mm256_set1_epi16(128);
+    cb = _mm256_sub_epi16(_mm256_slli_epi16(b, 6), _mm256_add_epi16(_mm256_mullo_epi16(r, _mm256_set1_epi16(22)), _mm256_mullo_epi16(g, _mm256_set1_epi16(42))));
+    cb = _mm256_add_epi16(_mm256_srai_epi16(_mm256_add_epi16(cb, round), 7), offset);
+    cr = _mm256_sub_epi16(_mm256_slli_epi16(r, 6), _mm256_add_epi16(_mm256_mullo_epi16(g, _mm256_set1_epi16(54)), _mm256_mullo_epi16(b, _mm256_set1_epi16(10))));
+    cr = _mm256_add_epi16(_mm256_srai_epi16(_mm256_add_epi16(cr, round), 7), offset);
+}
+
+// SSE4.1: 16 pixels of a row pair per step
+__attribute__((target("sse4.1")))
+inline void bgrRowPairSSE41(const uint8_t* top, const uint8_t* bottom, int w,
+                            uint8_t* y_top, uint8_t* y_bottom, uint8_t* cb, uint8_t* cr) {
+    const __m128i two = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i bt, gt, rt, bb, gb, rb;
+        deinterleave16(top + 3 * x, bt, gt, rt);
+        deinterleave16(bottom + 3 * x, bb, gb, rb);
+
+        const __m128i* src[2][3] = {{&bt, &gt, &rt}, {&bb, &gb, &rb}};
+        __m128i wide[2][3][2];
+        for (int row = 0; row < 2; row++) {
+            for (int c = 0; c < 3; c++) {
+                wide[row][c][0] = _mm_cvtepu8_epi16(*src[row][c]);
+                wide[row][c][1] = _mm_cvtepu8_epi16(_mm_srli_si128(*src[row][c], 8));
+            }
+            uint8_t* y_out = row == 0 ? y_top : y_bottom;
+            __m128i lo = luma8(wide[row][0][0], wide[row][1][0], wide[row][2][0]);
+            __m128i hi = luma8(wide[row][0][1], wide[row][1][1], wide[row][2][1]);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y_out + x), _mm_packus_epi16(lo, hi));
+        }
+
+        //2x2 averages: vertical add, then horizontal pair add
+        __m128i avg[3];
+        for (int c = 0; c < 3; c++) {
+            __m128i lo = _mm_add_epi16(wide[0][c][0], wide[1][c][0]);
+            __m128i hi = _mm_add_epi16(wide[0][c][1], wide[1][c][1]);
+            avg[c] = _mm_srli_epi16(_mm_add_epi16(_mm_hadd_epi16(lo, hi), two), 2);
+        }
+        __m128i vcb, vcr;
+        chroma8(avg[0], avg[1], avg[2], vcb, vcr);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(cb + x / 2), _mm_packus_epi16(vcb, vcb));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(cr + x / 2), _mm_packus_epi16(vcr, vcr));
+    }
+    bgrRowPairScalar(top, bottom, x, w, y_top, y_bottom, cb, cr);
+}
+
+// AVX2: 32 pixels of a row pair per step
+__attribute__((target("avx2")))
+inline void bgrRowPairAVX2(const uint8_t* top, const uint8_t* bottom, int w,
+                           uint8_t* y_top, uint8_t* y_bottom, uint8_t* cb, uint8_t* cr) {
+    const __m256i two = _mm256_set1_epi16(2);
+    int x = 0;
+    for (; x + 32 <= w; x += 32) {
+        __m128i in[2][2][3];   //[row][half][channel] as 16 x u8
+        for (int half = 0; half < 2; half++) {
+            deinterleave16(top + 3 * (x + 16 * half), in[0][half][0], in[0][half][1], in[0][half][2]);
+            deinterleave16(bottom + 3 * (x + 16 * half), in[1][half][0], in[1][half][1], in[1][half][2]);
+        }
+
+        __m256i wide[2][2][3];
+        for (int row = 0; row < 2; row++) {
+            __m256i y[2];
+            for (int half = 0; half < 2; half++) {
+                for (int c = 0; c < 3; c++) {
+                    wide[row][half][c] = _mm256_cvtepu8_epi16(in[row][half][c]);
+                }
+                __m256i v = _mm256_add_epi16(_mm256_mullo_epi16(wide[row][half][2], _mm256_set1_epi16(77)),
+                                             _mm256_mullo_epi16(wide[row][half][1], _mm256_set1_epi16(150)));
+                v = _mm256_add_epi16(v, _mm256_mullo_epi16(wide[row][half][0], _mm256_set1_epi16(29)));
+                y[half] = _mm256_srli_epi16(_mm256_add_epi16(v, _mm256_set1_epi16(128)), 8);
+            }
+            uint8_t* y_out = row == 0 ? y_top : y_bottom;
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(y[0], y[1]), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(y_out + x), packed);
+        }
+
+        __m256i avg[3];
+        for (int c = 0; c < 3; c++) {
+            __m256i a = _mm256_add_epi16(wide[0][0][c], wide[1][0][c]);
+            __m256i b = _mm256_add_epi16(wide[0][1][c], wide[1][1][c]);
+            __m256i pairs = _mm256_permute4x64_epi64(_mm256_hadd_epi16(a, b), 0xD8);
+            avg[c] = _mm256_srli_epi16(_mm256_add_epi16(pairs, two), 2);
+        }
+        __m256i vcb, vcr;
+        chroma16(avg[0], avg[1], avg[2], vcb, vcr);
+        __m256i pcb = _mm256_permute4x64_epi64(_mm256_packus_epi16(vcb, vcb), 0xD8);
+        __m256i pcr = _mm256_permute4x64_epi64(_mm256_packus_epi16(vcr, vcr), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cb + x / 2), _mm256_castsi256_si128(pcb));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cr + x / 2), _mm256_castsi256_si128(pcr));
+    }
+    bgrRowPairScalar(top, bottom, x, w, y_top, y_bottom, cb, cr);
+}
+
+// SSE4.1: 16 YUYV pixels of a row pair per step
+__attribute__((target("sse4.1")))
+inline void yuyvRowPairSSE41(const uint8_t* top, const uint8_t* bottom, int w,
+                             uint8_t* y_top, uint8_t* y_bottom, uint8_t* cb, uint8_t* cr) {
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m128i t0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + 2 * x));
+        __m128i t1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + 2 * x + 16));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + 2 * x));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + 2 * x + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y_top + x),
+                         _mm_packus_epi16(_mm_and_si128(t0, low), _mm_and_si128(t1, low)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(y_bottom + x),
+                         _mm_packus_epi16(_mm_and_si128(b0, low), _mm_and_si128(b1, low)));
+
+        __m128i uv_t = _mm_packus_epi16(_mm_srli_epi16(t0, 8), _mm_srli_epi16(t1, 8));
+        __m128i uv_b = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+        __m128i uv = _mm_avg_epu8(uv_t, uv_b);   //(a + b + 1) >> 1
+        __m128i u = _mm_packus_epi16(_mm_and_si128(uv, low), _mm_setzero_si128());
+        __m128i v = _mm_packus_epi16(_mm_srli_epi16(uv, 8), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(cb + x / 2), u);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(cr + x / 2), v);
+    }
+    yuyvRowPairScalar(top, bottom, x, w, y_top, y_bottom, cb, cr);
+}
+
+// AVX2: 32 YUYV pixels of a row pair per step
+__attribute__((target("avx2")))
+inline void yuyvRowPairAVX2(const uint8_t* top, const uint8_t* bottom, int w,
+                            uint8_t* y_top, uint8_t* y_bottom, uint8_t* cb, uint8_t* cr) {
+    const __m256i low = _mm256_set1_epi16(0x00FF);
+    int x = 0;
+    for (; x + 32 <= w; x += 32) {
+        __m256i t0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + 2 * x));
+        __m256i t1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + 2 * x + 32));
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + 2 * x));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + 2 * x + 32));
+        __m256i yt = _mm256_packus_epi16(_mm256_and_si256(t0, low), _mm256_and_si256(t1, low));
+        __m256i yb = _mm256_packus_epi16(_mm256_and_si256(b0, low), _mm256_and_si256(b1, low));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(y_top + x), _mm256_permute4x64_epi64(yt, 0xD8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(y_bottom + x), _mm256_permute4x64_epi64(yb, 0xD8));
+
+        __m256i uv_t = _mm256_packus_epi16(_mm256_srli_epi16(t0, 8), _mm256_srli_epi16(t1, 8));
+        __m256i uv_b = _mm256_packus_epi16(_mm256_srli_epi16(b0, 8), _mm256_srli_epi16(b1, 8));
+        __m256i uv = _mm256_permute4x64_epi64(_mm256_avg_epu8(uv_t, uv_b), 0xD8);
+        __m256i u = _mm256_packus_epi16(_mm256_and_si256(uv, low), _mm256_setzero_si256());
+        __m256i v = _mm256_packus_epi16(_mm256_srli_epi16(uv, 8), _mm256_setzero_si256());
+        u = _mm256_permute4x64_epi64(u, 0xD8);
+        v = _mm256_permute4x64_epi64(v, 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cb + x / 2), _mm256_castsi256_si128(u));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(cr + x / 2), _mm256_castsi256_si128(v));
+    }
+    yuyvRowPairScalar(top, bottom, x, w, y_top, y_bottom, cb, cr);
+}
+
+// 2x2 box average of one plane row pair into dst (dst_w outputs)
+inline void box2Scalar(const uint8_t* top, const uint8_t* bottom, int x0, int dst_w, int src_w, uint8_t* dst) {
+    for (int x = x0; x < dst_w; x++) {
+        int a = 2 * x, b = std::min(2 * x + 1, src_w - 1);
+        dst[x] = uint8_t((top[a] + top[b] + bottom[a] + bottom[b] + 2) >> 2);
+    }
+}
+
+__attribute__((target("sse4.1")))
+inline void box2SSE41(const uint8_t* top, const uint8_t* bottom, int dst_w, int src_w, uint8_t* dst) {
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 8 <= dst_w && 2 * x + 16 <= src_w; x += 8) {
+        __m128i t = _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + 2 * x)), ones);
+        __m128i b = _mm_maddubs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + 2 * x)), ones);
+        __m128i s = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, b), two), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(s, s));
+    }
+    box2Scalar(top, bottom, x, dst_w, src_w, dst);
+}
+
+__attribute__((target("avx2")))
+inline void box2AVX2(const uint8_t* top, const uint8_t* bottom, int dst_w, int src_w, uint8_t* dst) {
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi16(2);
+    int x = 0;
+    for (; x + 16 <= dst_w && 2 * x + 32 <= src_w; x += 16) {
+        __m256i t = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + 2 * x)), ones);
+        __m256i b = _mm256_maddubs_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + 2 * x)), ones);
+        __m256i s = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(t, b), two), 2);
+        s = _mm256_permute4x64_epi64(_mm256_packus_epi16(s, s), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm256_castsi256_si128(s));
+    }
+    box2Scalar(top, bottom, x, dst_w, src_w, dst);
+}
+
+// Vertical half of the bilinear filter: top * (256 - wy) + bottom * wy per pixel.
+// At most 255 * 256, so the 16-bit lanes never overflow.
+inline void blendRowsScalar(const uint8_t* top, const uint8_t* bottom, int wy, int x0, int w, uint16_t* out) {
+    for (int x = x0; x < w; x++) {
+        out[x] = uint16_t(top[x] * (256 - wy) + bottom[x] * wy);
+    }
+}
+
+__attribute__((target("sse4.1")))
+inline void blendRowsSSE41(const uint8_t* top, const uint8_t* bottom, int wy, int w, uint16_t* out) {
+    const __m128i wt = _mm_set1_epi16(int16_t(256 - wy)), wb = _mm_set1_epi16(int16_t(wy));
+    int x = 0;
+    for (; x + 8 <= w; x += 8) {
+        __m128i t = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(top + x)));
+        __m128i b = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bottom + x)));
+        __m128i v = _mm_add_epi16(_mm_mullo_epi16(t, wt), _mm_mullo_epi16(b, wb));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), v);
+    }
+    blendRowsScalar(top, bottom, wy, x, w, out);
+}
+
+__attribute__((target("avx2")))
+inline void blendRowsAVX2(const uint8_t* top, const uint8_t* bottom, int wy, int w, uint16_t* out) {
+    const __m256i wt = _mm256_set1_epi16(int16_t(256 - wy)), wb = _mm256_set1_epi16(int16_t(wy));
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        __m256i t = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + x)));
+        __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + x)));
+        __m256i v = _mm256_add_epi16(_mm256_mullo_epi16(t, wt), _mm256_mullo_epi16(b, wb));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), v);
+    }
+    blendRowsScalar(top, bottom, wy, x, w, out);
+}
+
+// Horizontal half: two taps per output from the blended row (one spare element past its end).
+// Column taps differ from pixel to pixel, so this stays a scalar loop over a row that is in L1.
+inline void blendColumns(const uint16_t* row, const int* index, const int* weight, int dst_w, uint8_t* dst) {
+    for (int x = 0; x < dst_w; x++) {
+        uint32_t i = uint32_t(index[x]), wx = uint32_t(weight[x]);
+        dst[x] = uint8_t((row[i] * (256 - wx) + row[i + 1] * wx + (1u << 15)) >> 16);
+    }
+}
+
+} // namespace preprocess_detail
+
+// Converts and scales camera frames into preallocated I420 planes
+class FramePreprocessor {
+public:
+    FramePreprocessor(int out_width, int out_height) : simd_(detectSimd()) {
+        out_.allocate(out_width & ~1, out_height & ~1);
+    }
+
+    SimdLevel simd() const { return simd_; }
+    void setSimd(SimdLevel level) { simd_ = level; }   // For testing the fallbacks
+
+    // Packed BGR (3 bytes per pixel)
+    const YUV420Planes& fromBGR(const uint8_t* data, int stride, int width, int height) {
+        YUV420Planes& dst = target(width, height);
+        for (int y = 0; y < dst.height; y += 2) {
+            const uint8_t* top = data + size_t(stride) * y;
+            const uint8_t* bottom = (y + 1 < dst.height) ? top + stride : top;
+            uint8_t* y_bottom = (y + 1 < dst.height) ? dst.row(0, y + 1) : nullptr;
+            if (simd_ == SimdLevel::AVX2 && y_bottom) {
+                preprocess_detail::bgrRowPairAVX2(top, bottom, dst.width, dst.row(0, y), y_bottom, dst.row(1, y / 2), dst.row(2, y / 2));
+            } else if (simd_ == SimdLevel::SSE41 && y_bottom) {
+                preprocess_detail::bgrRowPairSSE41(top, bottom, dst.width, dst.row(0, y), y_bottom, dst.row(1, y / 2), dst.row(2, y / 2));
+            } else {
+                preprocess_detail::bgrRowPairScalar(top, bottom, 0, dst.width, dst.row(0, y), y_bottom, dst.row(1, y / 2), dst.row(2, y / 2));
+            }
+        }
+        return finish(dst);
+    }
+
+    // Packed YUYV 4:2:2 (2 bytes per pixel)
+    const YUV420Planes& fromYUYV(const uint8_t* data, int stride, int width, int height) {
+        YUV420Planes& dst = target(width, height);
+        for (int y = 0; y < dst.height; y += 2) {
+            const uint8_t* top = data + size_t(stride) * y;
+            const uint8_t* bottom = (y + 1 < dst.height) ? top + stride : top;
+            uint8_t* y_bottom = (y + 1 < dst.height) ? dst.row(0, y + 1) : nullptr;
+            if (simd_ == SimdLevel::AVX2 && y_bottom) {
+                preprocess_detail::yuyvRowPairAVX2(top, bottom, dst.width, dst.row(0, y), y_bottom, dst.row(1, y / 2), dst.row(2, y / 2));
+            } else if (simd_ == SimdLevel::SSE41 && y_bottom) {
+                preprocess_detail::yuyvRowPairSSE41(top, bottom, dst.width, dst.row(0, y), y_bottom, dst.row(1, y / 2), dst.row(2, y / 2));
+            } else {
+                preprocess_detail::yuyvRowPairScalar(top, bottom, 0, dst.width, dst.row(0, y), y_bottom, dst.row(1, y / 2), dst.row(2, y / 2));
+            }
+        }
+        return finish(dst);
+    }
+
+    const YUV420Planes& output() const { return out_; }
+
+private:
+    // Convert straight into the output when no scaling is needed
+    YUV420Planes& target(int width, int height) {
+        if (width == out_.width && height == out_.height) {
+            return out_;
+        }
+        int w = width & ~1, h = height & ~1;
+        if (full_.width != w || full_.height != h) {
+            full_.allocate(w, h);
+            prepareBilinear(w, h);
+        }
+        return full_;
+    }
+
+    const YUV420Planes& finish(const YUV420Planes& converted) {
+        if (&converted == &out_) {
+            return out_;
+        }
+        for (int p = 0; p < 3; p++) {
+            int sw = p ? converted.width / 2 : converted.width;
+            int sh = p ? converted.height / 2 : converted.height;
+            int dw = p ? out_.width / 2 : out_.width;
+            int dh = p ? out_.height / 2 : out_.height;
+            if (sw == 2 * dw && sh == 2 * dh) {
+                box2(converted, p, sw, dw, dh);
+            } else {
+                bilinear(converted, p, sw, sh, dw, dh);
+            }
+        }
+        return out_;
+    }
+
+    void box2(const YUV420Planes& src, int p, int src_w, int dst_w, int dst_h) {
+        for (int y = 0; y < dst_h; y++) {
+            const uint8_t* top = src.row(p, 2 * y);
+            const uint8_t* bottom = src.row(p, 2 * y + 1);
+            if (simd_ == SimdLevel::AVX2) {
+                preprocess_detail::box2AVX2(top, bottom, dst_w, src_w, out_.row(p, y));
+            } else if (simd_ == SimdLevel::SSE41) {
+                preprocess_detail::box2SSE41(top, bottom, dst_w, src_w, out_.row(p, y));
+            } else {
+                preprocess_detail::box2Scalar(top, bottom, 0, dst_w, src_w, out_.row(p, y));
+            }
+        }
+    }
+
+    // Source positions and 8-bit weights for every output column/row, per plane size
+    struct Taps {
+        std::vector<int> index;
+        std::vector<int> weight;   // Weight of index + 1, out of 256
+    };
+
+    static void makeTaps(Taps& taps, int src, int dst) {
+        taps.index.resize(dst);
+        taps.weight.resize(dst);
+        for (int i = 0; i < dst; i++) {
+            int pos = int(((int64_t(2 * i + 1) * src * 256) / (2 * dst)) - 128);  //Centre-aligned, 1/256 px
+            pos = std::max(pos, 0);
+            taps.index[i] = std::min(pos >> 8, src - 1);
+            taps.weight[i] = (taps.index[i] + 1 < src) ? (pos & 255) : 0;
+        }
+    }
+
+    void prepareBilinear(int w, int h) {
+        makeTaps(cols_[0], w, out_.width);
+        makeTaps(rows_[0], h, out_.height);
+        makeTaps(cols_[1], w / 2, out_.width / 2);
+        makeTaps(rows_[1], h / 2, out_.height / 2);
+        blend_.assign(size_t(w) + 1, 0);     //Spare element: the second tap of the last column has weight 0
+    }
+
+    // Separable: blend the two source rows (SIMD), then the two columns of each output.
+    // All integer and unrounded until the end, so the result is the same as doing both at once.
+    void bilinear(const YUV420Planes& src, int p, int src_w, int src_h, int dst_w, int dst_h) {
+        const Taps& cols = cols_[p ? 1 : 0];
+        const Taps& rows = rows_[p ? 1 : 0];
+        uint16_t* blended = blend_.data();
+        for (int y = 0; y < dst_h; y++) {
+            //Output rows sharing source rows and weight reuse the blended row
+            if (y == 0 || rows.index[y] != rows.index[y - 1] || rows.weight[y] != rows.weight[y - 1]) {
+                const uint8_t* top = src.row(p, rows.index[y]);
+                const uint8_t* bottom = src.row(p, std::min(rows.index[y] + 1, src_h - 1));
+                int wy = rows.weight[y];
+                if (simd_ == SimdLevel::AVX2) {
+                    preprocess_detail::blendRowsAVX2(top, bottom, wy, src_w, blended);
+                } else if (simd_ == SimdLevel::SSE41) {
+                    preprocess_detail::blendRowsSSE41(top, bottom, wy, src_w, blended);
+                } else {
+                    preprocess_detail::blendRowsScalar(top, bottom, wy, 0, src_w, blended);
+                }
+            }
+            preprocess_detail::blendColumns(blended, cols.index.data(), cols.weight.data(), dst_w, out_.row(p, y));
+        }
+    }
+
+    SimdLevel simd_;
+    YUV420Planes out_;    // Stream-size planes handed to the encoder
+    YUV420Planes full_;   // Camera-size planes when scaling is needed
+    Taps cols_[2], rows_[2];
+    std::vector<uint16_t> blend_;   // One vertically blended source row
+};
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef STRIP_ENCODER_H
+#define STRIP_ENCODER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <turbojpeg.h>
+
+#include "preprocess.h"
+
+// Strip-parallel JPEG encoder.
+// A frame is cut into horizontal strips (multiples of 16 rows, one MCU row
+// for 4:2:0) and every strip is encoded as an independent JPEG by its own
+// worker thread with its own TurboJPEG handle. Each worker hands its strip to
+// the sink as soon as it is done, so packetization of the top strips starts
+// while the bottom ones are still being encoded.
+//
+// The sink runs on the worker threads and must be thread safe. Strip data
+// stays valid until the next encode() call.
+
+class StripEncoderPool {
+public:
+    using StripSink = std::function<void(int strip_i, int total_strips, const unsigned char* data, size_t size)>;
+
+    StripEncoderPool(int strips, int width, int height, int quality, StripSink sink)
+        : quality_(quality), sink_(std::move(sink)) {
+        int rows = ((height + strips - 1) / strips + 15) & ~15;
+        for (int y = 0; y < height; y += rows) {
+            Strip strip;
+            strip.y = y;
+            strip.height = std::min(rows, height - y);
+            strip.handle = tjInitCompress();
+            strip.buffer.resize(tjBufSize(width, strip.height, TJSAMP_420));
+            strips_.push_back(std::move(strip));
+        }
+        for (size_t i = 0; i < strips_.size(); i++) {
+            workers_.emplace_back(&StripEncoderPool::workerLoop, this, i);
+        }
+    }
+
+    ~StripEncoderPool() {
+        {
+            std::lock_guard<std::mutex> lock(mute_);
+            stopping_ = true;
+        }
+        start_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        for (auto& strip : strips_) {
+            if (strip.handle) tjDestroy(strip.handle);
+        }
+    }
+
+    StripEncoderPool(const StripEncoderPool&) = delete;
+    StripEncoderPool& operator=(const StripEncoderPool&) = delete;
+
+    // Encode all strips of one frame; returns once every strip reached the sink
+    bool encode(const YUV420Planes& planes) {
+        std::unique_lock<std::mutex> lock(mute_);
+        planes_ = &planes;
+        pending_ = strips_.size();
+        failed_ = false;
+        generation_++;
+        start_.notify_all();
+        done_.wait(lock, [this] { return pending_ == 0; });
+        return !failed_;
+    }
+
+    int strips() const { return static_cast<int>(strips_.size()); }
+    const unsigned char* stripData(int i) const { return strips_[i].buffer.data(); }
+    size_t stripSize(int i) const { return strips_[i].size; }
+
+private:
+    struct Strip {
+        int y = 0;
+        int height = 0;
+        tjhandle handle = nullptr;
+        std::vector<unsigned char> buffer;
+        size_t size = 0;
+    };
+
+    void workerLoop(size_t index) {
+        Strip& strip = strips_[index];
+        uint64_t seen = 0;
+        while (true) {
+            const YUV420Planes* planes;
+            {
+                std::unique_lock<std::mutex> lock(mute_);
+                start_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+                if (stopping_) {
+                    return;
+                }
+                seen = generation_;
+                planes = planes_;
+            }
+
+            bool ok = encodeStrip(strip, *planes);
+            if (ok) {
+                sink_(int(index), int(strips_.size()), strip.buffer.data(), strip.size);
+            }
+
+            std::lock_guard<std::mutex> lock(mute_);
+            if (!ok) failed_ = true;
+            if (--pending_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    bool encodeStrip(Strip& strip, const YUV420Planes& planes) {
+        if (!strip.handle) {
+            return false;
+        }
+        const unsigned char* src[3] = {planes.row(0, strip.y), planes.row(1, strip.y / 2), planes.row(2, strip.y / 2)};
+        unsigned char* out = strip.buffer.data();
+        unsigned long size = strip.buffer.size();
+        if (tjCompressFromYUVPlanes(strip.handle, src, planes.width, planes.stride, strip.height, TJSAMP_420,
+                                    &out, &size, quality_, TJFLAG_NOREALLOC | TJFLAG_FASTDCT) < 0) {
+            std::cerr << "Strip encode error: " << tjGetErrorStr2(strip.handle) << "\n";
+            return false;
+        }
+        strip.size = size;
+        return true;
+    }
+
+    const int quality_;
+    StripSink sink_;
+    std::vector<Strip> strips_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mute_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const YUV420Planes* planes_ = nullptr;
+    uint64_t generation_ = 0;
+    size_t pending_ = 0;
+    bool failed_ = false;
+    bool stopping_ = false;
+};
+
+#endif
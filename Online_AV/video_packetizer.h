@@ -0,0 +1,202 @@
+#ifndef VIDEO_PACKETIZER_H
+#define VIDEO_PACKETIZER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include "../common/av_packets.h"
+#include "video_playout.h"
+
+// Video packetization and reassembly, the per-fragment hot path of Online_AV.
+// FragmentStrip cuts an encoded strip into Video_Fragment datagrams;
+// ReassembleFragment collects fragments per frame and strip and hands out a
+// frame once every strip is complete. Duplicate fragments, and fragments whose
+// numbering disagrees with the first one of their strip, are dropped, so a
+// resend never stands in for a missing fragment. Loss handling lives here
+// too: frames that trail the newest one by more than Reorder_Frames are given
+// up, and after a loss only a key frame is let through. Whether and when to ask the
+// sender for that key frame is left to the caller.
+//
+// No sockets and no OpenCV, so PacketBench can drive it without a camera.
+
+//Frames an incomplete frame may trail the newest one
+#ifndef Reorder_Frames
+#define Reorder_Frames 1
+#endif
+
+//Most fragments one strip may be cut into
+#ifndef Max_Strip_Fragments
+#define Max_Strip_Fragments 4096
+#endif
+
+//Fragments of one strip; the first fragment fixes total_fragments
+struct Strip_Assembly {
+    std::vector<Video_Fragment> fragments;
+    std::vector<bool> received;   //By fragment_i
+    uint32_t total_fragments = 0;
+};
+
+//Fragments of one frame, per strip
+struct Frame_Assembly {
+    std::vector<Strip_Assembly> strips;
+    uint16_t strips_done = 0;
+};
+
+//Receiver side video reassembly state
+struct Video_Receiver {
+    std::map<uint32_t, Frame_Assembly> fragment_buffer;
+    uint32_t newest_seq = 0;      //Newest frame seen
+    uint32_t last_complete = 0;   //Last frame handed to playout
+    bool have_newest = false;
+    bool have_frame = false;
+    bool need_key = true;         //Drop frames until a key frame arrives
+    uint32_t request_seq = 0;
+    uint32_t unanswered = 0;      //Requests sent since the last key frame
+    std::chrono::steady_clock::time_point last_request{};
+};
+
+//What one fragment did to the receiver
+struct Reassembly {
+    bool complete = false;   //A whole frame is ready for playout
+    bool refresh = false;    //A frame was lost: the sender should send a key frame
+};
+
+//Cut one encoded strip into fragments and pass each to send(const Video_Fragment&)
+template <typename Send>
+void FragmentStrip(uint32_t frame_seq, uint64_t capture_ts, bool key_frame, int strip_i, int total_strips,
+                   const unsigned char* enc_strip, size_t strip_size, Send&& send) {
+
+    size_t max_fragment_s = sizeof(Video_Fragment::Fdata);
+    uint32_t total_fragments = (strip_size + max_fragment_s - 1) / max_fragment_s;
+
+    for (uint32_t fragment_i = 0; fragment_i < total_fragments; ++fragment_i) {
+        Video_Fragment fragment = {};
+        fragment.frame_seq = frame_seq;
+        fragment.fragment_i = fragment_i;
+        fragment.total_fragments = total_fragments;
+        fragment.strip_i = static_cast<uint16_t>(strip_i);
+        fragment.total_strips = static_cast<uint16_t>(total_strips);
+        fragment.capture_ts = capture_ts;
+        fragment.key_frame = key_frame;
+        fragment.last_fragment = (fragment_i == total_fragments - 1);
+
+        size_t offset = fragment_i * max_fragment_s;
+        fragment.fragment_s = std::min(max_fragment_s, strip_size - offset);
+        std::memcpy(fragment.Fdata, enc_strip + offset, fragment.fragment_s);
+        send(fragment);
+    }
+}
+
+//Add one fragment; when it completes a frame, the frame is moved into frame
+inline Reassembly ReassembleFragment(Video_Receiver& video_rx, const Video_Fragment& fragment, PlayoutFrame& frame) {
+
+    Reassembly result;
+    auto& fragment_buffer = video_rx.fragment_buffer;
+
+    //Frame already shown or given up on
+    if (video_rx.have_frame && int32_t(fragment.frame_seq - video_rx.last_complete) <= 0) {
+        return result;
+    }
+
+    //A newer frame started: incomplete frames too far behind it are lost
+    if (!video_rx.have_newest || int32_t(fragment.frame_seq - video_rx.newest_seq) > 0) {
+        video_rx.newest_seq = fragment.frame_seq;
+        video_rx.have_newest = true;
+
+        bool lost = false;
+        for (auto it = fragment_buffer.begin(); it != fragment_buffer.end();) {
+            if (int32_t(video_rx.newest_seq - it->first) > Reorder_Frames) {
+                it = fragment_buffer.erase(it);
+                lost = true;
+            } else {
+                ++it;
+            }
+        }
+        if (lost) {
+            video_rx.need_key = true;
+            result.refresh = true;
+        }
+    }
+
+    //Malformed strip or fragment numbering, or a size past the payload
+    if (fragment.total_strips == 0 || fragment.strip_i >= fragment.total_strips ||
+        fragment.total_fragments == 0 || fragment.total_fragments > Max_Strip_Fragments ||
+        fragment.fragment_i >= fragment.total_fragments || fragment.fragment_s > sizeof(fragment.Fdata)) {
+        return result;
+    }
+
+    //Load fragment in buffer
+    auto& assembly = fragment_buffer[fragment.frame_seq];
+    if (assembly.strips.empty()) {
+        assembly.strips.resize(fragment.total_strips);
+    }
+    if (fragment.total_strips != assembly.strips.size()) {
+        return result;
+    }
+    auto& strip = assembly.strips[fragment.strip_i];
+    if (strip.total_fragments == 0) {
+        strip.total_fragments = fragment.total_fragments;
+        strip.received.resize(fragment.total_fragments);
+    }
+    //Disagrees with the strip's first fragment, or a duplicate
+    if (fragment.total_fragments != strip.total_fragments || strip.received[fragment.fragment_i]) {
+        return result;
+    }
+    strip.received[fragment.fragment_i] = true;
+    strip.fragments.push_back(fragment);
+    if (strip.fragments.size() == strip.total_fragments) {
+        assembly.strips_done++;
+    }
+
+    //Check if all strips are received
+    if (assembly.strips_done != assembly.strips.size()) {
+        return result;
+    }
+
+    //Whole frames went missing in between
+    if (video_rx.have_frame && fragment.frame_seq != video_rx.last_complete + 1) {
+        video_rx.need_key = true;
+    }
+
+    //Frames after a loss are useless until a key frame
+    if (video_rx.need_key && !fragment.key_frame) {
+        fragment_buffer.erase(fragment.frame_seq);
+        result.refresh = true;
+        return result;
+    }
+    video_rx.need_key = false;
+    video_rx.unanswered = 0;
+
+    //Re-form each strip
+    frame.frame_seq = fragment.frame_seq;
+    frame.capture_us = fragment.capture_ts;
+    frame.strips.resize(assembly.strips.size());
+    for (size_t strip_i = 0; strip_i < assembly.strips.size(); strip_i++) {
+        auto& strip = assembly.strips[strip_i].fragments;
+        std::sort(strip.begin(), strip.end(), [](const Video_Fragment& a, const Video_Fragment& b) {
+            return a.fragment_i < b.fragment_i;
+        });
+        size_t bytes = 0;
+        for (const auto& frag : strip) {
+            bytes += frag.fragment_s;
+        }
+        frame.strips[strip_i].clear();
+        frame.strips[strip_i].reserve(bytes);
+        for (const auto& frag : strip) {
+            frame.strips[strip_i].insert(frame.strips[strip_i].end(), frag.Fdata, frag.Fdata + frag.fragment_s);
+        }
+    }
+    video_rx.last_complete = fragment.frame_seq;
+    video_rx.have_frame = true;
+
+    //Clear buffer up to this frame
+    fragment_buffer.erase(fragment_buffer.begin(), fragment_buffer.upper_bound(fragment.frame_seq));
+    result.complete = true;
+    return result;
+}
+
+#endif
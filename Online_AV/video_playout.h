@@ -0,0 +1,230 @@
+#ifndef VIDEO_PLAYOUT_H
+#define VIDEO_PLAYOUT_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Video playout buffer.
+// Reassembled frames are pushed as they complete and released on a steady
+// frame clock: each frame plays at capture_ts + base transit + target delay,
+// so frame spacing follows the sender's capture spacing instead of network
+// arrival. The target delay tracks interarrival jitter (RFC 3550 style) and
+// frames that are already late when a newer one is due are skipped.
+//
+// Every sender (PlayoutFrame::source) is a stream of its own: its own frame
+// sequence, transit, jitter and target delay. waitNext hands out whichever
+// stream's next frame is due first.
+
+struct PlayoutFrame {
+    uint32_t frame_seq = 0;         // Sender frame sequence
+    uint64_t capture_us = 0;        // Capture timestamp (sender clock, us)
+    uint32_t source = 0;            // Sending peer (tracing::sourceOf): the stream the frame belongs to
+    std::vector<std::vector<unsigned char>> strips; // Independently coded strips, top to bottom
+};
+
+class VideoPlayoutBuffer {
+public:
+    VideoPlayoutBuffer(int min_delay_ms, int max_delay_ms, size_t max_frames)
+        : min_delay_us_(int64_t(min_delay_ms) * 1000),
+          max_delay_us_(int64_t(max_delay_ms) * 1000),
+          max_frames_(max_frames) {}
+
+    // Queue a completed frame; called from the receive thread
+    void push(PlayoutFrame&& frame) {
+        int64_t now = nowUs();
+        int64_t transit = now - int64_t(frame.capture_us);
+
+        std::lock_guard<std::mutex> lock(mute_);
+        Stream& stream = streamOf(frame.source);
+
+        //Frames older than the last one shown are useless
+        if (stream.have_played && int32_t(frame.frame_seq - stream.last_played_seq) <= 0) {
+            late_++;
+            return;
+        }
+
+        updateTransit(stream, now, transit);
+
+        //Arrived after its slot: grow the delay straight away
+        int64_t due = int64_t(frame.capture_us) + stream.base_transit + stream.target_delay_us;
+        if (due < now) {
+            late_++;
+            stream.target_delay_us = clampDelay(stream.target_delay_us + (now - due));
+        }
+
+        stream.frames[frame.frame_seq] = std::move(frame);
+
+        //Too deep: drop the oldest frames
+        while (stream.frames.size() > max_frames_) {
+            stream.frames.erase(stream.frames.begin());
+            skipped_++;
+        }
+
+        ready_.notify_one();
+    }
+
+    // Block until the next frame of any stream is due; returns false once stopped.
+    // When several frames of a stream are already due only the newest is returned.
+    bool waitNext(PlayoutFrame& out) {
+        std::unique_lock<std::mutex> lock(mute_);
+        while (!stopped_) {
+            //Stream whose next frame is due first
+            Stream* first = nullptr;
+            int64_t due = 0;
+            for (auto& entry : streams_) {
+                Stream& stream = entry.second;
+                if (stream.frames.empty()) continue;
+                int64_t stream_due = dueUs(stream, stream.frames.begin()->second);
+                if (!first || stream_due < due) {
+                    first = &stream;
+                    due = stream_due;
+                }
+            }
+            if (!first) {
+                ready_.wait(lock);
+                continue;
+            }
+
+            int64_t now = nowUs();
+            if (due > now) {
+                ready_.wait_for(lock, std::chrono::microseconds(due - now));
+                continue;
+            }
+
+            //Skip ahead over frames whose successor is also due
+            auto& frames = first->frames;
+            auto next = frames.begin();
+            auto following = std::next(next);
+            while (following != frames.end() && dueUs(*first, following->second) <= now) {
+                frames.erase(next);
+                skipped_++;
+                next = following++;
+            }
+
+            out = std::move(next->second);
+            frames.erase(next);
+            first->last_played_seq = out.frame_seq;
+            first->have_played = true;
+            played_++;
+            return true;
+        }
+        return false;
+    }
+
+    // Forget a sender, e.g. when its frame numbering starts over
+    void reset(uint32_t source) {
+        std::lock_guard<std::mutex> lock(mute_);
+        streams_.erase(source);
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(mute_);
+        stopped_ = true;
+        ready_.notify_all();
+    }
+
+    // Largest target delay over the streams
+    int targetDelayMs() const {
+        std::lock_guard<std::mutex> lock(mute_);
+        int64_t delay = 0;
+        for (const auto& entry : streams_) {
+            delay = std::max(delay, entry.second.target_delay_us);
+        }
+        return int(delay / 1000);
+    }
+
+    uint64_t played() const { std::lock_guard<std::mutex> lock(mute_); return played_; }
+    uint64_t skipped() const { std::lock_guard<std::mutex> lock(mute_); return skipped_; }
+    uint64_t late() const { std::lock_guard<std::mutex> lock(mute_); return late_; }
+
+private:
+    struct Stream {
+        std::map<uint32_t, PlayoutFrame> frames;  //Pending frames by sequence
+        std::deque<std::pair<int64_t, int64_t>> transit_window;
+        int64_t base_transit = 0;
+        int64_t prev_transit = 0;
+        int64_t jitter_us = 0;
+        int64_t target_delay_us = 0;
+        bool have_transit = false;
+        uint32_t last_played_seq = 0;
+        bool have_played = false;
+    };
+
+    Stream& streamOf(uint32_t source) {
+        auto it = streams_.find(source);
+        if (it == streams_.end()) {
+            it = streams_.emplace(source, Stream()).first;
+            it->second.target_delay_us = min_delay_us_;
+        }
+        return it->second;
+    }
+
+    static int64_t nowUs() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static int64_t dueUs(const Stream& stream, const PlayoutFrame& frame) {
+        return int64_t(frame.capture_us) + stream.base_transit + stream.target_delay_us;
+    }
+
+    int64_t clampDelay(int64_t delay) const {
+        if (delay < min_delay_us_) return min_delay_us_;
+        if (delay > max_delay_us_) return max_delay_us_;
+        return delay;
+    }
+
+    // Base transit is the windowed minimum of (arrival - capture); it absorbs
+    // the unknown clock offset between peers. Jitter drives the target delay.
+    void updateTransit(Stream& stream, int64_t now, int64_t transit) {
+        auto& window = stream.transit_window;
+        while (!window.empty() && window.back().second >= transit) {
+            window.pop_back();
+        }
+        window.emplace_back(now, transit);
+        while (now - window.front().first > Transit_Window_us) {
+            window.pop_front();
+        }
+        stream.base_transit = window.front().second;
+
+        if (stream.have_transit) {
+            int64_t d = std::llabs(transit - stream.prev_transit);
+            stream.jitter_us += (d - stream.jitter_us) / 16;
+        }
+        stream.prev_transit = transit;
+        stream.have_transit = true;
+
+        //Decay slowly towards 3x jitter, never below the minimum
+        int64_t wanted = clampDelay(3 * stream.jitter_us);
+        if (wanted < stream.target_delay_us) {
+            stream.target_delay_us -= (stream.target_delay_us - wanted) / 64;
+        } else {
+            stream.target_delay_us = wanted;
+        }
+    }
+
+    static constexpr int64_t Transit_Window_us = 2000000; //2 s of history
+
+    const int64_t min_delay_us_;
+    const int64_t max_delay_us_;
+    const size_t max_frames_;
+
+    mutable std::mutex mute_;
+    std::condition_variable ready_;
+    std::map<uint32_t, Stream> streams_;       //By sending peer
+    bool stopped_ = false;
+
+    uint64_t played_ = 0;
+    uint64_t skipped_ = 0;
+    uint64_t late_ = 0;
+};
+
+#endif
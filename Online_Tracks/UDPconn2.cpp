@@ -9,6 +9,9 @@
  #include <algorithm> //search algorithm 
  #include <atomic>    //boolean controñl 
  #include <stdlib.h>  //Standard functions (exit) 
+ #include <string>
+ #include <chrono>    //Wall clock for the latency harness
+ #include <memory>    //Audio backends
 
 
  //POSIX libraries 
@@ -24,14 +27,24 @@
  #include <netinet/in.h>
  #include <netdb.h>
 
- //Audio Libraries 
- #include <alsa/asoundlib.h>
+ //Audio capture and playback (--audio-in / --audio-out)
+ #include "../common/audio_io.h"
+
+ //Acoustic end-to-end latency (--chirp-inject / --chirp-listen)
+ #include "../common/latency_harness.h"
+ //Loss, delay and jitter on loopback (--netsim / --netsim-in), capture and replay (--capture / --replay)
+ #include "../common/netsim.h"
+ //Per-stage latency timeline (--trace)
+ #include "../common/trace.h"
+ //Option values
+ #include "../common/cli_args.h"
 
 
  //Initialize global constants 
  #define PORT1 54321  //Port for client a 
  #define PORT2 12345  //Port for client b 
  #define BUFFSIZE 1024 
+ #define SEQ_BYTES 4    //Datagram header: sequence number (network order), then the PCM
  #define CLIENT1_IP "192.168.1.85"
  #define CLIENT2_IP "192.168.1.83"
  #define SRATE 44100 
@@ -41,9 +54,22 @@
  #define LOCAL_PORT_P 65433 //TCP playback view
 
 std::atomic<bool> stop_streaming(false);
+std::string audio_in = "alsa";    //Capture and playback backends
+std::string audio_out = "alsa";
+bool chirp_inject = false;        //Set by --chirp-inject
+uint64_t chirp_period_us = acoustic::Default_Period_us;
+netsim::UdpShim net;              //Impaired send/recv when --netsim is given
+tracing::Tracer tracer;           //Tags nothing unless --trace is given
+pcap::Writer capture_log;         //Every datagram, when --capture is given
 std::condition_variable stop_condition; 
 std::mutex fn_mute;
 
+//Both peers put the chirp grid on the wall clock: same host, or NTP/PTP synced
+uint64_t wall_us() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
 void init_sig(int sig) {
     if (sig == SIGINT) {
         stop_streaming = true; 
@@ -54,48 +80,48 @@ void init_sig(int sig) {
 //Audio capture function
 
 void audio_cap(int sockfd, struct sockaddr_in remote_addr, int local_sockfd_capture) {
-    snd_pcm_t *capture_man;
-    snd_pcm_hw_params_t *hw_params;
-    int err; 
-    char buffer[BUFFSIZE * 2 * Channels];
+    alignas(uint32_t) char packet[SEQ_BYTES + BUFFSIZE * 2 * Channels];
+    int16_t* buffer = reinterpret_cast<int16_t*>(packet + SEQ_BYTES);
+    acoustic::ChirpInjector injector(SRATE, Channels, chirp_period_us);
+    uint32_t sequence = 0;  //Sent in the datagram; the receiver traces the same id
 
 
-    //Open ALSA recording 
-    if ((err = snd_pcm_open(&capture_man, "default", SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-        std::cerr << "capture device error" << snd_strerror(err) << "\n";
+    //Open audio recording
+    std::unique_ptr<audio::Source> capture = audio::openSource(audio_in, {SRATE, Channels});
+    if (!capture) {
         return;
-
     }
 
-    //ALSA audio parameter
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(capture_man, hw_params);
-    snd_pcm_hw_params_set_access(capture_man, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(capture_man, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(capture_man, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(capture_man, hw_params, Channels);
-    snd_pcm_hw_params(capture_man, hw_params); 
-
 
 
     //Start audio capture
     while(!stop_streaming) {
-        int fr_capture = snd_pcm_readi(capture_man, buffer, BUFFSIZE);
+        int fr_capture = capture->read(buffer, BUFFSIZE);
         if (fr_capture < 0) {
-            fr_capture = snd_pcm_recover(capture_man, fr_capture, 0);
+            fr_capture = capture->recover(fr_capture);
             if (fr_capture < 0) {
-                std::cerr << "Audio capture error" << snd_strerror(fr_capture) << "\n";
+                std::cerr << "Audio capture error" << audio::errorText(fr_capture) << "\n";
                 break;
             }
         }
+        tracer.mark(tracing::Stage_Capture, tracing::Flow_Audio_Out, sequence);
+
+        //Harness: chirp on the wall-clock grid, timed from when the buffer was captured
+        if (chirp_inject) {
+            uint64_t first = acoustic::firstFrameUs(wall_us(), fr_capture, capture->delay(), SRATE);
+            injector.process(buffer, fr_capture, first);
+        }
 
-        //Send audio on socket 
-        int byte_send = fr_capture * 2 * Channels; //Calculate bytes sent
-        if (sendto(sockfd, buffer, byte_send, 0, (struct sockaddr *)&remote_addr, sizeof(remote_addr)) == -1) {
+        //Send audio on socket, behind its sequence number
+        uint32_t wire_seq = htonl(sequence);
+        memcpy(packet, &wire_seq, SEQ_BYTES);
+        int byte_send = SEQ_BYTES + fr_capture * 2 * Channels; //Calculate bytes sent
+        if (net.sendto(sockfd, packet, byte_send, 0, (struct sockaddr *)&remote_addr, sizeof(remote_addr)) == -1) {
             perror("error sending");
             stop_streaming = true;
             break;
         }
+        tracer.mark(tracing::Stage_Send, tracing::Flow_Audio_Out, sequence++);
 
         ////Send audio to Python (visualization) + Check broken pipe
         //if (send(local_sockfd_capture, buffer, byte_send, 0) == -1) {
@@ -111,7 +137,6 @@ void audio_cap(int sockfd, struct sockaddr_in remote_addr, int local_sockfd_capt
 
     }    
 
-    snd_pcm_close(capture_man);
     close(local_sockfd_capture);
 
 
@@ -119,61 +144,60 @@ void audio_cap(int sockfd, struct sockaddr_in remote_addr, int local_sockfd_capt
 
 //Audio playback function 
 void play_audio(int sockfd,  int local_sockfd_playback) {
-    snd_pcm_t *playback_man;
-    snd_pcm_hw_params_t *hw_params;
     int err; 
-    char buffer[BUFFSIZE * 2 * Channels];
+    alignas(uint32_t) char packet[SEQ_BYTES + BUFFSIZE * 2 * Channels];
+    const int16_t* buffer = reinterpret_cast<const int16_t*>(packet + SEQ_BYTES);
     struct sockaddr_in source_addr;
     socklen_t addr_len = sizeof(source_addr);
 
     //Open playback device
-    if((err = snd_pcm_open(&playback_man, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-        std::cerr << "playback device error" << snd_strerror(err) << "\n";
-        return; 
-
+    std::unique_ptr<audio::Sink> playback = audio::openSink(audio_out, {SRATE, Channels});
+    if (!playback) {
+        return;
     }
 
-    //ALSA audio parameters
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(playback_man, hw_params);
-    snd_pcm_hw_params_set_access(playback_man, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(playback_man, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(playback_man, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(playback_man, hw_params, Channels);
-    snd_pcm_hw_params(playback_man, hw_params); 
-
 
 
     //play audio 
     while(!stop_streaming) {
-        int byte_num = recvfrom(sockfd, buffer, sizeof(buffer), 0, (struct sockaddr *)&source_addr, &addr_len);
+        int byte_num = net.recvfrom(sockfd, packet, sizeof(packet), 0, (struct sockaddr *)&source_addr, &addr_len);
 
         if (byte_num <= 0) {
             if (byte_num == 0) {
-                std::cout << "Server closed connection. \n";
+                std::cout << (net.replayEnded() ? "Replay finished. \n" : "Server closed connection. \n");
             } else {
                 perror("recv error");
             }
             stop_streaming = true;
+            stop_condition.notify_all();    //main waits on this, not on the flag alone
             break;
         }
-
-        int frames_play = byte_num / (Channels * 2);
-        if ((err = snd_pcm_writei(playback_man, buffer, frames_play)) < 0) {
+        if (byte_num < SEQ_BYTES) {
+            continue;   //Not one of ours
+        }
+        uint32_t sequence;
+        memcpy(&sequence, packet, SEQ_BYTES);
+        sequence = ntohl(sequence);
+        uint32_t source = tracing::sourceOf(source_addr);
+        tracer.mark(tracing::Stage_Receive, tracing::Flow_Audio_In, sequence, source);
+
+        int frames_play = (byte_num - SEQ_BYTES) / (Channels * 2);
+        if ((err = playback->write(buffer, frames_play)) < 0) {
             if (err == -EPIPE) {
-                std::cerr << "Buffer underrun occurred: " << snd_strerror(err) << "\n";
-                if ((err = snd_pcm_prepare(playback_man)) < 0) {
-                    std::cerr << "Error recovering from underrum" << snd_strerror(err) << "\n";
+                std::cerr << "Buffer underrun occurred: " << audio::errorText(err) << "\n";
+                if ((err = playback->recover(err)) < 0) {
+                    std::cerr << "Error recovering from underrum" << audio::errorText(err) << "\n";
                     stop_streaming = true;
                     break;
                 
                 }
             } else {
-                std::cerr << "write to audio interface failed: " << snd_strerror(err) << "\n";
+                std::cerr << "write to audio interface failed: " << audio::errorText(err) << "\n";
                 stop_streaming = true;
                 break;
             }
         }
+        tracer.mark(tracing::Stage_Playback, tracing::Flow_Audio_In, sequence, source);
 
 
         //Python visualizer send
@@ -189,16 +213,78 @@ void play_audio(int sockfd,  int local_sockfd_playback) {
 
     }
 
-    snd_pcm_close(playback_man); 
     close(local_sockfd_playback);
 }
 
 
 
-int main() {
+int main(int argc, char* argv[]) {
     
     signal(SIGINT, init_sig);
 
+    //Addresses: --local-port N, --peer IP[:port] (defaults: the LAN pair above)
+    //Audio backends: --audio-in / --audio-out <spec> (alsa[:device], synth, file:path, null; default alsa)
+    //Latency harness: --chirp-inject on the sending peer, --chirp-listen <input spec> recording the other's output
+    //Impairment: --netsim <spec> on what we send, --netsim-in <spec> on what we receive (see netsim.h)
+    //Tracing: --trace <file> writes a per-stage timeline (see trace.h, trace_report.py)
+    //Sessions: --capture <file.pcapng> logs every datagram; --replay <file> plays back what it received
+    //instead of the network, at --replay-speed x (1: as recorded, 0: as fast as possible)
+    std::string chirp_input;
+    std::string trace_path;
+    std::string capture_path, replay_path;
+    double replay_speed = 1;
+    uint16_t local_port = PORT1;
+    std::string peer_ip = CLIENT2_IP;
+    uint16_t peer_port = PORT2;
+    uint64_t chirp_ms = 0;
+    netsim::Impairment egress, ingress;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--local-port" && i + 1 < argc && cli::parsePort(argv[i + 1], local_port)) {
+            i++;
+        } else if (arg == "--peer" && i + 1 < argc) {
+            std::string peer = argv[++i];
+            size_t colon = peer.find(':');
+            peer_ip = peer.substr(0, colon);
+            if (colon != std::string::npos && !cli::parsePort(peer.substr(colon + 1), peer_port)) {
+                std::cerr << "Bad peer port: " << peer << "\n";
+                return 1;
+            }
+        } else if (arg == "--netsim" && i + 1 < argc) {
+            if (!netsim::parseImpairment(argv[++i], egress)) {
+                return 1;
+            }
+        } else if (arg == "--netsim-in" && i + 1 < argc) {
+            if (!netsim::parseImpairment(argv[++i], ingress)) {
+                return 1;
+            }
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (arg == "--capture" && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "--replay-speed" && i + 1 < argc && cli::parseDouble(argv[i + 1], replay_speed, 0, 1000)) {
+            i++;
+        } else if (arg == "--audio-in" && i + 1 < argc) {
+            audio_in = argv[++i];
+        } else if (arg == "--audio-out" && i + 1 < argc) {
+            audio_out = argv[++i];
+        } else if (arg == "--chirp-inject") {
+            chirp_inject = true;
+        } else if (arg == "--chirp-listen" && i + 1 < argc) {
+            chirp_input = argv[++i];
+        } else if (arg == "--chirp-period-ms" && i + 1 < argc && cli::parseInt<uint64_t>(argv[i + 1], chirp_ms, 1, 3600 * 1000)) {
+            chirp_period_us = chirp_ms * 1000;
+            i++;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--local-port N] [--peer ip[:port]] [--audio-in spec] [--audio-out spec]"
+                      << " [--chirp-inject] [--chirp-listen spec] [--chirp-period-ms N] [--netsim spec] [--netsim-in spec] [--trace file]"
+                      << " [--capture file] [--replay file] [--replay-speed x]\n";
+            return 1;
+        }
+    }
+
 
     //Initialize socket 
     int sockfd; 
@@ -215,7 +301,7 @@ int main() {
     //Address structure (client 1)
     memset(&local_addr, 0, sizeof(local_addr));
     local_addr.sin_family = AF_INET; 
-    local_addr.sin_port = htons(PORT1);
+    local_addr.sin_port = htons(local_port);
     local_addr.sin_addr.s_addr = INADDR_ANY; 
 
 
@@ -230,8 +316,8 @@ int main() {
      // Set up remote address structure (destination address)
     memset(&remote_addr, 0, sizeof(remote_addr));
     remote_addr.sin_family = AF_INET;
-    remote_addr.sin_port = htons(PORT2); 
-    if (inet_pton(AF_INET, CLIENT2_IP, &remote_addr.sin_addr) <= 0) {  
+    remote_addr.sin_port = htons(peer_port); 
+    if (inet_pton(AF_INET, peer_ip.c_str(), &remote_addr.sin_addr) <= 0) {  
         perror("Invalid IP address");
         close(sockfd);
         exit(1);
@@ -243,6 +329,24 @@ int main() {
         return 1;
     }
 
+    //Impaired links, reproducible with the same seed
+    net.attach(sockfd, egress, ingress);
+    if (!trace_path.empty() && !tracer.start(trace_path)) {
+        close(sockfd);
+        return 1;
+    }
+    if (!capture_path.empty()) {
+        if (!capture_log.start(capture_path)) {
+            close(sockfd);
+            return 1;
+        }
+        net.record(&capture_log);
+    }
+    if (!replay_path.empty() && !net.replay(replay_path, replay_speed)) {
+        close(sockfd);
+        return 1;
+    }
+
     //Audio capture socket
     int local_sockfd_capture;     //local socket to connect to Python
     struct sockaddr_in local_addr_capture; 
@@ -292,6 +396,15 @@ int main() {
     std::thread capture_th(audio_cap, sockfd, remote_addr, local_sockfd_capture);
     std::thread playback_th(play_audio, sockfd, local_sockfd_playback);
 
+    //Chirp listener on the recording of what we play
+    std::thread chirp_listener;
+    if (!chirp_input.empty()) {
+        std::string label = "UDP peer, " + std::to_string(BUFFSIZE) + "-frame periods";
+        chirp_listener = std::thread([chirp_input, label]() {
+            acoustic::listen(chirp_input, SRATE, Channels, chirp_period_us, wall_us, label, stop_streaming);
+        });
+    }
+
    {
     std::unique_lock<std::mutex> lock(fn_mute);
     stop_condition.wait(lock, [] { return stop_streaming.load(); });
@@ -305,8 +418,15 @@ int main() {
     if (playback_th.joinable()) {
         playback_th.join();
     }
+    if (chirp_listener.joinable()) {
+        chirp_listener.join();
+    }
 
     
+    net.detach();
+    std::cout << net.summary();
+    tracer.stop();
+    capture_log.stop();
     close(sockfd);
     return 0; 
 
@@ -1,5 +1,8 @@
 #include <opencv2/opencv.hpp>
 #include <iostream>
+#include <chrono>
+
+#include "../common/session_recorder.h"
 
 int main() {
     // Open the default webcam (device ID 0)
@@ -16,16 +19,13 @@ int main() {
     int frame_height = static_cast<int>(cap.get(cv::CAP_PROP_FRAME_HEIGHT));
     std::cout << "Frame size: " << frame_width << "x" << frame_height << std::endl;
 
-    // Set up the video writer to save the output (optional)
-    cv::VideoWriter writer("output.avi", 
-                           cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 
-                           30, 
-                           cv::Size(frame_width, frame_height));
-
-    if (!writer.isOpened()) {
-        std::cerr << "Error: Unable to open video writer\n";
+    // Set up the recorder to save the output (optional); disk writes happen on its own thread
+    recording::SessionRecorder recorder("output", 60, 0, 0);
+    if (!recorder.start()) {
+        std::cerr << "Error: Unable to start recorder\n";
         return -1;
     }
+    std::vector<int> jpeg_params = {cv::IMWRITE_JPEG_QUALITY, 80};
 
     // Main loop to capture and display video
     cv::Mat frame;
@@ -39,8 +39,13 @@ int main() {
             break;
         }
 
-        // Write the frame to the output file (optional)
-        writer.write(frame);
+        // Hand the encoded frame to the recorder (optional); never waits on the disk
+        std::vector<uchar> jpeg;
+        if (cv::imencode(".jpg", frame, jpeg, jpeg_params)) {
+            uint64_t timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+                                     std::chrono::system_clock::now().time_since_epoch()).count();
+            recorder.pushVideo(timestamp, std::move(jpeg));
+        }
 
         // Display the frame in a window
         cv::imshow("Webcam - Real-Time Video", frame);
@@ -54,7 +59,7 @@ int main() {
 
     // Release resources
     cap.release();
-    writer.release();
+    recorder.stop();
     cv::destroyAllWindows();
 
     return 0;
@@ -9,7 +9,14 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <signal.h>
-#include <alsa/asoundlib.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "../../common/frame_protocol.h"
+#include "../../common/cli_args.h"
+#include "../../common/audio_io.h"
+#include "../../common/interval_reporter.h"
 
 #define SERVER_IP "192.168.1.83"
 #define SERVER_PORT 12345
@@ -18,8 +25,17 @@
 #define CHANNELS 2
 #define RETRIES 5
 #define DELAY 2
+#define REPORT_MS 1000
 
 std::atomic<bool> stop_streaming(false);
+std::string audio_in = "alsa";      // Capture and playback backends
+std::string audio_out = "alsa";
+
+// Interval metrics; the audio threads only add, the reporter thread prints
+std::atomic<uint64_t>* bytes_sent = nullptr;
+std::atomic<uint64_t>* frames_received = nullptr;
+std::atomic<uint64_t>* frames_lost = nullptr;
+measure::HdrHistogram* latency_us = nullptr;
 
 // Connect to the server with retries
 int connect_to_server(const char* ip, int port, int retries, int delay_seconds) {
@@ -54,102 +70,60 @@ int connect_to_server(const char* ip, int port, int retries, int delay_seconds)
     return -1; // All retries failed
 }
 
-// Send audio data and measure latency and bandwidth
+// Send audio frames and measure bandwidth
 void send_audio_with_metrics(int sockfd) {
-    snd_pcm_t* capture_handle;
-    snd_pcm_hw_params_t* hw_params;
-    char buffer[BUFFSIZE];
-    int err;
+    alignas(int16_t) char buffer[BUFFSIZE];
+    framing::FrameHeader header;
+    header.stream_id = uint16_t(getpid());
 
-    // Initialize ALSA for audio capture
-    if ((err = snd_pcm_open(&capture_handle, "default", SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-        std::cerr << "Capture open error: " << snd_strerror(err) << std::endl;
+    // Open the capture backend
+    std::unique_ptr<audio::Source> capture = audio::openSource(audio_in, {SRATE, CHANNELS});
+    if (!capture) {
         return;
     }
 
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(capture_handle, hw_params);
-    snd_pcm_hw_params_set_access(capture_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(capture_handle, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(capture_handle, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(capture_handle, hw_params, CHANNELS);
-    snd_pcm_hw_params(capture_handle, hw_params);
-
-    int64_t total_bytes_sent = 0;
-    auto start_time = std::chrono::steady_clock::now();
-
     while (!stop_streaming) {
-        int frames = snd_pcm_readi(capture_handle, buffer, BUFFSIZE / (CHANNELS * 2));
+        int frames = capture->read(reinterpret_cast<int16_t*>(buffer), BUFFSIZE / (CHANNELS * 2));
         if (frames < 0) {
-            frames = snd_pcm_recover(capture_handle, frames, 0);
+            frames = capture->recover(frames);
             if (frames < 0) {
-                std::cerr << "Audio capture error: " << snd_strerror(frames) << std::endl;
+                std::cerr << "Audio capture error: " << audio::errorText(frames) << std::endl;
                 break;
             }
         }
 
         int byte_count = frames * CHANNELS * 2;
 
-        // Add timestamp for latency measurement
-        auto timestamp = std::chrono::steady_clock::now();
-        int64_t ms_timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-                                    timestamp.time_since_epoch())
-                                    .count();
-
-        // Prepare packet: timestamp + audio data
-        std::vector<char> packet(sizeof(ms_timestamp) + byte_count);
-        memcpy(packet.data(), &ms_timestamp, sizeof(ms_timestamp));
-        memcpy(packet.data() + sizeof(ms_timestamp), buffer, byte_count);
-
-        // Send packet
-        if (send(sockfd, packet.data(), packet.size(), 0) == -1) {
+        // Send one frame; the header timestamp is what receivers measure latency against
+        header.length = byte_count;
+        header.timestamp_us = framing::nowUs();
+        if (!framing::sendFrame(sockfd, header, buffer)) {
             perror("Send failed");
             break;
         }
+        header.seq++;
 
-        total_bytes_sent += byte_count;
-
-        // Receive acknowledgment for latency measurement
-        char ack[8];
-        if (recv(sockfd, ack, sizeof(ack), 0) > 0) {
-            auto ack_time = std::chrono::steady_clock::now();
-            int latency = std::chrono::duration_cast<std::chrono::milliseconds>(ack_time - timestamp).count();
-            std::cout << "Latency: " << latency << " ms\n";
-        }
+        bytes_sent->fetch_add(uint64_t(byte_count), std::memory_order_relaxed);
     }
-
-    auto end_time = std::chrono::steady_clock::now();
-    double duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time).count();
-    double bandwidth = (total_bytes_sent / 1024.0) / duration; // Bandwidth in KB/s
-
-    std::cout << "Average Bandwidth: " << bandwidth << " KB/s\n";
-
-    snd_pcm_close(capture_handle);
 }
 
-// Receive and playback audio
+// Receive and playback audio; latency is the age of each frame on arrival
+// (sender and receiver clocks must be synchronised, e.g. with NTP)
 void receive_and_play_audio(int sockfd) {
-    snd_pcm_t* playback_handle;
-    snd_pcm_hw_params_t* hw_params;
-    char buffer[BUFFSIZE];
+    unsigned char buffer[BUFFSIZE + framing::Header_Size];
     int err;
 
-    // Initialize ALSA for playback
-    if ((err = snd_pcm_open(&playback_handle, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-        std::cerr << "Playback open error: " << snd_strerror(err) << std::endl;
+    // Open the playback backend
+    std::unique_ptr<audio::Sink> playback = audio::openSink(audio_out, {SRATE, CHANNELS});
+    if (!playback) {
         return;
     }
 
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(playback_handle, hw_params);
-    snd_pcm_hw_params_set_access(playback_handle, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(playback_handle, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(playback_handle, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(playback_handle, hw_params, CHANNELS);
-    snd_pcm_hw_params(playback_handle, hw_params);
+    framing::FrameParser parser;
+    std::map<uint16_t, uint32_t> next_seq;    // Per sender, to count frames the relay dropped
 
     while (!stop_streaming) {
-        int bytes_received = recv(sockfd, buffer, BUFFSIZE, 0);
+        int bytes_received = recv(sockfd, buffer, sizeof(buffer), 0);
         if (bytes_received <= 0) {
             if (bytes_received == 0) {
                 std::cout << "Server closed connection.\n";
@@ -159,29 +133,80 @@ void receive_and_play_audio(int sockfd) {
             break;
         }
 
-        int frames = bytes_received / (CHANNELS * 2);
-        if ((err = snd_pcm_writei(playback_handle, buffer, frames)) < 0) {
-            snd_pcm_recover(playback_handle, err, 0);
+        bool ok = parser.feed(buffer, bytes_received, [&](const framing::FrameHeader& header, const uint8_t* frame, size_t) {
+            if (header.type != framing::Frame_Audio) {
+                return;
+            }
+            latency_us->recordAtomic(int64_t(framing::nowUs() - header.timestamp_us));
+            frames_received->fetch_add(1, std::memory_order_relaxed);
+
+            //Only a step forward is a loss; a step back (sender restarted) just resynchronizes
+            auto seq = next_seq.find(header.stream_id);
+            int32_t gap = seq != next_seq.end() ? int32_t(header.seq - seq->second) : 0;
+            if (gap > 0) {
+                frames_lost->fetch_add(uint64_t(gap), std::memory_order_relaxed);
+            }
+            next_seq[header.stream_id] = header.seq + 1;
+
+            int frames = header.length / (CHANNELS * 2);
+            if ((err = playback->write(reinterpret_cast<const int16_t*>(frame + framing::Header_Size), frames)) < 0) {
+                playback->recover(err);
+            }
+        });
+        if (!ok) {
+            std::cerr << "Framing error from server.\n";
+            break;
         }
     }
 
-    snd_pcm_close(playback_handle);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
     signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE to prevent crashes
 
+    // Audio backends: --audio-in / --audio-out <spec> (alsa[:device], synth, file:path, null; default alsa)
+    // Metrics: one summary per --report-ms interval, also as CSV rows with --csv <file>
+    int report_ms = REPORT_MS;
+    std::string csv_path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--audio-in" && i + 1 < argc) {
+            audio_in = argv[++i];
+        } else if (arg == "--audio-out" && i + 1 < argc) {
+            audio_out = argv[++i];
+        } else if (arg == "--report-ms" && i + 1 < argc && cli::parseInt(argv[i + 1], report_ms, 1, 3600 * 1000)) {
+            i++;
+        } else if (arg == "--csv" && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--audio-in spec] [--audio-out spec] [--report-ms ms] [--csv file]\n";
+            return 1;
+        }
+    }
+
+    measure::IntervalReporter reporter(report_ms);
+    bytes_sent = &reporter.counter("sent", "KB/s", 1.0 / 1024);
+    frames_received = &reporter.counter("frames", "/s");
+    frames_lost = &reporter.counter("lost", "");
+    latency_us = &reporter.histogram("latency", "ms", 1000.0);
+
     int sockfd = connect_to_server(SERVER_IP, SERVER_PORT, RETRIES, DELAY);
     if (sockfd == -1) {
         std::cerr << "Failed to connect to server.\n";
         return 1;
     }
 
+    if (!reporter.start(csv_path)) {
+        close(sockfd);
+        return 1;
+    }
+
     std::thread sender_thread(send_audio_with_metrics, sockfd);
     std::thread receiver_thread(receive_and_play_audio, sockfd);
 
     sender_thread.join();
     receiver_thread.join();
+    reporter.stop();
 
     close(sockfd);
     return 0;
@@ -2,9 +2,7 @@
 #include <iostream>
 #include <cstring>
 #include <vector>
-#include <thread>
 #include <atomic>
-#include <mutex>
 #include <chrono>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -14,51 +12,15 @@
 #include <sys/wait.h>
 #include <algorithm> 
 
+#include "../../common/relay_engine.h"
+
 
 #define SERVER_PORT 12345
 #define BACKLOG 5
 #define BUFFSIZE 4096
 
-std::vector<int> clients; // Vector to store connected clients
-std::mutex client_m;      // Mutex for thread-safe access to the clients vector
 std::atomic<bool> stop_server(false);
 
-// Handle client connection
-#include <algorithm> // For std::remove
-#include <sys/wait.h> // For waitpid
-
-void handle_client(int client_socket) {
-    char buffer[BUFFSIZE];
-    int byte_num;
-
-    while ((byte_num = recv(client_socket, buffer, sizeof(buffer), 0)) > 0) {
-        // Broadcast message to all clients
-        std::lock_guard<std::mutex> lock(client_m); // Lock clients while broadcasting
-        for (int other_client : clients) {
-            if (other_client != client_socket) {
-                if (send(other_client, buffer, byte_num, 0) == -1) {
-                    perror("send error");
-                }
-            }
-        }
-    }
-
-    // Handle client disconnection or receive error
-    if (byte_num == 0) {
-        std::cout << "Client disconnected.\n";
-    } else if (byte_num == -1) {
-        perror("recv error");
-    }
-
-    // Remove client from the list
-    {
-        std::lock_guard<std::mutex> lock(client_m);
-        clients.erase(std::remove(clients.begin(), clients.end(), client_socket), clients.end());
-    }
-
-    close(client_socket); // Close the client socket
-}
-
 void sigchld_handler(int s) {
     // Save and restore errno because waitpid might overwrite it
     int saved_errno = errno;
@@ -71,12 +33,17 @@ void sigchld_handler(int s) {
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
     signal(SIGPIPE, SIG_IGN); // Ignore SIGPIPE to prevent crashes
 
-    int server_socket, new_client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t sin_size = sizeof(client_addr);
+    // Outbound queue bound and slow-client policy
+    relay::RelayOptions relay_opts;
+    if (!relay::parseOptions(argc, argv, relay_opts)) {
+        return 1;
+    }
+
+    int server_socket;
+    struct sockaddr_in server_addr;
 
     // Create server socket
     if ((server_socket = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
@@ -90,6 +57,11 @@ int main() {
         perror("Set socket options failed");
         return 1;
     }
+    // Let the relay workers share the port
+    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+        perror("Set socket options failed");
+        return 1;
+    }
 
     // Set up server address
     server_addr.sin_family = AF_INET;
@@ -122,28 +94,10 @@ int main() {
         return 1;
     }
 
-    // Accept incoming connections
-    while (!stop_server) {
-        new_client_socket = accept(server_socket, (struct sockaddr*)&client_addr, &sin_size);
-        if (new_client_socket == -1) {
-            perror("Accept failed");
-            continue;
-        }
-
-        // Display the client address
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
-        std::cout << "Connection from " << client_ip << "\n";
-
-        // Add client to the list
-        {
-            std::lock_guard<std::mutex> lock(client_m);
-            clients.push_back(new_client_socket);
-        }
-
-        // Create a thread to handle the client
-        std::thread client_thread(handle_client, new_client_socket);
-        client_thread.detach();
+    // Accept and relay for every client on the event loops
+    if (!relay::serve(server_socket, relay_opts, stop_server, BACKLOG)) {
+        close(server_socket);
+        return 1;
     }
 
     // Clean up
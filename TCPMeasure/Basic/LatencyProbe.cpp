@@ -0,0 +1,276 @@
+// Latency probe: round-trip times to an echo server (MeasureTCP) over TCP or UDP.
+// Probes carry a sequence number and their send time in nanoseconds and go
+// out at a fixed rate from one thread, whatever has come back; a second
+// thread reads the echoes and records each RTT in an HDR histogram. Sends
+// follow a schedule set at the start, and RTT is counted from the time a probe
+// was due, not from when it actually left: a stalled sender delays later
+// probes rather than thinning them out, and the stall shows up in the tail
+// instead of hiding. The final report adds the RTT from the actual send time,
+// which leaves the sender's own delays out.
+//
+//   LatencyProbe --host 192.168.1.83 --rate 2000 --seconds 10
+//   LatencyProbe --udp --rate 20000 --size 200
+//
+// Every --interval-s a line with that interval's percentiles is printed; the
+// run ends with the whole distribution, lost and reordered probes.
+
+// Include Libraries
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "../../common/cli_args.h"
+#include "../../common/hdr_histogram.h"
+
+#define SERVER_IP "192.168.1.83"
+#define SERVER_PORT 12345
+#define PROBE_MAGIC 0x4250524Fu  //"ORPB"
+#define DRAIN_MS 1000            //Wait for late echoes after the last probe
+
+struct ProbeOptions {
+    std::string host = SERVER_IP;
+    uint16_t port = SERVER_PORT;
+    bool udp = false;
+    int rate = 1000;            // Probes per second
+    size_t size = 64;           // Bytes per probe, header included
+    int seconds = 10;
+    int interval_s = 1;         // Interval report period, 0 = final report only
+};
+
+//Probe header; the rest of a probe is padding
+struct Probe_Header {
+    uint32_t magic;
+    uint32_t seq;
+    uint64_t due_ns;            // Scheduled send time
+    uint64_t send_ns;           // Actual send time
+};
+
+std::atomic<bool> stop_sending(false);
+std::atomic<uint64_t> probes_sent(0);
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool parse_options(int argc, char* argv[], ProbeOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--host" && has_value) {
+            opts.host = argv[++i];
+        } else if (arg == "--port" && has_value) {
+            ok = cli::parsePort(argv[++i], opts.port);
+        } else if (arg == "--udp") {
+            opts.udp = true;
+        } else if (arg == "--tcp") {
+            opts.udp = false;
+        } else if (arg == "--rate" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.rate, 1, 1000000);
+        } else if (arg == "--size" && has_value) {
+            ok = cli::parseInt<size_t>(argv[++i], opts.size, 0, 65000);
+        } else if (arg == "--seconds" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.seconds, 1, 86400);
+        } else if (arg == "--interval-s" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.interval_s, 0, 86400);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--host IP] [--port N] [--tcp|--udp] [--rate probes/s] [--size bytes]"
+                      << " [--seconds N] [--interval-s N]\n";
+            return false;
+        }
+    }
+    if (opts.rate <= 0 || opts.size < sizeof(Probe_Header) || opts.size > 65000) {
+        std::cerr << "Need a positive rate and probes of " << sizeof(Probe_Header) << " to 65000 bytes.\n";
+        return false;
+    }
+    return true;
+}
+
+// Connected TCP or UDP socket to the echo server
+int connect_probe(const ProbeOptions& opts) {
+    int sockfd = socket(AF_INET, opts.udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    struct sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opts.port);
+    if (inet_pton(AF_INET, opts.host.c_str(), &server_addr.sin_addr) <= 0) {
+        perror("Invalid address or address not supported");
+        close(sockfd);
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0) {
+        perror("Connection failed");
+        close(sockfd);
+        return -1;
+    }
+    if (!opts.udp) {
+        //Probes are small: send each one as it is written
+        int yes = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    }
+    //Receive wakes up now and then to report and to notice the end
+    timeval timeout = {0, 100000};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return sockfd;
+}
+
+// Paced sending on a fixed schedule; never waits for echoes
+void send_probes(int sockfd, const ProbeOptions& opts) {
+    std::vector<char> probe(opts.size, 0);
+    Probe_Header header = {};
+    header.magic = PROBE_MAGIC;
+    auto period = std::chrono::nanoseconds(1000000000LL / opts.rate);
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(opts.seconds);
+
+    for (uint32_t seq = 0; !stop_sending; seq++) {
+        auto due = start + period * seq;
+        if (due >= end) break;
+        std::this_thread::sleep_until(due);
+
+        header.seq = seq;
+        header.due_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(due.time_since_epoch()).count());
+        header.send_ns = uint64_t(now_ns());
+        memcpy(probe.data(), &header, sizeof(header));
+        //TCP may take a probe in pieces; UDP sends it whole or not at all
+        for (size_t done = 0; done < probe.size();) {
+            ssize_t n = send(sockfd, probe.data() + done, probe.size() - done, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (opts.udp && (errno == ECONNREFUSED || errno == ENOBUFS)) break;     //Counted as lost
+                perror("Send failed");
+                stop_sending = true;
+                return;
+            }
+            done += size_t(n);
+        }
+        probes_sent++;
+    }
+    stop_sending = true;
+}
+
+void print_line(const char* label, const measure::HdrHistogram& rtt) {
+    auto us = [](int64_t ns) { return double(ns) / 1000.0; };
+    printf("%s n=%llu min=%.3f p50=%.3f p90=%.3f p99=%.3f p99.9=%.3f max=%.3f mean=%.3f us\n", label,
+           (unsigned long long)rtt.count(), us(rtt.min()), us(rtt.percentile(50)), us(rtt.percentile(90)),
+           us(rtt.percentile(99)), us(rtt.percentile(99.9)), us(rtt.max()), rtt.mean() / 1000.0);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    ProbeOptions opts;
+    if (!parse_options(argc, argv, opts)) {
+        return 1;
+    }
+    int sockfd = connect_probe(opts);
+    if (sockfd == -1) {
+        return 1;
+    }
+    std::cout << "Probing " << opts.host << ":" << opts.port << " over " << (opts.udp ? "UDP" : "TCP") << ": "
+              << opts.rate << " probes/s of " << opts.size << " bytes for " << opts.seconds << " s\n";
+
+    measure::HdrHistogram total;            //From the scheduled send time
+    measure::HdrHistogram interval;
+    measure::HdrHistogram from_send;        //From the actual send time
+    uint64_t received = 0;
+    uint64_t reordered = 0;
+    uint64_t corrupt = 0;
+    uint32_t highest_seq = 0;
+    std::vector<char> buffer(opts.size * 64);
+    size_t buffered = 0;
+
+    std::thread sender(send_probes, sockfd, std::cref(opts));
+
+    auto started = std::chrono::steady_clock::now();
+    auto next_report = started + std::chrono::seconds(opts.interval_s);
+    std::chrono::steady_clock::time_point drain_until{};
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        if (opts.interval_s > 0 && now >= next_report) {
+            char label[32];
+            snprintf(label, sizeof(label), "[probe] t=%llds",
+                     (long long)std::chrono::duration_cast<std::chrono::seconds>(now - started).count());
+            print_line(label, interval);
+            interval.reset();
+            next_report += std::chrono::seconds(opts.interval_s);
+        }
+        if (stop_sending) {
+            if (drain_until == std::chrono::steady_clock::time_point()) {
+                drain_until = now + std::chrono::milliseconds(DRAIN_MS);
+            }
+            if (received >= probes_sent || now >= drain_until) break;
+        }
+
+        //UDP: one datagram per probe. TCP: whole probes out of the stream.
+        ssize_t n = recv(sockfd, buffer.data() + buffered, opts.udp ? opts.size : buffer.size() - buffered, 0);
+        int64_t arrived = now_ns();
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || (opts.udp && errno == ECONNREFUSED)) continue;
+            perror("Receive failed");
+            break;
+        }
+        if (n == 0) {
+            std::cerr << "Server closed the connection.\n";
+            break;
+        }
+        if (opts.udp && size_t(n) != opts.size) {
+            corrupt++;
+            continue;
+        }
+        buffered += size_t(n);
+
+        size_t offset = 0;
+        for (; buffered - offset >= opts.size; offset += opts.size) {
+            Probe_Header echo;
+            memcpy(&echo, buffer.data() + offset, sizeof(echo));
+            if (echo.magic != PROBE_MAGIC) {
+                corrupt++;
+                continue;
+            }
+            if (echo.seq < highest_seq) {
+                reordered++;
+            }
+            highest_seq = std::max(highest_seq, echo.seq);
+            int64_t rtt = arrived - int64_t(echo.due_ns);
+            total.record(rtt);
+            interval.record(rtt);
+            from_send.record(arrived - int64_t(echo.send_ns));
+            received++;
+        }
+        memmove(buffer.data(), buffer.data() + offset, buffered - offset);
+        buffered -= offset;
+    }
+    stop_sending = true;
+    sender.join();
+    close(sockfd);
+
+    uint64_t sent = probes_sent;
+    uint64_t lost = sent > received ? sent - received : 0;
+    printf("Probes: sent %llu, received %llu, lost %llu (%.3f%%), reordered %llu, corrupt %llu\n",
+           (unsigned long long)sent, (unsigned long long)received, (unsigned long long)lost,
+           sent ? 100.0 * double(lost) / double(sent) : 0.0, (unsigned long long)reordered, (unsigned long long)corrupt);
+    print_line("RTT", total);
+    print_line("RTT from send", from_send);
+    return received > 0 ? 0 : 1;
+}
@@ -1,20 +1,43 @@
+// Echo server for LatencyProbe: every byte a TCP client sends comes straight
+// back, and so does every UDP datagram sent to the same port.
+//
+// Traffic is summed into interval counters off the echo path; a reporter
+// thread prints one line per interval (and a CSV row with --csv):
+//   ./MeasureTCP [--report-ms 1000] [--csv echo.csv]
+
 #include <iostream>
+#include <cerrno>
 #include <cstring>
-#include <chrono>
+#include <csignal>
+#include <string>
+#include <atomic>
 #include <thread>
 #include <sys/socket.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 
+#include "../../common/cli_args.h"
+#include "../../common/interval_reporter.h"
+
 #define PORT 12345
 #define BUFFSIZE 1024
+#define UDP_BUFFSIZE 65536
+#define REPORT_MS 1000
+
+std::atomic<uint64_t>* tcp_bytes = nullptr;
+std::atomic<uint64_t>* clients = nullptr;
+std::atomic<uint64_t>* udp_datagrams = nullptr;
+
+volatile sig_atomic_t stop_requested = 0;
+void request_stop(int) { stop_requested = 1; }
 
 void handle_client(int client_sock) {
     char buffer[BUFFSIZE];
-    int64_t prev_timestamp = 0;
-    int total_bytes = 0;
 
-    auto start_time = std::chrono::steady_clock::now();
+    //Echoes are small: do not let Nagle hold them back
+    int yes = 1;
+    setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
 
     while (true) {
         int bytes_received = recv(client_sock, buffer, BUFFSIZE, 0);
@@ -22,29 +45,85 @@ void handle_client(int client_sock) {
             break; // Connection closed or error
         }
 
-        // Extract timestamp from the received buffer
-        int64_t client_timestamp;
-        memcpy(&client_timestamp, buffer, sizeof(client_timestamp));
-
-        // Send acknowledgment with the received timestamp
-        if (send(client_sock, &client_timestamp, sizeof(client_timestamp), 0) == -1) {
-            perror("Send acknowledgment failed");
+        // Echo what arrived, as it arrived; the probe finds its own boundaries
+        int echoed = 0;
+        while (echoed < bytes_received) {
+            int n = send(client_sock, buffer + echoed, bytes_received - echoed, MSG_NOSIGNAL);
+            if (n == -1) {
+                perror("Send echo failed");
+                break;
+            }
+            echoed += n;
+        }
+        if (echoed < bytes_received) {
             break;
         }
 
-        total_bytes += bytes_received;
-
-        // Log received data size and calculate bandwidth
-        auto current_time = std::chrono::steady_clock::now();
-        double elapsed_time = std::chrono::duration_cast<std::chrono::seconds>(current_time - start_time).count();
-        double bandwidth = (total_bytes / 1024.0) / elapsed_time; // Bandwidth in KB/s
-        std::cout << "Bandwidth: " << bandwidth << " KB/s\n";
+        tcp_bytes->fetch_add(uint64_t(bytes_received), std::memory_order_relaxed);
     }
 
     close(client_sock);
 }
 
-int main() {
+// UDP probes: send every datagram back to where it came from
+void echo_udp() {
+    int udp_sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udp_sock == -1) {
+        perror("UDP socket creation failed");
+        return;
+    }
+
+    struct sockaddr_in udp_addr = {};
+    udp_addr.sin_family = AF_INET;
+    udp_addr.sin_port = htons(PORT);
+    udp_addr.sin_addr.s_addr = INADDR_ANY;
+    if (bind(udp_sock, (struct sockaddr*)&udp_addr, sizeof(udp_addr)) == -1) {
+        perror("UDP bind failed");
+        close(udp_sock);
+        return;
+    }
+
+    static char datagram[UDP_BUFFSIZE];
+    while (true) {
+        struct sockaddr_in from = {};
+        socklen_t from_len = sizeof(from);
+        ssize_t n = recvfrom(udp_sock, datagram, sizeof(datagram), 0, (struct sockaddr*)&from, &from_len);
+        if (n < 0) {
+            perror("UDP receive failed");
+            continue;
+        }
+        sendto(udp_sock, datagram, size_t(n), 0, (struct sockaddr*)&from, from_len);
+        udp_datagrams->fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int report_ms = REPORT_MS;
+    std::string csv_path;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--report-ms" && i + 1 < argc && cli::parseInt(argv[i + 1], report_ms, 1, 3600 * 1000)) {
+            i++;
+        } else if (arg == "--csv" && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--report-ms ms] [--csv file]\n";
+            return 1;
+        }
+    }
+
+    //Never deleted: detached client threads may still count while the process exits
+    measure::IntervalReporter& intervals = *new measure::IntervalReporter(report_ms);
+    tcp_bytes = &intervals.counter("tcp_bytes", "KB/s", 1.0 / 1024);
+    clients = &intervals.counter("clients", "");
+    udp_datagrams = &intervals.counter("udp_datagrams", "/s");
+
+    //Ctrl-C ends the accept loop so the run total gets printed
+    struct sigaction on_stop = {};
+    on_stop.sa_handler = request_stop;
+    sigaction(SIGINT, &on_stop, nullptr);
+    sigaction(SIGTERM, &on_stop, nullptr);
+
     int server_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (server_sock == -1) {
         perror("Socket creation failed");
@@ -68,19 +147,29 @@ int main() {
         return 1;
     }
 
-    std::cout << "Server listening on port " << PORT << "\n";
+    if (!intervals.start(csv_path)) {
+        close(server_sock);
+        return 1;
+    }
+
+    std::cout << "Server listening on port " << PORT << " (TCP and UDP echo)\n";
+    std::thread(echo_udp).detach();
 
-    while (true) {
+    while (!stop_requested) {
         int client_sock = accept(server_sock, nullptr, nullptr);
         if (client_sock == -1) {
-            perror("Accept failed");
+            if (errno != EINTR) {
+                perror("Accept failed");
+            }
             continue;
         }
 
         std::cout << "Client connected.\n";
+        clients->fetch_add(1, std::memory_order_relaxed);
         std::thread(handle_client, client_sock).detach();
     }
 
+    intervals.stop();
     close(server_sock);
     return 0;
 }
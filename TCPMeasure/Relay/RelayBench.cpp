@@ -0,0 +1,289 @@
+// Relay benchmark: load a running relay with framed clients and measure what comes back.
+// Every sender sends one frame per interval; every frame should reach all other
+// clients. Forwarding latency is taken from the frame timestamp, so run the
+// bench on the relay's host (or with synced clocks).
+//
+// Compare the relay's I/O backends by running the same load against
+//   TCPLBSr --io epoll   and   TCPLBSr --io uring
+// With --server-pid the relay's CPU time over the run is reported as well.
+// --rooms N spreads the clients round-robin over N rooms; a frame then only
+// reaches the other members of its sender's room.
+
+// Include Libraries
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include "../../common/cli_args.h"
+#include "../../common/frame_protocol.h"
+
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 12345
+
+struct BenchOptions {
+    std::string host = SERVER_IP;
+    uint16_t port = SERVER_PORT;
+    int clients = 8;
+    int senders = -1;           // -1 = every client sends
+    size_t frame_bytes = 4096;  // Payload per frame
+    int interval_us = 5805;     // 256 stereo frames at 44.1 kHz; 0 = as fast as possible
+    int seconds = 5;
+    int server_pid = 0;         // Relay process on this host, for CPU time
+    int rooms = 0;              // 0 = everyone in the relay's main room
+};
+
+struct ClientState {
+    int fd = -1;
+    framing::FrameParser parser;
+};
+
+std::atomic<bool> stop_sending(false);
+
+// Connect one client to the relay
+int connect_client(const BenchOptions& opts) {
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        perror("Socket creation failed");
+        return -1;
+    }
+    struct sockaddr_in server_addr = {};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(opts.port);
+    if (inet_pton(AF_INET, opts.host.c_str(), &server_addr.sin_addr) <= 0) {
+        perror("Invalid address or address not supported");
+        close(sockfd);
+        return -1;
+    }
+    if (connect(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0) {
+        perror("Connection failed");
+        close(sockfd);
+        return -1;
+    }
+    int yes = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    return sockfd;
+}
+
+// User + system CPU time of a process in seconds, -1 if unknown
+double process_cpu_seconds(int pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if (!std::getline(stat, line)) {
+        return -1;
+    }
+    //Fields after the command name, which is in parentheses and may contain spaces
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) utime = strtoull(field.c_str(), nullptr, 10);
+        if (i == 15) stime = strtoull(field.c_str(), nullptr, 10);
+    }
+    return double(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+bool parse_options(int argc, char* argv[], BenchOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--host" && has_value) {
+            opts.host = argv[++i];
+        } else if (arg == "--port" && has_value) {
+            ok = cli::parsePort(argv[++i], opts.port);
+        } else if (arg == "--clients" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.clients, 2, 100000);
+        } else if (arg == "--senders" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.senders, -1, 100000);
+        } else if (arg == "--size" && has_value) {
+            ok = cli::parseInt<size_t>(argv[++i], opts.frame_bytes, 0, framing::Max_Payload);
+        } else if (arg == "--interval-us" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.interval_us, 0, 60 * 1000 * 1000);
+        } else if (arg == "--seconds" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.seconds, 1, 86400);
+        } else if (arg == "--server-pid" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.server_pid, 0, 1 << 22);
+        } else if (arg == "--rooms" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.rooms, 0, 100000);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--host IP] [--port N] [--clients N] [--senders N] [--size bytes]"
+                      << " [--interval-us N] [--seconds N] [--server-pid PID] [--rooms N]\n";
+            return false;
+        }
+    }
+    if (opts.senders < 0 || opts.senders > opts.clients) {
+        opts.senders = opts.clients;
+    }
+    if (opts.clients < 2 || opts.frame_bytes > framing::Max_Payload) {
+        std::cerr << "Need at least 2 clients and frames up to " << framing::Max_Payload << " bytes.\n";
+        return false;
+    }
+    return true;
+}
+
+// Paced sending: one frame per sender per interval
+void send_frames(const BenchOptions& opts, const std::vector<std::unique_ptr<ClientState>>& clients,
+                 uint64_t& frames_sent) {
+    std::vector<char> payload(opts.frame_bytes, 0);
+    framing::FrameHeader header;
+    header.length = uint32_t(opts.frame_bytes);
+    auto next = std::chrono::steady_clock::now();
+    while (!stop_sending) {
+        for (int i = 0; i < opts.senders; i++) {
+            header.stream_id = uint16_t(i);
+            header.timestamp_us = framing::nowUs();
+            if (!framing::sendFrame(clients[i]->fd, header, payload.data())) {
+                perror("Send failed");
+                stop_sending = true;
+                return;
+            }
+            frames_sent++;
+        }
+        header.seq++;
+        if (opts.interval_us > 0) {
+            next += std::chrono::microseconds(opts.interval_us);
+            std::this_thread::sleep_until(next);
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    signal(SIGPIPE, SIG_IGN);
+
+    BenchOptions opts;
+    if (!parse_options(argc, argv, opts)) {
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<ClientState>> clients;
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < opts.clients; i++) {
+        std::unique_ptr<ClientState> client(new ClientState());
+        client->fd = connect_client(opts);
+        if (client->fd == -1) {
+            return 1;
+        }
+        if (opts.rooms > 0 && !framing::sendJoin(client->fd, "bench-" + std::to_string(i % opts.rooms))) {
+            perror("Join failed");
+            return 1;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = uint32_t(i);
+        epoll_ctl(epfd, EPOLL_CTL_ADD, client->fd, &ev);
+        clients.push_back(std::move(client));
+    }
+    //Let the relay register every client before the first frame
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    std::cout << "Relay bench: " << opts.clients << " clients";
+    if (opts.rooms > 0) {
+        std::cout << " in " << opts.rooms << " rooms";
+    }
+    std::cout << ", " << opts.senders << " senders, "
+              << opts.frame_bytes << " byte frames every " << opts.interval_us << " us, "
+              << opts.seconds << " s\n";
+
+    double cpu_start = opts.server_pid ? process_cpu_seconds(opts.server_pid) : -1;
+    uint64_t frames_sent = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::thread sender(send_frames, std::cref(opts), std::cref(clients), std::ref(frames_sent));
+
+    // Receive on this thread until the run is over and the relay has drained
+    std::vector<uint32_t> latencies;
+    std::vector<uint32_t> uplinks;      //Sender to relay (relay timestamp - timestamp)
+    std::vector<uint32_t> downlinks;    //Relay to receiver
+    uint64_t frames_received = 0;
+    uint64_t bytes_received = 0;
+    std::vector<uint8_t> buffer(256 * 1024);
+    std::vector<epoll_event> events(opts.clients);
+    auto send_end = start + std::chrono::seconds(opts.seconds);
+    auto drain_end = send_end + std::chrono::seconds(1);
+    while (std::chrono::steady_clock::now() < drain_end) {
+        if (!stop_sending && std::chrono::steady_clock::now() >= send_end) {
+            stop_sending = true;
+        }
+        int n = epoll_wait(epfd, events.data(), int(events.size()), 20);
+        for (int e = 0; e < n; e++) {
+            ClientState& client = *clients[events[e].data.u32];
+            ssize_t got = recv(client.fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+            if (got <= 0) {
+                if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    std::cerr << "Relay closed a client connection.\n";
+                    epoll_ctl(epfd, EPOLL_CTL_DEL, client.fd, nullptr);
+                }
+                continue;
+            }
+            bytes_received += size_t(got);
+            uint64_t now = framing::nowUs();
+            client.parser.feed(buffer.data(), size_t(got),
+                [&](const framing::FrameHeader& header, const uint8_t*, size_t) {
+                    if (header.type != framing::Frame_Audio) return;    //Join answers
+                    frames_received++;
+                    latencies.push_back(uint32_t(std::min<uint64_t>(now - header.timestamp_us, UINT32_MAX)));
+                    if (header.relay_us >= header.timestamp_us && header.relay_us <= now) {
+                        uplinks.push_back(uint32_t(std::min<uint64_t>(header.relay_us - header.timestamp_us, UINT32_MAX)));
+                        downlinks.push_back(uint32_t(std::min<uint64_t>(now - header.relay_us, UINT32_MAX)));
+                    }
+                });
+        }
+    }
+    stop_sending = true;
+    sender.join();
+    double elapsed = double(opts.seconds);
+    double cpu_used = cpu_start >= 0 ? process_cpu_seconds(opts.server_pid) - cpu_start : -1;
+
+    // Report
+    //A sender does not hear itself, every other client in its room hears it
+    uint64_t listeners = 0;     //Per round of sends
+    for (int i = 0; i < opts.senders; i++) {
+        int room_size = opts.clients;
+        if (opts.rooms > 0) {
+            room_size = opts.clients / opts.rooms + (i % opts.rooms < opts.clients % opts.rooms ? 1 : 0);
+        }
+        listeners += uint64_t(room_size - 1);
+    }
+    uint64_t expected = opts.senders > 0 ? frames_sent / uint64_t(opts.senders) * listeners : 0;
+    std::cout << "Frames sent: " << frames_sent << ", received: " << frames_received << " of " << expected
+              << " (" << (expected ? 100.0 * frames_received / expected : 0.0) << "%)\n";
+    std::cout << "Forwarded: " << bytes_received / elapsed / 1e6 << " MB/s, "
+              << frames_received / elapsed << " frames/s\n";
+    auto report = [](const char* label, std::vector<uint32_t>& values) {
+        if (values.empty()) return;
+        std::sort(values.begin(), values.end());
+        uint64_t sum = 0;
+        for (uint32_t v : values) sum += v;
+        auto pct = [&](double p) { return values[size_t(p * (values.size() - 1))]; };
+        std::cout << label << " (us): avg " << sum / values.size() << ", p50 " << pct(0.5)
+                  << ", p99 " << pct(0.99) << ", max " << values.back() << "\n";
+    };
+    report("Forward latency", latencies);
+    report("  uplink", uplinks);
+    report("  downlink", downlinks);
+    if (cpu_used >= 0) {
+        std::cout << "Relay CPU: " << cpu_used << " s (" << 100.0 * cpu_used / elapsed << "% of one core)\n";
+    }
+
+    for (auto& client : clients) {
+        close(client->fd);
+    }
+    close(epfd);
+    return 0;
+}
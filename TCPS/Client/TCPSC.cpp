@@ -7,6 +7,9 @@
 #include <thread>    //Multi-thread
 #include <mutex>     //Thread safety variables
 #include <atomic>
+#include <map>       //Delay per received stream
+#include <cstdio>    //Delay reports
+#include <memory>    //Audio backends
 
 #include <signal.h> 
 #include <chrono>  //Add timestamps for measurements
@@ -22,21 +25,56 @@
 #include <netinet/in.h> //address 
 #include <arpa/inet.h>  //IP address convertion
 
-//Audio Libraries 
-#include <alsa/asoundlib.h>
+//Audio capture and playback (--audio-in / --audio-out)
+#include "../../common/audio_io.h"
+
+//Framed audio protocol
+#include "../../common/frame_protocol.h"
+//Optional io_uring socket I/O (--io uring)
+#include "../../common/uring_stream.h"
+//Clock offset to the relay, for one-way delays
+#include "../../common/clock_sync.h"
+#include "../../common/hdr_histogram.h"
+//Acoustic end-to-end latency (--chirp-inject / --chirp-listen)
+#include "../../common/latency_harness.h"
+//Metrics for the visualizer, in shared memory (Measure.py)
+#include "../../common/metrics_ring.h"
+//Option values
+#include "../../common/cli_args.h"
+//Room name rules shared with the relay
+#include "../../common/room_table.h"
 
 
 //Define global constants 
 #define PORT 12345   //TCP port 
-#define LOCAL_PORT_C 65432 //TCP visualization port 
-#define LOCAL_PORT_P 65433 //TCP playback view
 #define SERVER_IP "192.168.1.83"  //loopback address
 #define BUFFSIZE 1024  //Buffer size
 #define SRATE 44100     //Sample rate in Hz 
 #define Channels 2      //Stereo audio 
+#define SYNC_FAST_MS 100    //Clock exchanges while starting up
+#define SYNC_FAST_COUNT 8
+#define SYNC_MS 1000        //... and after
+#define DELAY_REPORT_S 5    //One-way delay report period
+#define DELAY_MAX_US 10000000   //Histogram range (10 s)
+#define METRICS_SHM "/tcpsc_metrics"  //Default metrics segment, /dev/shm/tcpsc_metrics
+#define METRICS_LANE_CAPTURE 0  //One lane per producing thread
+#define METRICS_LANE_PLAYBACK 1
 
 
 std::atomic<bool> stop_streaming(false);
+bool use_uring = false;  //Set by --io uring; settled in main before the threads start
+timesync::ClockSync relay_clock;  //Relay clock minus ours: frames are stamped in relay time
+std::string audio_in = "alsa";    //Capture and playback backends
+std::string audio_out = "alsa";
+bool chirp_inject = false;        //Set by --chirp-inject
+uint64_t chirp_period_us = acoustic::Default_Period_us;
+telemetry::MetricsWriter metrics; //Never blocks; a no-op unless the segment was created
+
+//One-way delay of a received stream, via the relay
+struct Stream_Delay {
+    measure::HdrHistogram uplink{DELAY_MAX_US};     //Sender to relay
+    measure::HdrHistogram downlink{DELAY_MAX_US};   //Relay to us
+};
 
 //Connect to server function 
 int connect_server(const char* server_ip, int port, int retries, int delay_second) {
@@ -86,161 +124,282 @@ int connect_server(const char* server_ip, int port, int retries, int delay_secon
 
 
 //Function to capture audio 
-void audio_cap(int sockfd, int local_sockfd_capture) {
-    snd_pcm_t *capture_man;
-    snd_pcm_hw_params_t *hw_params;
-    int err; 
-    char buffer[BUFFSIZE * 2 * Channels];
-    int64_t timestamp; 
-
-
-    //Open ALSA recording 
-    if ((err = snd_pcm_open(&capture_man, "default", SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-        std::cerr << "capture device error" << snd_strerror(err) << "\n";
+//sender: io_uring sender set up by main, nullptr for plain send()
+void audio_cap(int sockfd, uring::FrameSender* sender) {
+    alignas(int16_t) char buffer[BUFFSIZE * 2 * Channels];
+    telemetry::MetricRecord record{};
+    record.kind = telemetry::Metric_Capture;
+    record.delay_us = -1;
+    framing::FrameHeader header;       //Frame header for the server stream
+    header.stream_id = uint16_t(getpid());
+    auto next_sync = std::chrono::steady_clock::now();
+    int syncs = 0;
+    acoustic::ChirpInjector injector(SRATE, Channels, chirp_period_us);
+
+    //Open audio recording 
+    std::unique_ptr<audio::Source> capture = audio::openSource(audio_in, {SRATE, Channels});
+    if (!capture) {
         return;
 
     }
 
-    //ALSA audio parameter
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(capture_man, hw_params);
-    snd_pcm_hw_params_set_access(capture_man, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(capture_man, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(capture_man, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(capture_man, hw_params, Channels);
-    snd_pcm_hw_params(capture_man, hw_params); 
-
 
 
 
 
     //Start audio capture
     while(!stop_streaming) {
-        int fr_capture = snd_pcm_readi(capture_man, buffer, BUFFSIZE);
+        int fr_capture = capture->read(reinterpret_cast<int16_t*>(buffer), BUFFSIZE);
         if (fr_capture < 0) {
-            fr_capture = snd_pcm_recover(capture_man, fr_capture, 0);
+            fr_capture = capture->recover(fr_capture);
             if (fr_capture < 0) {
-                std::cerr << "Audio capture error" << snd_strerror(fr_capture) << "\n";
+                std::cerr << "Audio capture error" << audio::errorText(fr_capture) << "\n";
                 break;
             }
         }
 
-         // Get the current timestamp in milliseconds
-        timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::steady_clock::now().time_since_epoch()
-                    ).count();
+        //Harness: chirp on the relay-time grid, timed from when the buffer was captured
+        if (chirp_inject && relay_clock.synced()) {
+            uint64_t first = acoustic::firstFrameUs(relay_clock.toRemote(framing::nowUs()), fr_capture, capture->delay(), SRATE);
+            injector.process(reinterpret_cast<int16_t*>(buffer), fr_capture, first);
+        }
+
+        //Clock exchange with the relay: a few quick ones, then one a second
+        bool sent = true;
+        auto now = std::chrono::steady_clock::now();
+        if (now >= next_sync) {
+            framing::FrameHeader request = framing::timeRequest(framing::nowUs());
+            sent = sender ? sender->send(request, nullptr) : framing::sendFrame(sockfd, request, nullptr);
+            next_sync = now + std::chrono::milliseconds(++syncs < SYNC_FAST_COUNT ? SYNC_FAST_MS : SYNC_MS);
+        }
 
-        //Send audio on socket 
+        //Send audio on socket as one frame, stamped in relay time
         int byte_send = fr_capture * 2 * Channels; //Calculate bytes sent
-        if (send(sockfd, buffer, byte_send, 0) == -1) {
+        header.length = byte_send;
+        header.timestamp_us = relay_clock.toRemote(framing::nowUs());
+        sent = sent && (sender ? sender->send(header, buffer) : framing::sendFrame(sockfd, header, buffer));
+        if (!sent) {
+            if (sender) errno = sender->error();
             perror("error sending");
             stop_streaming = true;
             break;
         }
 
-        //Combine timestamp and buffer into one packet
-        std::vector<char> packet(sizeof(timestamp) + byte_send);
-
-        // Copy timestamp into packet
-        memcpy(packet.data(), &timestamp, sizeof(timestamp));
-
-        // Copy audio buffer into packet
-        memcpy(packet.data() + sizeof(timestamp), buffer, byte_send);
-
-        // Send the combined packet to Python visualizer
-        if (send(local_sockfd_capture, packet.data(), packet.size(), 0) == -1) {
-            perror("Error sending data to Python (timestamp + audio)");
-            stop_streaming = true;
-            break;
-        }
+        //Visualizer record: what went out, and how loud
+        record.wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+        record.stamp_us = header.timestamp_us;
+        record.seq = header.seq;
+        record.stream_id = header.stream_id;
+        record.frames = fr_capture;
+        record.bytes = byte_send;
+        telemetry::audioLevels(reinterpret_cast<int16_t*>(buffer), size_t(fr_capture) * Channels, record.peak, record.rms);
+        metrics.push(METRICS_LANE_CAPTURE, record);
+        header.seq++;
     }    
 
-    snd_pcm_close(capture_man);
+    if (sender) {
+        sender->drain();
+    }
     close(sockfd);           // Close main server socket
-    close(local_sockfd_capture);  // Close local socket properly
 
 }
 
 
 
 //Audio playback function 
-void play_audio(int sockfd, int local_sockfd_playback) {
-    snd_pcm_t *playback_man;
-    snd_pcm_hw_params_t *hw_params;
+//receiver: io_uring receiver set up by main, nullptr for plain recv()
+void play_audio(int sockfd, uring::StreamReceiver* receiver) {
     int err; 
     char buffer[BUFFSIZE * 2 * Channels];
 
 
     //Open playback device
-    if((err = snd_pcm_open(&playback_man, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-        std::cerr << "playback device error" << snd_strerror(err) << "\n";
+    std::unique_ptr<audio::Sink> playback = audio::openSink(audio_out, {SRATE, Channels});
+    if (!playback) {
         return; 
 
     }
 
-    //ALSA audio parameters
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(playback_man, hw_params);
-    snd_pcm_hw_params_set_access(playback_man, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(playback_man, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(playback_man, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(playback_man, hw_params, Channels);
-    snd_pcm_hw_params(playback_man, hw_params); 
 
 
 
-    //play audio 
-    while(!stop_streaming) {
-        int byte_num = recv(sockfd, buffer, sizeof(buffer), 0);
-        if (byte_num <= 0) {
-            if (byte_num == 0) {
-                std::cout << "Server closed connection. \n";
+    //One-way delays per stream, reported every DELAY_REPORT_S
+    std::map<uint16_t, Stream_Delay> delays;
+    auto next_report = std::chrono::steady_clock::now() + std::chrono::seconds(DELAY_REPORT_S);
+    auto report_delays = [&]() {
+        auto ms = [](int64_t us) { return double(us) / 1000.0; };
+        for (auto& entry : delays) {
+            Stream_Delay& delay = entry.second;
+            if (delay.uplink.count() == 0) continue;
+            printf("[delay] stream %u: uplink p50=%.2f p99=%.2f max=%.2f ms, downlink p50=%.2f p99=%.2f max=%.2f ms\n",
+                   entry.first, ms(delay.uplink.percentile(50)), ms(delay.uplink.percentile(99)), ms(delay.uplink.max()),
+                   ms(delay.downlink.percentile(50)), ms(delay.downlink.percentile(99)), ms(delay.downlink.max()));
+            delay.uplink.reset();
+            delay.downlink.reset();
+        }
+        printf("[delay] relay clock offset %+lld us (+/- %lld us), drift %+.2f ppm\n",
+               (long long)relay_clock.offsetUs(framing::nowUs()), (long long)relay_clock.rttUs() / 2, relay_clock.driftPpm());
+        fflush(stdout);
+    };
+
+    //play audio: recv returns arbitrary byte ranges, the parser hands out whole frames
+    framing::FrameParser parser;
+    unsigned char stream[sizeof(buffer) + framing::Header_Size];
+    auto on_frame = [&](const framing::FrameHeader& header, const uint8_t* frame, size_t) {
+        if (header.type == framing::Frame_Time_Response && header.length >= framing::Time_Payload) {
+            relay_clock.addExchange(framing::timeResponseT1(frame), header.relay_us, header.timestamp_us, framing::nowUs());
+            return;
+        }
+        //Answer to --room: the room we are in, or nothing when the relay refused the name
+        if (header.type == framing::Frame_Join) {
+            if (header.length == 0) {
+                std::cerr << "Relay rejected the room name.\n";
+                stop_streaming = true;
             } else {
-                perror("recv error");
+                std::cout << "Joined room " << std::string(reinterpret_cast<const char*>(frame + framing::Header_Size), header.length) << "\n";
             }
-            stop_streaming = true;
-            break;
+            return;
+        }
+        if (stop_streaming || header.type != framing::Frame_Audio) {
+            return;
+        }
+        const uint8_t* audio = frame + framing::Header_Size;
+        telemetry::MetricRecord record{};
+        record.kind = telemetry::Metric_Playback;
+        record.delay_us = -1;
+
+        //Both ends stamp in relay time, so the stamps split the delay
+        if (header.relay_us != 0 && relay_clock.synced()) {
+            int64_t arrival = int64_t(relay_clock.toRemote(framing::nowUs()));
+            Stream_Delay& delay = delays[header.stream_id];
+            delay.uplink.record(int64_t(header.relay_us) - int64_t(header.timestamp_us));
+            delay.downlink.record(arrival - int64_t(header.relay_us));
+            record.delay_us = arrival - int64_t(header.timestamp_us);
+        }
+        if (std::chrono::steady_clock::now() >= next_report) {
+            report_delays();
+            next_report += std::chrono::seconds(DELAY_REPORT_S);
         }
 
-        int frames_play = byte_num / (Channels * 2);
-        if ((err = snd_pcm_writei(playback_man, buffer, frames_play)) < 0) {
+        int frames_play = header.length / (Channels * 2);
+        if ((err = playback->write(reinterpret_cast<const int16_t*>(audio), frames_play)) < 0) {
             if (err == -EPIPE) {
-                std::cerr << "Buffer underrun occurred: " << snd_strerror(err) << "\n";
-                if ((err = snd_pcm_prepare(playback_man)) < 0) {
-                    std::cerr << "Error recovering from underrum" << snd_strerror(err) << "\n";
+                std::cerr << "Buffer underrun occurred: " << audio::errorText(err) << "\n";
+                if ((err = playback->recover(err)) < 0) {
+                    std::cerr << "Error recovering from underrum" << audio::errorText(err) << "\n";
                     stop_streaming = true;
-                    break;
-                
+                    return;
                 }
             } else {
-                std::cerr << "write to audio interface failed: " << snd_strerror(err) << "\n";
+                std::cerr << "write to audio interface failed: " << audio::errorText(err) << "\n";
                 stop_streaming = true;
-                break;
+                return;
             }
         }
 
-        //Python visualizer send
-        if (send(local_sockfd_playback, buffer, byte_num, 0) == -1) {
-            if (errno == EPIPE) {
-                std::cerr << "Python visualizer disconnected. Playback pipe";
+        //Visualizer record of what was played
+        record.wall_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::system_clock::now().time_since_epoch()).count();
+        record.stamp_us = header.timestamp_us;
+        record.seq = header.seq;
+        record.stream_id = header.stream_id;
+        record.frames = frames_play;
+        record.bytes = header.length;
+        telemetry::audioLevels(reinterpret_cast<const int16_t*>(audio), size_t(frames_play) * Channels, record.peak, record.rms);
+        metrics.push(METRICS_LANE_PLAYBACK, record);
+    };
+    bool ok = true;
+    auto on_bytes = [&](const uint8_t* data, size_t len) {
+        ok = parser.feed(data, len, on_frame) && ok;
+    };
+
+    while(!stop_streaming) {
+        int byte_num;
+        if (receiver) {
+            byte_num = receiver->receive(on_bytes);
+            if (byte_num < 0) {
+                errno = -byte_num;
+                byte_num = -1;
+            }
+        } else {
+            byte_num = recv(sockfd, stream, sizeof(stream), 0);
+            if (byte_num > 0) {
+                on_bytes(stream, byte_num);
+            }
+        }
+        if (byte_num <= 0) {
+            if (byte_num == 0) {
+                std::cout << "Server closed connection. \n";
             } else {
-                perror("Error sending playback to python");
+                perror("recv error");
             }
             stop_streaming = true;
             break;
         }
+        if (!ok) {
+            std::cerr << "Framing error from server.\n";
+            stop_streaming = true;
+            break;
+        }
 
     }
 
-    snd_pcm_close(playback_man); 
-    close(local_sockfd_playback);
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
     //Ignore SIGPIPE
     signal(SIGPIPE, SIG_IGN);
 
+    //Socket I/O backend: --io epoll (plain send/recv, default) or --io uring
+    //Relay room: --room <name> (default: the relay's main room)
+    //Audio backends: --audio-in / --audio-out <spec> (alsa[:device], synth, file:path, null; default alsa)
+    //Latency harness: --chirp-inject on the sending end, --chirp-listen <input spec> recording the other's output
+    //Visualizer metrics: --metrics-shm <name> (default /tcpsc_metrics, "off" for none); one name per client on a host
+    std::string room;
+    std::string chirp_input;
+    std::string metrics_name = METRICS_SHM;
+    uint64_t chirp_ms = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--room" && i + 1 < argc) {
+            room = argv[++i];
+            if (!relay::validRoomName(room)) {
+                std::cerr << "Room names are 1 to " << relay::Max_Room_Name << " printable characters without spaces.\n";
+                return 1;
+            }
+        } else if (arg == "--audio-in" && i + 1 < argc) {
+            audio_in = argv[++i];
+        } else if (arg == "--audio-out" && i + 1 < argc) {
+            audio_out = argv[++i];
+        } else if (arg == "--metrics-shm" && i + 1 < argc) {
+            metrics_name = argv[++i];
+        } else if (arg == "--chirp-inject") {
+            chirp_inject = true;
+        } else if (arg == "--chirp-listen" && i + 1 < argc) {
+            chirp_input = argv[++i];
+        } else if (arg == "--chirp-period-ms" && i + 1 < argc && cli::parseInt<uint64_t>(argv[i + 1], chirp_ms, 1, 3600 * 1000)) {
+            chirp_period_us = chirp_ms * 1000;
+            i++;
+        } else if (arg == "--io" && i + 1 < argc) {
+            std::string value = argv[++i];
+            use_uring = value == "uring";
+            if (!use_uring && value != "epoll") {
+                std::cerr << "Unknown I/O backend: " << value << "\n";
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--io epoll|uring] [--room name] [--audio-in spec] [--audio-out spec]"
+                      << " [--chirp-inject] [--chirp-listen spec] [--chirp-period-ms N] [--metrics-shm name|off]\n";
+            return 1;
+        }
+    }
+    if (use_uring && !uring::available()) {
+        std::cerr << "io_uring is not available, using send/recv.\n";
+        use_uring = false;
+    }
+
     //Retry configuration
     const int max_retries = 5;
     const int delay_second = 2;
@@ -254,73 +413,47 @@ int main() {
 
     }
 
-    //Audio capture
-    int local_sockfd_cap = -1; 
-    struct sockaddr_in local_addr_capture; 
-
-    //Socket for Python script 
-    if ((local_sockfd_cap = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("Python socket error");
-
-    } else {
-        memset(&local_addr_capture, 0, sizeof(local_addr_capture));
-        local_addr_capture.sin_family = AF_INET;
-        local_addr_capture.sin_port = htons(LOCAL_PORT_C);
-        inet_pton(AF_INET, "127.0.0.1", &local_addr_capture.sin_addr);
-
-        int retries = max_retries;
-        while (retries-- > 0) {
-            if (connect(local_sockfd_cap, (struct sockaddr *)&local_addr_capture, sizeof(local_addr_capture)) == 0) {
-                std::cout << "Python View connection successful.\n";
-                break; 
-            } else {
-                perror("Python connection error");
-                std::this_thread::sleep_for(std::chrono::seconds(delay_second));
-
-            }
-        }
-
-
-        if (retries <= 0) {
-            std::cerr << "Failed to connect to Python.\n";
-            local_sockfd_cap = -1; 
-
+    //Join the room before any audio goes out
+    if (!room.empty()) {
+        if (!framing::sendJoin(sockfd, room)) {
+            perror("Join error");
+            close(sockfd);
+            return 1;
         }
+        std::cout << "Joining room " << room << "\n";
     }
 
-     // Audio playback socket connection (to Python script for visualization)
-    int local_sockfd_playback = -1;
-    struct sockaddr_in local_addr_playback;
-
-    // Create and connect playback socket for Python visualizer
-    if ((local_sockfd_playback = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-        perror("Local socket error (playback)");
-    } else {
-        memset(&local_addr_playback, 0, sizeof(local_addr_playback));
-        local_addr_playback.sin_family = AF_INET;
-        local_addr_playback.sin_port = htons(LOCAL_PORT_P);
-        inet_pton(AF_INET, "127.0.0.1", &local_addr_playback.sin_addr);
-
-        int retries = max_retries;
-        while (retries-- > 0) {
-            if (connect(local_sockfd_playback, (struct sockaddr *)&local_addr_playback, sizeof(local_addr_playback)) == 0) {
-                std::cout << "Python playback view successful (playback).\n";
-                break;
-            } else {
-                perror("Python connection error (playback)");
-                std::this_thread::sleep_for(std::chrono::seconds(delay_second));
-            }
+    //Metrics for Measure.py; without them streaming goes on regardless
+    if (metrics_name != "off") {
+        if (metrics.create(metrics_name, 2)) {
+            std::cout << "Metrics in shared memory " << metrics_name << "\n";
+        } else {
+            std::cerr << "Streaming without metrics; pick a free segment with --metrics-shm <name>.\n";
         }
+    }
 
-        if (retries <= 0) {
-            std::cerr << "Failed to connect to Python playback view after retries.\n";
-            local_sockfd_playback = -1;  // Mark as invalid if connection not successful
-        }
+    //io_uring sender and receiver, set up here so both threads agree on the backend
+    uring::FrameSender sender;
+    uring::StreamReceiver receiver;
+    if (use_uring && !(sender.init(sockfd) && receiver.init(sockfd))) {
+        std::cerr << "io_uring setup failed, using send/recv.\n";
+        use_uring = false;
     }
 
     // Start capture and playback threads
-    std::thread capture_a(audio_cap, sockfd, local_sockfd_cap);
-    std::thread playback_a(play_audio, sockfd, local_sockfd_playback);
+    std::thread capture_a(audio_cap, sockfd, use_uring ? &sender : nullptr);
+    std::thread playback_a(play_audio, sockfd, use_uring ? &receiver : nullptr);
+
+    //Chirp listener on the recording of what we play, in relay time like the injector
+    std::thread chirp_listener;
+    if (!chirp_input.empty()) {
+        std::string label = std::string("TCP relay, io ") + (use_uring ? "uring" : "epoll") + ", "
+                            + std::to_string(BUFFSIZE) + "-frame periods" + (room.empty() ? "" : ", room " + room);
+        chirp_listener = std::thread([chirp_input, label]() {
+            auto clock = []() { return relay_clock.synced() ? relay_clock.toRemote(framing::nowUs()) : uint64_t(0); };
+            acoustic::listen(chirp_input, SRATE, Channels, chirp_period_us, clock, label, stop_streaming);
+        });
+    }
 
     // Wait for user to terminate the transmission via a keyboard command (e.g., pressing Ctrl+C)
     std::cout << "Press Ctrl+C to stop streaming..." << std::endl;
@@ -332,15 +465,13 @@ int main() {
     if (playback_a.joinable()) {
         playback_a.join();
     }
+    if (chirp_listener.joinable()) {
+        chirp_listener.join();
+    }
 
-    // Close all open sockets
+    // Close the socket and remove the metrics segment
     close(sockfd);
-    if (local_sockfd_cap != -1) {
-        close(local_sockfd_cap);
-    }
-    if (local_sockfd_playback != -1) {
-        close(local_sockfd_playback);
-    }
+    metrics.close();
 
     std::cout << "Connection closed.\n";
 
@@ -1,93 +1,166 @@
-import socket
+import mmap
+import os
+import struct
+import sys
 import time
-import numpy as np
-import errno
-import signal
-import struct  # <-- Add this import for unpacking the timestamp
 
 import matplotlib
-matplotlib.use('TkAgg') 
+matplotlib.use('TkAgg')
 from matplotlib import pyplot as plt
 
-# Define constants
-LOCAL_PORT = 65432
-BUFFER_SIZE = 4096
+# Reads the metrics TCPSC publishes in shared memory (common/metrics_ring.h) and
+# plots one-way delay, bandwidth and levels. The client never waits for this script:
+# start it before or after the client, and if it falls behind it only loses records.
+# Usage: python3 Measure.py [segment name, default /tcpsc_metrics]
+
+# Define constants (layout shared with common/metrics_ring.h)
+SEGMENT = sys.argv[1] if len(sys.argv) > 1 else "/tcpsc_metrics"
+MAGIC = b"EPMETR1\0"
+VERSION = 1
+HEADER = "<8sIIIII"         # magic, version, slot size, capacity, lanes, pid
+RECORD = "<QQqIHHIIff"      # wall_us, stamp_us, delay_us, seq, kind, stream_id, frames, bytes, peak, rms
+SLOT_SIZE = 64
+LANE_CAPTURE = 0
+LANE_PLAYBACK = 1
+POLL_INTERVAL = 0.05
 MAX_LATENCY_POINTS = 1000  # Maximum number of latency checkpoints before auto-termination
 
 # Store variables
+latency_times = []
 latency_values = []
-bandwidth_values = []
-timestamps = []
-
-# Listen on port for data
-def listen_on_port(port): 
-    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s: 
-        s.bind(("127.0.0.1", port))
-        s.listen()
-
-        print(f"Listening on port {port}")
-        conn, addr = s.accept()
-        print('Connected by', addr)
-        while True: 
-            try: 
-                # Receive timestamp and audio data
-                header = conn.recv(8)  # 8 bytes for timestamp
-                if len(header) < 8: 
-                    print("Connection closed. Plotting data.")
-                    break
-
-                # Unpack timestamp
-                timestamp = struct.unpack('q', header)[0]
-
-                # Receive audio data
-                data = conn.recv(1024)  # Receive audio
-                if not data: 
-                    print("Connection closed.")
-                    break
-
-                # Calculate latency and bandwidth
-                current_time = int(time.time() * 1000) 
-                latency = current_time - timestamp 
-                bandwidth = len(data) / 1024.0  # KBps (based on the buffer size received)
-
-                # Store latency and bandwidth values for plotting later
-                timestamps.append(current_time)
-                latency_values.append(latency)
-                bandwidth_values.append(bandwidth)
-
-                # Limit the number of points to avoid excessive memory usage
-                if len(latency_values) >= MAX_LATENCY_POINTS:
-                    print("Maximum latency points reached. Stopping collection.")
-                    break
-
-            except socket.error as e: 
-                print(f"Socket error: {e}")
-                break
-
-# Listen and collect data from capture socket
-listen_on_port(LOCAL_PORT)
-
-# Plot latency and bandwidth
-plt.figure(figsize=(12, 6))
-
-# Plot latency
-plt.subplot(2, 1, 1) 
-plt.plot(timestamps, latency_values, label='Latency (ms)', color='b')
+capture_records = []
+playback_records = []
+
+
+def open_segment(name):
+    """Map the segment once the client has created it"""
+    path = "/dev/shm/" + name.lstrip("/")
+    print(f"Waiting for {path}")
+    while True:
+        try:
+            with open(path, "rb") as f:
+                segment = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+            if len(segment) >= 64:
+                magic, version, slot_size, capacity, lanes, pid = struct.unpack_from(HEADER, segment, 0)
+                if magic == MAGIC and version == VERSION and slot_size == SLOT_SIZE:
+                    print(f"Reading metrics of client pid {pid} ({lanes} lanes of {capacity})")
+                    return segment, capacity, lanes, pid
+            segment.close()
+        except (FileNotFoundError, ValueError):
+            pass
+        time.sleep(0.5)
+
+
+def read_lane(segment, capacity, lanes, lane, cursor):
+    """Records of a lane past cursor; returns (records, new cursor, lost)"""
+    (written,) = struct.unpack_from("<Q", segment, 64 + 64 * lane)
+    lost = 0
+    if written - cursor > capacity:
+        lost = written - capacity - cursor
+        cursor = written - capacity
+    records = []
+    base = 64 + 64 * lanes + SLOT_SIZE * capacity * lane
+    while cursor < written:
+        offset = base + SLOT_SIZE * (cursor % capacity)
+        (before,) = struct.unpack_from("<Q", segment, offset)
+        record = struct.unpack_from(RECORD, segment, offset + 8)
+        (after,) = struct.unpack_from("<Q", segment, offset)
+        # Sequence changed under us: the client was rewriting the slot
+        if before == cursor + 1 and after == cursor + 1:
+            records.append(record)
+        else:
+            lost += 1
+        cursor += 1
+    return records, cursor, lost
+
+
+def client_alive(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        pass
+    return True
+
+
+def collect():
+    segment, capacity, lanes, pid = open_segment(SEGMENT)
+    cursors = [0] * lanes
+    lost = 0
+    while len(latency_values) < MAX_LATENCY_POINTS:
+        for lane in range(lanes):
+            records, cursors[lane], dropped = read_lane(segment, capacity, lanes, lane, cursors[lane])
+            lost += dropped
+            if lane == LANE_CAPTURE:
+                capture_records.extend(records)
+            elif lane == LANE_PLAYBACK:
+                playback_records.extend(records)
+                for wall_us, _, delay_us, *_ in records:
+                    if delay_us >= 0:
+                        latency_times.append(wall_us / 1000.0)
+                        latency_values.append(delay_us / 1000.0)
+        time.sleep(POLL_INTERVAL)
+
+        # Segment gone, its client dead (Ctrl+C leaves it behind) or a new pid in it
+        if not os.path.exists("/dev/shm/" + SEGMENT.lstrip("/")) or not client_alive(pid):
+            print("Client stopped. Plotting data.")
+            break
+        if struct.unpack_from(HEADER, segment, 0)[5] != pid:
+            print("Client restarted. Plotting data.")
+            break
+    else:
+        print("Maximum latency points reached. Stopping collection.")
+    if lost:
+        print(f"Fell behind the client: {lost} records lost")
+
+
+def per_second(records):
+    """Bytes per second of records, as (time ms, KBps)"""
+    buckets = {}
+    for wall_us, _, _, _, _, _, _, size, _, _ in records:
+        second = wall_us // 1000000
+        buckets[second] = buckets.get(second, 0) + size
+    seconds = sorted(buckets)
+    return [s * 1000 for s in seconds], [buckets[s] / 1024.0 for s in seconds]
+
+
+try:
+    collect()
+except KeyboardInterrupt:
+    print("\nStopped. Plotting data.")
+
+# Plot latency, bandwidth and levels
+plt.figure(figsize=(12, 9))
+
+# Plot latency (capture on the sender to playback here, via the relay)
+plt.subplot(3, 1, 1)
+plt.plot(latency_times, latency_values, label='One-way delay (ms)', color='b')
 plt.xlabel('Time (ms)')
 plt.ylabel('Latency (ms)')
 plt.title('Latency Over Time')
 plt.legend()
 
 # Plot bandwidth
-plt.subplot(2, 1, 2)
-plt.plot(timestamps, bandwidth_values, label='Bandwidth (KBps)', color='r')
+plt.subplot(3, 1, 2)
+times, sent = per_second(capture_records)
+plt.plot(times, sent, label='Sent (KBps)', color='r')
+times, received = per_second(playback_records)
+plt.plot(times, received, label='Received (KBps)', color='g')
 plt.xlabel('Time (ms)')
 plt.ylabel('Bandwidth (KBps)')
 plt.title('Bandwidth Over Time')
 plt.legend()
 
+# Plot levels
+plt.subplot(3, 1, 3)
+plt.plot([r[0] / 1000.0 for r in capture_records], [r[9] for r in capture_records], label='Captured RMS', color='r')
+plt.plot([r[0] / 1000.0 for r in playback_records], [r[9] for r in playback_records], label='Played RMS', color='g')
+plt.xlabel('Time (ms)')
+plt.ylabel('Level (full scale)')
+plt.title('Audio Level Over Time')
+plt.legend()
+
 plt.tight_layout()
 plt.savefig('latency_bandwidth_plot.png')
 print("Latency and bandwidth plots saved as 'latency_bandwidth_plot.png'")
-
-
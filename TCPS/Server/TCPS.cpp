@@ -3,10 +3,9 @@
 // Standard Libraries         
 #include <stdlib.h>        // Standard functions (exit)       
 #include <vector>          // Dynamic array
-#include <mutex>           // Thread safe operations
+#include <atomic>          // Stop flag for the event loop
 #include <cstring>         // String managing (memset, strcpy)
 #include <iostream> 
-#include <thread> 
 #include <algorithm>
 
 // POSIX Libraries (System calls, signal handling, process management)
@@ -22,8 +21,9 @@
 #include <netinet/in.h>    // Internet address family constants and structures (e.g., sockaddr_in, IP protocols)
 #include <netdb.h>         // Network database operations (e.g., gethostbyname, getaddrinfo)
 
-//Audio Library 
-#include <alsa/asoundlib.h>  //Audio capture and playback 
+//Relay engine
+#include "../../common/relay_engine.h"  //Epoll event loop that forwards between clients
+#include "../../common/sfu_engine.h"    //UDP selective forwarding for Online_AV (--sfu)
 
 
 //Define Constants
@@ -33,52 +33,6 @@
 #define BACKLOG 5       //User connection queue 
 
 
-//Define Global Variables
-std::vector <int> clients; // Vector to store all connected client sockets
-std::mutex client_m;       // Mutex to protect access to the clients vector
-
-
-//Function to hanlde clients in different threads
-void handle_c(int client_socket) {
-    char buffer[BUFFSIZE];
-    int byte_num;
-
-
-    while ((byte_num = recv(client_socket, buffer, sizeof(buffer), 0)) > 0) {
-        
-        //Broadcast message to all clients
-        std::lock_guard<std::mutex> lock(client_m);       //Lock clients while broadcasting
-        for (int others_addr : clients) {
-            if (others_addr != client_socket) {
-                if (send(others_addr, buffer, byte_num, 0) == -1) {
-                    perror("send error");
-                }
-            }
-        }
-    
-    }
-
-    //Client disconnection 
-    if (byte_num == 0) {
-        std::cout << "Client disconnected.\n";
-    } else if (byte_num == -1) {
-        perror("recv error");
-
-    }
-
-
-    //Remove client from list 
-    {
-        std::lock_guard<std::mutex> lock(client_m); 
-        clients.erase(std::remove(clients.begin(), clients.end(), client_socket), clients.end());
-
-    }
-
-    close(client_socket);
-
-
-}
-
 //Get rid of zombie processes
 void sigchld_handler(int s) {
 
@@ -90,34 +44,25 @@ void sigchld_handler(int s) {
     }
 }
 
-//Utility to get socket address
-void *get_addr(struct sockaddr *sa) {
-    if (sa->sa_family == AF_INET) {
-        return &(((struct sockaddr_in*)sa)->sin_addr);
-    }
-    return &(((struct sockaddr_in6*)sa)->sin6_addr);
-    
-}
-
-
-
+int main(int argc, char* argv[]) {
 
-int main() {
-
-    int sockfd, new_fd;
+    int sockfd;
     struct addrinfo hints, *servinfo, *p;
-    struct sockaddr_storage client_addr;   //connector`s address
-    socklen_t sin_size;
     struct sigaction sa;
     int yes=1;
-    char s[INET6_ADDRSTRLEN];
     int rv;
+    relay::RelayOptions relay_opts;   //Outbound queue bound and slow-client policy
+
 
+    //Read relay options
+    if (!relay::parseOptions(argc, argv, relay_opts)) {
+        return 1;
+    }
 
     // Clear `hints` structure before using it
     memset (&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC; 
-    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_socktype = relay_opts.sfu ? SOCK_DGRAM : SOCK_STREAM; //SFU mode takes Online_AV datagrams
     hints.ai_flags = AI_PASSIVE; //use my IP 
 
 
@@ -145,6 +90,12 @@ int main() {
             exit(1);
         }
 
+        //Let the relay workers share the port
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1) {
+            perror("setsocketopt");
+            exit(1);
+        }
+
 
         //Bind socket to address
         if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
@@ -168,6 +119,14 @@ int main() {
     freeaddrinfo(servinfo); //free addresses list 
 
 
+    //SFU mode: forward Online_AV datagrams between the room members
+    if (relay_opts.sfu) {
+        std::atomic<bool> stop_sfu(false);
+        sfu::serve(sockfd, relay_opts, stop_sfu);
+        close(sockfd);
+        return 0;
+    }
+
     //Listen for clients
     if (listen(sockfd, BACKLOG) == -1) {
         perror("listen error");
@@ -186,28 +145,10 @@ int main() {
         exit(1);
     }
 
-    // Main loop: Accept and handle incoming connections
-    while (true) {
-        sin_size = sizeof client_addr;
-        int new_fd = accept(sockfd, (struct sockaddr *)&client_addr, &sin_size);
-        if (new_fd == -1) {
-            perror("accept");
-            continue; // Skip to the next iteration if `accept()` fails
-        }
-
-        // Convert the client address to a human-readable format
-        inet_ntop(client_addr.ss_family, get_addr((struct sockaddr *)&client_addr), s, sizeof s);
-        std::cout << "Server: got connection from " << s << "\n";
-
-        // Add new client to the list
-        {
-            std::lock_guard<std::mutex> lock(client_m);
-            clients.push_back(new_fd);
-        }
-
-        // Create a new thread to handle the client
-        std::thread client_thread(handle_c, new_fd);
-        client_thread.detach();  // Detach the thread to let it run independently
+    // Main loop: event loops accept and relay for every client
+    std::atomic<bool> stop_server(false);
+    if (!relay::serve(sockfd, relay_opts, stop_server, BACKLOG)) {
+        exit(1);
     }
 
     // Close the listening socket (though we won't reach here)
@@ -7,6 +7,8 @@
 #include <thread>    //Multi-thread
 #include <mutex>     //Thread safety variables
 #include <atomic>
+#include <memory>    //Audio backends
+#include <string>
 
 #include <signal.h> 
 
@@ -22,8 +24,11 @@
 #include <netinet/in.h> //address 
 #include <arpa/inet.h>  //IP address convertion
 
-//Audio Libraries 
-#include <alsa/asoundlib.h>
+//Audio capture and playback (--audio-in / --audio-out)
+#include "../../common/audio_io.h"
+
+//Framed audio protocol
+#include "../../common/frame_protocol.h"
 
 
 //Define global constants 
@@ -37,6 +42,8 @@
 
 
 std::atomic<bool> stop_streaming(false);
+std::string audio_in = "alsa";    //Capture and playback backends
+std::string audio_out = "alsa";
 
 //Connect to server function 
 int connect_server(const char* server_ip, const char* port) {
@@ -95,50 +102,42 @@ int connect_server(const char* server_ip, const char* port) {
 
 //Function to capture audio 
 void audio_cap(int sockfd, int local_sockfd_capture) {
-    snd_pcm_t *capture_man;
-    snd_pcm_hw_params_t *hw_params;
-    int err; 
-    char buffer[BUFFSIZE * 2 * Channels];
+    alignas(int16_t) char buffer[BUFFSIZE * 2 * Channels];
+    framing::FrameHeader header;       //Frame header for the server stream
+    header.stream_id = uint16_t(getpid());
 
 
-    //Open ALSA recording 
-    if ((err = snd_pcm_open(&capture_man, "default", SND_PCM_STREAM_CAPTURE, 0)) < 0) {
-        std::cerr << "capture device error" << snd_strerror(err) << "\n";
+    //Open audio recording
+    std::unique_ptr<audio::Source> capture = audio::openSource(audio_in, {SRATE, Channels});
+    if (!capture) {
         return;
-
     }
 
-    //ALSA audio parameter
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(capture_man, hw_params);
-    snd_pcm_hw_params_set_access(capture_man, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(capture_man, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(capture_man, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(capture_man, hw_params, Channels);
-    snd_pcm_hw_params(capture_man, hw_params); 
-
 
 
 
 
     //Start audio capture
     while(!stop_streaming) {
-        int fr_capture = snd_pcm_readi(capture_man, buffer, BUFFSIZE);
+        int fr_capture = capture->read(reinterpret_cast<int16_t*>(buffer), BUFFSIZE);
         if (fr_capture < 0) {
-            fr_capture = snd_pcm_recover(capture_man, fr_capture, 0);
+            fr_capture = capture->recover(fr_capture);
             if (fr_capture < 0) {
-                std::cerr << "Audio capture error" << snd_strerror(fr_capture) << "\n";
+                std::cerr << "Audio capture error" << audio::errorText(fr_capture) << "\n";
                 break;
             }
         }
 
-        //Send audio on socket 
+        //Send audio on socket as one frame
         int byte_send = fr_capture * 2 * Channels; //Calculate bytes sent
-        if (send(sockfd, buffer, byte_send, 0) == -1) {
+        header.length = byte_send;
+        header.timestamp_us = framing::nowUs();
+        if (!framing::sendFrame(sockfd, header, buffer)) {
             perror("error sending");
             stop_streaming = true;
             break;
         }
+        header.seq++;
 
         //Send audio to Python (visualization) + Check broken pipe
         if (send(local_sockfd_capture, buffer, byte_send, 0) == -1) {
@@ -153,7 +152,6 @@ void audio_cap(int sockfd, int local_sockfd_capture) {
         }
     }    
 
-    snd_pcm_close(capture_man);
     close(local_sockfd_capture);
 
 }
@@ -162,33 +160,23 @@ void audio_cap(int sockfd, int local_sockfd_capture) {
 
 //Audio playback function 
 void play_audio(int sockfd, int local_sockfd_playback) {
-    snd_pcm_t *playback_man;
-    snd_pcm_hw_params_t *hw_params;
     int err; 
     char buffer[BUFFSIZE * 2 * Channels];
 
 
     //Open playback device
-    if((err = snd_pcm_open(&playback_man, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-        std::cerr << "playback device error" << snd_strerror(err) << "\n";
-        return; 
-
+    std::unique_ptr<audio::Sink> playback = audio::openSink(audio_out, {SRATE, Channels});
+    if (!playback) {
+        return;
     }
 
-    //ALSA audio parameters
-    snd_pcm_hw_params_alloca(&hw_params);
-    snd_pcm_hw_params_any(playback_man, hw_params);
-    snd_pcm_hw_params_set_access(playback_man, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-    snd_pcm_hw_params_set_format(playback_man, hw_params, SND_PCM_FORMAT_S16_LE);
-    snd_pcm_hw_params_set_rate(playback_man, hw_params, SRATE, 0);
-    snd_pcm_hw_params_set_channels(playback_man, hw_params, Channels);
-    snd_pcm_hw_params(playback_man, hw_params); 
-
 
 
-    //play audio 
+    //play audio: recv returns arbitrary byte ranges, the parser hands out whole frames
+    framing::FrameParser parser;
+    unsigned char stream[sizeof(buffer) + framing::Header_Size];
     while(!stop_streaming) {
-        int byte_num = recv(sockfd, buffer, sizeof(buffer), 0);
+        int byte_num = recv(sockfd, stream, sizeof(stream), 0);
         if (byte_num <= 0) {
             if (byte_num == 0) {
                 std::cout << "Server closed connection. \n";
@@ -199,45 +187,67 @@ void play_audio(int sockfd, int local_sockfd_playback) {
             break;
         }
 
-        int frames_play = byte_num / (Channels * 2);
-        if ((err = snd_pcm_writei(playback_man, buffer, frames_play)) < 0) {
-            if (err == -EPIPE) {
-                std::cerr << "Buffer underrun occurred: " << snd_strerror(err) << "\n";
-                if ((err = snd_pcm_prepare(playback_man)) < 0) {
-                    std::cerr << "Error recovering from underrum" << snd_strerror(err) << "\n";
+        bool ok = parser.feed(stream, byte_num, [&](const framing::FrameHeader& header, const uint8_t* frame, size_t) {
+            if (stop_streaming || header.type != framing::Frame_Audio) {
+                return;
+            }
+            const uint8_t* audio = frame + framing::Header_Size;
+
+            int frames_play = header.length / (Channels * 2);
+            if ((err = playback->write(reinterpret_cast<const int16_t*>(audio), frames_play)) < 0) {
+                if (err == -EPIPE) {
+                    std::cerr << "Buffer underrun occurred: " << audio::errorText(err) << "\n";
+                    if ((err = playback->recover(err)) < 0) {
+                        std::cerr << "Error recovering from underrum" << audio::errorText(err) << "\n";
+                        stop_streaming = true;
+                        return;
+                    }
+                } else {
+                    std::cerr << "write to audio interface failed: " << audio::errorText(err) << "\n";
                     stop_streaming = true;
-                    break;
-                
+                    return;
                 }
-            } else {
-                std::cerr << "write to audio interface failed: " << snd_strerror(err) << "\n";
-                stop_streaming = true;
-                break;
             }
-        }
 
-        //Python visualizer send
-        if (send(local_sockfd_playback, buffer, byte_num, 0) == -1) {
-            if (errno == EPIPE) {
-                std::cerr << "Python visualizer disconnected. Playback pipe";
-            } else {
-                perror("Error sending playback to python");
+            //Python visualizer send
+            if (send(local_sockfd_playback, audio, header.length, 0) == -1) {
+                if (errno == EPIPE) {
+                    std::cerr << "Python visualizer disconnected. Playback pipe";
+                } else {
+                    perror("Error sending playback to python");
+                }
+                stop_streaming = true;
             }
+        });
+        if (!ok) {
+            std::cerr << "Framing error from server.\n";
             stop_streaming = true;
             break;
         }
 
     }
 
-    snd_pcm_close(playback_man); 
     close(local_sockfd_playback);
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
     //Ignore SIGPIPE
     signal(SIGPIPE, SIG_IGN);
 
+    //Audio backends: --audio-in / --audio-out <spec> (alsa[:device], synth, file:path, null; default alsa)
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--audio-in" && i + 1 < argc) {
+            audio_in = argv[++i];
+        } else if (arg == "--audio-out" && i + 1 < argc) {
+            audio_out = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--audio-in spec] [--audio-out spec]\n";
+            return 1;
+        }
+    }
+
     //Connect to server
     int sockfd = connect_server(SERVER_IP, PORT);
     if (sockfd == -1) {
@@ -1,13 +1,24 @@
 #include <iostream>
+#include <cstring>
 #include <thread>
+#include <csignal>
+#include <cstdlib>
 #include <pulse/simple.h>
 #include <pulse/error.h>
 #include <asio.hpp>
 
+#include "../common/netsim.h"   // Datagram capture (--capture) and replay (--replay)
+#include "../common/cli_args.h" // Option values
+
 #define SAMPLE_RATE 44100
 #define CHANNELS 2
 #define SAMPLE_SIZE 1024
 
+// One shim per socket; both log to the same capture
+netsim::UdpShim net_out;
+netsim::UdpShim net_in;
+pcap::Writer capture_log;
+
 void audio_sender(asio::ip::udp::socket& socket, asio::ip::udp::endpoint& receiver_endpoint, pa_simple* pa) {
     uint8_t buffer[SAMPLE_SIZE * CHANNELS * 2]; // 16-bit samples (2 bytes per sample)
     int error;
@@ -27,7 +38,11 @@ void audio_sender(asio::ip::udp::socket& socket, asio::ip::udp::endpoint& receiv
             std::string packet_data = timestamp_str + "|" + std::string(reinterpret_cast<char*>(buffer), sizeof(buffer));
 
             // Send the captured audio data via UDP
-            socket.send_to(asio::buffer(packet_data), receiver_endpoint);
+            if (net_out.sendto(socket.native_handle(), packet_data.data(), packet_data.size(), 0,
+                               receiver_endpoint.data(), receiver_endpoint.size()) < 0) {
+                std::cerr << "Send error: " << strerror(errno) << "\n";
+                break;
+            }
         }
     } catch (std::exception& e) {
         std::cerr << "Sender exception: " << e.what() << "\n";
@@ -39,10 +54,21 @@ void audio_receiver(asio::ip::udp::socket& socket, pa_simple* pa) {
     uint8_t buffer[SAMPLE_SIZE * CHANNELS * 2]; // 16-bit samples (2 bytes per sample)
     int error;
     try {
-        asio::ip::udp::endpoint sender_endpoint;
+        sockaddr_in sender_addr;
         while (true) {
-            // Receive audio data via UDP
-            size_t length = socket.receive_from(asio::buffer(buffer), sender_endpoint);
+            // Receive audio data via UDP (or from the capture being replayed)
+            socklen_t addr_len = sizeof(sender_addr);
+            ssize_t received = net_in.recvfrom(socket.native_handle(), buffer, sizeof(buffer), 0,
+                                               reinterpret_cast<sockaddr*>(&sender_addr), &addr_len);
+            if (received < 0) {
+                std::cerr << "Receive error: " << strerror(errno) << "\n";
+                break;
+            }
+            if (received == 0 && net_in.replayEnded()) {
+                std::cout << "Replay finished.\n";
+                break;
+            }
+            size_t length = size_t(received);
 
             // Playback the received audio data
             if (pa_simple_write(pa, buffer, length, &error) < 0) {
@@ -62,14 +88,31 @@ int main(int argc, char* argv[]) {
         std::cout << "argv[" << i << "]: " << argv[i] << "\n";
     }
 
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <local port> <receiver IP> <receiver port>\n";
+    // Sessions: --capture <file.pcapng> logs every datagram; --replay <file> plays back what it
+    // received instead of the network, at --replay-speed x (1: as recorded, 0: as fast as possible)
+    std::string capture_path, replay_path;
+    double replay_speed = 1;
+    uint16_t local_port = 0, receiver_port = 0;
+    bool usage = argc < 4 || !cli::parsePort(argv[1], local_port) || !cli::parsePort(argv[3], receiver_port);
+    for (int i = 4; i < argc && !usage; i++) {
+        std::string arg = argv[i];
+        if (arg == "--capture" && i + 1 < argc) {
+            capture_path = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (arg == "--replay-speed" && i + 1 < argc && cli::parseDouble(argv[i + 1], replay_speed, 0, 1000)) {
+            i++;
+        } else {
+            usage = true;
+        }
+    }
+    if (usage) {
+        std::cerr << "Usage: " << argv[0] << " <local port> <receiver IP> <receiver port>"
+                  << " [--capture file] [--replay file [--replay-speed x]]\n";
         return 1;
     }
 
-    uint16_t local_port = std::stoi(argv[1]);
     const char* receiver_ip = argv[2];
-    uint16_t receiver_port = std::stoi(argv[3]);
 
     asio::io_context io_context;
 
@@ -80,6 +123,21 @@ int main(int argc, char* argv[]) {
 
     asio::ip::udp::socket receive_socket(io_context, asio::ip::udp::endpoint(asio::ip::udp::v4(), local_port));
 
+    net_out.attach(send_socket.native_handle(), {}, {});
+    net_in.attach(receive_socket.native_handle(), {}, {});
+    if (!capture_path.empty()) {
+        if (!capture_log.start(capture_path)) {
+            return 1;
+        }
+        net_out.record(&capture_log);
+        net_in.record(&capture_log);
+    }
+    if (!replay_path.empty()) {
+        if (!net_in.replay(replay_path, replay_speed)) {
+            return 1;
+        }
+    }
+
     // Set up PulseAudio for recording
     pa_simple *pa_record = nullptr;
     pa_sample_spec ss;
@@ -101,17 +159,38 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    // Start sender and receiver threads
-    std::thread sender_thread(audio_sender, std::ref(send_socket), std::ref(receiver_endpoint), pa_record);
+    // Start sender and receiver threads; a replay only plays back
+    std::thread sender_thread;
+    if (replay_path.empty()) {
+        sender_thread = std::thread(audio_sender, std::ref(send_socket), std::ref(receiver_endpoint), pa_record);
+    }
     std::thread receiver_thread(audio_receiver, std::ref(receive_socket), pa_play);
 
+    //Ctrl-C is the usual way out: finish the capture file and the summary, then exit
+    //without waiting on the audio threads, which sit in blocking reads
+    asio::signal_set signals(io_context, SIGINT, SIGTERM);
+    signals.async_wait([&](const asio::error_code& error, int) {
+        if (error) return;
+        std::cout << net_in.summary();
+        capture_log.stop();
+        std::cout.flush();
+        std::_Exit(0);
+    });
+    std::thread signal_thread([&io_context]() { io_context.run(); });
+
     // Wait for threads to finish
-    sender_thread.join();
+    if (sender_thread.joinable()) {
+        sender_thread.join();
+    }
     receiver_thread.join();
+    signals.cancel();
+    signal_thread.join();
 
     if (pa_record) pa_simple_free(pa_record);
     if (pa_play) pa_simple_free(pa_play);
 
+    std::cout << net_in.summary();
+    capture_log.stop();
     return 0;
 }
 
@@ -0,0 +1,440 @@
+#ifndef AUDIO_IO_H
+#define AUDIO_IO_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+#include "cli_args.h"
+
+#if !defined(AUDIO_NO_ALSA) && __has_include(<alsa/asoundlib.h>)
+#define AUDIO_HAVE_ALSA 1
+#include <alsa/asoundlib.h>
+#endif
+
+// Pluggable audio capture and playback.
+// The clients used to open the ALSA "default" device themselves, so none of
+// them ran without a sound card. They now get a Source and a Sink from a spec
+// string (--audio-in / --audio-out):
+//
+//   alsa[:device]          ALSA, "default" unless named (capture and playback)
+//   synth[:sine[:hz]]      generated sine (440 Hz), also synth:noise, synth:silence
+//   file:path              capture: loops a .wav or raw S16 file; playback: writes one
+//   null                   playback: discards
+//
+// The synthetic and file backends run on CLOCK_MONOTONIC at the configured
+// rate like a sound card would: a source hands out a period only once its
+// last frame is due, a sink drains at the rate, blocks while its buffer is
+// full and reports an underrun (-EPIPE) when it runs dry. Absolute sleeps
+// keep the rate exact however late a read returns.
+//
+// The calls follow ALSA's conventions so call sites read the same: read and
+// write return frames or a negative errno, recover() after an error, delay()
+// gives the frames between the stream and the application (captured but not
+// read, or written but not played). Build with -DAUDIO_NO_ALSA, or without
+// the ALSA headers, for machines that have no libasound.
+
+namespace audio {
+
+constexpr unsigned Default_Sink_Buffer_us = 100000;     // Clocked sinks without a latency
+constexpr double Synth_Level = 0.25;                    // Of full scale
+
+struct Format {
+    int rate = 44100;
+    int channels = 2;
+    unsigned latency_us = 0;    // Device buffer; 0 leaves ALSA's defaults
+};
+
+inline const char* errorText(int err) {
+#ifdef AUDIO_HAVE_ALSA
+    return snd_strerror(err);
+#else
+    return strerror(-err);
+#endif
+}
+
+class Source {
+public:
+    virtual ~Source() = default;
+    // Interleaved S16 frames read, or a negative errno
+    virtual long read(int16_t* samples, size_t frames) = 0;
+    // 0 once the stream can be read again
+    virtual int recover(int err) { return err; }
+    // Frames captured but not read yet
+    virtual long delay() { return 0; }
+};
+
+class Sink {
+public:
+    virtual ~Sink() = default;
+    // Frames accepted, or a negative errno (-EPIPE: underrun, nothing written)
+    virtual long write(const int16_t* samples, size_t frames) = 0;
+    virtual int recover(int err) { return err; }
+    // Frames written but not played yet
+    virtual long delay() { return 0; }
+};
+
+// Frame clock: frame n of a stream is due at start + n / rate
+class FrameClock {
+public:
+    explicit FrameClock(int rate) : rate_(rate) {}
+
+    void start() { start_ns_ = nowNs(); }
+    bool started() const { return start_ns_ != 0; }
+    void stop() { start_ns_ = 0; }
+
+    // Frames due by now
+    int64_t elapsed() const {
+        return started() ? (nowNs() - start_ns_) * rate_ / 1000000000 : 0;
+    }
+
+    // Sleeps until frame n is due
+    void waitFor(int64_t frame) const {
+        int64_t due = start_ns_ + frame * 1000000000 / rate_;
+        timespec until = {time_t(due / 1000000000), long(due % 1000000000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) == EINTR) {}
+    }
+
+    static int64_t nowNs() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+    }
+
+private:
+    int rate_;
+    int64_t start_ns_ = 0;
+};
+
+#ifdef AUDIO_HAVE_ALSA
+
+// Opens and sets up one direction of an ALSA device; nullptr after printing why not
+inline snd_pcm_t* openAlsa(const std::string& device, snd_pcm_stream_t stream, const Format& format) {
+    snd_pcm_t* pcm;
+    int err;
+    if ((err = snd_pcm_open(&pcm, device.c_str(), stream, 0)) < 0) {
+        std::cerr << (stream == SND_PCM_STREAM_CAPTURE ? "capture" : "playback") << " device error ("
+                  << device << "): " << snd_strerror(err) << "\n";
+        return nullptr;
+    }
+    if (format.latency_us) {
+        err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, format.channels,
+                                 format.rate, 1, format.latency_us);
+    } else {
+        snd_pcm_hw_params_t* hw_params;
+        snd_pcm_hw_params_alloca(&hw_params);
+        snd_pcm_hw_params_any(pcm, hw_params);
+        snd_pcm_hw_params_set_access(pcm, hw_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+        snd_pcm_hw_params_set_format(pcm, hw_params, SND_PCM_FORMAT_S16_LE);
+        snd_pcm_hw_params_set_rate(pcm, hw_params, format.rate, 0);
+        snd_pcm_hw_params_set_channels(pcm, hw_params, format.channels);
+        err = snd_pcm_hw_params(pcm, hw_params);
+    }
+    if (err < 0) {
+        std::cerr << "audio parameters (" << device << "): " << snd_strerror(err) << "\n";
+        snd_pcm_close(pcm);
+        return nullptr;
+    }
+    return pcm;
+}
+
+class AlsaSource : public Source {
+public:
+    explicit AlsaSource(snd_pcm_t* pcm) : pcm_(pcm) {}
+    ~AlsaSource() override { snd_pcm_close(pcm_); }
+
+    long read(int16_t* samples, size_t frames) override { return snd_pcm_readi(pcm_, samples, frames); }
+    int recover(int err) override { return snd_pcm_recover(pcm_, err, 0); }
+    long delay() override {
+        snd_pcm_sframes_t frames = 0;
+        return snd_pcm_delay(pcm_, &frames) < 0 ? 0 : long(frames);
+    }
+
+private:
+    snd_pcm_t* pcm_;
+};
+
+class AlsaSink : public Sink {
+public:
+    explicit AlsaSink(snd_pcm_t* pcm) : pcm_(pcm) {}
+    ~AlsaSink() override { snd_pcm_close(pcm_); }
+
+    long write(const int16_t* samples, size_t frames) override { return snd_pcm_writei(pcm_, samples, frames); }
+    int recover(int err) override { return snd_pcm_recover(pcm_, err, 0); }
+    long delay() override {
+        snd_pcm_sframes_t frames = 0;
+        return snd_pcm_delay(pcm_, &frames) < 0 ? 0 : long(frames);
+    }
+
+private:
+    snd_pcm_t* pcm_;
+};
+
+#endif
+
+// Capture from a generator or a looped file, paced by the frame clock
+class ClockedSource : public Source {
+public:
+    enum class Signal { Sine, Noise, Silence, File };
+
+    ClockedSource(const Format& format, Signal signal, double hz = 440.0)
+        : format_(format), signal_(signal), hz_(hz), clock_(format.rate) {}
+
+    // Interleaved S16 at the source's format, played in a loop
+    void setFile(std::vector<int16_t> samples) { file_ = std::move(samples); }
+
+    long read(int16_t* samples, size_t frames) override {
+        if (!clock_.started()) clock_.start();
+        read_ += int64_t(frames);
+        clock_.waitFor(read_);
+
+        size_t channels = size_t(format_.channels);
+        for (size_t i = 0; i < frames; i++) {
+            int16_t value = 0;
+            if (signal_ == Signal::Sine) {
+                value = int16_t(std::lround(Synth_Level * 32767.0 * std::sin(phase_)));
+                phase_ += 2.0 * M_PI * hz_ / format_.rate;
+                if (phase_ > 2.0 * M_PI) phase_ -= 2.0 * M_PI;
+            } else if (signal_ == Signal::Noise) {
+                noise_ ^= noise_ << 13;
+                noise_ ^= noise_ >> 17;
+                noise_ ^= noise_ << 5;
+                value = int16_t(Synth_Level * double(int32_t(noise_ >> 16) - 32768));
+            }
+            for (size_t c = 0; c < channels; c++) {
+                if (signal_ == Signal::File) {
+                    samples[i * channels + c] = file_[file_pos_++];
+                    if (file_pos_ == file_.size()) file_pos_ = 0;
+                } else {
+                    samples[i * channels + c] = value;
+                }
+            }
+        }
+        return long(frames);
+    }
+
+    // A late reader finds frames already waiting, as on a sound card
+    long delay() override { return long(std::max<int64_t>(0, clock_.elapsed() - read_)); }
+
+private:
+    Format format_;
+    Signal signal_;
+    double hz_;
+    double phase_ = 0;
+    uint32_t noise_ = 2463534242u;
+    std::vector<int16_t> file_;
+    size_t file_pos_ = 0;
+    FrameClock clock_;
+    int64_t read_ = 0;
+};
+
+// Playback that drains at the rate into nothing or a file
+class ClockedSink : public Sink {
+public:
+    ClockedSink(const Format& format, FILE* out = nullptr, bool wav = false)
+        : format_(format), out_(out), wav_(wav), clock_(format.rate) {
+        unsigned buffer_us = format.latency_us ? format.latency_us : Default_Sink_Buffer_us;
+        buffer_frames_ = int64_t(buffer_us) * format.rate / 1000000;
+        if (out_ && wav_) writeWavHeader();
+    }
+
+    ~ClockedSink() override {
+        if (!out_) return;
+        if (wav_) writeWavHeader();     //Now with the sizes
+        fclose(out_);
+    }
+
+    long write(const int16_t* samples, size_t frames) override {
+        if (clock_.started() && written_ < clock_.elapsed()) {
+            clock_.stop();
+            written_ = 0;
+            underruns_++;
+            return -EPIPE;
+        }
+        //Full buffer: wait for the device to play enough
+        if (clock_.started() && written_ + int64_t(frames) > buffer_frames_) {
+            clock_.waitFor(written_ + int64_t(frames) - buffer_frames_);
+        }
+        written_ += int64_t(frames);
+        //Playback starts at half a buffer (ALSA's start threshold), so one late period does not underrun
+        if (!clock_.started() && written_ >= buffer_frames_ / 2) {
+            clock_.start();
+        }
+        if (out_) {
+            size_t count = frames * size_t(format_.channels);
+            if (fwrite(samples, sizeof(int16_t), count, out_) != count) return -errno;
+            data_bytes_ += uint32_t(count * sizeof(int16_t));
+            //Sizes kept current about once a second, so a killed client still leaves a valid file
+            if (wav_ && written_ / format_.rate != (written_ - int64_t(frames)) / format_.rate) {
+                writeWavHeader();
+                fflush(out_);
+            }
+        }
+        return long(frames);
+    }
+
+    int recover(int err) override { return err == -EPIPE ? 0 : err; }
+    long delay() override { return long(std::max<int64_t>(0, written_ - clock_.elapsed())); }
+    uint64_t underruns() const { return underruns_; }
+
+private:
+    void writeWavHeader() {
+        auto u32 = [this](uint32_t v) { fwrite(&v, 4, 1, out_); };
+        auto u16 = [this](uint16_t v) { fwrite(&v, 2, 1, out_); };
+        uint16_t block = uint16_t(format_.channels * 2);
+        fseek(out_, 0, SEEK_SET);
+        fwrite("RIFF", 1, 4, out_);
+        u32(36 + data_bytes_);
+        fwrite("WAVEfmt ", 1, 8, out_);
+        u32(16);
+        u16(1);     //PCM
+        u16(uint16_t(format_.channels));
+        u32(uint32_t(format_.rate));
+        u32(uint32_t(format_.rate) * block);
+        u16(block);
+        u16(16);
+        fwrite("data", 1, 4, out_);
+        u32(data_bytes_);
+        fseek(out_, 0, SEEK_END);
+    }
+
+    Format format_;
+    FILE* out_;
+    bool wav_;
+    FrameClock clock_;
+    int64_t buffer_frames_ = 0;
+    int64_t written_ = 0;
+    uint32_t data_bytes_ = 0;
+    uint64_t underruns_ = 0;
+};
+
+inline bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Whole file as interleaved S16: the data chunk of a 16-bit PCM .wav matching
+// the format, or anything else taken as raw samples
+inline bool loadSamples(const std::string& path, const Format& format, std::vector<int16_t>& samples) {
+    FILE* in = fopen(path.c_str(), "rb");
+    if (!in) {
+        std::cerr << "audio file " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    std::vector<uint8_t> bytes;
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0) bytes.insert(bytes.end(), chunk, chunk + n);
+    fclose(in);
+
+    size_t data = 0, length = bytes.size();
+    if (length >= 12 && memcmp(bytes.data(), "RIFF", 4) == 0 && memcmp(bytes.data() + 8, "WAVE", 4) == 0) {
+        auto u16 = [&](size_t at) { return uint16_t(bytes[at] | bytes[at + 1] << 8); };
+        auto u32 = [&](size_t at) { return uint32_t(u16(at) | uint32_t(u16(at + 2)) << 16); };
+        length = 0;
+        for (size_t at = 12; at + 8 <= bytes.size(); at += 8 + u32(at + 4) + (u32(at + 4) & 1)) {
+            size_t size = u32(at + 4);
+            if (memcmp(&bytes[at], "fmt ", 4) == 0 && size >= 16) {
+                if (u16(at + 8) != 1 || u16(at + 10) != format.channels || u32(at + 12) != uint32_t(format.rate) ||
+                    u16(at + 22) != 16) {
+                    std::cerr << "audio file " << path << ": need 16-bit PCM, " << format.channels << " channels at "
+                              << format.rate << " Hz\n";
+                    return false;
+                }
+            } else if (memcmp(&bytes[at], "data", 4) == 0) {
+                data = at + 8;
+                length = std::min(size, bytes.size() - data);
+                break;
+            }
+        }
+    }
+    size_t frame_bytes = size_t(format.channels) * sizeof(int16_t);
+    length -= length % frame_bytes;
+    if (length == 0) {
+        std::cerr << "audio file " << path << ": no samples\n";
+        return false;
+    }
+    samples.resize(length / sizeof(int16_t));
+    memcpy(samples.data(), bytes.data() + data, length);
+    return true;
+}
+
+// Capture backend for a spec; nullptr after printing why not
+inline std::unique_ptr<Source> openSource(const std::string& spec, const Format& format) {
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string rest = spec.size() > kind.size() ? spec.substr(kind.size() + 1) : "";
+    if (kind == "alsa") {
+#ifdef AUDIO_HAVE_ALSA
+        snd_pcm_t* pcm = openAlsa(rest.empty() ? "default" : rest, SND_PCM_STREAM_CAPTURE, format);
+        return pcm ? std::unique_ptr<Source>(new AlsaSource(pcm)) : nullptr;
+#else
+        std::cerr << "Built without ALSA; use synth or file capture.\n";
+        return nullptr;
+#endif
+    }
+    if (kind == "synth") {
+        std::string signal = rest.substr(0, rest.find(':'));
+        if (signal.empty() || signal == "sine") {
+            double hz = 440.0;
+            if (signal.size() < rest.size() && !cli::parseDouble(rest.substr(signal.size() + 1), hz, 1, format.rate / 2.0)) {
+                std::cerr << "Bad synth frequency: " << spec << "\n";
+                return nullptr;
+            }
+            return std::unique_ptr<Source>(new ClockedSource(format, ClockedSource::Signal::Sine, hz));
+        }
+        if (signal == "noise") return std::unique_ptr<Source>(new ClockedSource(format, ClockedSource::Signal::Noise));
+        if (signal == "silence") return std::unique_ptr<Source>(new ClockedSource(format, ClockedSource::Signal::Silence));
+        std::cerr << "Unknown synth signal: " << signal << "\n";
+        return nullptr;
+    }
+    if (kind == "file" && !rest.empty()) {
+        std::vector<int16_t> samples;
+        if (!loadSamples(rest, format, samples)) return nullptr;
+        std::unique_ptr<ClockedSource> source(new ClockedSource(format, ClockedSource::Signal::File));
+        source->setFile(std::move(samples));
+        return std::unique_ptr<Source>(source.release());
+    }
+    std::cerr << "Unknown audio input: " << spec << " (alsa[:device], synth[:sine[:hz]|noise|silence], file:path)\n";
+    return nullptr;
+}
+
+// Playback backend for a spec; nullptr after printing why not
+inline std::unique_ptr<Sink> openSink(const std::string& spec, const Format& format) {
+    std::string kind = spec.substr(0, spec.find(':'));
+    std::string rest = spec.size() > kind.size() ? spec.substr(kind.size() + 1) : "";
+    if (kind == "alsa") {
+#ifdef AUDIO_HAVE_ALSA
+        snd_pcm_t* pcm = openAlsa(rest.empty() ? "default" : rest, SND_PCM_STREAM_PLAYBACK, format);
+        return pcm ? std::unique_ptr<Sink>(new AlsaSink(pcm)) : nullptr;
+#else
+        std::cerr << "Built without ALSA; use null or file playback.\n";
+        return nullptr;
+#endif
+    }
+    if (kind == "null") {
+        return std::unique_ptr<Sink>(new ClockedSink(format));
+    }
+    if (kind == "file" && !rest.empty()) {
+        FILE* out = fopen(rest.c_str(), "wb");
+        if (!out) {
+            std::cerr << "audio file " << rest << ": " << strerror(errno) << "\n";
+            return nullptr;
+        }
+        return std::unique_ptr<Sink>(new ClockedSink(format, out, endsWith(rest, ".wav")));
+    }
+    std::cerr << "Unknown audio output: " << spec << " (alsa[:device], null, file:path)\n";
+    return nullptr;
+}
+
+} // namespace audio
+
+#endif
@@ -0,0 +1,281 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include <immintrin.h>
+
+// Server-side audio mixer (MCU mode of the relay).
+// Every contributing client gets a jitter buffer of S16 samples. On each tick
+// the bus takes one period from every buffer that is playing, sums them once
+// into a 32-bit accumulator, and produces each client's N-1 mix as
+// total - own contribution, saturated back to 16 bits. Mixing costs one
+// accumulate per source plus one subtract per listener, so it grows linearly
+// with the room instead of quadratically.
+//
+// A buffer starts playing once it holds jitter_ms of audio, goes back to
+// prefill on underrun, and is trimmed to the target when the client's clock
+// runs ahead of the mixer's. Accumulate and mix-minus use AVX2 or SSE2 picked
+// at runtime; all kernels give identical results.
+
+namespace mixing {
+
+enum class MixKernel { Scalar, SSE2, AVX2 };
+
+inline MixKernel detectKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return MixKernel::AVX2;
+    if (__builtin_cpu_supports("sse2")) return MixKernel::SSE2;
+    return MixKernel::Scalar;
+}
+
+namespace mixer_detail {
+
+inline int16_t saturate(int32_t v) {
+    return int16_t(std::min(32767, std::max(-32768, v)));
+}
+
+inline void accumulateScalar(int32_t* acc, const int16_t* in, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        acc[i] += in[i];
+    }
+}
+
+__attribute__((target("sse2")))
+inline void accumulateSSE2(int32_t* acc, const int16_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        //Sign extend without SSE4.1: duplicate each sample, shift arithmetic
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        __m128i* a = reinterpret_cast<__m128i*>(acc + i);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), lo));
+        _mm_storeu_si128(a + 1, _mm_add_epi32(_mm_loadu_si128(a + 1), hi));
+    }
+    accumulateScalar(acc + i, in + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline void accumulateAVX2(int32_t* acc, const int16_t* in, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8));
+        __m256i* a = reinterpret_cast<__m256i*>(acc + i);
+        _mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), _mm256_cvtepi16_epi32(s0)));
+        _mm256_storeu_si256(a + 1, _mm256_add_epi32(_mm256_loadu_si256(a + 1), _mm256_cvtepi16_epi32(s1)));
+    }
+    accumulateScalar(acc + i, in + i, n - i);
+}
+
+// out = saturate(total - own); own may be null for listeners
+inline void mixMinusScalar(int16_t* out, const int32_t* total, const int16_t* own, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = saturate(total[i] - (own ? own[i] : 0));
+    }
+}
+
+__attribute__((target("sse2")))
+inline void mixMinusSSE2(int16_t* out, const int32_t* total, const int16_t* own, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i t0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(total + i));
+        __m128i t1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(total + i + 4));
+        if (own) {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(own + i));
+            t0 = _mm_sub_epi32(t0, _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+            t1 = _mm_sub_epi32(t1, _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packs_epi32(t0, t1));
+    }
+    mixMinusScalar(out + i, total + i, own ? own + i : nullptr, n - i);
+}
+
+__attribute__((target("avx2")))
+inline void mixMinusAVX2(int16_t* out, const int32_t* total, const int16_t* own, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i t0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(total + i));
+        __m256i t1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(total + i + 8));
+        if (own) {
+            __m128i s0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(own + i));
+            __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(own + i + 8));
+            t0 = _mm256_sub_epi32(t0, _mm256_cvtepi16_epi32(s0));
+            t1 = _mm256_sub_epi32(t1, _mm256_cvtepi16_epi32(s1));
+        }
+        //packs works per 128-bit lane; restore sample order across lanes
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(t0, t1), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+    }
+    mixMinusScalar(out + i, total + i, own ? own + i : nullptr, n - i);
+}
+
+} // namespace mixer_detail
+
+// FIFO of samples with a fixed capacity
+class SampleFifo {
+public:
+    explicit SampleFifo(size_t capacity) : buf_(capacity) {}
+
+    size_t size() const { return size_; }
+
+    // Bytes may be unaligned (straight from the receive buffer)
+    void write(const void* bytes, size_t samples) {
+        const uint8_t* src = static_cast<const uint8_t*>(bytes);
+        if (samples > buf_.size()) {
+            src += (samples - buf_.size()) * sizeof(int16_t);
+            samples = buf_.size();
+        }
+        if (size_ + samples > buf_.size()) {
+            drop(size_ + samples - buf_.size());
+        }
+        size_t tail = (head_ + size_) % buf_.size();
+        size_t first = std::min(samples, buf_.size() - tail);
+        memcpy(buf_.data() + tail, src, first * sizeof(int16_t));
+        memcpy(buf_.data(), src + first * sizeof(int16_t), (samples - first) * sizeof(int16_t));
+        size_ += samples;
+    }
+
+    void read(int16_t* out, size_t samples) {
+        size_t first = std::min(samples, buf_.size() - head_);
+        memcpy(out, buf_.data() + head_, first * sizeof(int16_t));
+        memcpy(out + first, buf_.data(), (samples - first) * sizeof(int16_t));
+        drop(samples);
+    }
+
+    void drop(size_t samples) {
+        samples = std::min(samples, size_);
+        head_ = (head_ + samples) % buf_.size();
+        size_ -= samples;
+    }
+
+private:
+    std::vector<int16_t> buf_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
+
+struct SourceStats {
+    uint64_t underruns = 0;         // Ticks that found the buffer short
+    uint64_t trimmed_samples = 0;   // Dropped because the buffer ran too deep
+};
+
+class MixBus {
+public:
+    MixBus(int rate, int channels, int period_frames, int jitter_ms)
+        : channels_(channels),
+          period_(size_t(period_frames) * channels),
+          target_(std::max(period_, size_t(rate) * channels * jitter_ms / 1000)),
+          limit_(target_ * 3 + period_),
+          kernel_(detectKernel()),
+          total_(period_),
+          out_(period_) {}
+
+    MixKernel kernel() const { return kernel_; }
+    void setKernel(MixKernel kernel) { kernel_ = kernel; }   // For testing the fallbacks
+    size_t periodSamples() const { return period_; }
+    int channels() const { return channels_; }
+
+    // Append S16 samples received from a client
+    void push(int id, const void* pcm, size_t bytes) {
+        auto it = sources_.find(id);
+        if (it == sources_.end()) {
+            //Headroom above the limit so the trim below, not the FIFO, decides what goes
+            it = sources_.emplace(id, Source(limit_ * 2, period_)).first;
+        }
+        Source& src = it->second;
+        src.fifo.write(pcm, bytes / sizeof(int16_t));
+        if (src.fifo.size() > limit_) {
+            size_t excess = src.fifo.size() - target_;
+            src.fifo.drop(excess);
+            src.stats.trimmed_samples += excess;
+        }
+    }
+
+    void removeSource(int id) { sources_.erase(id); }
+
+    // Pull one period from every playing source and sum them.
+    // Returns false when nobody contributed (nothing to send).
+    bool tick() {
+        std::fill(total_.begin(), total_.end(), 0);
+        bool any = false;
+        for (auto& entry : sources_) {
+            Source& src = entry.second;
+            src.active = false;
+            if (!src.playing) {
+                src.playing = src.fifo.size() >= target_;
+                if (!src.playing) continue;
+            }
+            if (src.fifo.size() < period_) {
+                src.playing = false;    //Rebuffer up to the target
+                src.stats.underruns++;
+                continue;
+            }
+            src.fifo.read(src.period.data(), period_);
+            accumulate(total_.data(), src.period.data(), period_);
+            src.active = true;
+            any = true;
+        }
+        return any;
+    }
+
+    // N-1 mix for one client after tick(); valid until the next call
+    const int16_t* mixFor(int id) {
+        const int16_t* own = nullptr;
+        auto it = sources_.find(id);
+        if (it != sources_.end() && it->second.active) {
+            own = it->second.period.data();
+        }
+        switch (kernel_) {
+            case MixKernel::AVX2: mixer_detail::mixMinusAVX2(out_.data(), total_.data(), own, period_); break;
+            case MixKernel::SSE2: mixer_detail::mixMinusSSE2(out_.data(), total_.data(), own, period_); break;
+            default: mixer_detail::mixMinusScalar(out_.data(), total_.data(), own, period_); break;
+        }
+        return out_.data();
+    }
+
+    // Buffered samples and counters of one source; false if it never sent audio
+    bool sourceState(int id, size_t& buffered, SourceStats& stats) const {
+        auto it = sources_.find(id);
+        if (it == sources_.end()) return false;
+        buffered = it->second.fifo.size();
+        stats = it->second.stats;
+        return true;
+    }
+
+private:
+    struct Source {
+        Source(size_t capacity, size_t period) : fifo(capacity), period(period) {}
+        SampleFifo fifo;
+        std::vector<int16_t> period;    // This tick's contribution
+        bool playing = false;
+        bool active = false;
+        SourceStats stats;
+    };
+
+    void accumulate(int32_t* acc, const int16_t* in, size_t n) {
+        switch (kernel_) {
+            case MixKernel::AVX2: mixer_detail::accumulateAVX2(acc, in, n); break;
+            case MixKernel::SSE2: mixer_detail::accumulateSSE2(acc, in, n); break;
+            default: mixer_detail::accumulateScalar(acc, in, n); break;
+        }
+    }
+
+    const int channels_;
+    const size_t period_;       // Samples per tick (frames * channels)
+    const size_t target_;       // Prefill depth
+    const size_t limit_;        // Trim back to target above this
+    MixKernel kernel_;
+    std::unordered_map<int, Source> sources_;
+    std::vector<int32_t> total_;
+    std::vector<int16_t> out_;
+};
+
+} // namespace mixing
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef AV_PACKETS_H
+#define AV_PACKETS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Online_AV datagrams, shared by the client and the SFU server.
+// Datagrams on a socket are told apart by size, so every type must have a
+// size of its own. HELLO (the 5 bytes "HELLO") announces a peer.
+
+//Audio format on the wire
+#define Buff_Size 1024 //Frames per audio packet
+#define Channels 2     //Stereo audio
+
+//Audio packet structure
+struct Audio_Packet {
+    uint32_t a_sequence;
+    uint64_t timestamp;
+    int16_t audio_data[Buff_Size * Channels];
+
+};
+
+//Received audio waiting for playback (Online_AV's receive queue)
+struct Queued_Audio {
+    Audio_Packet packet;
+    uint32_t source;   //Sending peer, for trace tags
+};
+
+
+//Video packet structure
+struct Video_Fragment{
+    uint32_t frame_seq;        //Video frame sequence
+    uint32_t fragment_i;       //Video fragment index within the strip
+    uint32_t total_fragments;      //Total fragments of the strip
+    uint16_t strip_i;          //Strip index (top to bottom)
+    uint16_t total_strips;     //Strips in this frame
+    uint64_t capture_ts;       //Capture time (us) for playout scheduling
+    bool last_fragment;        //Last fragment of the strip
+    bool key_frame;            //Decodable without earlier frames
+    size_t fragment_s;         //Fragment size
+    unsigned char Fdata[1400];  //Fragment data
+};
+
+//Feedback packet (receiver -> video sender)
+#define FB_Magic 0x4F414642  //Tag for feedback datagrams
+#define FB_PLI 1             //Picture loss indication: a key frame soon, rate limited
+#define FB_FIR 2             //Full intra request: a key frame now, once per request_seq
+
+struct Feedback_Packet {
+    uint32_t magic;          //FB_Magic
+    uint32_t type;           //FB_PLI or FB_FIR
+    uint32_t frame_seq;      //Last frame the receiver completed
+    uint32_t request_seq;    //Request counter; a repeated FIR carries the same value
+    uint32_t requester;      //Random id of the receiver; behind an SFU all requests share one address
+};
+
+//SFU control (client <-> selective forwarding server)
+#define SFU_Magic 0x4F415346     //Tag for SFU control datagrams
+#define SFU_Welcome 1            //Server -> member: member is its id, room its room
+#define SFU_Joined 2             //Server -> members: member joined (also lists existing members to a newcomer)
+#define SFU_Left 3               //Server -> members: member left or timed out
+#define SFU_Subscribe 4          //Client -> server: receive kinds from member
+#define SFU_Unsubscribe 5        //Client -> server: stop receiving kinds from member
+#define SFU_Join 6               //Client -> server: move to room (members start in "main")
+#define SFU_All 0xFFFFFFFFu      //Subscribe: every member (the default)
+#define SFU_Audio 1              //Kinds
+#define SFU_Video 2
+#define SFU_Room_Max 32          //Room name bytes, NUL padded
+
+struct Sfu_Control {
+    uint32_t magic;          //SFU_Magic
+    uint32_t op;             //SFU_Welcome ... SFU_Join
+    uint32_t member;         //Member id the message is about, or SFU_All
+    uint32_t kinds;          //SFU_Audio | SFU_Video
+    uint32_t members;        //Room size after the change (server messages)
+    char room[SFU_Room_Max]; //SFU_Join and SFU_Welcome
+};
+
+static_assert(sizeof(Audio_Packet) != sizeof(Video_Fragment), "Audio and video datagrams must differ in size");
+static_assert(sizeof(Feedback_Packet) != sizeof(Video_Fragment) && sizeof(Feedback_Packet) != sizeof(Audio_Packet), "Feedback datagram size clash");
+static_assert(sizeof(Sfu_Control) != sizeof(Feedback_Packet) && sizeof(Sfu_Control) != sizeof(Audio_Packet) &&
+              sizeof(Sfu_Control) != sizeof(Video_Fragment) && sizeof(Sfu_Control) != 5, "SFU control datagram size clash");
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef CLI_ARGS_H
+#define CLI_ARGS_H
+
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+// Number parsing for command-line options.
+// The whole text must be the number (no trailing junk, no sign on unsigned
+// types) and within [min, max] inclusive; nothing throws and nothing wraps.
+// On failure the value is left as it was and the caller prints its usage.
+
+namespace cli {
+
+template <typename T>
+bool parseInt(const char* text, T& value, T min = std::numeric_limits<T>::lowest(),
+              T max = std::numeric_limits<T>::max()) {
+    static_assert(std::is_integral<T>::value, "integer options only");
+    if (!text || *text == '\0') return false;
+    char* end = nullptr;
+    errno = 0;
+    if (std::is_signed<T>::value) {
+        long long parsed = strtoll(text, &end, 10);
+        if (errno != 0 || *end != '\0' || parsed < (long long)min || parsed > (long long)max) return false;
+        value = T(parsed);
+    } else {
+        if (*text == '-' || *text == '+') return false;
+        unsigned long long parsed = strtoull(text, &end, 10);
+        if (errno != 0 || *end != '\0' || parsed < (unsigned long long)min || parsed > (unsigned long long)max) {
+            return false;
+        }
+        value = T(parsed);
+    }
+    return true;
+}
+
+template <typename T>
+bool parseInt(const std::string& text, T& value, T min = std::numeric_limits<T>::lowest(),
+              T max = std::numeric_limits<T>::max()) {
+    return parseInt(text.c_str(), value, min, max);
+}
+
+inline bool parseDouble(const char* text, double& value, double min, double max) {
+    if (!text || *text == '\0') return false;
+    char* end = nullptr;
+    errno = 0;
+    double parsed = strtod(text, &end);
+    if (errno != 0 || *end != '\0' || !std::isfinite(parsed) || parsed < min || parsed > max) return false;
+    value = parsed;
+    return true;
+}
+
+inline bool parseDouble(const std::string& text, double& value, double min, double max) {
+    return parseDouble(text.c_str(), value, min, max);
+}
+
+// TCP/UDP port, 1-65535
+inline bool parsePort(const std::string& text, uint16_t& port) {
+    return parseInt<uint16_t>(text, port, 1, 65535);
+}
+
+} // namespace cli
+
+#endif
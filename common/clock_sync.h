@@ -0,0 +1,128 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// Clock offset and drift to a remote host, NTP style.
+// An exchange gives four times: t1 request sent (local clock), t2 request
+// received and t3 answer sent (remote clock), t4 answer received (local).
+// Assuming the path is symmetric, the remote clock is ahead by
+//
+//   offset = ((t2 - t1) + (t3 - t4)) / 2,   round trip = (t4 - t1) - (t3 - t2)
+//
+// and the error of that estimate is at most half the round trip. Queueing
+// makes single exchanges wildly asymmetric, so only the exchange with the
+// shortest round trip among the last Window is believed (min-RTT filter).
+// Drift comes from a least-squares line through the best exchange of each
+// block of Window exchanges; between exchanges the offset is extrapolated
+// along it, so a slow exchange rate still tracks a crystal a few ppm off.
+//
+// Thread safe: one thread usually feeds exchanges while others convert times.
+
+namespace timesync {
+
+class ClockSync {
+public:
+    static constexpr size_t Window = 16;           // Exchanges the min-RTT filter picks from
+    static constexpr size_t Min_Exchanges = 4;     // Before the offset is trusted
+    static constexpr size_t Drift_Points = 32;     // Filtered points behind the drift fit
+    static constexpr double Min_Drift_Span_us = 10e6;
+    static constexpr double Max_Drift = 500e-6;    // Clamp: worse than this is a clock step
+
+    // One completed exchange, all in microseconds
+    void addExchange(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4) {
+        int64_t rtt = (int64_t(t4) - int64_t(t1)) - (int64_t(t3) - int64_t(t2));
+        if (rtt < 0) return;    //Clock stepped mid-exchange
+        Sample sample;
+        sample.local_us = t4;
+        sample.offset_us = ((int64_t(t2) - int64_t(t1)) + (int64_t(t3) - int64_t(t4))) / 2;
+        sample.rtt_us = rtt;
+
+        std::lock_guard<std::mutex> lock(mute_);
+        window_.push_back(sample);
+        if (window_.size() > Window) window_.pop_front();
+        best_ = *std::min_element(window_.begin(), window_.end(),
+                                  [](const Sample& a, const Sample& b) { return a.rtt_us < b.rtt_us; });
+        exchanges_++;
+
+        //Each completed block contributes its best exchange to the drift fit
+        if (exchanges_ % Window == 0) {
+            points_.push_back(best_);
+            if (points_.size() > Drift_Points) points_.pop_front();
+            fitDrift();
+        }
+    }
+
+    bool synced() const {
+        std::lock_guard<std::mutex> lock(mute_);
+        return exchanges_ >= Min_Exchanges;
+    }
+
+    // Remote minus local clock at a local time; 0 until synced
+    int64_t offsetUs(uint64_t local_us) const {
+        std::lock_guard<std::mutex> lock(mute_);
+        if (exchanges_ < Min_Exchanges) return 0;
+        return best_.offset_us + int64_t(drift_ * (double(int64_t(local_us) - int64_t(best_.local_us))));
+    }
+
+    uint64_t toRemote(uint64_t local_us) const { return uint64_t(int64_t(local_us) + offsetUs(local_us)); }
+
+    // Round trip of the exchange the offset comes from; half of it bounds the error
+    int64_t rttUs() const {
+        std::lock_guard<std::mutex> lock(mute_);
+        return best_.rtt_us;
+    }
+
+    double driftPpm() const {
+        std::lock_guard<std::mutex> lock(mute_);
+        return drift_ * 1e6;
+    }
+
+    uint64_t exchanges() const {
+        std::lock_guard<std::mutex> lock(mute_);
+        return exchanges_;
+    }
+
+private:
+    struct Sample {
+        uint64_t local_us = 0;
+        int64_t offset_us = 0;
+        int64_t rtt_us = 0;
+    };
+
+    //Slope of offset over local time, relative to the first point for precision
+    void fitDrift() {
+        if (points_.size() < 3) return;
+        double span = double(points_.back().local_us - points_.front().local_us);
+        if (span < Min_Drift_Span_us) return;
+        double x0 = double(points_.front().local_us);
+        double y0 = double(points_.front().offset_us);
+        double n = double(points_.size()), sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (const Sample& p : points_) {
+            double x = double(p.local_us) - x0;
+            double y = double(p.offset_us) - y0;
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        double denom = n * sxx - sx * sx;
+        if (denom <= 0) return;
+        drift_ = std::min(std::max((n * sxy - sx * sy) / denom, -Max_Drift), Max_Drift);
+    }
+
+    mutable std::mutex mute_;
+    std::deque<Sample> window_;
+    std::deque<Sample> points_;
+    Sample best_;
+    double drift_ = 0;          // Offset change per microsecond
+    uint64_t exchanges_ = 0;
+};
+
+} // namespace timesync
+
+#endif
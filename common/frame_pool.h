@@ -0,0 +1,167 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Reference-counted frame buffers for the relay's fan-out.
+// A frame received from one client is copied once into a pooled buffer; every
+// outbound queue it goes to holds a FrameRef to that same buffer rather than
+// a copy of its own, and the buffer returns to the pool when the last
+// reference is dropped (the last queue has written it, or dropped it).
+// Buffers come in power-of-two size classes from 256 B to 128 KiB, enough for
+// a maximal frame; freed buffers wait on a per-class free list, so steady
+// traffic does not touch the allocator. A pool and its references belong to
+// one event loop thread: the count is not atomic.
+// FramePool::shared() makes the exception, a buffer in no pool whose count is
+// atomic, for frames handed between threads (relay_bridge.h); it goes back to
+// the heap when the last reference is dropped, on whichever thread that is.
+
+namespace relay {
+
+class FramePool;
+
+struct FrameBlock {
+    FramePool* pool;        // Null for a shared block
+    uint32_t refs;
+    uint32_t size;          // Bytes in use
+    uint8_t size_class;
+    //The frame bytes follow the block
+    uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+};
+
+class FrameRef {
+public:
+    FrameRef() = default;
+    FrameRef(const FrameRef& other) : block_(other.block_) {
+        if (!block_) return;
+        if (block_->pool) {
+            block_->refs++;
+        } else {
+            __atomic_add_fetch(&block_->refs, 1, __ATOMIC_RELAXED);
+        }
+    }
+    FrameRef(FrameRef&& other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+    FrameRef& operator=(FrameRef other) noexcept {
+        std::swap(block_, other.block_);
+        return *this;
+    }
+    ~FrameRef() { reset(); }
+
+    inline void reset();
+
+    explicit operator bool() const { return block_ != nullptr; }
+    //Shared buffers are written only before the first copy of the reference
+    uint8_t* data() const { return block_->bytes(); }
+    size_t size() const { return block_->size; }
+    uint32_t refs() const { return block_ ? __atomic_load_n(&block_->refs, __ATOMIC_RELAXED) : 0; }
+
+private:
+    friend class FramePool;
+    explicit FrameRef(FrameBlock* block) : block_(block) {}
+
+    FrameBlock* block_ = nullptr;
+};
+
+class FramePool {
+public:
+    FramePool() = default;
+    ~FramePool() {
+        for (auto& list : free_) {
+            for (FrameBlock* block : list) {
+                ::operator delete(block);
+            }
+        }
+    }
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // A buffer of size bytes, contents undefined
+    FrameRef alloc(size_t size) {
+        unsigned cls = sizeClass(size);
+        FrameBlock* block;
+        if (cls < Classes && !free_[cls].empty()) {
+            block = free_[cls].back();
+            free_[cls].pop_back();
+        } else {
+            size_t capacity = cls < Classes ? classBytes(cls) : size;
+            block = static_cast<FrameBlock*>(::operator new(sizeof(FrameBlock) + capacity));
+            block->pool = this;
+            block->size_class = uint8_t(cls);
+            allocated_++;
+        }
+        block->refs = 1;
+        block->size = uint32_t(size);
+        return FrameRef(block);
+    }
+
+    // A buffer holding a copy of data
+    FrameRef copy(const void* data, size_t size) {
+        FrameRef frame = alloc(size);
+        memcpy(frame.data(), data, size);
+        return frame;
+    }
+
+    // A copy of data other threads may hold references to; written only before it is shared
+    static FrameRef shared(const void* data, size_t size) {
+        FrameBlock* block = static_cast<FrameBlock*>(::operator new(sizeof(FrameBlock) + size));
+        block->pool = nullptr;
+        block->refs = 1;
+        block->size = uint32_t(size);
+        block->size_class = uint8_t(Classes);
+        memcpy(block->bytes(), data, size);
+        return FrameRef(block);
+    }
+
+    // Buffers taken from the heap so far
+    uint64_t allocated() const { return allocated_; }
+
+private:
+    friend class FrameRef;
+
+    static constexpr unsigned Min_Shift = 8;                // 256 B
+    static constexpr unsigned Classes = 10;                 // up to 128 KiB
+    static constexpr size_t Max_Free_Bytes = 4 << 20;       // Kept per class after a burst
+
+    static size_t classBytes(unsigned cls) { return size_t(1) << (Min_Shift + cls); }
+
+    //Oversized requests get Classes and are not pooled
+    static unsigned sizeClass(size_t size) {
+        unsigned cls = 0;
+        while (cls < Classes && classBytes(cls) < size) cls++;
+        return cls;
+    }
+
+    void release(FrameBlock* block) {
+        unsigned cls = block->size_class;
+        if (cls >= Classes || free_[cls].size() >= Max_Free_Bytes / classBytes(cls)) {
+            ::operator delete(block);
+            return;
+        }
+        free_[cls].push_back(block);
+    }
+
+    std::vector<FrameBlock*> free_[Classes];
+    uint64_t allocated_ = 0;
+};
+
+inline void FrameRef::reset() {
+    if (!block_) return;
+    if (!block_->pool) {
+        if (__atomic_sub_fetch(&block_->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+            ::operator delete(block_);
+        }
+    } else if (--block_->refs == 0) {
+        block_->pool->release(block_);
+    }
+    block_ = nullptr;
+}
+
+} // namespace relay
+
+#endif
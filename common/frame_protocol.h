@@ -0,0 +1,259 @@
+#ifndef FRAME_PROTOCOL_H
+#define FRAME_PROTOCOL_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <endian.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// Length-prefixed framing for the TCP audio protocol.
+// TCP delivers a byte stream, so every message carries a fixed header in
+// network byte order:
+//
+//   0  u16 magic "AF"        2  u8 version    3  u8 type
+//   4  u16 stream id         6  u16 reserved
+//   8  u32 payload length   12  u32 sequence
+//  16  u64 timestamp (sender's clock, us)
+//  24  u64 relay timestamp (relay's clock, us; set when the relay forwards it)
+//
+// followed by the payload. Clients that keep their clock offset to the relay
+// (clock_sync.h) stamp frames in relay time; a receiver then splits a frame's
+// delay into uplink (relay stamp - timestamp) and downlink (arrival - relay
+// stamp). The time frames carry that offset exchange: a Frame_Time_Request
+// holds the client's send time t1 as its timestamp, and the relay answers the
+// same connection with a Frame_Time_Response whose payload is t1, relay
+// timestamp its receive time t2 and timestamp its send time t3.
+// FrameParser reassembles frames from arbitrary
+// recv() boundaries: frames that lie completely inside the bytes handed to
+// feed() are delivered in place, and only a frame cut by the end of the
+// buffer is copied aside until the rest arrives.
+
+namespace framing {
+
+constexpr uint16_t Frame_Magic = 0x4146;          // "AF"
+constexpr uint8_t Frame_Version = 2;
+constexpr size_t Header_Size = 32;
+constexpr size_t Time_Payload = 8;                 // Frame_Time_Response: t1
+constexpr uint32_t Max_Payload = 64 * 1024;        // Larger lengths are a protocol error
+
+enum FrameType : uint8_t {
+    Frame_Audio = 1,        // Interleaved S16_LE PCM
+    Frame_Join = 2,         // Payload: room name; the relay moves the sender into that room and
+                            // answers with a Frame_Join naming it, or with no payload if it refused the name
+    Frame_Time_Request = 3, // Client -> relay, no payload
+    Frame_Time_Response = 4,// Relay -> client, payload: t1 (u64)
+};
+
+struct FrameHeader {
+    uint8_t type = Frame_Audio;
+    uint16_t stream_id = 0;
+    uint32_t length = 0;
+    uint32_t seq = 0;
+    uint64_t timestamp_us = 0;
+    uint64_t relay_us = 0;
+};
+
+// Frame timestamps use the wall clock; clock_sync.h corrects for the offset between hosts
+inline uint64_t nowUs() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+inline void encodeHeader(const FrameHeader& header, uint8_t* out) {
+    uint16_t magic = htobe16(Frame_Magic);
+    uint16_t stream = htobe16(header.stream_id);
+    uint16_t reserved = 0;
+    uint32_t length = htobe32(header.length);
+    uint32_t seq = htobe32(header.seq);
+    uint64_t timestamp = htobe64(header.timestamp_us);
+    uint64_t relay = htobe64(header.relay_us);
+    memcpy(out + 0, &magic, 2);
+    out[2] = Frame_Version;
+    out[3] = header.type;
+    memcpy(out + 4, &stream, 2);
+    memcpy(out + 6, &reserved, 2);
+    memcpy(out + 8, &length, 4);
+    memcpy(out + 12, &seq, 4);
+    memcpy(out + 16, &timestamp, 8);
+    memcpy(out + 24, &relay, 8);
+}
+
+// Set the relay timestamp of an encoded frame
+inline void stampRelay(uint8_t* frame, uint64_t relay_us) {
+    uint64_t relay = htobe64(relay_us);
+    memcpy(frame + 24, &relay, 8);
+}
+
+// Returns false when the bytes are not a valid header
+inline bool decodeHeader(const uint8_t* in, FrameHeader& header) {
+    uint16_t magic, stream;
+    uint32_t length, seq;
+    uint64_t timestamp, relay;
+    memcpy(&magic, in + 0, 2);
+    memcpy(&stream, in + 4, 2);
+    memcpy(&length, in + 8, 4);
+    memcpy(&seq, in + 12, 4);
+    memcpy(&timestamp, in + 16, 8);
+    memcpy(&relay, in + 24, 8);
+    if (be16toh(magic) != Frame_Magic || in[2] != Frame_Version) {
+        return false;
+    }
+    header.type = in[3];
+    header.stream_id = be16toh(stream);
+    header.length = be32toh(length);
+    header.seq = be32toh(seq);
+    header.timestamp_us = be64toh(timestamp);
+    header.relay_us = be64toh(relay);
+    return header.length <= Max_Payload;
+}
+
+// Send header and payload with one gathered write (blocking socket)
+inline bool sendFrame(int sockfd, const FrameHeader& header, const void* payload) {
+    uint8_t head[Header_Size];
+    encodeHeader(header, head);
+    iovec iov[2] = {{head, Header_Size}, {const_cast<void*>(payload), header.length}};
+    msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    size_t left = Header_Size + header.length;
+    while (left > 0) {
+        ssize_t sent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        left -= size_t(sent);
+        //Partial write: advance the iovecs past what went out
+        while (msg.msg_iovlen > 0 && size_t(sent) >= msg.msg_iov->iov_len) {
+            sent -= ssize_t(msg.msg_iov->iov_len);
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = static_cast<uint8_t*>(msg.msg_iov->iov_base) + sent;
+            msg.msg_iov->iov_len -= size_t(sent);
+        }
+    }
+    return true;
+}
+
+// Ask the relay to move this connection into a room
+inline bool sendJoin(int sockfd, const std::string& room) {
+    FrameHeader header;
+    header.type = Frame_Join;
+    header.length = uint32_t(room.size());
+    header.timestamp_us = nowUs();
+    return sendFrame(sockfd, header, room.data());
+}
+
+// Header of a request for the relay's clock; t1 is its send time on this host
+inline FrameHeader timeRequest(uint64_t t1) {
+    FrameHeader header;
+    header.type = Frame_Time_Request;
+    header.timestamp_us = t1;
+    return header;
+}
+
+// t1 of a Frame_Time_Response
+inline uint64_t timeResponseT1(const uint8_t* frame) {
+    uint64_t t1;
+    memcpy(&t1, frame + Header_Size, 8);
+    return be64toh(t1);
+}
+
+// Type of an encoded frame, without decoding the rest of the header
+inline uint8_t frameType(const uint8_t* frame) {
+    return frame[3];
+}
+
+class FrameParser {
+public:
+    // Feed received bytes. on_frame(header, frame, frame_size) runs for every
+    // complete frame; frame points at the header, the payload follows at
+    // frame + Header_Size. Pointers are only valid during the call.
+    // Returns false on a protocol error; the stream cannot be resynchronised.
+    template <typename OnFrame>
+    bool feed(const uint8_t* data, size_t len, OnFrame&& on_frame) {
+        if (failed_) {
+            return false;
+        }
+
+        //Finish the frame carried over from the previous call
+        if (!pending_.empty()) {
+            size_t used = fillPending(data, len);
+            data += used;
+            len -= used;
+            if (!pendingComplete()) {
+                return !failed_;
+            }
+            on_frame(pending_header_, pending_.data(), pending_.size());
+            pending_.clear();
+        }
+
+        //Whole frames straight from the caller's buffer
+        while (len >= Header_Size) {
+            FrameHeader header;
+            if (!decodeHeader(data, header)) {
+                failed_ = true;
+                return false;
+            }
+            size_t frame_size = Header_Size + header.length;
+            if (len < frame_size) {
+                break;
+            }
+            on_frame(header, data, frame_size);
+            data += frame_size;
+            len -= frame_size;
+        }
+
+        //Keep the cut-off tail
+        if (len > 0) {
+            fillPending(data, len);
+        }
+        return !failed_;
+    }
+
+    bool failed() const { return failed_; }
+
+private:
+    // Copy what the pending frame still needs; returns bytes consumed
+    size_t fillPending(const uint8_t* data, size_t len) {
+        size_t used = 0;
+        if (pending_.size() < Header_Size) {
+            size_t take = std::min(len, Header_Size - pending_.size());
+            pending_.insert(pending_.end(), data, data + take);
+            used += take;
+            if (pending_.size() < Header_Size) {
+                return used;
+            }
+            if (!decodeHeader(pending_.data(), pending_header_)) {
+                failed_ = true;
+                return used;
+            }
+            pending_.reserve(Header_Size + pending_header_.length);
+        }
+        size_t want = Header_Size + pending_header_.length - pending_.size();
+        size_t take = std::min(len - used, want);
+        pending_.insert(pending_.end(), data + used, data + used + take);
+        return used + take;
+    }
+
+    bool pendingComplete() const {
+        return !failed_ && pending_.size() >= Header_Size && pending_.size() == Header_Size + pending_header_.length;
+    }
+
+    std::vector<uint8_t> pending_;
+    FrameHeader pending_header_;
+    bool failed_ = false;
+};
+
+} // namespace framing
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef HDR_HISTOGRAM_H
+#define HDR_HISTOGRAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// High dynamic range histogram (after Gil Tene's HdrHistogram).
+// Values from 1 to highest are recorded with a fixed number of significant
+// decimal digits: every power-of-two range has the same count of linear
+// sub-buckets, so a latency of 40 us and one of 40 ms are both kept to within
+// 0.1% at three digits, in a table of fixed size. Recording is an index
+// computation and an increment; nothing is allocated after construction.
+// Percentiles are reported as the highest value equivalent to the bucket they
+// fall in, i.e. never below the true value.
+//
+// One writer; merge() adds a histogram of the same shape into another.
+// A histogram shared between threads is recorded with recordAtomic() (relaxed
+// atomic adds, any number of threads) and read through snapshot(); the
+// difference of two snapshots (subtract()) is what was recorded in between.
+
+namespace measure {
+
+class HdrHistogram {
+public:
+    // Tracks 1..highest with significant_digits (1..5) decimal digits
+    explicit HdrHistogram(int64_t highest = 60000000000LL, int significant_digits = 3) {
+        significant_digits = std::min(std::max(significant_digits, 1), 5);
+        significant_digits_ = significant_digits;
+        int64_t largest_single_unit = 2;
+        for (int i = 0; i < significant_digits; i++) largest_single_unit *= 10;
+        int sub_bucket_magnitude = 0;
+        while ((int64_t(1) << sub_bucket_magnitude) < largest_single_unit) sub_bucket_magnitude++;
+
+        sub_bucket_half_magnitude_ = sub_bucket_magnitude - 1;
+        sub_bucket_count_ = int64_t(1) << sub_bucket_magnitude;
+        sub_bucket_half_count_ = sub_bucket_count_ / 2;
+        sub_bucket_mask_ = sub_bucket_count_ - 1;
+        highest_ = std::max(highest, sub_bucket_count_);
+
+        int buckets = 1;
+        for (int64_t smallest_untrackable = sub_bucket_count_; smallest_untrackable <= highest_; buckets++) {
+            if (smallest_untrackable > INT64_MAX / 2) {
+                buckets++;
+                break;
+            }
+            smallest_untrackable <<= 1;
+        }
+        counts_.assign(size_t(buckets + 1) * size_t(sub_bucket_half_count_), 0);
+    }
+
+    // Values above highest are counted as highest; max() keeps the true value
+    void record(int64_t value) {
+        if (value < 0) value = 0;
+        counts_[index(std::min(value, highest_))]++;
+        total_++;
+        sum_ += uint64_t(value);
+        if (value > max_) max_ = value;
+        if (value < min_) min_ = value;
+    }
+
+    // record() for a histogram other threads record into or snapshot() at the same time
+    void recordAtomic(int64_t value) {
+        if (value < 0) value = 0;
+        __atomic_fetch_add(&counts_[index(std::min(value, highest_))], 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&total_, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&sum_, uint64_t(value), __ATOMIC_RELAXED);
+        int64_t seen = __atomic_load_n(&max_, __ATOMIC_RELAXED);
+        while (value > seen && !__atomic_compare_exchange_n(&max_, &seen, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+        seen = __atomic_load_n(&min_, __ATOMIC_RELAXED);
+        while (value < seen && !__atomic_compare_exchange_n(&min_, &seen, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    }
+
+    // Copy taken while recordAtomic() may run; the count is that of the copied buckets
+    HdrHistogram snapshot() const {
+        HdrHistogram copy(highest_, significant_digits_);
+        for (size_t i = 0; i < counts_.size(); i++) {
+            copy.counts_[i] = __atomic_load_n(&counts_[i], __ATOMIC_RELAXED);
+            copy.total_ += copy.counts_[i];
+        }
+        copy.sum_ = __atomic_load_n(&sum_, __ATOMIC_RELAXED);
+        copy.max_ = __atomic_load_n(&max_, __ATOMIC_RELAXED);
+        copy.min_ = __atomic_load_n(&min_, __ATOMIC_RELAXED);
+        return copy;
+    }
+
+    // Remove an earlier snapshot of the same histogram, leaving what was recorded
+    // since. min and max become those of the remaining buckets, max capped by the true max.
+    void subtract(const HdrHistogram& earlier) {
+        if (earlier.counts_.size() != counts_.size()) return;
+        total_ = 0;
+        int64_t lowest = INT64_MAX, highest = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            counts_[i] -= earlier.counts_[i];
+            if (counts_[i] == 0) continue;
+            total_ += counts_[i];
+            lowest = std::min(lowest, valueAt(i));
+            highest = std::max(highest, highestEquivalent(valueAt(i)));
+        }
+        sum_ -= earlier.sum_;
+        max_ = std::min(highest, max_);
+        min_ = lowest;
+    }
+
+    void merge(const HdrHistogram& other) {
+        if (other.counts_.size() != counts_.size()) return;
+        for (size_t i = 0; i < counts_.size(); i++) counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+        min_ = std::min(min_, other.min_);
+    }
+
+    void reset() {
+        std::fill(counts_.begin(), counts_.end(), 0);
+        total_ = 0;
+        sum_ = 0;
+        max_ = 0;
+        min_ = INT64_MAX;
+    }
+
+    uint64_t count() const { return total_; }
+    int64_t max() const { return max_; }
+    int64_t min() const { return total_ ? min_ : 0; }
+    double mean() const { return total_ ? double(sum_) / double(total_) : 0.0; }
+
+    // Value at a percentile (0..100)
+    int64_t percentile(double p) const {
+        if (total_ == 0) return 0;
+        p = std::min(std::max(p, 0.0), 100.0);
+        uint64_t target = std::max<uint64_t>(1, uint64_t(p / 100.0 * double(total_) + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); i++) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return std::min(highestEquivalent(valueAt(i)), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static int highestBit(int64_t value) { return 63 - __builtin_clzll(uint64_t(value)); }
+
+    size_t index(int64_t value) const {
+        int bucket = highestBit(value | sub_bucket_mask_) - sub_bucket_half_magnitude_;
+        int64_t sub_bucket = value >> bucket;
+        return size_t((int64_t(bucket + 1) << sub_bucket_half_magnitude_) + (sub_bucket - sub_bucket_half_count_));
+    }
+
+    int64_t valueAt(size_t i) const {
+        int bucket = int(i >> sub_bucket_half_magnitude_) - 1;
+        int64_t sub_bucket = int64_t(i & size_t(sub_bucket_half_count_ - 1)) + sub_bucket_half_count_;
+        if (bucket < 0) {
+            sub_bucket -= sub_bucket_half_count_;
+            bucket = 0;
+        }
+        return sub_bucket << bucket;
+    }
+
+    // Last value that lands in the same bucket as value
+    int64_t highestEquivalent(int64_t value) const {
+        int bucket = highestBit(value | sub_bucket_mask_) - sub_bucket_half_magnitude_;
+        int64_t sub_bucket = value >> bucket;
+        int range_magnitude = sub_bucket >= sub_bucket_count_ ? bucket + 1 : bucket;
+        int64_t lowest = (sub_bucket << bucket);
+        return lowest + (int64_t(1) << range_magnitude) - 1;
+    }
+
+    int significant_digits_ = 3;
+    int sub_bucket_half_magnitude_ = 0;
+    int64_t sub_bucket_count_ = 0;
+    int64_t sub_bucket_half_count_ = 0;
+    int64_t sub_bucket_mask_ = 0;
+    int64_t highest_ = 0;
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    uint64_t sum_ = 0;
+    int64_t max_ = 0;
+    int64_t min_ = INT64_MAX;
+};
+
+} // namespace measure
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef INTERVAL_REPORTER_H
+#define INTERVAL_REPORTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hdr_histogram.h"
+
+// Interval metrics for the measurement tools.
+// The hot path only ever does relaxed atomic adds: a counter is a plain
+// std::atomic<uint64_t> bumped with fetch_add, a histogram is a
+// measure::HdrHistogram recorded with recordAtomic(). Nothing is reset, so no
+// update can fall between two intervals; a background thread snapshots
+// everything at the chosen cadence and reports the difference to the previous
+// snapshot:
+//
+//   [12.0s] bytes 176400 (172.3 KB/s)  latency n=43 p50=1.02 p90=1.10 p99=1.31 max=1.40 ms
+//
+// on stdout, and one row per interval in an optional CSV file. Intervals in
+// which nothing was counted are left out of the text but kept in the CSV.
+// stop() adds a line over the whole run.
+//
+// Percentiles carry HdrHistogram's error bound: three significant digits,
+// never below the true value.
+//
+// Register every metric before start(); they live as long as the reporter.
+
+namespace measure {
+
+class IntervalReporter {
+public:
+    explicit IntervalReporter(int interval_ms = 1000) : interval_ms_(std::max(interval_ms, 1)) {}
+    ~IntervalReporter() { stop(); }
+
+    IntervalReporter(const IntervalReporter&) = delete;
+    IntervalReporter& operator=(const IntervalReporter&) = delete;
+
+    // Monotonic count, with a per-second rate times rate_scale in the report
+    // (e.g. 1/1024 for KB/s from bytes); rate_unit empty for no rate column
+    std::atomic<uint64_t>& counter(const std::string& name, const std::string& rate_unit = "/s", double rate_scale = 1.0) {
+        counters_.emplace_back(name, rate_unit, rate_scale);
+        return counters_.back().value;
+    }
+
+    // Values 1..highest, shown divided by display_scale in display_unit; record with recordAtomic()
+    HdrHistogram& histogram(const std::string& name, const std::string& display_unit = "us", double display_scale = 1.0,
+                            int64_t highest = 3600000000LL) {
+        histograms_.emplace_back(name, display_unit, display_scale, highest);
+        return histograms_.back().values;
+    }
+
+    // csv_path empty: text only
+    bool start(const std::string& csv_path = "") {
+        if (!csv_path.empty()) {
+            csv_ = fopen(csv_path.c_str(), "w");
+            if (!csv_) {
+                fprintf(stderr, "Report file %s: %s\n", csv_path.c_str(), strerror(errno));
+                return false;
+            }
+            writeCsvHeader();
+        }
+        started_ = std::chrono::steady_clock::now();
+        last_ = takeSnapshot(started_);
+        first_ = last_;
+        running_ = true;
+        thread_ = std::thread(&IntervalReporter::loop, this);
+        return true;
+    }
+
+    // Reports the last partial interval and the whole run
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mute_);
+            if (!running_) return;
+            running_ = false;
+        }
+        wake_.notify_one();
+        thread_.join();
+        Snapshot now = takeSnapshot(std::chrono::steady_clock::now());
+        report(last_, now, "interval");
+        report(first_, now, "total");
+        if (csv_) {
+            fclose(csv_);
+            csv_ = nullptr;
+        }
+    }
+
+private:
+    struct Counter {
+        Counter(const std::string& name, const std::string& rate_unit, double rate_scale)
+            : name(name), rate_unit(rate_unit), rate_scale(rate_scale) {}
+        std::string name;
+        std::string rate_unit;
+        double rate_scale;
+        std::atomic<uint64_t> value{0};
+    };
+
+    struct Histogram {
+        Histogram(const std::string& name, const std::string& unit, double scale, int64_t highest)
+            : name(name), unit(unit), scale(scale), values(highest) {}
+        std::string name;
+        std::string unit;
+        double scale;
+        HdrHistogram values;
+    };
+
+    struct Snapshot {
+        std::chrono::steady_clock::time_point time;
+        std::vector<uint64_t> counters;
+        std::vector<HdrHistogram> histograms;
+    };
+
+    Snapshot takeSnapshot(std::chrono::steady_clock::time_point time) const {
+        Snapshot s;
+        s.time = time;
+        for (const Counter& counter : counters_) s.counters.push_back(counter.value.load(std::memory_order_relaxed));
+        for (const Histogram& histogram : histograms_) s.histograms.push_back(histogram.values.snapshot());
+        return s;
+    }
+
+    void loop() {
+        std::unique_lock<std::mutex> lock(mute_);
+        auto next = started_ + std::chrono::milliseconds(interval_ms_);
+        while (running_) {
+            if (wake_.wait_until(lock, next, [this] { return !running_; })) break;
+            Snapshot now = takeSnapshot(std::chrono::steady_clock::now());
+            report(last_, now, "interval");
+            last_ = std::move(now);
+            next += std::chrono::milliseconds(interval_ms_);
+        }
+    }
+
+    void report(const Snapshot& from, const Snapshot& to, const char* kind) {
+        double seconds = std::chrono::duration<double>(to.time - from.time).count();
+        double elapsed = std::chrono::duration<double>(to.time - started_).count();
+        bool total = std::strcmp(kind, "total") == 0;
+        char text[256];
+        snprintf(text, sizeof(text), total ? "[total %.1fs]" : "[%.1fs]", total ? seconds : elapsed);
+        std::string line = text;
+        bool idle = true;
+        std::string row;
+        snprintf(text, sizeof(text), "%s,%.3f,%.3f", kind, elapsed, seconds);
+        row += text;
+
+        for (size_t i = 0; i < counters_.size(); i++) {
+            const Counter& counter = counters_[i];
+            uint64_t delta = to.counters[i] - from.counters[i];
+            idle = idle && delta == 0;
+            double rate = seconds > 0 ? double(delta) / seconds * counter.rate_scale : 0;
+            snprintf(text, sizeof(text), " %s %llu", counter.name.c_str(), (unsigned long long)delta);
+            line += text;
+            if (!counter.rate_unit.empty()) {
+                snprintf(text, sizeof(text), " (%.1f %s)", rate, counter.rate_unit.c_str());
+                line += text;
+            }
+            snprintf(text, sizeof(text), ",%llu,%.3f", (unsigned long long)delta, rate);
+            row += text;
+        }
+
+        for (size_t i = 0; i < histograms_.size(); i++) {
+            const Histogram& histogram = histograms_[i];
+            HdrHistogram values = to.histograms[i];
+            values.subtract(from.histograms[i]);
+            uint64_t count = values.count();
+            auto shown = [&](int64_t v) { return double(v) / histogram.scale; };
+            if (count == 0) {
+                snprintf(text, sizeof(text), "  %s n=0", histogram.name.c_str());
+                line += text;
+                row += ",0,,,,,";
+                continue;
+            }
+            idle = false;
+            double mean = values.mean() / histogram.scale;
+            snprintf(text, sizeof(text), "  %s n=%llu p50=%.2f p90=%.2f p99=%.2f max=%.2f mean=%.2f %s",
+                     histogram.name.c_str(), (unsigned long long)count, shown(values.percentile(50)),
+                     shown(values.percentile(90)), shown(values.percentile(99)), shown(values.max()), mean,
+                     histogram.unit.c_str());
+            line += text;
+            snprintf(text, sizeof(text), ",%llu,%.3f,%.3f,%.3f,%.3f,%.3f", (unsigned long long)count,
+                     shown(values.percentile(50)), shown(values.percentile(90)), shown(values.percentile(99)),
+                     shown(values.max()), mean);
+            row += text;
+        }
+
+        if (!idle || total) {
+            printf("%s\n", line.c_str());
+            fflush(stdout);
+        }
+        if (csv_) {
+            fprintf(csv_, "%s\n", row.c_str());
+            fflush(csv_);
+        }
+    }
+
+    void writeCsvHeader() {
+        fprintf(csv_, "kind,time_s,interval_s");
+        for (const Counter& counter : counters_) {
+            fprintf(csv_, ",%s,%s_per_s", counter.name.c_str(), counter.name.c_str());
+        }
+        for (const Histogram& histogram : histograms_) {
+            const char* n = histogram.name.c_str();
+            fprintf(csv_, ",%s_n,%s_p50,%s_p90,%s_p99,%s_max,%s_mean", n, n, n, n, n, n);
+        }
+        fprintf(csv_, "\n");
+    }
+
+    int interval_ms_;
+    std::deque<Counter> counters_;          // Deques: references stay valid as metrics are added
+    std::deque<Histogram> histograms_;
+    std::chrono::steady_clock::time_point started_;
+    Snapshot first_, last_;
+    std::mutex mute_;                       // Reporter thread wake-up only
+    std::condition_variable wake_;
+    std::thread thread_;
+    bool running_ = false;
+    FILE* csv_ = nullptr;
+};
+
+} // namespace measure
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef LATENCY_HARNESS_H
+#define LATENCY_HARNESS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "audio_io.h"
+#include "hdr_histogram.h"
+
+// Acoustic mouth-to-ear latency harness.
+// Network delay is only part of what a musician hears: the capture period,
+// the send, jitter and playback buffers and the DAC all add to it. The harness
+// measures the whole chain by putting a known sound through it.
+//
+// The sending client mixes a short chirp (a Hann-windowed linear sweep) into
+// its capture stream, starting exactly on a grid of period_us on a clock both
+// ends share. The receiving client records what it plays (an audio_io source:
+// an ALSA loopback device, or a microphone in front of its speaker) and runs
+// a matched filter over the recording: where the normalized cross-correlation
+// with the chirp peaks, the chirp came out. Its start time modulo the period is the
+// end-to-end latency, so nothing but the grid needs to be agreed, and the
+// period has to exceed the worst latency (default 1 s).
+//
+// Capture times come from the source delay: the sample just read was picked up
+// frames_queued frames ago, the first of the buffer frames_read before that.
+// The shared clock is the relay clock estimate for the TCP client and the
+// wall clock for the UDP peers (same host, or NTP/PTP synced); clock error
+// shows up 1:1 in the result.
+
+namespace acoustic {
+
+constexpr double Chirp_Start_Hz = 1000.0;
+constexpr double Chirp_End_Hz = 8000.0;
+constexpr int Chirp_Ms = 20;
+constexpr double Chirp_Level = 0.5;         // Of full scale, mixed over the capture
+constexpr double Detect_Threshold = 0.5;    // Normalized correlation for a detection
+constexpr uint64_t Default_Period_us = 1000000;
+constexpr int64_t Max_Latency_us = 10000000;    // Histogram range
+constexpr uint64_t Report_Every = 10;        // Detections between summaries
+
+// Chirp samples at a rate, peak 1.0
+inline std::vector<float> makeChirp(int rate) {
+    size_t length = size_t(rate) * Chirp_Ms / 1000;
+    std::vector<float> chirp(length);
+    double duration = double(length) / rate;
+    double sweep = (Chirp_End_Hz - Chirp_Start_Hz) / duration;
+    for (size_t i = 0; i < length; i++) {
+        double t = double(i) / rate;
+        double window = 0.5 - 0.5 * std::cos(2.0 * M_PI * double(i) / double(length - 1));
+        chirp[i] = float(window * std::sin(2.0 * M_PI * (Chirp_Start_Hz * t + 0.5 * sweep * t * t)));
+    }
+    return chirp;
+}
+
+// Time of the first frame of a buffer just read from a source
+inline uint64_t firstFrameUs(uint64_t now_us, long frames_read, long frames_queued, int rate) {
+    return now_us - uint64_t((frames_read + std::max(frames_queued, 0L)) * 1000000LL / rate);
+}
+
+// Capture side: mixes the chirp into interleaved S16 audio on the period grid
+class ChirpInjector {
+public:
+    ChirpInjector(int rate, int channels, uint64_t period_us = Default_Period_us)
+        : rate_(rate), channels_(channels), period_us_(period_us), chirp_(makeChirp(rate)),
+          chirp_us_(uint64_t(chirp_.size()) * 1000000 / uint64_t(rate)) {}
+
+    // first_us: shared-clock time of samples[0]
+    void process(int16_t* samples, size_t frames, uint64_t first_us) {
+        uint64_t end_us = first_us + uint64_t(frames) * 1000000 / uint64_t(rate_);
+        //First buffer, or the clock jumped past a whole chirp: wait for the next grid point
+        if (due_us_ == 0 || first_us > due_us_ + chirp_us_ || due_us_ > end_us + period_us_) {
+            due_us_ = (first_us / period_us_ + 1) * period_us_;
+        }
+        if (end_us <= due_us_) return;
+
+        //Chirp sample k belongs at due + k / rate
+        double start = double(int64_t(first_us) - int64_t(due_us_)) * rate_ / 1e6;
+        for (size_t i = 0; i < frames; i++) {
+            long long k = std::llround(start + double(i));
+            if (k < 0 || k >= (long long)chirp_.size()) continue;
+            int32_t add = int32_t(std::lround(chirp_[size_t(k)] * Chirp_Level * 32767.0));
+            for (int c = 0; c < channels_; c++) {
+                int16_t& s = samples[i * size_t(channels_) + size_t(c)];
+                s = int16_t(std::min(32767, std::max(-32768, int32_t(s) + add)));
+            }
+        }
+        if (end_us >= due_us_ + chirp_us_) {
+            injected_++;
+            due_us_ += period_us_;
+        }
+    }
+
+    uint64_t injected() const { return injected_; }
+
+private:
+    int rate_;
+    int channels_;
+    uint64_t period_us_;
+    std::vector<float> chirp_;
+    uint64_t chirp_us_;
+    uint64_t due_us_ = 0;
+    uint64_t injected_ = 0;
+};
+
+// Listening side: matched filter over the recording, latency per chirp found
+class ChirpDetector {
+public:
+    ChirpDetector(int rate, uint64_t period_us = Default_Period_us)
+        : rate_(rate), period_us_(period_us), chirp_(makeChirp(rate)), latency_(Max_Latency_us) {
+        for (float v : chirp_) chirp_energy_ += double(v) * v;
+    }
+
+    // Interleaved S16 recording; first_us: shared-clock time of samples[0], 0 if unknown yet
+    void process(const int16_t* samples, size_t frames, int channels, uint64_t first_us) {
+        if (first_us == 0) {
+            history_.clear();
+            return;
+        }
+        if (started_us_ == 0) started_us_ = first_us;
+        last_us_ = first_us;
+        size_t length = chirp_.size();
+
+        //Window n covers history_[n, n + length): the tail of the previous buffer, then this one
+        size_t carried = history_.size();
+        for (size_t i = 0; i < frames; i++) {
+            int32_t sum = 0;
+            for (int c = 0; c < channels; c++) sum += samples[i * size_t(channels) + size_t(c)];
+            history_.push_back(float(sum) / float(channels * 32768));
+        }
+        //Window energy slides: add the sample entering, drop the one leaving. It is summed
+        //afresh once per window length so rounding in the running sum cannot build up.
+        double energy = 0;
+        for (size_t n = 0; n + length <= history_.size(); n++) {
+            const float* window = history_.data() + n;
+            if (n % length == 0) {
+                energy = 0;
+                for (size_t k = 0; k < length; k++) energy += double(window[k]) * window[k];
+            } else {
+                double in = window[length - 1], out = window[-1];
+                energy = std::max(0.0, energy + in * in - out * out);
+            }
+            double dot = 0;
+            for (size_t k = 0; k < length; k++) {
+                dot += double(window[k]) * chirp_[k];
+            }
+            double score = energy > 0 ? dot / std::sqrt(energy * chirp_energy_) : 0.0;
+            int64_t start_us = int64_t(first_us) + (int64_t(n) - int64_t(carried)) * 1000000 / rate_;
+            consider(score, start_us);
+        }
+        size_t keep = std::min(history_.size(), length - 1);
+        history_.erase(history_.begin(), history_.end() - long(keep));
+    }
+
+    // Latency of every chirp found so far, microseconds
+    const measure::HdrHistogram& latency() const { return latency_; }
+    uint64_t detected() const { return latency_.count(); }
+    uint64_t early() const { return early_; }
+
+    // Grid points passed since listening started, less those found
+    uint64_t missed() const {
+        uint64_t expected = last_us_ / period_us_ - started_us_ / period_us_;
+        uint64_t found = latency_.count() + early_;
+        return expected > found ? expected - found : 0;
+    }
+
+    // Called with each latency as it is found
+    std::function<void(int64_t latency_us, double score)> on_detect;
+
+private:
+    //Peak picking: the best score over a chirp length past the threshold wins
+    void consider(double score, int64_t start_us) {
+        if (start_us < holdoff_until_us_) return;
+        if (peak_score_ > 0 && start_us - peak_us_ > Chirp_Ms * 1000) {
+            finish();
+            if (start_us < holdoff_until_us_) return;
+        }
+        if (score >= Detect_Threshold && score > peak_score_) {
+            peak_score_ = score;
+            peak_us_ = start_us;
+        }
+    }
+
+    //Latency is the start time past its grid point; just under a period means the clock is behind
+    void finish() {
+        int64_t period = int64_t(period_us_);
+        int64_t latency = peak_us_ % period;
+        if (latency > period - period / 10) {
+            early_++;
+        } else {
+            latency_.record(latency);
+            if (on_detect) on_detect(latency, peak_score_);
+        }
+        holdoff_until_us_ = peak_us_ + period / 2;
+        peak_score_ = 0;
+    }
+
+    int rate_;
+    uint64_t period_us_;
+    std::vector<float> chirp_;
+    double chirp_energy_ = 0;
+    std::vector<float> history_;
+    double peak_score_ = 0;
+    int64_t peak_us_ = 0;
+    int64_t holdoff_until_us_ = 0;
+    uint64_t started_us_ = 0;
+    uint64_t last_us_ = 0;
+    uint64_t early_ = 0;
+    measure::HdrHistogram latency_;
+};
+
+inline void printSummary(const std::string& label, const ChirpDetector& detector) {
+    const measure::HdrHistogram& latency = detector.latency();
+    auto ms = [](int64_t us) { return double(us) / 1000.0; };
+    printf("[chirp] %s: n=%llu min=%.2f p50=%.2f p90=%.2f p99=%.2f max=%.2f mean=%.2f ms, missed %llu, early %llu\n",
+           label.c_str(), (unsigned long long)latency.count(), ms(latency.min()), ms(latency.percentile(50)),
+           ms(latency.percentile(90)), ms(latency.percentile(99)), ms(latency.max()), latency.mean() / 1000.0,
+           (unsigned long long)detector.missed(), (unsigned long long)detector.early());
+    fflush(stdout);
+}
+
+// Records from an audio_io source spec until stop, feeding the detector and reporting
+// as chirps come in. clock() gives shared-clock microseconds, or 0 while not synced.
+inline bool listen(const std::string& spec, int rate, int channels, uint64_t period_us,
+                   const std::function<uint64_t()>& clock, const std::string& label,
+                   const std::atomic<bool>& stop) {
+    std::unique_ptr<audio::Source> source = audio::openSource(spec, {rate, channels, 10000});
+    if (!source) {
+        fprintf(stderr, "Chirp listen input %s unavailable.\n", spec.c_str());
+        return false;
+    }
+
+    ChirpDetector detector(rate, period_us);
+    detector.on_detect = [&](int64_t latency_us, double score) {
+        printf("[chirp] %s: %.2f ms (score %.2f)\n", label.c_str(), double(latency_us) / 1000.0, score);
+        if (detector.detected() % Report_Every == 0) printSummary(label, detector);
+        fflush(stdout);
+    };
+
+    std::vector<int16_t> buffer(size_t(rate / 100) * size_t(channels));
+    while (!stop) {
+        long frames = source->read(buffer.data(), buffer.size() / size_t(channels));
+        if (frames < 0) {
+            int err = source->recover(int(frames));
+            if (err < 0) {
+                fprintf(stderr, "Chirp listen error: %s\n", audio::errorText(err));
+                break;
+            }
+            continue;
+        }
+        long queued = source->delay();
+        uint64_t now = clock();
+        detector.process(buffer.data(), size_t(frames), channels, now ? firstFrameUs(now, frames, queued, rate) : 0);
+    }
+    printSummary(label, detector);
+    return true;
+}
+
+} // namespace acoustic
+
+#endif
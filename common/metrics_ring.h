@@ -0,0 +1,228 @@
+#ifndef METRICS_RING_H
+#define METRICS_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Client metrics in shared memory, for an observer such as Measure.py.
+// The client publishes one small record per audio buffer (times, sizes,
+// levels, delay) into a POSIX shared memory segment, /dev/shm/<name>. Nothing
+// the observer does can hold the client up: the segment is a set of lanes, each
+// an overwriting ring with exactly one producer thread, and a push is a couple
+// of stores. An observer that falls behind loses the oldest records and knows
+// how many it lost; one that never shows up costs nothing.
+//
+// Layout (little endian, offsets in bytes):
+//
+//   0                 SegmentHeader: magic, version, slot size, capacity, lanes, pid
+//   64 + 64 * lane    records written to the lane so far (u64)
+//   64 + 64 * lanes   lanes * capacity slots of 64 bytes: [u64 sequence][MetricRecord]
+//
+// Record n of a lane goes to slot n % capacity. The producer zeroes the slot's
+// sequence, writes the record, then stores n + 1 in the sequence and the lane
+// head. A reader copies the record between two reads of the sequence; if
+// either is not n + 1 the slot was being rewritten and record n is lost.
+//
+// A segment has one producer process: create() fails when the name is held by
+// a live client, and only takes over a segment whose client is gone.
+
+namespace telemetry {
+
+constexpr char Segment_Magic[8] = "EPMETR1";
+constexpr uint32_t Segment_Version = 1;
+constexpr size_t Slot_Size = 64;
+constexpr uint32_t Default_Capacity = 4096;     // Records per lane, ~40 s of 1024-frame buffers
+
+// Record kinds
+constexpr uint16_t Metric_Capture = 1;      // A buffer captured and sent
+constexpr uint16_t Metric_Playback = 2;     // A frame received and played
+
+struct MetricRecord {
+    uint64_t wall_us;       // System clock when recorded
+    uint64_t stamp_us;      // Frame timestamp (relay time), 0 if none
+    int64_t delay_us;       // One-way delay sender to us, -1 if unknown
+    uint32_t seq;           // Frame sequence number
+    uint16_t kind;
+    uint16_t stream_id;
+    uint32_t frames;
+    uint32_t bytes;         // Payload on the wire
+    float peak;             // Of full scale, 0..1
+    float rms;
+};
+static_assert(sizeof(MetricRecord) == 48, "MetricRecord layout is shared with Measure.py");
+
+struct SegmentHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t capacity;
+    uint32_t lanes;
+    uint32_t pid;           // Producer; a new pid means a new run
+};
+
+struct alignas(64) LaneHead {
+    std::atomic<uint64_t> written{0};
+};
+
+struct alignas(64) Slot {
+    std::atomic<uint64_t> sequence{0};
+    MetricRecord record;
+};
+static_assert(sizeof(Slot) == Slot_Size, "Slot layout is shared with Measure.py");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Lanes need lock-free 64-bit atomics");
+
+// Peak and RMS of interleaved S16 audio, of full scale
+inline void audioLevels(const int16_t* samples, size_t count, float& peak, float& rms) {
+    int32_t top = 0;
+    double energy = 0;
+    for (size_t i = 0; i < count; i++) {
+        int32_t s = samples[i];
+        top = std::max(top, s < 0 ? -s : s);
+        energy += double(s) * s;
+    }
+    peak = float(top) / 32768.0f;
+    rms = count ? float(std::sqrt(energy / double(count)) / 32768.0) : 0.0f;
+}
+
+inline size_t segmentSize(uint32_t lanes, uint32_t capacity) {
+    return 64 + 64 * size_t(lanes) + Slot_Size * size_t(lanes) * capacity;
+}
+
+// Producer side. Each lane must be pushed from one thread only.
+class MetricsWriter {
+public:
+    MetricsWriter() = default;
+    ~MetricsWriter() { close(); }
+
+    MetricsWriter(const MetricsWriter&) = delete;
+    MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+    // name: "/something"; capacity is rounded up to a power of two
+    bool create(const std::string& name, uint32_t lanes, uint32_t capacity = Default_Capacity) {
+        uint32_t rounded = 2;
+        while (rounded < capacity) rounded <<= 1;
+        size_t size = segmentSize(lanes, rounded);
+
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        int error = fd < 0 ? errno : 0;
+        uint32_t owner = 0;
+        if (error == EEXIST) {
+            //A client that was killed (Ctrl+C) leaves its segment behind
+            owner = ownerPid(name);
+            if (owner != 0 && kill(pid_t(owner), 0) < 0 && errno == ESRCH) {
+                shm_unlink(name.c_str());
+                fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+                error = fd < 0 ? errno : 0;
+            }
+        }
+        if (fd < 0) {
+            if (error == EEXIST && owner != 0) {
+                fprintf(stderr, "Metrics segment %s is in use by pid %u; give each client its own name\n",
+                        name.c_str(), owner);
+            } else if (error == EEXIST) {
+                fprintf(stderr, "Metrics segment %s exists without an owner; remove /dev/shm/%s\n", name.c_str(),
+                        name.c_str() + (name[0] == '/'));
+            } else {
+                fprintf(stderr, "Metrics segment %s: %s\n", name.c_str(), strerror(error));
+            }
+            return false;
+        }
+        if (ftruncate(fd, off_t(size)) < 0) {
+            fprintf(stderr, "Metrics segment %s size: %s\n", name.c_str(), strerror(errno));
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+        void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            fprintf(stderr, "Metrics segment %s map: %s\n", name.c_str(), strerror(errno));
+            shm_unlink(name.c_str());
+            return false;
+        }
+
+        base_ = static_cast<uint8_t*>(base);
+        size_ = size;
+        name_ = name;
+        lanes_ = lanes;
+        mask_ = rounded - 1;
+        heads_ = reinterpret_cast<LaneHead*>(base_ + 64);
+        slots_ = reinterpret_cast<Slot*>(base_ + 64 + 64 * size_t(lanes));
+        for (uint32_t i = 0; i < lanes; i++) new (&heads_[i]) LaneHead;
+        for (size_t i = 0; i < size_t(lanes) * rounded; i++) new (&slots_[i]) Slot;
+
+        //Magic last: a reader that sees it sees the rest
+        SegmentHeader* header = reinterpret_cast<SegmentHeader*>(base_);
+        header->version = Segment_Version;
+        header->slot_size = Slot_Size;
+        header->capacity = rounded;
+        header->lanes = lanes;
+        header->pid = uint32_t(getpid());
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, Segment_Magic, sizeof(header->magic));
+        return true;
+    }
+
+    bool open() const { return base_ != nullptr; }
+
+    // Never blocks; a no-op when no segment is open
+    void push(uint32_t lane, const MetricRecord& record) {
+        if (!base_ || lane >= lanes_) return;
+        std::atomic<uint64_t>& written = heads_[lane].written;
+        uint64_t n = written.load(std::memory_order_relaxed);
+        Slot& slot = slots_[size_t(lane) * (mask_ + 1) + (n & mask_)];
+        slot.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.record = record;
+        slot.sequence.store(n + 1, std::memory_order_release);
+        written.store(n + 1, std::memory_order_release);
+    }
+
+    // Unmaps and removes the segment; readers keep their mapping until they let go
+    void close() {
+        if (!base_) return;
+        munmap(base_, size_);
+        shm_unlink(name_.c_str());
+        base_ = nullptr;
+    }
+
+private:
+    // Producer pid recorded in an existing segment, 0 if it has none yet
+    static uint32_t ownerPid(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) return 0;
+        SegmentHeader header = {};
+        ssize_t got = pread(fd, &header, sizeof(header), 0);
+        ::close(fd);
+        if (got != ssize_t(sizeof(header)) || memcmp(header.magic, Segment_Magic, sizeof(header.magic)) != 0) {
+            return 0;
+        }
+        return header.pid;
+    }
+
+    uint8_t* base_ = nullptr;
+    size_t size_ = 0;
+    std::string name_;
+    uint32_t lanes_ = 0;
+    uint64_t mask_ = 0;
+    LaneHead* heads_ = nullptr;
+    Slot* slots_ = nullptr;
+};
+
+} // namespace telemetry
+
+#endif
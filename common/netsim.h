@@ -0,0 +1,559 @@
+#ifndef NETSIM_H
+#define NETSIM_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "pcap_capture.h"
+
+// In-process network impairment for UDP sockets (a netem in the application).
+// UdpShim stands in for sendto/recvfrom on one socket and passes datagrams
+// through a Link model on the way out, on the way in, or both:
+//
+//   loss=2%                    Bernoulli loss
+//   gilbert=1%:30%[:0%:100%]   Gilbert-Elliott: good->bad, bad->good, loss in good, in bad
+//   delay=40ms jitter=10ms     constant delay plus normally distributed jitter
+//   reorder=5%                 packets that skip the delay and overtake the queue
+//   dup=1%                     duplicated packets
+//   rate=512kbit               serialization at a link rate, tail drop past 1 s of backlog
+//   seed=7                     RNG seed; the same seed and traffic give the same fate
+//
+// A spec is a comma-separated list of those, e.g. "loss=1%,delay=30ms,jitter=5ms".
+// Packets keep their order unless reordered: jitter stretches the gaps but a
+// packet never leaves before the one ahead of it, as on a real queue.
+//
+// Egress packets wait in a timer queue drained by a thread of the shim, so
+// sendto returns at once like a real UDP send. Ingress is lazy: recvfrom reads
+// the socket, queues what arrives with its due time and hands out packets as
+// they come due, honouring SO_RCVTIMEO. Any number of threads may send; one
+// thread receives.
+//
+// The shim is also where sessions are captured and replayed. record() logs
+// every datagram the application sends and every one the socket receives,
+// with its kernel arrival time, to a pcapng file (pcap_capture.h). replay()
+// takes the received datagrams from such a file instead of the socket, at
+// their original spacing or a multiple of it, and drops what the application
+// sends; ingress impairment still applies on top. Once the recording runs
+// out, recvfrom behaves like a socket nothing arrives on any more: it times
+// out per SO_RCVTIMEO or, without a timeout, returns 0.
+
+namespace netsim {
+
+constexpr double Max_Backlog_s = 1.0;      // Rate limiter queue before tail drop
+constexpr size_t Max_Datagram = 65536;
+
+struct Impairment {
+    double loss = 0;            // Bernoulli, 0..1
+    double ge_p = 0;            // Gilbert-Elliott good -> bad per packet
+    double ge_r = 0;            // ... bad -> good
+    double ge_loss_good = 0;
+    double ge_loss_bad = 1;
+    double delay_ms = 0;
+    double jitter_ms = 0;       // Standard deviation
+    double reorder = 0;
+    double duplicate = 0;
+    double rate_bps = 0;        // 0: unlimited
+    uint64_t seed = 1;
+
+    bool enabled() const {
+        return loss > 0 || ge_p > 0 || delay_ms > 0 || jitter_ms > 0 || reorder > 0 || duplicate > 0 || rate_bps > 0;
+    }
+};
+
+// "2%" or "0.02" as a probability, "40ms" / "0.04s" as milliseconds, "512kbit" as bits/s
+inline bool parseNumber(const std::string& text, double& value, const char* unit) {
+    char* end = nullptr;
+    value = strtod(text.c_str(), &end);
+    if (end == text.c_str()) return false;
+    std::string suffix = end;
+    if (strcmp(unit, "p") == 0) {
+        if (suffix == "%") value /= 100.0;
+        else if (!suffix.empty()) return false;
+        return value >= 0 && value <= 1;
+    }
+    if (strcmp(unit, "ms") == 0) {
+        if (suffix == "s") value *= 1000.0;
+        else if (suffix == "us") value /= 1000.0;
+        else if (suffix != "ms" && !suffix.empty()) return false;
+        return value >= 0;
+    }
+    double scale = suffix == "kbit" ? 1e3 : suffix == "mbit" ? 1e6 : suffix == "bit" || suffix.empty() ? 1 : 0;
+    value *= scale;
+    return scale > 0 && value >= 0;
+}
+
+// Spec as in the header comment; false (after printing why) on anything unknown
+inline bool parseImpairment(const std::string& spec, Impairment& out) {
+    Impairment imp;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t comma = spec.find(',', start);
+        std::string item = spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = comma == std::string::npos ? spec.size() : comma + 1;
+        size_t eq = item.find('=');
+        std::string key = item.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : item.substr(eq + 1);
+        bool ok = !value.empty();
+        if (key == "loss") {
+            ok = ok && parseNumber(value, imp.loss, "p");
+        } else if (key == "gilbert") {
+            double* fields[] = {&imp.ge_p, &imp.ge_r, &imp.ge_loss_good, &imp.ge_loss_bad};
+            size_t at = 0;
+            int n = 0;
+            while (ok && at <= value.size() && n < 4) {
+                size_t colon = value.find(':', at);
+                std::string field = value.substr(at, colon == std::string::npos ? std::string::npos : colon - at);
+                ok = parseNumber(field, *fields[n++], "p");
+                at = colon == std::string::npos ? value.size() + 1 : colon + 1;
+            }
+            ok = ok && n >= 2 && at > value.size();
+        } else if (key == "delay") {
+            ok = ok && parseNumber(value, imp.delay_ms, "ms");
+        } else if (key == "jitter") {
+            ok = ok && parseNumber(value, imp.jitter_ms, "ms");
+        } else if (key == "reorder") {
+            ok = ok && parseNumber(value, imp.reorder, "p");
+        } else if (key == "dup") {
+            ok = ok && parseNumber(value, imp.duplicate, "p");
+        } else if (key == "rate") {
+            ok = ok && parseNumber(value, imp.rate_bps, "bit");
+        } else if (key == "seed") {
+            imp.seed = strtoull(value.c_str(), nullptr, 10);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            fprintf(stderr, "Bad impairment \"%s\" (loss= gilbert=p:r[:lg:lb] delay= jitter= reorder= dup= rate= seed=)\n",
+                    item.c_str());
+            return false;
+        }
+    }
+    out = imp;
+    return true;
+}
+
+struct LinkStats {
+    uint64_t packets = 0;
+    uint64_t lost = 0;
+    uint64_t tail_dropped = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0;
+};
+
+// Fate of each packet on one direction of a link
+class Link {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit Link(const Impairment& imp) : imp_(imp), rng_(imp.seed) {}
+
+    // Delivery times of a packet offered now: none if lost, two if duplicated
+    std::vector<Clock::time_point> schedule(size_t bytes, Clock::time_point now) {
+        std::vector<Clock::time_point> out;
+        stats_.packets++;
+        if (lost()) {
+            stats_.lost++;
+            return out;
+        }
+        int copies = chance(imp_.duplicate) ? 2 : 1;
+        if (copies == 2) stats_.duplicated++;
+        for (int i = 0; i < copies; i++) {
+            //Serialization at the link rate
+            Clock::time_point sent = now;
+            if (imp_.rate_bps > 0) {
+                Clock::time_point start = std::max(now, link_free_);
+                if (start - now > std::chrono::duration<double>(Max_Backlog_s)) {
+                    stats_.tail_dropped++;
+                    continue;
+                }
+                link_free_ = start + std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::duration<double>(double(bytes) * 8.0 / imp_.rate_bps));
+                sent = link_free_;
+            }
+            //Reordered packets skip the delay; the rest queue behind each other
+            if (chance(imp_.reorder)) {
+                stats_.reordered++;
+                out.push_back(sent);
+                continue;
+            }
+            double delay_ms = imp_.delay_ms;
+            if (imp_.jitter_ms > 0) {
+                delay_ms = std::max(0.0, delay_ms + std::normal_distribution<double>(0.0, imp_.jitter_ms)(rng_));
+            }
+            Clock::time_point due = sent + std::chrono::duration_cast<Clock::duration>(
+                                               std::chrono::duration<double, std::milli>(delay_ms));
+            due = std::max(due, last_due_);
+            last_due_ = due;
+            out.push_back(due);
+        }
+        return out;
+    }
+
+    const Impairment& impairment() const { return imp_; }
+    const LinkStats& stats() const { return stats_; }
+
+private:
+    bool chance(double p) { return p > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < p; }
+
+    bool lost() {
+        bool lost = chance(imp_.loss);
+        if (imp_.ge_p > 0) {
+            bad_ = bad_ ? !chance(imp_.ge_r) : chance(imp_.ge_p);
+            lost = chance(bad_ ? imp_.ge_loss_bad : imp_.ge_loss_good) || lost;
+        }
+        return lost;
+    }
+
+    Impairment imp_;
+    std::mt19937_64 rng_;
+    bool bad_ = false;
+    Clock::time_point link_free_{};
+    Clock::time_point last_due_{};
+    LinkStats stats_;
+};
+
+// sendto/recvfrom for one UDP socket through impaired links; a pass-through until attached
+class UdpShim {
+public:
+    using Clock = Link::Clock;
+
+    UdpShim() = default;
+    UdpShim(const UdpShim&) = delete;
+    UdpShim& operator=(const UdpShim&) = delete;
+    ~UdpShim() { detach(); }
+
+    void attach(int fd, const Impairment& egress, const Impairment& ingress) {
+        detach();
+        fd_ = fd;
+        recv_buffer_.resize(Max_Datagram);
+        if (egress.enabled()) {
+            egress_.reset(new Link(egress));
+            stop_ = false;
+            sender_ = std::thread(&UdpShim::sendLoop, this);
+        }
+        if (ingress.enabled()) {
+            ingress_.reset(new Link(ingress));
+        }
+        timeval timeout = {};
+        socklen_t size = sizeof(timeout);
+        if (getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, &size) == 0) {
+            recv_timeout_ = std::chrono::seconds(timeout.tv_sec) + std::chrono::microseconds(timeout.tv_usec);
+        }
+    }
+
+    // Log the attached socket's traffic to capture (after attach, before traffic)
+    void record(pcap::Writer* capture) {
+        pcap_ = capture;
+        int on = 1;
+        if (setsockopt(fd_, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+            perror("SO_TIMESTAMPNS");   //Arrival times fall back to the time recvfrom returns
+        }
+        socklen_t len = sizeof(local_);
+        if (getsockname(fd_, reinterpret_cast<sockaddr*>(&local_), &len) < 0) {
+            local_ = {};
+            local_.sin_family = AF_INET;
+        }
+    }
+
+    // Receive from a capture instead of the socket (after attach); speed 0: no waiting
+    bool replay(const std::string& path, double speed) {
+        replay_.reset(new Replay);
+        if (!replay_->reader.open(path)) {
+            replay_.reset();
+            return false;
+        }
+        replay_->path = path;
+        replay_->speed = speed;
+        replay_->have_next = nextInbound();
+        return true;
+    }
+
+    bool replayEnded() const { return replay_ && !replay_->have_next; }
+
+    // Stops the egress thread; packets still queued are dropped
+    void detach() {
+        if (sender_.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mute_);
+                stop_ = true;
+            }
+            wake_.notify_all();
+            sender_.join();
+        }
+    }
+
+    ssize_t sendto(int fd, const void* data, size_t len, int flags, const sockaddr* addr, socklen_t addrlen) {
+        if (fd == fd_ && pcap_ && addr && addr->sa_family == AF_INET) {
+            pcap_->log(pcap::Outbound, pcap::wallNs(), local_, *reinterpret_cast<const sockaddr_in*>(addr), data, len);
+        }
+        if (fd == fd_ && replay_) return ssize_t(len);     //Offline: nothing goes out
+        if (fd != fd_ || !egress_) return ::sendto(fd, data, len, flags, addr, addrlen);
+        std::lock_guard<std::mutex> lock(mute_);
+        for (Clock::time_point due : egress_->schedule(len, Clock::now())) {
+            push(out_queue_, due, data, len, addr, addrlen);
+        }
+        wake_.notify_one();
+        return ssize_t(len);
+    }
+
+    ssize_t recvfrom(int fd, void* data, size_t len, int flags, sockaddr* addr, socklen_t* addrlen) {
+        if (fd != fd_ || (!ingress_ && !pcap_ && !replay_)) return ::recvfrom(fd, data, len, flags, addr, addrlen);
+        if (!ingress_ && !replay_) return receive(fd, data, len, flags, addr, addrlen);
+        Clock::time_point deadline = recv_timeout_.count() ? Clock::now() + recv_timeout_ : Clock::time_point::max();
+        std::vector<uint8_t>& buffer = recv_buffer_;
+        while (true) {
+            Clock::time_point now = Clock::now();
+            if (!in_queue_.empty() && in_queue_.top().due <= now) {
+                const Pending& head = in_queue_.top();
+                size_t n = std::min(len, head.data.size());
+                memcpy(data, head.data.data(), n);
+                if (addr && addrlen) {
+                    memcpy(addr, &head.addr, std::min<size_t>(*addrlen, head.addrlen));
+                    *addrlen = head.addrlen;
+                }
+                in_queue_.pop();
+                return ssize_t(n);
+            }
+            //Wait for the socket (or the recording) until the next packet is due or the caller's timeout
+            Clock::time_point until = std::min(deadline, in_queue_.empty() ? Clock::time_point::max() : in_queue_.top().due);
+            if (until <= now) {
+                errno = EAGAIN;
+                return -1;
+            }
+
+            sockaddr_storage from;
+            socklen_t from_len = sizeof(from);
+            ssize_t n;
+            if (replay_) {
+                if (!replay_->have_next && in_queue_.empty() && until == Clock::time_point::max()) {
+                    return 0;   //End of the recording and no timeout to wait out
+                }
+                n = replayed(buffer.data(), buffer.size(), from, from_len, until);
+                if (n < 0) continue;
+            } else {
+                pollfd pfd = {fd, POLLIN, 0};
+                timespec wait;
+                timespec* wait_ptr = nullptr;
+                if (until != Clock::time_point::max()) {
+                    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(until - now).count();
+                    wait = {time_t(ns / 1000000000), long(ns % 1000000000)};
+                    wait_ptr = &wait;
+                }
+                int ready = ppoll(&pfd, 1, wait_ptr, nullptr);
+                if (ready < 0 && errno != EINTR) return -1;
+                if (ready <= 0) continue;
+
+                n = receive(fd, buffer.data(), buffer.size(), flags | MSG_DONTWAIT, reinterpret_cast<sockaddr*>(&from), &from_len);
+                if (n < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                    return -1;
+                }
+            }
+            if (!ingress_) {
+                size_t copied = std::min(len, size_t(n));
+                memcpy(data, buffer.data(), copied);
+                if (addr && addrlen) {
+                    memcpy(addr, &from, std::min<size_t>(*addrlen, from_len));
+                    *addrlen = from_len;
+                }
+                return ssize_t(copied);
+            }
+            for (Clock::time_point due : ingress_->schedule(size_t(n), Clock::now())) {
+                push(in_queue_, due, buffer.data(), size_t(n), reinterpret_cast<sockaddr*>(&from), from_len);
+            }
+        }
+    }
+
+    // One line per impaired direction, for the end of a run
+    std::string summary() {
+        std::string text;
+        auto line = [&text](const char* name, const Link& link) {
+            const LinkStats& s = link.stats();
+            char buf[256];
+            snprintf(buf, sizeof(buf), "[netsim] %s: %llu packets, %llu lost, %llu tail-dropped, %llu duplicated, %llu reordered\n",
+                     name, (unsigned long long)s.packets, (unsigned long long)s.lost, (unsigned long long)s.tail_dropped,
+                     (unsigned long long)s.duplicated, (unsigned long long)s.reordered);
+            text += buf;
+        };
+        std::lock_guard<std::mutex> lock(mute_);
+        if (egress_) line("egress", *egress_);
+        if (ingress_) line("ingress", *ingress_);
+        if (replay_) {
+            char speed[32] = "full speed";
+            if (replay_->speed > 0) snprintf(speed, sizeof(speed), "%gx", replay_->speed);
+            char buf[512];
+            snprintf(buf, sizeof(buf), "[replay] %llu datagrams from %s at %s%s\n", (unsigned long long)replay_->packets,
+                     replay_->path.c_str(), speed, replay_->have_next ? "" : ", to the end");
+            text += buf;
+        }
+        return text;
+    }
+
+private:
+    struct Pending {
+        Clock::time_point due;
+        uint64_t order;
+        std::vector<uint8_t> data;
+        sockaddr_storage addr;
+        socklen_t addrlen;
+
+        //Earliest due first; equal times keep their order
+        bool operator>(const Pending& other) const {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+    using Queue = std::priority_queue<Pending, std::vector<Pending>, std::greater<Pending>>;
+
+    struct Replay {
+        pcap::Reader reader;
+        pcap::Packet next;
+        bool have_next = false;
+        std::string path;
+        double speed = 1;
+        uint64_t first_ns = 0;          // Capture time of the first datagram
+        Clock::time_point started;      // When it was replayed
+        uint64_t packets = 0;
+    };
+
+    //recvmsg with the kernel arrival time, logged when recording
+    ssize_t receive(int fd, void* data, size_t len, int flags, sockaddr* addr, socklen_t* addrlen) {
+        sockaddr_in from = {};
+        iovec iov = {data, len};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(timespec))];
+        msghdr msg = {};
+        msg.msg_name = &from;
+        msg.msg_namelen = sizeof(from);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(fd, &msg, flags);
+        if (n < 0) return n;
+
+        uint64_t t_ns = 0;
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                t_ns = uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+            }
+        }
+        if (pcap_) {
+            pcap_->log(pcap::Inbound, t_ns ? t_ns : pcap::wallNs(), local_, from, data, std::min(len, size_t(n)));
+        }
+        if (addr && addrlen) {
+            memcpy(addr, &from, std::min<size_t>(*addrlen, msg.msg_namelen));
+            *addrlen = msg.msg_namelen;
+        }
+        return n;
+    }
+
+    //Skip to the next received datagram of the recording
+    bool nextInbound() {
+        while (replay_->reader.next(replay_->next)) {
+            if (replay_->next.direction != pcap::Outbound) return true;
+        }
+        return false;
+    }
+
+    //The next recorded datagram once it is due, or -1 after waiting until then or until
+    ssize_t replayed(uint8_t* data, size_t len, sockaddr_storage& from, socklen_t& from_len, Clock::time_point until) {
+        Replay& r = *replay_;
+        Clock::time_point due = Clock::time_point::max();
+        if (r.have_next) {
+            if (r.packets == 0) {
+                r.first_ns = r.next.t_ns;
+                r.started = Clock::now();
+            }
+            double offset_ns = r.speed > 0 ? double(r.next.t_ns - std::min(r.next.t_ns, r.first_ns)) / r.speed : 0;
+            due = r.started + std::chrono::nanoseconds(int64_t(offset_ns));
+        }
+        if (due > Clock::now()) {
+            std::this_thread::sleep_until(std::min(due, until));
+            if (due > Clock::now()) return -1;
+        }
+
+        size_t n = std::min(len, r.next.payload.size());
+        memcpy(data, r.next.payload.data(), n);
+        memset(&from, 0, sizeof(from));
+        memcpy(&from, &r.next.source, sizeof(r.next.source));
+        from_len = sizeof(r.next.source);
+        if (pcap_) {
+            pcap_->log(pcap::Inbound, pcap::wallNs(), local_, r.next.source, data, n);
+        }
+        r.packets++;
+        r.have_next = nextInbound();
+        if (!r.have_next) {
+            printf("[replay] end of %s after %llu datagrams\n", r.path.c_str(), (unsigned long long)r.packets);
+        }
+        return ssize_t(n);
+    }
+
+    void push(Queue& queue, Clock::time_point due, const void* data, size_t len, const sockaddr* addr, socklen_t addrlen) {
+        Pending pending;
+        pending.due = due;
+        pending.order = order_++;
+        pending.data.assign(static_cast<const uint8_t*>(data), static_cast<const uint8_t*>(data) + len);
+        memset(&pending.addr, 0, sizeof(pending.addr));
+        pending.addrlen = std::min<socklen_t>(addrlen, sizeof(pending.addr));
+        if (addr) memcpy(&pending.addr, addr, pending.addrlen);
+        queue.push(std::move(pending));
+    }
+
+    void sendLoop() {
+        std::unique_lock<std::mutex> lock(mute_);
+        while (!stop_) {
+            if (out_queue_.empty()) {
+                wake_.wait(lock);
+                continue;
+            }
+            if (wake_.wait_until(lock, out_queue_.top().due) != std::cv_status::timeout &&
+                Clock::now() < out_queue_.top().due) {
+                continue;   //Woken early: a new packet may be due sooner
+            }
+            Pending head = out_queue_.top();
+            out_queue_.pop();
+            lock.unlock();
+            ::sendto(fd_, head.data.data(), head.data.size(), 0, reinterpret_cast<const sockaddr*>(&head.addr), head.addrlen);
+            lock.lock();
+        }
+    }
+
+    int fd_ = -1;
+    std::unique_ptr<Link> egress_;
+    std::unique_ptr<Link> ingress_;
+    std::chrono::microseconds recv_timeout_{0};
+    std::mutex mute_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::thread sender_;
+    Queue out_queue_;
+    Queue in_queue_;
+    std::atomic<uint64_t> order_{0};
+    pcap::Writer* pcap_ = nullptr;
+    sockaddr_in local_{};
+    std::unique_ptr<Replay> replay_;
+    std::vector<uint8_t> recv_buffer_;      // One datagram, for recvfrom (one receiving thread)
+};
+
+} // namespace netsim
+
+#endif
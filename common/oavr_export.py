@@ -0,0 +1,96 @@
+import glob
+import struct
+import sys
+import wave
+
+import cv2
+import numpy as np
+
+# Convert SessionRecorder segments (<prefix>_NNNN.oavr) into <prefix>.avi + <prefix>.wav
+# Usage: python3 oavr_export.py <prefix> [fps]
+
+FILE_HEADER = "<8sIIQIHH"   # magic, version, segment, start_us, sample_rate, channels, reserved
+RECORD_HEADER = "<IIQ"      # type, size, timestamp_us
+VIDEO_JPEG = 1
+AUDIO_PCM16 = 2
+VIDEO_STRIPS = 3
+
+
+def read_segment(path):
+    """Yield (type, timestamp_us, payload) records of one segment"""
+    with open(path, "rb") as f:
+        header = f.read(struct.calcsize(FILE_HEADER))
+        magic, version, segment, start_us, rate, channels, _ = struct.unpack(FILE_HEADER, header)
+        if magic.rstrip(b"\0") != b"OAVREC1":
+            raise ValueError(f"{path}: not a recording segment")
+        while True:
+            head = f.read(struct.calcsize(RECORD_HEADER))
+            if len(head) < struct.calcsize(RECORD_HEADER):
+                break
+            rtype, size, timestamp = struct.unpack(RECORD_HEADER, head)
+            payload = f.read(size)
+            if len(payload) < size:
+                break
+            yield rtype, timestamp, payload, rate, channels
+
+
+def decode_strips(payload):
+    """Decode a frame stored as [u32 size][JPEG] strips and stack them"""
+    strips = []
+    offset = 0
+    while offset + 4 <= len(payload):
+        (size,) = struct.unpack_from("<I", payload, offset)
+        offset += 4
+        strip = cv2.imdecode(np.frombuffer(payload[offset:offset + size], np.uint8), cv2.IMREAD_COLOR)
+        offset += size
+        if strip is None:
+            return None
+        strips.append(strip)
+    return np.vstack(strips) if strips else None
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: python3 oavr_export.py <prefix> [fps]")
+        return
+    prefix = sys.argv[1]
+    fps = float(sys.argv[2]) if len(sys.argv) > 2 else 30.0
+
+    records = []
+    for path in sorted(glob.glob(prefix + "_*.oavr")):
+        records.extend(read_segment(path))
+    records.sort(key=lambda r: r[1])
+
+    writer = None
+    audio = None
+    frames = 0
+    for rtype, timestamp, payload, rate, channels in records:
+        if rtype in (VIDEO_JPEG, VIDEO_STRIPS):
+            if rtype == VIDEO_JPEG:
+                image = cv2.imdecode(np.frombuffer(payload, np.uint8), cv2.IMREAD_COLOR)
+            else:
+                image = decode_strips(payload)
+            if image is None:
+                continue
+            if writer is None:
+                height, width = image.shape[:2]
+                writer = cv2.VideoWriter(prefix + ".avi", cv2.VideoWriter_fourcc(*"MJPG"), fps, (width, height))
+            writer.write(image)
+            frames += 1
+        elif rtype == AUDIO_PCM16 and rate > 0:
+            if audio is None:
+                audio = wave.open(prefix + ".wav", "wb")
+                audio.setnchannels(channels)
+                audio.setsampwidth(2)
+                audio.setframerate(rate)
+            audio.writeframes(payload)
+
+    if writer is not None:
+        writer.release()
+    if audio is not None:
+        audio.close()
+    print(f"Exported {frames} frames from {len(records)} records")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,332 @@
+#ifndef PCAP_CAPTURE_H
+#define PCAP_CAPTURE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <time.h>
+
+// Datagram capture in pcapng, for replaying field sessions offline.
+// Writer logs every datagram a socket sent or received as an Enhanced Packet
+// Block with nanosecond timestamps, a synthesized IPv4/UDP header (from the
+// socket's own address and the peer's) and the direction in epb_flags, so
+// Wireshark and tcpdump open the file as they would a capture of the wire.
+// Received datagrams carry the kernel's SO_TIMESTAMPNS arrival time; sent
+// ones the wall clock at sendto (CLOCK_REALTIME both).
+//
+// Any thread may log: a block's header and payload are appended to a buffer
+// under a short lock; a writer thread writes the buffer out and flushes the
+// file every Flush_Ms, so a killed process loses at most that much. Past Max_Pending unflushed bytes blocks are dropped and
+// counted rather than stalling the caller.
+//
+// Reader walks a file written by Writer (or any pcapng of raw IPv4 UDP) one
+// datagram at a time; netsim::UdpShim::replay() feeds those back to recvfrom.
+
+namespace pcap {
+
+constexpr uint32_t Block_Section = 0x0A0D0D0A;
+constexpr uint32_t Block_Interface = 1;
+constexpr uint32_t Block_Packet = 6;
+constexpr uint32_t Byte_Order_Magic = 0x1A2B3C4D;
+constexpr uint16_t Link_IPv4 = 228;         // LINKTYPE_IPV4: packets start at the IP header
+constexpr size_t Ip_Udp_Header = 28;
+constexpr size_t Max_Datagram = 65536;
+constexpr size_t Max_Pending = 64 << 20;    // Unflushed bytes before blocks are dropped
+constexpr int Flush_Ms = 50;
+
+// epb_flags direction bits
+enum Direction : uint32_t {
+    Direction_Unknown = 0,
+    Inbound = 1,
+    Outbound = 2,
+};
+
+struct Packet {
+    Direction direction = Direction_Unknown;
+    uint64_t t_ns = 0;              // Wall clock, ns since the epoch
+    sockaddr_in source{};
+    sockaddr_in destination{};
+    std::vector<uint8_t> payload;   // UDP payload
+};
+
+inline uint64_t wallNs() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+inline size_t pad4(size_t n) { return (n + 3) & ~size_t(3); }
+
+class Writer {
+public:
+    Writer() = default;
+    ~Writer() { stop(); }
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+    // Writes the section and interface blocks and starts the flush thread
+    bool start(const std::string& path) {
+        file_ = fopen(path.c_str(), "wb");
+        if (!file_) {
+            fprintf(stderr, "Capture file %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        path_ = path;
+
+        uint8_t head[28 + 32] = {};
+        uint8_t* p = head;
+        put32(p, Block_Section); put32(p, 28); put32(p, Byte_Order_Magic);
+        put16(p, 1); put16(p, 0);                          // Version 1.0
+        put32(p, 0xFFFFFFFF); put32(p, 0xFFFFFFFF);        // Section length unknown
+        put32(p, 28);
+        put32(p, Block_Interface); put32(p, 32);
+        put16(p, Link_IPv4); put16(p, 0); put32(p, 0);     // No snap length
+        put16(p, 9); put16(p, 1); *p = 9; p += 4;          // if_tsresol: 10^-9 s
+        put32(p, 0);                                       // opt_endofopt
+        put32(p, 32);
+        fwrite(head, 1, sizeof(head), file_);
+
+        running_ = true;
+        writer_ = std::thread(&Writer::flushLoop, this);
+        enabled_ = true;
+        return true;
+    }
+
+    // Flushes what is left and closes the file
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mute_);
+            enabled_ = false;
+            if (!running_) return;
+            running_ = false;
+        }
+        wake_.notify_one();
+        writer_.join();
+        fclose(file_);
+        file_ = nullptr;
+        printf("[capture] %llu datagrams (%llu bytes) to %s, %llu dropped\n", (unsigned long long)packets_,
+               (unsigned long long)bytes_, path_.c_str(), (unsigned long long)dropped_);
+    }
+
+    // Any thread; local and peer are the socket's own address and the other end's
+    void log(Direction direction, uint64_t t_ns, const sockaddr_in& local, const sockaddr_in& peer,
+             const void* payload, size_t len) {
+        len = std::min(len, Max_Datagram - Ip_Udp_Header);
+        const sockaddr_in& source = direction == Inbound ? peer : local;
+        const sockaddr_in& destination = direction == Inbound ? local : peer;
+        size_t captured = Ip_Udp_Header + len;
+        size_t padding = pad4(captured) - captured;
+        uint32_t total = uint32_t(28 + pad4(captured) + 12 + 4);
+        if (!enabled_) return;
+
+        // Only the fixed parts are built here; the payload is copied once, into pending_
+        uint8_t head[28 + Ip_Udp_Header];
+        uint8_t* p = head;
+        put32(p, Block_Packet); put32(p, total);
+        put32(p, 0);                                       // Interface 0
+        put32(p, uint32_t(t_ns >> 32)); put32(p, uint32_t(t_ns));
+        put32(p, uint32_t(captured)); put32(p, uint32_t(captured));
+        ipUdpHeader(p, source, destination, len);
+        uint8_t tail[3 + 12 + 4] = {};
+        p = tail + padding;
+        put16(p, 2); put16(p, 4); put32(p, direction);     // epb_flags
+        put32(p, 0);
+        put32(p, total);
+
+        std::lock_guard<std::mutex> lock(mute_);
+        if (!enabled_) return;
+        if (pending_.size() + total > Max_Pending) {
+            dropped_++;
+            return;
+        }
+        const uint8_t* data = static_cast<const uint8_t*>(payload);
+        pending_.insert(pending_.end(), head, head + sizeof(head));
+        pending_.insert(pending_.end(), data, data + len);
+        pending_.insert(pending_.end(), tail, p);
+        packets_++;
+        bytes_ += len;
+    }
+
+    bool enabled() const { return enabled_; }
+
+private:
+    static void put16(uint8_t*& p, uint16_t v) { memcpy(p, &v, 2); p += 2; }
+    static void put32(uint8_t*& p, uint32_t v) { memcpy(p, &v, 4); p += 4; }
+
+    // Network byte order; UDP checksum 0 (none), IPv4 header checksum computed
+    static void ipUdpHeader(uint8_t* p, const sockaddr_in& source, const sockaddr_in& destination, size_t len) {
+        uint16_t ip_len = uint16_t(Ip_Udp_Header + len);
+        uint16_t udp_len = uint16_t(8 + len);
+        uint8_t* ip = p;
+        ip[0] = 0x45;                                      // IPv4, 20-byte header
+        ip[1] = 0;
+        ip[2] = uint8_t(ip_len >> 8); ip[3] = uint8_t(ip_len);
+        memset(ip + 4, 0, 4);                              // Id, no fragments
+        ip[8] = 64;                                        // TTL
+        ip[9] = IPPROTO_UDP;
+        ip[10] = ip[11] = 0;
+        memcpy(ip + 12, &source.sin_addr, 4);
+        memcpy(ip + 16, &destination.sin_addr, 4);
+        uint32_t sum = 0;
+        for (int i = 0; i < 20; i += 2) sum += uint32_t(ip[i] << 8 | ip[i + 1]);
+        while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+        uint16_t check = uint16_t(~sum);
+        ip[10] = uint8_t(check >> 8); ip[11] = uint8_t(check);
+
+        uint8_t* udp = p + 20;
+        memcpy(udp, &source.sin_port, 2);
+        memcpy(udp + 2, &destination.sin_port, 2);
+        udp[4] = uint8_t(udp_len >> 8); udp[5] = uint8_t(udp_len);
+        udp[6] = udp[7] = 0;
+    }
+
+    void flushLoop() {
+        std::vector<uint8_t> out;
+        std::unique_lock<std::mutex> lock(mute_);
+        while (true) {
+            bool last = !running_;
+            out.swap(pending_);
+            lock.unlock();
+            if (!out.empty()) {
+                fwrite(out.data(), 1, out.size(), file_);
+                fflush(file_);
+                out.clear();
+            }
+            lock.lock();
+            if (last) break;
+            wake_.wait_for(lock, std::chrono::milliseconds(Flush_Ms));
+        }
+    }
+
+    std::mutex mute_;               // Pending buffer, and the writer's wake-up
+    std::condition_variable wake_;
+    std::vector<uint8_t> pending_;
+    std::thread writer_;
+    bool running_ = false;
+    std::atomic<bool> enabled_{false};
+    FILE* file_ = nullptr;
+    std::string path_;
+    uint64_t packets_ = 0;
+    uint64_t bytes_ = 0;
+    uint64_t dropped_ = 0;
+};
+
+class Reader {
+public:
+    Reader() = default;
+    ~Reader() {
+        if (file_) fclose(file_);
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    bool open(const std::string& path) {
+        file_ = fopen(path.c_str(), "rb");
+        if (!file_) {
+            fprintf(stderr, "Capture file %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        uint32_t head[3];
+        if (fread(head, 4, 3, file_) != 3 || head[0] != Block_Section || head[2] != Byte_Order_Magic) {
+            fprintf(stderr, "%s is not a pcapng file in host byte order\n", path.c_str());
+            return false;
+        }
+        rewind(file_);
+        return true;
+    }
+
+    // Next UDP datagram; false at the end of the file
+    bool next(Packet& packet) {
+        uint32_t head[2];
+        while (fread(head, 4, 2, file_) == 2) {
+            uint32_t type = head[0], total = head[1];
+            if (total < 12 || total % 4 != 0 || total > Max_Datagram + 4096) {
+                fprintf(stderr, "Capture file: bad block length %u\n", total);
+                return false;
+            }
+            block_.resize(total - 8);
+            if (fread(block_.data(), 1, block_.size(), file_) != block_.size()) return false;
+            const uint8_t* body = block_.data();
+            size_t body_len = total - 12;
+
+            if (type == Block_Interface) {
+                interface(body, body_len);
+            } else if (type == Block_Packet && body_len >= 20 && parsePacket(body, body_len, packet)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    static uint16_t get16(const uint8_t* p) { uint16_t v; memcpy(&v, p, 2); return v; }
+    static uint32_t get32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+    //Link type and timestamp resolution of the (single) interface
+    void interface(const uint8_t* body, size_t len) {
+        if (len < 8) return;
+        link_ = get16(body);
+        for (size_t at = 8; at + 4 <= len;) {
+            uint16_t code = get16(body + at), size = get16(body + at + 2);
+            if (code == 0 || at + 4 + size > len) break;
+            if (code == 9 && size >= 1) {
+                uint8_t resol = body[at + 4];
+                ticks_per_s_ = 1;
+                for (int i = 0; i < (resol & 0x7F); i++) ticks_per_s_ *= (resol & 0x80) ? 2 : 10;
+            }
+            at += 4 + pad4(size);
+        }
+    }
+
+    bool parsePacket(const uint8_t* body, size_t len, Packet& packet) {
+        uint64_t ticks = uint64_t(get32(body + 4)) << 32 | get32(body + 8);
+        uint32_t captured = get32(body + 12);
+        if (20 + pad4(captured) > len || (link_ != Link_IPv4 && link_ != 101)) return false;
+        const uint8_t* ip = body + 20;
+        size_t ihl = size_t(ip[0] & 0x0F) * 4;
+        if (captured < ihl + 8 || (ip[0] >> 4) != 4 || ip[9] != IPPROTO_UDP) return false;
+        const uint8_t* udp = ip + ihl;
+
+        packet.direction = Direction_Unknown;
+        for (size_t at = 20 + pad4(captured); at + 4 <= len;) {
+            uint16_t code = get16(body + at), size = get16(body + at + 2);
+            if (code == 0 || at + 4 + size > len) break;
+            if (code == 2 && size == 4) packet.direction = Direction(get32(body + at + 4) & 3);
+            at += 4 + pad4(size);
+        }
+        packet.t_ns = ticks_per_s_ == 1000000000ULL ? ticks
+                    : uint64_t(double(ticks) * 1e9 / double(ticks_per_s_));
+        packet.source = {};
+        packet.source.sin_family = AF_INET;
+        memcpy(&packet.source.sin_addr, ip + 12, 4);
+        memcpy(&packet.source.sin_port, udp, 2);
+        packet.destination = {};
+        packet.destination.sin_family = AF_INET;
+        memcpy(&packet.destination.sin_addr, ip + 16, 4);
+        memcpy(&packet.destination.sin_port, udp + 2, 2);
+        packet.payload.assign(udp + 8, ip + captured);
+        return true;
+    }
+
+    FILE* file_ = nullptr;
+    std::vector<uint8_t> block_;
+    uint16_t link_ = Link_IPv4;
+    uint64_t ticks_per_s_ = 1000000;    // pcapng default: microseconds
+};
+
+} // namespace pcap
+
+#endif
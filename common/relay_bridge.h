@@ -0,0 +1,157 @@
+#ifndef RELAY_BRIDGE_H
+#define RELAY_BRIDGE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "frame_pool.h"
+
+// Frame exchange between relay workers.
+// With SO_REUSEPORT the kernel spreads connections over the workers, so the
+// members of one room can end up on different event loops. A worker forwards
+// a frame to its own clients directly and publishes it here for the others:
+// every worker owns an inbox (a vector swapped out under a short lock) and an
+// eventfd that wakes its epoll loop. The eventfd is only written when the
+// inbox goes from empty to non-empty, so a busy worker gets one wakeup per
+// batch rather than per frame. Frames carry their room, and a worker only gets
+// the frames of rooms it has members in (a table kept up to date on joins and
+// leaves, read under a shared lock).
+//
+// A published frame is copied once, into a shared buffer (FramePool::shared)
+// that every destination inbox and, after delivery, every client queue holds a
+// reference to. Rooms travel as ids the bridge hands out on the first join
+// anywhere; an id stays the same while any worker has members in the room and
+// is never reused, so a frame left over from an emptied room matches nothing.
+
+namespace relay {
+
+// A frame handed between workers, with the id of the room it was sent to
+struct BridgedFrame {
+    uint32_t room;
+    FrameRef frame;
+};
+
+class Bridge {
+public:
+    explicit Bridge(int workers) {
+        for (int i = 0; i < workers; i++) {
+            std::unique_ptr<Inbox> inbox(new Inbox());
+            inbox->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (inbox->event_fd < 0) {
+                perror("eventfd");
+            }
+            inboxes_.push_back(std::move(inbox));
+        }
+    }
+
+    ~Bridge() {
+        for (auto& inbox : inboxes_) {
+            if (inbox->event_fd >= 0) close(inbox->event_fd);
+        }
+    }
+
+    Bridge(const Bridge&) = delete;
+    Bridge& operator=(const Bridge&) = delete;
+
+    int workers() const { return int(inboxes_.size()); }
+    int eventFd(int worker) const { return inboxes_[worker]->event_fd; }
+
+    // Members of a room on a worker; workers without any get none of its frames.
+    // Returns the room's id, the one its frames are published under.
+    uint32_t setRoomMembers(int worker, const std::string& room, int count) {
+        std::unique_lock<std::shared_mutex> lock(rooms_mute_);
+        auto named = ids_.find(room);
+        if (named == ids_.end()) {
+            if (count == 0) return 0;
+            named = ids_.emplace(room, next_id_++).first;
+        }
+        uint32_t id = named->second;
+        std::vector<int>& counts = members_[id];
+        counts.resize(size_t(workers()), 0);
+        counts[size_t(worker)] = count;
+        if (std::all_of(counts.begin(), counts.end(), [](int n) { return n == 0; })) {
+            members_.erase(id);
+            ids_.erase(named);
+        }
+        return id;
+    }
+
+    // Hand a frame to every other worker with members in the room
+    void publish(int from, uint32_t room, const FrameRef& frame) {
+        std::shared_lock<std::shared_mutex> rooms_lock(rooms_mute_);
+        auto members = members_.find(room);
+        if (members == members_.end()) return;
+        FrameRef shared;    //Copied on the first worker that takes it
+        for (int i = 0; i < workers(); i++) {
+            Inbox& inbox = *inboxes_[i];
+            if (i == from || members->second[size_t(i)] == 0) continue;
+            if (!shared) {
+                shared = FramePool::shared(frame.data(), frame.size());
+            }
+
+            bool wake;
+            {
+                std::lock_guard<std::mutex> lock(inbox.mute);
+                if (inbox.frames.size() >= Max_Inbox) {
+                    inbox.dropped++;
+                    continue;
+                }
+                wake = inbox.frames.empty();
+                inbox.frames.push_back(BridgedFrame{room, shared});
+            }
+            if (wake) {
+                uint64_t one = 1;
+                if (write(inbox.event_fd, &one, sizeof(one)) < 0) {
+                    perror("bridge wake");
+                }
+            }
+        }
+    }
+
+    // Take everything queued for a worker (called on its eventfd)
+    void drain(int worker, std::vector<BridgedFrame>& out) {
+        Inbox& inbox = *inboxes_[worker];
+        uint64_t count;
+        if (read(inbox.event_fd, &count, sizeof(count)) < 0) {
+            //EAGAIN: already drained with an earlier batch
+        }
+        out.clear();
+        std::lock_guard<std::mutex> lock(inbox.mute);
+        out.swap(inbox.frames);
+    }
+
+    uint64_t dropped(int worker) {
+        std::lock_guard<std::mutex> lock(inboxes_[worker]->mute);
+        return inboxes_[worker]->dropped;
+    }
+
+private:
+    static constexpr size_t Max_Inbox = 4096;   // Frames; a stuck worker must not grow without bound
+
+    struct alignas(64) Inbox {
+        std::mutex mute;
+        std::vector<BridgedFrame> frames;
+        uint64_t dropped = 0;
+        int event_fd = -1;
+    };
+
+    std::vector<std::unique_ptr<Inbox>> inboxes_;
+    std::shared_mutex rooms_mute_;
+    std::unordered_map<std::string, uint32_t> ids_;             // Room name -> id
+    std::unordered_map<uint32_t, std::vector<int>> members_;    // Room id -> members per worker
+    uint32_t next_id_ = 1;
+};
+
+} // namespace relay
+
+#endif
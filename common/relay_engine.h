@@ -0,0 +1,1411 @@
+#ifndef RELAY_ENGINE_H
+#define RELAY_ENGINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "audio_mixer.h"
+#include "cli_args.h"
+#include "frame_pool.h"
+#include "frame_protocol.h"
+#include "relay_bridge.h"
+#include "relay_metrics.h"
+#include "room_table.h"
+#include "uring.h"
+
+// Event-loop relay engine.
+// One thread serves every connection through edge-triggered epoll on
+// non-blocking sockets. Each client's byte stream is cut into whole frames
+// (frame_protocol.h); every frame is queued on every other client in its
+// room and written as far as that socket accepts right now, the rest goes out
+// on the next EPOLLOUT. A client with a full send buffer therefore only
+// delays itself, and no lock is held while forwarding.
+//
+// Each outbound queue is bounded. Under the drop policy a slow client that
+// exceeds the bound loses its oldest queued audio frames (never the one partly
+// written, so receivers always see whole frames, and never time or join
+// answers). Under the disconnect policy the byte bound is not applied: the
+// queue holds everything and the client is disconnected once its oldest frame
+// is older than max_lag_ms.
+//
+// Clients are grouped into named rooms (room_table.h): a Frame_Join frame
+// moves a client into a room, and frames only go to the sender's room.
+// Forwarded frames get the relay timestamp of their arrival, and time requests
+// are answered on the spot, so clients can split delays into uplink and
+// downlink (clock_sync.h).
+//
+// With mix set the loop works as an MCU instead: audio frames go into the
+// room's MixBus, and a timerfd tick sends every client one N-1 mix per period,
+// so each client receives a single stream whatever the room size.
+//
+// serve() can run several loops, one per core, each accepting on its own
+// SO_REUSEPORT socket; frames cross between workers through a Bridge, which
+// only hands a room's frames to workers with members in that room.
+//
+// The loop has two I/O backends with the same relay logic on top. The epoll
+// backend makes a recv/send call per socket operation. The io_uring backend
+// (--io uring) keeps one multishot accept and one multishot receive per client
+// armed, receiving into buffers provided to the kernel up front. It addresses
+// clients through the fixed-file table and writes each client's queue as a
+// chain of linked sends, so many operations share one io_uring_enter call.
+//
+// A forwarded frame is copied once, into a pooled reference-counted buffer
+// (frame_pool.h) that every recipient's queue shares; a queue is written by
+// gathering its frames into one sendmsg. With --zerocopy-kb the epoll backend
+// sends frames of that size and up with MSG_ZEROCOPY and holds their buffers
+// until the completion for the send arrives on the socket's error queue.
+//
+// Each loop counts what passes through it per client and per room, including
+// how long frames wait in the queues (queued to written) and how long clients
+// sit behind a full socket. With --metrics the counts are published to a
+// MetricsRegistry (relay_metrics.h) and served as text while the relay runs.
+
+namespace relay {
+
+// Set O_NONBLOCK on a descriptor
+inline bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Printable address of a connected peer
+inline std::string peerName(const sockaddr_storage& addr) {
+    char host[INET6_ADDRSTRLEN] = "?";
+    int port = 0;
+    if (addr.ss_family == AF_INET) {
+        const sockaddr_in* in = reinterpret_cast<const sockaddr_in*>(&addr);
+        inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+        port = ntohs(in->sin_port);
+    } else if (addr.ss_family == AF_INET6) {
+        const sockaddr_in6* in6 = reinterpret_cast<const sockaddr_in6*>(&addr);
+        inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+        port = ntohs(in6->sin6_port);
+    }
+    return std::string(host) + ":" + std::to_string(port);
+}
+
+using Clock = std::chrono::steady_clock;
+
+enum class IoBackend { Epoll, Uring };
+
+enum class OverflowPolicy {
+    DropOldest,     // Discard the oldest queued frames to make room
+    Disconnect,     // Close clients that fall too far behind
+};
+
+struct RelayOptions {
+    size_t queue_limit = 64 * 1024;             // DropOldest: outbound bytes per client
+    OverflowPolicy policy = OverflowPolicy::DropOldest;
+    int max_lag_ms = 500;                       // Disconnect: oldest queued frame age
+    int stats_s = 0;                            // Queue report period, 0 = off
+    bool mix = false;                           // Mix on the server instead of forwarding
+    int mix_rate = 44100;                       // Format the clients send (S16_LE)
+    int mix_channels = 2;
+    int mix_period_frames = 256;                // Frames per mix tick
+    int mix_jitter_ms = 40;                     // Per-client jitter buffer target
+    int workers = 1;                            // Event loops, 0 = one per core
+    IoBackend io = IoBackend::Epoll;
+    size_t zerocopy_bytes = 0;                  // Epoll: MSG_ZEROCOPY for frames this large, 0 = off
+    bool sfu = false;                           // UDP forwarding for Online_AV instead (sfu_engine.h)
+    std::string metrics;                        // Metrics endpoint: 127.0.0.1 port (HTTP) or Unix socket path
+};
+
+// Parse the relay flags shared by the servers; returns false on a bad flag or value
+inline bool parseOptions(int argc, char* argv[], RelayOptions& opts) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        size_t kb = 0;
+        if (arg == "--queue-kb" && has_value) {
+            ok = cli::parseInt<size_t>(argv[++i], kb, 1, 1024 * 1024);
+            if (ok) opts.queue_limit = kb * 1024;
+        } else if (arg == "--policy" && has_value) {
+            std::string value = argv[++i];
+            if (value == "drop") {
+                opts.policy = OverflowPolicy::DropOldest;
+            } else if (value == "disconnect") {
+                opts.policy = OverflowPolicy::Disconnect;
+            } else {
+                std::cerr << "Unknown policy: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--max-lag-ms" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.max_lag_ms, 1, 3600 * 1000);
+        } else if (arg == "--stats" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.stats_s, 0, 86400);
+        } else if (arg == "--io" && has_value) {
+            std::string value = argv[++i];
+            if (value == "epoll") {
+                opts.io = IoBackend::Epoll;
+            } else if (value == "uring") {
+                opts.io = IoBackend::Uring;
+            } else {
+                std::cerr << "Unknown I/O backend: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--zerocopy-kb" && has_value) {
+            ok = cli::parseInt<size_t>(argv[++i], kb, 0, 1024 * 1024);
+            if (ok) opts.zerocopy_bytes = kb * 1024;
+        } else if (arg == "--workers" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.workers, 0, 1024);
+        } else if (arg == "--metrics" && has_value) {
+            opts.metrics = argv[++i];
+        } else if (arg == "--sfu") {
+            opts.sfu = true;
+        } else if (arg == "--mix") {
+            opts.mix = true;
+        } else if (arg == "--mix-period" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.mix_period_frames, 1, 48000);
+        } else if (arg == "--mix-jitter-ms" && has_value) {
+            ok = cli::parseInt(argv[++i], opts.mix_jitter_ms, 0, 10000);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--queue-kb N] [--policy drop|disconnect] [--max-lag-ms N] [--stats seconds]"
+                      << " [--io epoll|uring] [--zerocopy-kb N] [--workers N] [--mix [--mix-period frames] [--mix-jitter-ms N]] [--sfu]"
+                      << " [--metrics port|socket-path]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+struct OutChunk {
+    FrameRef frame;                   // Shared with the other recipients
+    Clock::time_point queued;
+};
+
+// A frame the kernel may still read after a MSG_ZEROCOPY send
+struct ZeroCopyHold {
+    uint32_t send_id;                 // Which zerocopy send call, as numbered by the kernel
+    FrameRef frame;
+};
+
+struct QueueStats {
+    size_t peak_bytes = 0;            // Deepest queue since the last report
+    uint64_t frames_in = 0;           // Received from the client
+    uint64_t bytes_in = 0;
+    uint64_t dropped_frames = 0;
+    uint64_t dropped_bytes = 0;
+    uint64_t sent_frames = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t blocked_us = 0;          // Time spent with frames waiting on a full socket
+    LatencyHistogram latency;         // Queued until written to the socket
+    uint64_t zerocopy_sends = 0;      // Completed MSG_ZEROCOPY sends
+    uint64_t zerocopy_copied = 0;     // ... of which the kernel copied after all
+};
+
+// io_uring: one sendmsg of a linked chain, gathering several queued frames
+struct SendPart {
+    msghdr msg = {};
+    size_t frames = 0;
+    size_t bytes = 0;
+};
+
+struct Connection;
+
+// What the relay keeps per room besides members and counters
+struct RoomState {
+    std::unique_ptr<mixing::MixBus> mixer;     // Mix mode only
+    LatencyHistogram latency;                  // Queued until written, over all members
+    uint64_t blocked_us = 0;                   // Members' send-blocked time
+    uint32_t bridge_id = 0;                    // Id on the Bridge, with several workers
+};
+
+using RelayRoom = Room<Connection, RoomState>;
+
+struct Connection {
+    int fd = -1;
+    RelayRoom* room = nullptr;        // Kept by the room table
+    std::string name;                 // Peer address for logging
+    framing::FrameParser parser;      // Reassembles inbound frames
+    std::deque<OutChunk> outq;        // Frames waiting for the socket
+    size_t out_offset = 0;            // Bytes of outq.front() already sent
+    size_t out_bytes = 0;             // Bytes queued in total
+    std::deque<OutChunk> sending;     // io_uring: frames owned by submitted sends
+    size_t sending_bytes = 0;         // io_uring: bytes in sending, not held against the queue limit
+    std::vector<iovec> send_iov;      // io_uring: one entry per frame in sending
+    std::vector<SendPart> send_parts; // io_uring: the linked sendmsgs of that chain
+    size_t parts_done = 0;
+    bool recv_armed = false;          // io_uring: multishot receive outstanding
+    bool flush_queued = false;        // io_uring: listed for the end of this completion batch
+    bool shut = false;                // io_uring: shutdown issued, waiting for completions
+    bool zerocopy = false;            // SO_ZEROCOPY is set on the socket
+    uint32_t zerocopy_next = 0;       // Id the kernel gives the next zerocopy send
+    std::deque<ZeroCopyHold> zerocopy_held;
+    QueueStats stats;
+    Clock::time_point blocked_since{};   // Frames waiting on a full socket since, zero when not
+    uint32_t mix_seq = 0;             // Sequence of the mix sent to this client
+    bool read_pending = false;        // Read budget ran out with data left
+    bool closing = false;
+};
+
+class EventLoop {
+public:
+    // Takes a bound, listening socket
+    explicit EventLoop(int listen_fd, const RelayOptions& opts = RelayOptions())
+        : opts_(opts), listen_fd_(listen_fd) {
+        setNonBlocking(listen_fd_);
+        if (opts_.io == IoBackend::Uring) {
+            if (!uring::available()) {
+                std::cerr << "io_uring is not available, using epoll.\n";
+            } else if (initUring()) {
+                uring_ok_ = true;
+            } else {
+                return;
+            }
+        }
+        if (!uring_ok_) {
+            epfd_ = epoll_create1(EPOLL_CLOEXEC);
+            if (epfd_ < 0) {
+                perror("epoll_create1");
+                return;
+            }
+            epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLET;
+            ev.data.fd = listen_fd_;
+            if (epoll_ctl(epfd_, EPOLL_CTL_ADD, listen_fd_, &ev) < 0) {
+                perror("epoll_ctl listen");
+            }
+        }
+        if (opts_.zerocopy_bytes > 0 && uring_ok_) {
+            std::cout << "MSG_ZEROCOPY is used by the epoll backend only.\n";
+        }
+        if (opts_.mix) {
+            startMixer();
+        }
+    }
+
+    ~EventLoop() {
+        for (auto& entry : conns_) {
+            close(entry.first);
+        }
+        if (timer_fd_ >= 0) {
+            close(timer_fd_);
+        }
+        if (epfd_ >= 0) {
+            close(epfd_);
+        }
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool ok() const { return epfd_ >= 0 || uring_ok_; }
+
+    // Join a multi-worker relay: frames are shared with the other workers
+    void attachBridge(Bridge* bridge, int worker) {
+        bridge_ = bridge;
+        worker_ = worker;
+        watch(bridge_->eventFd(worker_));
+    }
+
+    // Publish counts to a metrics slot instead of keeping them to this loop
+    void attachMetrics(WorkerMetrics* metrics) {
+        metrics_ = metrics;
+        publish_metrics_ = true;
+    }
+
+    // Serve until stop is set
+    void run(const std::atomic<bool>& stop) {
+        if (uring_ok_) {
+            runUring(stop);
+        } else {
+            runEpoll(stop);
+        }
+    }
+
+    size_t connections() const { return conns_.size(); }
+
+private:
+    static constexpr int Max_Events = 256;
+    static constexpr int Tick_ms = 50;      // Lag checks run even when idle
+    static constexpr size_t Read_Chunk = 64 * 1024;
+    static constexpr int Read_Budget = 16;   // recv calls per connection per wakeup
+    static constexpr uint64_t Max_Catchup_Ticks = 4;
+    static constexpr unsigned Ring_Entries = 4096;
+    static constexpr unsigned Ring_Files = 4096;        // Fixed-file slots, indexed by fd
+    //The receive pool bounds what one loop pass reads, as Read_Budget does
+    //under epoll; a larger pool reads past what the sends can keep up with
+    static constexpr unsigned Recv_Buffers = 32;
+    static constexpr unsigned Recv_Buffer_Size = 16 * 1024;
+    static constexpr size_t Max_Send_Chain = 256;       // Frames in flight per client
+    static constexpr size_t Frames_Per_Send = 64;       // Frames gathered by one linked sendmsg
+    static constexpr int Publish_ms = 500;              // Client and room tables for the metrics endpoint
+
+    // Readiness of an auxiliary descriptor (mix timer, bridge eventfd)
+    void watch(int fd) {
+        if (uring_ok_) {
+            armPoll(fd);
+            return;
+        }
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl watch");
+        }
+    }
+
+    void onReadable(int fd) {
+        if (fd == timer_fd_) {
+            mixTick();
+        } else if (bridge_ && fd == bridge_->eventFd(worker_)) {
+            deliverBridged();
+        }
+    }
+
+    void runEpoll(const std::atomic<bool>& stop) {
+        std::vector<epoll_event> events(Max_Events);
+        last_report_ = Clock::now();
+        while (!stop) {
+            //Do not sleep while some connection still has unread data
+            int timeout = pending_reads_.empty() ? Tick_ms : 0;
+            Clock::time_point waiting = Clock::now();
+            int n = epoll_wait(epfd_, events.data(), int(events.size()), timeout);
+            metrics_->idle_ns.add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - waiting).count()));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listen_fd_) {
+                    acceptAll();
+                    continue;
+                }
+                if (fd == timer_fd_ || (bridge_ && fd == bridge_->eventFd(worker_))) {
+                    onReadable(fd);
+                    continue;
+                }
+                auto it = conns_.find(fd);
+                if (it == conns_.end()) continue;
+                Connection& conn = *it->second;
+
+                if (events[i].events & EPOLLERR) {
+                    //Zerocopy completions also raise EPOLLERR
+                    if (!conn.zerocopy || !reapZeroCopy(conn)) {
+                        conn.closing = true;
+                    }
+                }
+                if (events[i].events & EPOLLHUP) {
+                    conn.closing = true;
+                }
+                if (events[i].events & EPOLLOUT) {
+                    flush(conn);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+                    readSome(conn);
+                }
+            }
+
+            //Continue connections whose read budget ran out
+            std::vector<int> again;
+            again.swap(pending_reads_);
+            for (int fd : again) {
+                auto it = conns_.find(fd);
+                if (it != conns_.end()) {
+                    it->second->read_pending = false;
+                    readSome(*it->second);
+                }
+            }
+
+            housekeeping();
+            reapClosed();
+        }
+    }
+
+    void acceptAll() {
+        while (true) {
+            sockaddr_storage addr = {};
+            socklen_t len = sizeof(addr);
+            int fd = accept4(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                perror("accept");
+                return;
+            }
+
+            epoll_event ev = {};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.fd = fd;
+            if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                perror("epoll_ctl add");
+                close(fd);
+                continue;
+            }
+            addConnection(fd, peerName(addr));
+        }
+    }
+
+    Connection& addConnection(int fd, const std::string& name) {
+        //Audio chunks are small: do not let Nagle hold them back
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        std::unique_ptr<Connection> conn(new Connection());
+        conn->fd = fd;
+        conn->name = name;
+        if (opts_.zerocopy_bytes > 0 && !uring_ok_) {
+            conn->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &yes, sizeof(yes)) == 0;
+        }
+        Connection& added = *conn;
+        conns_[fd] = std::move(conn);
+        metrics_->connections.set(conns_.size());
+        std::cout << "Server: got connection from " << name << "\n";
+        joinRoom(added, Default_Room);
+        return added;
+    }
+
+    // Move a client into a room (Frame_Join, and Default_Room on connect)
+    void joinRoom(Connection& conn, const std::string& name) {
+        if (conn.room && conn.room->name == name) return;
+        leaveRoom(conn);
+        RelayRoom& room = rooms_.join(conn, name);
+        if (opts_.mix && !room.state.mixer) {
+            room.state.mixer.reset(new mixing::MixBus(opts_.mix_rate, opts_.mix_channels, opts_.mix_period_frames, opts_.mix_jitter_ms));
+        }
+        if (bridge_) {
+            room.state.bridge_id = bridge_->setRoomMembers(worker_, name, int(room.members.size()));
+            bridged_rooms_[room.state.bridge_id] = &room;
+        }
+        if (name != Default_Room) {
+            std::cout << "Client " << conn.name << " joined room " << name << " (" << room.members.size() << " here)\n";
+        }
+    }
+
+    void leaveRoom(Connection& conn) {
+        RelayRoom* room = conn.room;
+        if (!room) return;
+        if (room->state.mixer) {
+            room->state.mixer->removeSource(conn.fd);
+        }
+        std::string name = room->name;
+        uint32_t bridge_id = room->state.bridge_id;
+        int left = int(room->members.size()) - 1;
+        rooms_.leave(conn);     //May delete the room
+        if (bridge_) {
+            bridge_->setRoomMembers(worker_, name, left);
+            if (left == 0) bridged_rooms_.erase(bridge_id);
+        }
+    }
+
+    // Edge triggered: read until EAGAIN, or park the connection when over budget
+    void readSome(Connection& conn) {
+        if (conn.closing) return;
+        for (int budget = Read_Budget; budget > 0; budget--) {
+            ssize_t n = recv(conn.fd, scratch_, sizeof(scratch_), 0);
+            if (n > 0) {
+                if (!onData(conn, scratch_, size_t(n))) {
+                    return;
+                }
+                continue;
+            }
+            if (n == 0) {
+                std::cout << "Client disconnected (" << conn.name << ").\n";
+                conn.closing = true;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                if (errno == EINTR) continue;
+                perror("recv error");
+                conn.closing = true;
+            }
+            return;
+        }
+        if (!conn.read_pending) {
+            conn.read_pending = true;
+            pending_reads_.push_back(conn.fd);
+        }
+    }
+
+    // Bytes received from a client, whatever the backend
+    bool onData(Connection& conn, const uint8_t* data, size_t len) {
+        bool ok = conn.parser.feed(data, len,
+            [&](const framing::FrameHeader& header, const uint8_t* frame, size_t size) {
+                if (header.type == framing::Frame_Join) {
+                    std::string name(reinterpret_cast<const char*>(frame + framing::Header_Size), header.length);
+                    bool valid = validRoomName(name);
+                    if (valid) {
+                        joinRoom(conn, name);
+                    } else {
+                        std::cerr << "Bad room name from " << conn.name << "\n";
+                    }
+                    answerJoin(conn, valid ? name : std::string());
+                    return;
+                }
+                if (header.type == framing::Frame_Time_Request) {
+                    answerTime(conn, header);
+                    return;
+                }
+                RelayRoom& room = *conn.room;
+                room.stats.frames_in++;
+                room.stats.bytes_in += size;
+                conn.stats.frames_in++;
+                conn.stats.bytes_in += size;
+                metrics_->frames_in.add(1);
+                metrics_->bytes_in.add(size);
+                if (room.state.mixer) {
+                    if (header.type == framing::Frame_Audio) {
+                        room.state.mixer->push(conn.fd, frame + framing::Header_Size, header.length);
+                    }
+                } else if (room.members.size() > 1 || bridge_) {
+                    //One copy for every queue and the bridge, stamped with its arrival here
+                    FrameRef copy = pool_.copy(frame, size);
+                    framing::stampRelay(copy.data(), framing::nowUs());
+                    forward(conn, copy);
+                    if (bridge_) {
+                        bridge_->publish(worker_, room.state.bridge_id, copy);
+                    }
+                }
+            });
+        if (!ok) {
+            std::cerr << "Framing error from " << conn.name << ", disconnecting.\n";
+            conn.closing = true;
+        }
+        return ok;
+    }
+
+    // Queue a frame on every other client in the room, all sharing one copy
+    void forward(Connection& from, const FrameRef& frame) {
+        for (Connection* member : from.room->members) {
+            Connection& to = *member;
+            if (&to == &from || to.closing) continue;
+            enqueue(to, frame);
+        }
+    }
+
+    // Join result: the room joined, or an empty name when the name was refused
+    void answerJoin(Connection& conn, const std::string& joined) {
+        framing::FrameHeader header;
+        header.type = framing::Frame_Join;
+        header.length = uint32_t(joined.size());
+        header.timestamp_us = framing::nowUs();
+        FrameRef frame = pool_.alloc(framing::Header_Size + joined.size());
+        framing::encodeHeader(header, frame.data());
+        memcpy(frame.data() + framing::Header_Size, joined.data(), joined.size());
+        enqueue(conn, std::move(frame));
+    }
+
+    // Clock exchange for clock_sync.h: t1 back, with this host's receive and send times.
+    // Queued ahead of the audio waiting for this client, so t3 is close to when it leaves.
+    void answerTime(Connection& conn, const framing::FrameHeader& request) {
+        uint64_t received = framing::nowUs();
+        framing::FrameHeader header;
+        header.type = framing::Frame_Time_Response;
+        header.stream_id = request.stream_id;
+        header.seq = request.seq;
+        header.length = uint32_t(framing::Time_Payload);
+        header.relay_us = received;
+        header.timestamp_us = framing::nowUs();
+        FrameRef frame = pool_.alloc(framing::Header_Size + framing::Time_Payload);
+        framing::encodeHeader(header, frame.data());
+        uint64_t t1 = htobe64(request.timestamp_us);
+        memcpy(frame.data() + framing::Header_Size, &t1, sizeof(t1));
+        enqueue(conn, std::move(frame), true);
+    }
+
+    // Frames other workers received for this worker's clients
+    void deliverBridged() {
+        bridge_->drain(worker_, bridged_);
+        for (BridgedFrame& bridged : bridged_) {
+            auto room = bridged_rooms_.find(bridged.room);
+            if (room == bridged_rooms_.end()) continue;    //Its members here have left since
+            for (Connection* member : room->second->members) {
+                if (member->closing) continue;
+                enqueue(*member, bridged.frame);
+            }
+        }
+        bridged_.clear();
+    }
+
+    // Queue one frame on a client and push it out as far as possible.
+    // An urgent frame goes ahead of everything not yet written.
+    void enqueue(Connection& to, FrameRef frame, bool urgent = false) {
+        bool was_idle = to.outq.empty();
+        to.room->stats.frames_out++;
+        to.room->stats.bytes_out += frame.size();
+        metrics_->frames_out.add(1);
+        metrics_->bytes_out.add(frame.size());
+        to.out_bytes += frame.size();
+        if (urgent) {
+            //Behind a partly written head only; with io_uring submitted frames already left outq
+            size_t keep = (!uring_ok_ && to.out_offset > 0) ? 1 : 0;
+            to.outq.insert(to.outq.begin() + std::min(keep, to.outq.size()), OutChunk{std::move(frame), Clock::now()});
+        } else {
+            to.outq.push_back(OutChunk{std::move(frame), Clock::now()});
+        }
+        if (uring_ok_) {
+            //Sends go out once the whole completion batch has been handled
+            if (!to.flush_queued) {
+                to.flush_queued = true;
+                flush_list_.push_back(to.fd);
+            }
+            return;
+        }
+        if (was_idle) {
+            flush(to);
+        } else if (to.out_bytes > opts_.queue_limit) {
+            overflow(to);
+        }
+        to.stats.peak_bytes = std::max(to.stats.peak_bytes, to.out_bytes);
+    }
+
+    void startMixer() {
+        timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timer_fd_ < 0) {
+            perror("timerfd_create");
+            return;
+        }
+        long period_ns = long(1000000000.0 * opts_.mix_period_frames / opts_.mix_rate);
+        itimerspec spec = {};
+        spec.it_interval.tv_sec = period_ns / 1000000000;
+        spec.it_interval.tv_nsec = period_ns % 1000000000;
+        spec.it_value = spec.it_interval;
+        timerfd_settime(timer_fd_, 0, &spec, nullptr);
+
+        watch(timer_fd_);
+        std::cout << "Mixing " << opts_.mix_period_frames << " frames per tick (" << period_ns / 1000 << " us).\n";
+    }
+
+    // One mix per elapsed period and room; a loop that fell behind catches up a few ticks
+    void mixTick() {
+        uint64_t expirations = 0;
+        if (read(timer_fd_, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+            return;
+        }
+        expirations = std::min<uint64_t>(expirations, Max_Catchup_Ticks);
+
+        rooms_.forEach([&](RelayRoom& room) {
+            mixing::MixBus& mixer = *room.state.mixer;
+            size_t bytes = mixer.periodSamples() * sizeof(int16_t);
+            for (uint64_t tick = 0; tick < expirations; tick++) {
+                if (!mixer.tick()) {
+                    continue;   //Nobody is talking
+                }
+                framing::FrameHeader header;
+                header.stream_id = 0;   //The mix
+                header.length = uint32_t(bytes);
+                header.timestamp_us = framing::nowUs();
+                header.relay_us = header.timestamp_us;     //Made here: no uplink
+                for (Connection* member : room.members) {
+                    Connection& to = *member;
+                    if (to.closing) continue;
+                    header.seq = to.mix_seq++;
+                    //Every client gets its own mix, so nothing is shared here
+                    FrameRef frame = pool_.alloc(framing::Header_Size + bytes);
+                    framing::encodeHeader(header, frame.data());
+                    memcpy(frame.data() + framing::Header_Size, mixer.mixFor(to.fd), bytes);
+                    enqueue(to, std::move(frame));
+                }
+            }
+        });
+    }
+
+    // Queue over its bound: drop the oldest audio frames. Under Disconnect the
+    // queue is left to grow; housekeeping() disconnects on lag instead.
+    void overflow(Connection& conn) {
+        if (opts_.policy == OverflowPolicy::Disconnect) {
+            return;
+        }
+        //The head may be partly written; dropping it would tear the stream.
+        //With io_uring, submitted frames already left outq for conn.sending.
+        //Time and join answers stay: they are small and the client waits on them.
+        size_t keep = (!uring_ok_ && conn.out_offset > 0) ? 1 : 0;
+        auto audio = [](const OutChunk& chunk) { return framing::frameType(chunk.frame.data()) == framing::Frame_Audio; };
+        while (conn.out_bytes > opts_.queue_limit && conn.outq.size() > keep + 1) {
+            auto victim = std::find_if(conn.outq.begin() + keep, conn.outq.end() - 1, audio);
+            if (victim == conn.outq.end() - 1) {
+                break;
+            }
+            conn.out_bytes -= victim->frame.size();
+            conn.stats.dropped_frames++;
+            conn.stats.dropped_bytes += victim->frame.size();
+            conn.room->stats.dropped_frames++;
+            metrics_->dropped_frames.add(1);
+            metrics_->dropped_bytes.add(victim->frame.size());
+            conn.outq.erase(victim);
+        }
+    }
+
+    // Write queued frames until the socket would block, gathering up to
+    // Frames_Per_Send of them per sendmsg. Zerocopy frames go out in calls of
+    // their own, and their buffers are held until the kernel reports the send
+    // complete (reapZeroCopy).
+    void flush(Connection& conn) {
+        if (uring_ok_) {
+            submitSends(conn);
+            return;
+        }
+        bool zerocopy_ok = conn.zerocopy;
+        iovec iov[Frames_Per_Send];
+        while (!conn.outq.empty() && !conn.closing) {
+            bool zerocopy = zerocopy_ok && conn.outq.front().frame.size() >= opts_.zerocopy_bytes;
+            size_t count = 0;
+            size_t total = 0;
+            for (auto chunk = conn.outq.begin(); chunk != conn.outq.end() && count < Frames_Per_Send; ++chunk) {
+                if (count > 0 && zerocopy != (zerocopy_ok && chunk->frame.size() >= opts_.zerocopy_bytes)) break;
+                size_t skip = count == 0 ? conn.out_offset : 0;
+                iov[count++] = {chunk->frame.data() + skip, chunk->frame.size() - skip};
+                total += chunk->frame.size() - skip;
+            }
+            msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            ssize_t n = sendmsg(conn.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT | (zerocopy ? MSG_ZEROCOPY : 0));
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    markBlocked(conn);
+                    return;     //EPOLLOUT resumes
+                }
+                if (errno == EINTR) continue;
+                if (zerocopy && errno == ENOBUFS) {
+                    zerocopy_ok = false;    //Too many completions outstanding: copy for now
+                    continue;
+                }
+                perror("send error");
+                conn.closing = true;
+                return;
+            }
+            conn.out_bytes -= size_t(n);
+            conn.stats.sent_bytes += size_t(n);
+            metrics_->bytes_sent.add(size_t(n));
+            Clock::time_point now = Clock::now();
+            for (size_t left = size_t(n); left > 0;) {
+                OutChunk& head = conn.outq.front();
+                size_t part = std::min(left, head.frame.size() - conn.out_offset);
+                if (zerocopy) {
+                    conn.zerocopy_held.push_back(ZeroCopyHold{conn.zerocopy_next, head.frame});
+                }
+                left -= part;
+                conn.out_offset += part;
+                if (conn.out_offset == head.frame.size()) {
+                    frameSent(conn, head, now);
+                    conn.outq.pop_front();
+                    conn.out_offset = 0;
+                }
+            }
+            if (zerocopy) {
+                conn.zerocopy_next++;
+            }
+            if (size_t(n) < total) {
+                markBlocked(conn);
+                return;     //Socket buffer full
+            }
+        }
+        if (conn.outq.empty()) {
+            markDrained(conn);
+        }
+    }
+
+    // A frame fully written: how long it spent in the relay
+    void frameSent(Connection& conn, const OutChunk& chunk, Clock::time_point now) {
+        uint64_t us = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(now - chunk.queued).count());
+        conn.stats.sent_frames++;
+        conn.stats.latency.record(us);
+        conn.room->state.latency.record(us);
+        latency_.record(us);
+    }
+
+    // Send-blocked time runs from the first send the socket could not take
+    // until the client's queue has drained
+    void markBlocked(Connection& conn) {
+        if (conn.blocked_since == Clock::time_point()) {
+            conn.blocked_since = Clock::now();
+        }
+    }
+
+    void markDrained(Connection& conn) {
+        if (conn.blocked_since == Clock::time_point()) return;
+        uint64_t us = uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - conn.blocked_since).count());
+        conn.stats.blocked_us += us;
+        conn.room->state.blocked_us += us;
+        conn.blocked_since = Clock::time_point();
+    }
+
+    // Read MSG_ZEROCOPY completions off the error queue and release the
+    // frames of every finished send. False if the socket has a real error.
+    bool reapZeroCopy(Connection& conn) {
+        while (true) {
+            char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+            msghdr msg = {};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(conn.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno == EINTR) continue;
+                break;      //EAGAIN: queue drained
+            }
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                bool recverr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                               (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+                if (!recverr) continue;
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cm), sizeof(err));
+                if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+                //Sends ee_info..ee_data are done; ids wrap at 2^32
+                uint32_t first = err.ee_info;
+                uint32_t count = err.ee_data - first + 1;
+                conn.stats.zerocopy_sends += count;
+                if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    conn.stats.zerocopy_copied += count;
+                }
+                auto done = [&](const ZeroCopyHold& hold) { return hold.send_id - first < count; };
+                auto begin = std::find_if(conn.zerocopy_held.begin(), conn.zerocopy_held.end(), done);
+                auto end = std::find_if_not(begin, conn.zerocopy_held.end(), done);
+                conn.zerocopy_held.erase(begin, end);
+            }
+        }
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        return error == 0;
+    }
+
+    // Lag check for the disconnect policy and the periodic queue report
+    void housekeeping() {
+        Clock::time_point now = Clock::now();
+        if (opts_.policy == OverflowPolicy::Disconnect) {
+            for (auto& entry : conns_) {
+                Connection& conn = *entry.second;
+                const OutChunk* oldest = oldestQueued(conn);
+                if (conn.closing || !oldest) continue;
+                auto lag = std::chrono::duration_cast<std::chrono::milliseconds>(now - oldest->queued);
+                if (lag.count() > opts_.max_lag_ms) {
+                    std::cout << "Client " << conn.name << " is " << lag.count() << " ms behind, disconnecting.\n";
+                    conn.closing = true;
+                }
+            }
+        }
+
+        if (publish_metrics_ && now - last_publish_ >= std::chrono::milliseconds(Publish_ms)) {
+            last_publish_ = now;
+            publishMetrics(now);
+        }
+
+        if (opts_.stats_s <= 0 || now - last_report_ < std::chrono::seconds(opts_.stats_s)) {
+            return;
+        }
+        last_report_ = now;
+        for (auto& entry : conns_) {
+            Connection& conn = *entry.second;
+            long lag_ms = 0;
+            if (const OutChunk* oldest = oldestQueued(conn)) {
+                lag_ms = long(std::chrono::duration_cast<std::chrono::milliseconds>(now - oldest->queued).count());
+            }
+            std::cout << "[queue] " << conn.name
+                      << " depth=" << conn.out_bytes + conn.sending_bytes << "B/" << conn.outq.size() + conn.sending.size()
+                      << " peak=" << conn.stats.peak_bytes << "B"
+                      << " lag=" << lag_ms << "ms"
+                      << " dropped=" << conn.stats.dropped_frames << "/" << conn.stats.dropped_bytes << "B"
+                      << " sent=" << conn.stats.sent_bytes << "B";
+            if (conn.zerocopy) {
+                std::cout << " zerocopy=" << conn.stats.zerocopy_sends << "/copied=" << conn.stats.zerocopy_copied
+                          << " held=" << conn.zerocopy_held.size();
+            }
+            std::cout << "\n";
+            if (conn.room->state.mixer) {
+                size_t buffered = 0;
+                mixing::SourceStats source;
+                if (conn.room->state.mixer->sourceState(conn.fd, buffered, source)) {
+                    std::cout << "[mix] " << conn.name
+                              << " jitter=" << buffered * 1000 / (size_t(opts_.mix_rate) * opts_.mix_channels) << "ms"
+                              << " underruns=" << source.underruns
+                              << " trimmed=" << source.trimmed_samples << "\n";
+                }
+            }
+            conn.stats.peak_bytes = conn.out_bytes;
+        }
+        rooms_.forEach([&](const RelayRoom& room) {
+            std::cout << "[room] " << room.name << " members=" << room.members.size()
+                      << " in=" << room.stats.frames_in << "/" << room.stats.bytes_in << "B"
+                      << " out=" << room.stats.frames_out << "/" << room.stats.bytes_out << "B"
+                      << " dropped=" << room.stats.dropped_frames << "\n";
+        });
+    }
+
+    // Client, room and latency tables for the metrics endpoint
+    void publishMetrics(Clock::time_point now) {
+        //Totals so far plus the stall still in progress
+        auto blockedNow = [&](const Connection& conn) -> uint64_t {
+            if (conn.blocked_since == Clock::time_point()) return 0;
+            return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(now - conn.blocked_since).count());
+        };
+
+        std::ostringstream out;
+        for (auto& entry : conns_) {
+            const Connection& conn = *entry.second;
+            out << "[client] " << worker_ << " " << conn.name << " room=" << (conn.room ? conn.room->name : "-")
+                << " in=" << conn.stats.frames_in << "/" << conn.stats.bytes_in << "B"
+                << " sent=" << conn.stats.sent_frames << "/" << conn.stats.sent_bytes << "B"
+                << " depth=" << conn.out_bytes + conn.sending_bytes << "B/" << conn.outq.size() + conn.sending.size()
+                << " dropped=" << conn.stats.dropped_frames << "/" << conn.stats.dropped_bytes << "B"
+                << " blocked=" << (conn.stats.blocked_us + blockedNow(conn)) / 1000 << "ms"
+                << " latency " << conn.stats.latency.summary() << "\n";
+        }
+        rooms_.forEach([&](const RelayRoom& room) {
+            uint64_t blocked_us = room.state.blocked_us;
+            for (const Connection* member : room.members) {
+                blocked_us += blockedNow(*member);
+            }
+            out << "[room] " << worker_ << " " << room.name << " members=" << room.members.size()
+                << " in=" << room.stats.frames_in << "/" << room.stats.bytes_in << "B"
+                << " out=" << room.stats.frames_out << "/" << room.stats.bytes_out << "B"
+                << " dropped=" << room.stats.dropped_frames
+                << " blocked=" << blocked_us / 1000 << "ms"
+                << " latency " << room.state.latency.summary() << "\n";
+        });
+        out << "[latency] " << worker_ << " frames=" << latency_.count();
+        for (int i = 0; i < LatencyHistogram::Buckets; i++) {
+            if (latency_.bucketCount(i) > 0) {
+                out << " <" << LatencyHistogram::bucketLimit(i) << "us:" << latency_.bucketCount(i);
+            }
+        }
+        out << "\n";
+
+        std::string text = out.str();
+        std::lock_guard<std::mutex> lock(metrics_->detail_mutex);
+        metrics_->detail.swap(text);
+    }
+
+    const OutChunk* oldestQueued(const Connection& conn) const {
+        if (!conn.sending.empty()) return &conn.sending.front();
+        if (!conn.outq.empty()) return &conn.outq.front();
+        return nullptr;
+    }
+
+    // Closing is deferred so forward() never invalidates a connection in use.
+    // With io_uring the socket is shut down first and the connection lives on
+    // until its outstanding receive and sends have completed.
+    void reapClosed() {
+        for (auto it = conns_.begin(); it != conns_.end();) {
+            Connection& conn = *it->second;
+            if (conn.closing && uring_ok_ && (conn.recv_armed || !conn.sending.empty())) {
+                if (!conn.shut) {
+                    ::shutdown(conn.fd, SHUT_RDWR);
+                    conn.shut = true;
+                }
+                ++it;
+                continue;
+            }
+            if (conn.closing) {
+                leaveRoom(conn);
+                if (uring_ok_) {
+                    if (unsigned(it->first) < ring_.fileSlots()) {
+                        ring_.updateFile(unsigned(it->first), -1);
+                    }
+                } else {
+                    epoll_ctl(epfd_, EPOLL_CTL_DEL, it->first, nullptr);
+                }
+                close(it->first);
+                it = conns_.erase(it);
+                metrics_->connections.set(conns_.size());
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // ---- io_uring backend ----
+
+    enum UringOp : uint32_t { Op_Accept = 1, Op_Recv, Op_Send, Op_Poll };
+
+    static uint64_t userData(UringOp op, int fd) { return (uint64_t(op) << 32) | uint32_t(fd); }
+
+    bool initUring() {
+        //Only this thread uses the ring, so completions can be processed when
+        //it waits instead of interrupting it (kernel 6.1+)
+        if (!ring_.init(Ring_Entries, IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN) &&
+            !ring_.init(Ring_Entries)) {
+            perror("io_uring_setup");
+            return false;
+        }
+        if (!ring_.registerFiles(Ring_Files) || !recv_buffers_.init(ring_, 0, Recv_Buffers, Recv_Buffer_Size)) {
+            return false;
+        }
+        armAccept();
+        return true;
+    }
+
+    // Client sockets go through the fixed-file table when the fd fits
+    void setTarget(io_uring_sqe* sqe, int fd) {
+        if (unsigned(fd) < ring_.fileSlots()) {
+            sqe->fd = fd;
+            sqe->flags |= IOSQE_FIXED_FILE;
+        } else {
+            sqe->fd = fd;
+        }
+    }
+
+    void armAccept() {
+        io_uring_sqe* sqe = ring_.sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = listen_fd_;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        sqe->user_data = userData(Op_Accept, listen_fd_);
+    }
+
+    void armRecv(Connection& conn) {
+        io_uring_sqe* sqe = ring_.sqe();
+        if (!sqe) {
+            conn.closing = true;
+            return;
+        }
+        sqe->opcode = IORING_OP_RECV;
+        setTarget(sqe, conn.fd);
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = recv_buffers_.group();
+        sqe->user_data = userData(Op_Recv, conn.fd);
+        conn.recv_armed = true;
+    }
+
+    void armPoll(int fd) {
+        io_uring_sqe* sqe = ring_.sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = POLLIN;
+        sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = userData(Op_Poll, fd);
+    }
+
+    // Move queued frames into one chain of linked sendmsgs, each gathering
+    // up to Frames_Per_Send frames so a wakeup fills the socket buffer rather
+    // than moving a single frame. The next chain is submitted when this one has
+    // completed, which keeps frames in order. Like the socket buffer under
+    // epoll, the chain no longer counts as queued.
+    void submitSends(Connection& conn) {
+        if (conn.closing || conn.outq.empty()) {
+            return;
+        }
+        if (!conn.sending.empty()) {
+            markBlocked(conn);      //Waiting behind the chain in flight
+            return;
+        }
+        size_t chain = std::min(conn.outq.size(), Max_Send_Chain);
+        size_t parts = (chain + Frames_Per_Send - 1) / Frames_Per_Send;
+        if (ring_.spaceLeft() < parts) {
+            ring_.submit(0);    //A chain must not be split across two submits
+            if (ring_.spaceLeft() < parts) return;  //Retried on the next enqueue
+        }
+
+        conn.send_iov.resize(chain);
+        conn.send_parts.assign(parts, SendPart());
+        conn.parts_done = 0;
+        for (size_t i = 0; i < chain; i++) {
+            conn.sending.push_back(std::move(conn.outq.front()));
+            conn.outq.pop_front();
+            const FrameRef& frame = conn.sending.back().frame;
+            conn.out_bytes -= frame.size();
+            conn.sending_bytes += frame.size();
+            conn.send_iov[i] = {frame.data(), frame.size()};
+            SendPart& part = conn.send_parts[i / Frames_Per_Send];
+            part.frames++;
+            part.bytes += frame.size();
+        }
+        if (conn.outq.empty()) {
+            markDrained(conn);
+        }
+
+        for (size_t p = 0; p < parts; p++) {
+            SendPart& part = conn.send_parts[p];
+            part.msg.msg_iov = &conn.send_iov[p * Frames_Per_Send];
+            part.msg.msg_iovlen = part.frames;
+
+            io_uring_sqe* sqe = ring_.sqe();
+            sqe->opcode = IORING_OP_SENDMSG;
+            setTarget(sqe, conn.fd);
+            sqe->addr = reinterpret_cast<uint64_t>(&part.msg);
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;    //Kernel retries short sends
+            if (p + 1 < parts) {
+                sqe->flags |= IOSQE_IO_LINK;
+            }
+            sqe->user_data = userData(Op_Send, conn.fd);
+        }
+    }
+
+    void runUring(const std::atomic<bool>& stop) {
+        last_report_ = Clock::now();
+        __kernel_timespec tick = {0, Tick_ms * 1000000LL};
+        while (!stop) {
+            Clock::time_point waiting = Clock::now();
+            if (ring_.submit(1, &tick) < 0) {
+                perror("io_uring_enter");
+                break;
+            }
+            metrics_->idle_ns.add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - waiting).count()));
+            ring_.forEachCqe([&](const io_uring_cqe& cqe) { onCompletion(cqe); });
+            flushQueued();
+            housekeeping();
+            reapClosed();
+        }
+    }
+
+    // Start the sends for every client that got frames in this batch; only
+    // what could not be submitted counts against the queue limit
+    void flushQueued() {
+        for (int fd : flush_list_) {
+            auto it = conns_.find(fd);
+            if (it == conns_.end()) continue;
+            Connection& conn = *it->second;
+            conn.flush_queued = false;
+            submitSends(conn);
+            if (conn.out_bytes > opts_.queue_limit) {
+                overflow(conn);
+            }
+            conn.stats.peak_bytes = std::max(conn.stats.peak_bytes, conn.out_bytes);
+        }
+        flush_list_.clear();
+    }
+
+    void onCompletion(const io_uring_cqe& cqe) {
+        UringOp op = UringOp(cqe.user_data >> 32);
+        int fd = int(uint32_t(cqe.user_data));
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+
+        if (op == Op_Accept) {
+            if (cqe.res >= 0) {
+                sockaddr_storage addr = {};
+                socklen_t len = sizeof(addr);
+                getpeername(cqe.res, reinterpret_cast<sockaddr*>(&addr), &len);
+                if (unsigned(cqe.res) < ring_.fileSlots()) {
+                    ring_.updateFile(unsigned(cqe.res), cqe.res);
+                }
+                armRecv(addConnection(cqe.res, peerName(addr)));
+            } else if (cqe.res != -EAGAIN && cqe.res != -EINTR && cqe.res != -ECONNABORTED) {
+                errno = -cqe.res;
+                perror("accept");
+            }
+            if (!more) armAccept();
+            return;
+        }
+        if (op == Op_Poll) {
+            onReadable(fd);
+            if (!more) armPoll(fd);
+            return;
+        }
+
+        auto it = conns_.find(fd);
+        if (it == conns_.end()) return;
+        Connection& conn = *it->second;
+
+        if (op == Op_Recv) {
+            if (cqe.res > 0) {
+                uint16_t id = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (!conn.closing) {
+                    onData(conn, recv_buffers_.buffer(id), size_t(cqe.res));
+                }
+                recv_buffers_.recycle(id);
+            } else if (cqe.res == 0) {
+                if (!conn.closing) {
+                    std::cout << "Client disconnected (" << conn.name << ").\n";
+                }
+                conn.closing = true;
+            } else if (cqe.res != -ENOBUFS) {
+                if (!conn.closing) {
+                    errno = -cqe.res;
+                    perror("recv error");
+                }
+                conn.closing = true;
+            }
+            if (!more) {
+                conn.recv_armed = false;
+                if (!conn.closing) armRecv(conn);   //Ended early, e.g. out of buffers
+            }
+            return;
+        }
+
+        if (op == Op_Send) {
+            //Linked sends complete in submission order
+            const SendPart& part = conn.send_parts[conn.parts_done++];
+            bool sent = cqe.res >= 0 && size_t(cqe.res) == part.bytes;
+            if (sent) {
+                Clock::time_point now = Clock::now();
+                for (size_t i = 0; i < part.frames; i++) {
+                    frameSent(conn, conn.sending[i], now);
+                }
+            }
+            conn.sending.erase(conn.sending.begin(), conn.sending.begin() + part.frames);
+            conn.sending_bytes -= part.bytes;
+            if (sent) {
+                conn.stats.sent_bytes += part.bytes;
+                metrics_->bytes_sent.add(part.bytes);
+            } else if (!conn.closing) {
+                if (cqe.res < 0 && cqe.res != -ECANCELED) {
+                    errno = -cqe.res;
+                    perror("send error");
+                }
+                conn.closing = true;
+            }
+            if (conn.sending.empty()) {
+                submitSends(conn);
+            }
+        }
+    }
+
+    const RelayOptions opts_;
+    uring::Uring ring_;                        // Only with the io_uring backend
+    uring::BufferGroup recv_buffers_;
+    bool uring_ok_ = false;
+    std::vector<int> flush_list_;              // Clients with frames queued this batch
+    int epfd_ = -1;
+    int listen_fd_;
+    Clock::time_point last_report_;
+    int timer_fd_ = -1;
+    Bridge* bridge_ = nullptr;                 // Only with several workers
+    int worker_ = 0;
+    std::vector<BridgedFrame> bridged_;
+    std::unordered_map<uint32_t, RelayRoom*> bridged_rooms_;   // Bridge id -> room here
+    RoomTable<Connection, RoomState> rooms_;
+    WorkerMetrics own_metrics_;                // Counted here unless attachMetrics() is called
+    WorkerMetrics* metrics_ = &own_metrics_;
+    bool publish_metrics_ = false;
+    Clock::time_point last_publish_;
+    LatencyHistogram latency_;                 // Every frame this loop has written
+    FramePool pool_;                           // Before conns_: outlives every queued reference
+    std::unordered_map<int, std::unique_ptr<Connection>> conns_;
+    std::vector<int> pending_reads_;
+    uint8_t scratch_[Read_Chunk];
+};
+
+// Another listening socket on the same address, for one more worker
+inline int reuseportListener(int listen_fd, int backlog) {
+    sockaddr_storage addr = {};
+    socklen_t len = sizeof(addr);
+    if (getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) {
+        perror("getsockname");
+        return -1;
+    }
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("worker socket");
+        return -1;
+    }
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) < 0 || listen(fd, backlog) < 0) {
+        perror("worker bind (was SO_REUSEPORT set on the first socket?)");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Run the relay on a listening socket until stop is set. With more than one
+// worker, each runs its own loop on its own SO_REUSEPORT socket, pinned to a
+// core; the caller's socket must have SO_REUSEPORT set before bind. With
+// opts.metrics a thread of its own answers the metrics endpoint.
+inline bool serve(int listen_fd, const RelayOptions& opts, const std::atomic<bool>& stop, int backlog = SOMAXCONN) {
+    if (opts.sfu) {
+        std::cerr << "This server has no SFU mode.\n";
+        return false;
+    }
+    MetricsEndpoint endpoint;
+    if (!opts.metrics.empty() && !endpoint.open(opts.metrics)) {
+        return false;
+    }
+
+    int workers = opts.workers > 0 ? opts.workers : int(std::thread::hardware_concurrency());
+    if (opts.mix && workers > 1) {
+        std::cout << "Mixing needs every source in one loop, running a single worker.\n";
+        workers = 1;
+    }
+    std::vector<int> sockets = {listen_fd};
+    for (int i = 1; i < workers; i++) {
+        int fd = reuseportListener(listen_fd, backlog);
+        if (fd < 0) break;
+        sockets.push_back(fd);
+    }
+
+    std::unique_ptr<MetricsRegistry> metrics;
+    std::atomic<bool> metrics_stop(false);
+    std::thread metrics_thread;
+    if (!opts.metrics.empty()) {
+        metrics.reset(new MetricsRegistry(int(sockets.size())));
+        metrics_thread = std::thread([&] { endpoint.run(*metrics, metrics_stop); });
+        std::cout << "Metrics at " << opts.metrics << ".\n";
+    }
+
+    bool ok = true;
+    if (sockets.size() == 1) {
+        EventLoop loop(listen_fd, opts);
+        if (loop.ok()) {
+            if (metrics) loop.attachMetrics(&metrics->worker(0));
+            loop.run(stop);
+        } else {
+            ok = false;
+        }
+    } else {
+        Bridge bridge(int(sockets.size()));
+        std::vector<std::thread> threads;
+        int cores = int(std::thread::hardware_concurrency());
+        for (size_t i = 0; i < sockets.size(); i++) {
+            threads.emplace_back([&, i] {
+                EventLoop loop(sockets[i], opts);
+                if (!loop.ok()) return;
+                loop.attachBridge(&bridge, int(i));
+                if (metrics) loop.attachMetrics(&metrics->worker(int(i)));
+                loop.run(stop);
+            });
+            if (cores > 0) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(int(i) % cores, &set);
+                pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set);
+            }
+        }
+        std::cout << "Relay running " << sockets.size() << " workers.\n";
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (size_t i = 1; i < sockets.size(); i++) {
+            close(sockets[i]);
+        }
+    }
+
+    metrics_stop = true;
+    if (metrics_thread.joinable()) {
+        metrics_thread.join();
+    }
+    return ok;
+}
+
+} // namespace relay
+
+#endif
@@ -0,0 +1,286 @@
+#ifndef RELAY_METRICS_H
+#define RELAY_METRICS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cli_args.h"
+
+// Live metrics for the relay workers.
+// Every worker owns one WorkerMetrics slot, aligned to a cache line so that
+// workers counting on their own cores never share a line. The worker totals
+// are single-writer atomics, bumped on the hot path with a plain load/store
+// (no locked instruction) and read by the endpoint whenever it likes. The
+// per-client and per-room tables change shape as clients come and go, so the
+// worker renders them itself a few times a second into its slot's text, under
+// a mutex only the worker and the endpoint take.
+//
+// MetricsEndpoint serves the lot as plain text from a thread of its own: on
+// 127.0.0.1:<port> as an HTTP response (curl, a browser, a scraper), or on a
+// Unix socket path where connecting is enough (nc -U, socat).
+
+namespace relay {
+
+constexpr size_t Cache_Line = 64;
+
+// Power-of-two buckets in microseconds: bucket 0 is under 1 us, bucket i
+// holds [2^(i-1), 2^i) us, the last one everything from about 34 s up
+class LatencyHistogram {
+public:
+    static constexpr int Buckets = 27;
+
+    void record(uint64_t us) {
+        int bucket = 0;
+        while (bucket + 1 < Buckets && us >= (uint64_t(1) << bucket)) bucket++;
+        counts_[bucket]++;
+        total_++;
+        if (us > max_) max_ = us;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < Buckets; i++) counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        if (other.max_ > max_) max_ = other.max_;
+    }
+
+    uint64_t count() const { return total_; }
+    uint64_t max() const { return max_; }
+    uint64_t bucketCount(int bucket) const { return counts_[bucket]; }
+    // Upper bound of a bucket, in microseconds
+    static uint64_t bucketLimit(int bucket) { return uint64_t(1) << bucket; }
+
+    // Upper bound of the bucket holding the q-quantile (0..1)
+    uint64_t percentile(double q) const {
+        if (total_ == 0) return 0;
+        uint64_t rank = uint64_t(q * double(total_ - 1)) + 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < Buckets; i++) {
+            seen += counts_[i];
+            if (seen >= rank) return std::min(bucketLimit(i), max_);
+        }
+        return max_;
+    }
+
+    // "p50=..us p99=..us max=..us", or "-" when empty
+    std::string summary() const {
+        if (total_ == 0) return "-";
+        return "p50=" + std::to_string(percentile(0.50)) + "us p90=" + std::to_string(percentile(0.90)) +
+               "us p99=" + std::to_string(percentile(0.99)) + "us max=" + std::to_string(max_) + "us";
+    }
+
+private:
+    uint64_t counts_[Buckets] = {};
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+};
+
+// Counter with one writing thread; readers may be anywhere
+class Counter {
+public:
+    void add(uint64_t n) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    void set(uint64_t n) { value_.store(n, std::memory_order_relaxed); }
+    uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+struct alignas(Cache_Line) WorkerMetrics {
+    Counter frames_in;            // Frames received from clients
+    Counter bytes_in;
+    Counter frames_out;           // Frames queued for clients (one per recipient)
+    Counter bytes_out;
+    Counter bytes_sent;           // Bytes the sockets accepted
+    Counter dropped_frames;       // Lost to full queues
+    Counter dropped_bytes;
+    Counter idle_ns;              // Time spent waiting for events
+    Counter connections;
+
+    // Client and room tables, rendered by the worker
+    std::mutex detail_mutex;
+    std::string detail;
+};
+
+class MetricsRegistry {
+public:
+    explicit MetricsRegistry(int workers)
+        : workers_(workers), slots_(new WorkerMetrics[size_t(workers)]), previous_(size_t(workers)),
+          started_(std::chrono::steady_clock::now()) {
+        for (Sample& sample : previous_) sample.taken = started_;
+    }
+
+    int workers() const { return workers_; }
+    WorkerMetrics& worker(int index) { return slots_[index]; }
+
+    // The whole report; loop load is measured since the previous call
+    std::string render() {
+        std::lock_guard<std::mutex> lock(render_mutex_);
+        auto now = std::chrono::steady_clock::now();
+        std::ostringstream out;
+        out << "# relay metrics, up " << std::chrono::duration_cast<std::chrono::seconds>(now - started_).count()
+            << "s, " << workers_ << " workers\n";
+        for (int i = 0; i < workers_; i++) {
+            WorkerMetrics& m = slots_[i];
+            Sample& last = previous_[i];
+            uint64_t idle = m.idle_ns.get();
+            double wall = std::chrono::duration<double, std::nano>(now - last.taken).count();
+            double busy = wall > 0 ? 100.0 * (1.0 - double(idle - last.idle_ns) / wall) : 0.0;
+            last.taken = now;
+            last.idle_ns = idle;
+
+            char load[16];
+            snprintf(load, sizeof(load), "%.1f", busy < 0 ? 0.0 : busy);
+            out << "[worker] " << i << " connections=" << m.connections.get() << " busy=" << load << "%"
+                << " in=" << m.frames_in.get() << "/" << m.bytes_in.get() << "B"
+                << " out=" << m.frames_out.get() << "/" << m.bytes_out.get() << "B"
+                << " sent=" << m.bytes_sent.get() << "B"
+                << " dropped=" << m.dropped_frames.get() << "/" << m.dropped_bytes.get() << "B\n";
+            std::lock_guard<std::mutex> detail(m.detail_mutex);
+            out << m.detail;
+        }
+        return out.str();
+    }
+
+private:
+    struct Sample {
+        std::chrono::steady_clock::time_point taken;
+        uint64_t idle_ns = 0;
+    };
+
+    int workers_;
+    std::unique_ptr<WorkerMetrics[]> slots_;
+    std::vector<Sample> previous_;
+    std::chrono::steady_clock::time_point started_;
+    std::mutex render_mutex_;
+};
+
+// Text endpoint for a MetricsRegistry: "<port>" is HTTP on 127.0.0.1, anything
+// else a Unix socket path
+class MetricsEndpoint {
+public:
+    ~MetricsEndpoint() {
+        if (fd_ >= 0) close(fd_);
+        if (!path_.empty()) unlink(path_.c_str());
+    }
+
+    bool open(const std::string& where) {
+        bool port = !where.empty() && where.find_first_not_of("0123456789") == std::string::npos;
+        uint16_t port_number = 0;
+        if (port && !cli::parsePort(where, port_number)) {
+            std::fprintf(stderr, "Bad metrics port: %s\n", where.c_str());
+            return false;
+        }
+        if (port) {
+            fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd_ < 0) {
+                perror("metrics socket");
+                return false;
+            }
+            int yes = 1;
+            setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port_number);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);      //Local only
+            if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+                perror("metrics bind");
+                return false;
+            }
+            http_ = true;
+        } else {
+            sockaddr_un addr = {};
+            if (where.empty() || where.size() >= sizeof(addr.sun_path)) {
+                std::fprintf(stderr, "Bad metrics socket path: %s\n", where.c_str());
+                return false;
+            }
+            fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd_ < 0) {
+                perror("metrics socket");
+                return false;
+            }
+            addr.sun_family = AF_UNIX;
+            memcpy(addr.sun_path, where.c_str(), where.size());
+            unlink(where.c_str());      //Left over from an earlier run
+            if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+                perror("metrics bind");
+                return false;
+            }
+            path_ = where;
+        }
+        if (listen(fd_, 8) < 0) {
+            perror("metrics listen");
+            return false;
+        }
+        return true;
+    }
+
+    // Answer readers until stop is set; one reader at a time
+    void run(MetricsRegistry& registry, const std::atomic<bool>& stop) {
+        while (!stop) {
+            pollfd pfd = {fd_, POLLIN, 0};
+            if (poll(&pfd, 1, Poll_ms) <= 0) continue;
+            int client = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client < 0) continue;
+            timeval timeout = {1, 0};   //A stuck reader must not stall the endpoint
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            if (http_) {
+                skipRequest(client);
+            }
+            std::string body = registry.render();
+            std::string reply;
+            if (http_) {
+                reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; charset=utf-8\r\nContent-Length: " +
+                        std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+            } else {
+                reply = body;
+            }
+            for (size_t done = 0; done < reply.size();) {
+                ssize_t n = send(client, reply.data() + done, reply.size() - done, MSG_NOSIGNAL);
+                if (n <= 0) break;
+                done += size_t(n);
+            }
+            close(client);
+        }
+    }
+
+private:
+    static constexpr int Poll_ms = 200;
+    static constexpr int Request_Wait_ms = 500;
+
+    //Whatever was asked for, the answer is the report; read up to the blank line
+    static void skipRequest(int client) {
+        std::string request;
+        char buffer[1024];
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < 16 * 1024) {
+            pollfd pfd = {client, POLLIN, 0};
+            if (poll(&pfd, 1, Request_Wait_ms) <= 0) return;
+            ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+            if (n <= 0) return;
+            request.append(buffer, size_t(n));
+        }
+    }
+
+    int fd_ = -1;
+    bool http_ = false;
+    std::string path_;
+};
+
+} // namespace relay
+
+#endif
@@ -0,0 +1,108 @@
+#ifndef ROOM_TABLE_H
+#define ROOM_TABLE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Named rooms, shared by the TCP relay and the SFU.
+// Every member is in exactly one room, and a frame is forwarded only to the
+// members of its sender's room, so the cost of a fan-out follows the room's
+// size rather than the number of connections on the server. Rooms are looked
+// up by name in a hash table, created by the first join and removed when the
+// last member leaves. Each room has its own counters, and State holds what
+// else a server keeps per room (the relay's mixer).
+//
+// Members start in Default_Room, so clients that never join a room all hear
+// each other as before. A Member type provides a `room` pointer for the table.
+
+namespace relay {
+
+constexpr size_t Max_Room_Name = 32;
+const char* const Default_Room = "main";
+
+// Room names: 1..Max_Room_Name printable characters
+inline bool validRoomName(const std::string& name) {
+    if (name.empty() || name.size() > Max_Room_Name) return false;
+    return std::all_of(name.begin(), name.end(), [](char c) { return c > ' ' && c < 127; });
+}
+
+struct RoomStats {
+    uint64_t frames_in = 0;           // Received from members
+    uint64_t bytes_in = 0;
+    uint64_t frames_out = 0;          // Queued for members (one per recipient)
+    uint64_t bytes_out = 0;
+    uint64_t dropped_frames = 0;      // Lost to slow members
+};
+
+struct NoRoomState {};
+
+template <typename Member, typename State = NoRoomState>
+struct Room {
+    std::string name;
+    std::vector<Member*> members;
+    RoomStats stats;
+    State state;
+};
+
+template <typename Member, typename State = NoRoomState>
+class RoomTable {
+public:
+    using RoomType = Room<Member, State>;
+
+    // Move a member into a room, creating the room on first use
+    RoomType& join(Member& member, const std::string& name) {
+        leave(member);
+        auto it = rooms_.find(name);
+        if (it == rooms_.end()) {
+            it = rooms_.emplace(name, std::unique_ptr<RoomType>(new RoomType())).first;
+            it->second->name = name;
+        }
+        RoomType& room = *it->second;
+        room.members.push_back(&member);
+        member.room = &room;
+        return room;
+    }
+
+    // Take a member out of its room; an empty room is removed
+    void leave(Member& member) {
+        RoomType* room = member.room;
+        if (!room) return;
+        member.room = nullptr;
+        auto& members = room->members;
+        auto it = std::find(members.begin(), members.end(), &member);
+        if (it != members.end()) {
+            *it = members.back();
+            members.pop_back();
+        }
+        if (members.empty()) {
+            std::string name = room->name;   //The key must outlive the node
+            rooms_.erase(name);
+        }
+    }
+
+    RoomType* find(const std::string& name) {
+        auto it = rooms_.find(name);
+        return it == rooms_.end() ? nullptr : it->second.get();
+    }
+
+    size_t size() const { return rooms_.size(); }
+
+    template <typename Visit>
+    void forEach(Visit&& visit) {
+        for (auto& entry : rooms_) {
+            visit(*entry.second);
+        }
+    }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<RoomType>> rooms_;
+};
+
+} // namespace relay
+
+#endif
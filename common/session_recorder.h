@@ -0,0 +1,278 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "spsc_ring.h"
+
+// Non-blocking session recorder.
+// Capture threads hand over already-encoded video frames and PCM audio through
+// lock-free rings; a dedicated I/O thread packs them into 1 MiB aligned blocks
+// and writes them with O_DIRECT where the filesystem allows it. A full ring
+// drops the record (counted) instead of stalling the caller.
+//
+// Output is a series of self-contained segments <prefix>_NNNN.oavr, rotated
+// every segment_seconds. Each segment starts with RecordFileHeader followed by
+// records of RecordHeader + payload (little endian). Audio and video records
+// are written in drain order, so readers should order them by timestamp.
+
+namespace recording {
+
+enum RecordType : uint32_t {
+    Record_Video_JPEG = 1,  // One complete JPEG frame
+    Record_Audio_PCM16 = 2, // Interleaved S16_LE samples
+    Record_Video_Strips = 3, // One frame as JPEG strips, top to bottom: repeated [u32 size][JPEG]
+};
+
+struct RecordFileHeader {
+    char magic[8];          // "OAVREC1"
+    uint32_t version;       // 1
+    uint32_t segment;       // Segment index
+    uint64_t start_us;      // Timestamp of the first record
+    uint32_t sample_rate;   // Audio format of Record_Audio_PCM16
+    uint16_t channels;
+    uint16_t reserved;
+};
+
+struct RecordHeader {
+    uint32_t type;          // RecordType
+    uint32_t size;          // Payload bytes
+    uint64_t timestamp_us;  // Capture time
+};
+
+static_assert(sizeof(RecordFileHeader) == 32, "Segment header layout");
+static_assert(sizeof(RecordHeader) == 16, "Record header layout");
+
+class SessionRecorder {
+public:
+    SessionRecorder(const std::string& prefix, int segment_seconds, uint32_t sample_rate, uint16_t channels)
+        : prefix_(prefix),
+          segment_us_(uint64_t(segment_seconds) * 1000000),
+          sample_rate_(sample_rate),
+          channels_(channels),
+          video_q_(Queue_Records),
+          audio_q_(Queue_Records),
+          audio_free_(Queue_Records) {}
+
+    ~SessionRecorder() { stop(); }
+
+    SessionRecorder(const SessionRecorder&) = delete;
+    SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+    bool start() {
+        if (posix_memalign(reinterpret_cast<void**>(&block_), Block_Align, Block_Size) != 0) {
+            std::cerr << "Recorder buffer allocation failed.\n";
+            return false;
+        }
+        running_ = true;
+        io_thread_ = std::thread(&SessionRecorder::ioLoop, this);
+        return true;
+    }
+
+    // Drains what is queued, closes the segment and joins the I/O thread
+    void stop() {
+        if (!running_.exchange(false)) {
+            return;
+        }
+        io_thread_.join();
+        free(block_);
+        block_ = nullptr;
+        std::cout << "Recorder: " << records_ << " records in " << segment_ << " segments, " << dropped_.load() << " dropped.\n";
+    }
+
+    // Video producer thread only; takes ownership of the encoded frame
+    bool pushVideo(uint64_t timestamp_us, std::vector<unsigned char>&& jpeg, RecordType type = Record_Video_JPEG) {
+        Record record{type, timestamp_us, std::move(jpeg)};
+        if (!video_q_.push(std::move(record))) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    // Audio producer thread only; reuses buffers returned by the I/O thread
+    bool pushAudio(uint64_t timestamp_us, const void* pcm, size_t bytes) {
+        Record record{Record_Audio_PCM16, timestamp_us, {}};
+        audio_free_.pop(record.data);
+        const unsigned char* src = static_cast<const unsigned char*>(pcm);
+        record.data.assign(src, src + bytes);
+        if (!audio_q_.push(std::move(record))) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Record {
+        uint32_t type = 0;
+        uint64_t timestamp_us = 0;
+        std::vector<unsigned char> data;
+    };
+
+    static constexpr size_t Queue_Records = 256;     // Per stream
+    static constexpr size_t Block_Size = 1 << 20;    // Bytes per write
+    static constexpr size_t Block_Align = 4096;      // O_DIRECT alignment
+
+    void ioLoop() {
+        Record record;
+        while (true) {
+            bool stopping = !running_;
+            bool any = false;
+            while (audio_q_.pop(record)) {
+                writeRecord(record);
+                audio_free_.push(std::move(record.data)); //Back to the producer for reuse
+                record.data = {};
+                any = true;
+            }
+            while (video_q_.pop(record)) {
+                writeRecord(record);
+                any = true;
+            }
+            if (stopping && !any) {
+                break;
+            }
+            if (!any) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        closeSegment();
+    }
+
+    void writeRecord(const Record& record) {
+        if (failed_) {
+            return;
+        }
+
+        //Records from the other stream may be slightly older than the segment start
+        if (fd_ < 0 || int64_t(record.timestamp_us - segment_start_) >= int64_t(segment_us_)) {
+            closeSegment();
+            if (!openSegment(record.timestamp_us)) {
+                failed_ = true;
+                return;
+            }
+        }
+
+        RecordHeader header = {record.type, uint32_t(record.data.size()), record.timestamp_us};
+        append(&header, sizeof(header));
+        append(record.data.data(), record.data.size());
+        records_++;
+    }
+
+    bool openSegment(uint64_t start_us) {
+        char name[32];
+        snprintf(name, sizeof(name), "_%04u.oavr", segment_);
+        std::string path = prefix_ + name;
+
+        direct_ = true;
+        fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        if (fd_ < 0 && errno == EINVAL) {
+            direct_ = false; //Filesystem without O_DIRECT (e.g. tmpfs)
+            fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        }
+        if (fd_ < 0) {
+            std::cerr << "Recorder open error (" << path << "): " << strerror(errno) << "\n";
+            return false;
+        }
+
+        segment_start_ = start_us;
+        RecordFileHeader header = {};
+        memcpy(header.magic, "OAVREC1", 8);
+        header.version = 1;
+        header.segment = segment_;
+        header.start_us = start_us;
+        header.sample_rate = sample_rate_;
+        header.channels = channels_;
+        append(&header, sizeof(header));
+        return true;
+    }
+
+    // Flush the partial block without O_DIRECT (tail is not block sized)
+    void closeSegment() {
+        if (fd_ < 0) {
+            return;
+        }
+        if (used_ > 0) {
+            if (direct_) {
+                fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+            }
+            writeAll(block_, used_);
+            used_ = 0;
+        }
+        fsync(fd_);
+        close(fd_);
+        fd_ = -1;
+        segment_++;
+    }
+
+    void append(const void* data, size_t bytes) {
+        const unsigned char* src = static_cast<const unsigned char*>(data);
+        while (bytes > 0) {
+            size_t chunk = std::min(bytes, Block_Size - used_);
+            memcpy(block_ + used_, src, chunk);
+            used_ += chunk;
+            src += chunk;
+            bytes -= chunk;
+            if (used_ == Block_Size) {
+                writeAll(block_, Block_Size);
+                used_ = 0;
+            }
+        }
+    }
+
+    void writeAll(const unsigned char* data, size_t bytes) {
+        while (bytes > 0) {
+            ssize_t written = write(fd_, data, bytes);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "Recorder write error: " << strerror(errno) << "\n";
+                failed_ = true;
+                return;
+            }
+            data += written;
+            bytes -= size_t(written);
+        }
+    }
+
+    const std::string prefix_;
+    const uint64_t segment_us_;
+    const uint32_t sample_rate_;
+    const uint16_t channels_;
+
+    SpscRing<Record> video_q_;
+    SpscRing<Record> audio_q_;
+    SpscRing<std::vector<unsigned char>> audio_free_;  // Emptied audio buffers
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<bool> running_{false};
+    std::thread io_thread_;
+
+    // I/O thread state
+    unsigned char* block_ = nullptr;
+    size_t used_ = 0;
+    int fd_ = -1;
+    bool direct_ = false;
+    bool failed_ = false;
+    uint32_t segment_ = 0;
+    uint64_t segment_start_ = 0;
+    uint64_t records_ = 0;
+};
+
+} // namespace recording
+
+#endif
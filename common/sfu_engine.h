@@ -0,0 +1,412 @@
+#ifndef SFU_ENGINE_H
+#define SFU_ENGINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "av_packets.h"
+#include "relay_engine.h"
+#include "room_table.h"
+
+// UDP selective forwarding unit for Online_AV clients.
+// Instead of sending to every peer, each client sends its audio packets and
+// video fragments once, to the SFU, and the SFU forwards them to the other
+// members of the room. There is no retransmission: a lost datagram costs the
+// receiver that datagram only, not a stall of everything behind it as on a
+// TCP relay. Replies go to the address a datagram came from, so clients
+// behind NAT work as long as they keep sending (HELLO every few seconds).
+//
+// Any datagram from a new address makes it a member, in the main room until it
+// sends SFU_Join; datagrams only go to members of the sender's room. The SFU
+// answers with SFU_Welcome (also in reply to each HELLO) and tells a room's
+// members about joins and leaves. Members silent for Member_Timeout_s are
+// dropped. Each member chooses
+// per kind whose streams it receives (SFU_Subscribe/SFU_Unsubscribe), e.g. a
+// client that shows one video picks that sender. Picture-loss feedback goes to
+// the video senders the member receives.
+//
+// Datagrams are read with recvmmsg and forwarded with sendmmsg, one batch at a
+// time; the copies of a datagram all point at its receive buffer.
+
+namespace sfu {
+
+using Clock = std::chrono::steady_clock;
+
+struct MemberStats {
+    uint64_t in_packets = 0;
+    uint64_t in_bytes = 0;
+    uint64_t out_packets = 0;
+    uint64_t out_bytes = 0;
+    uint64_t send_errors = 0;
+};
+
+// Whose streams of one kind a member receives: everyone except ids, or only ids
+struct Subscription {
+    bool all = true;
+    std::vector<uint32_t> ids;
+
+    bool wants(uint32_t id) const {
+        return all != (std::find(ids.begin(), ids.end(), id) != ids.end());
+    }
+
+    void subscribe(uint32_t id) {
+        if (id == SFU_All) {
+            all = true;
+            ids.clear();
+        } else {
+            all ? remove(id) : add(id);
+        }
+    }
+
+    void unsubscribe(uint32_t id) {
+        if (id == SFU_All) {
+            all = false;
+            ids.clear();
+        } else {
+            all ? add(id) : remove(id);
+        }
+    }
+
+    void add(uint32_t id) {
+        if (std::find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
+    }
+
+    void remove(uint32_t id) { ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end()); }
+
+    std::string describe() const {
+        if (all && ids.empty()) return "all";
+        if (!all && ids.empty()) return "none";
+        std::string text = all ? "all but" : "only";
+        for (uint32_t id : ids) text += " " + std::to_string(id);
+        return text;
+    }
+};
+
+struct Member {
+    uint32_t id = 0;
+    relay::Room<Member>* room = nullptr;   // Kept by the room table
+    sockaddr_in addr = {};
+    std::string name;                 // Address for logging
+    Clock::time_point last_seen;
+    Subscription audio;
+    Subscription video;
+    bool sends_video = false;         // Feedback is only routed to video senders
+    bool left = false;                // Said goodbye, removed by the next sweep
+    MemberStats stats;
+};
+
+inline uint64_t addressKey(const sockaddr_in& addr) {
+    return (uint64_t(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+class Forwarder {
+public:
+    // Takes a bound UDP socket
+    Forwarder(int fd, const relay::RelayOptions& opts) : opts_(opts), fd_(fd) {
+        //Bursts from every sender land on this one socket (capped by net.core.rmem_max/wmem_max)
+        int bytes = Socket_Buffer;
+        setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+        setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+        buffers_.resize(size_t(Batch) * Max_Datagram);
+        for (int i = 0; i < Batch; i++) {
+            in_iov_[i] = {&buffers_[size_t(i) * Max_Datagram], Max_Datagram};
+        }
+    }
+
+    // Serve until stop is set
+    void run(const std::atomic<bool>& stop) {
+        last_report_ = last_sweep_ = Clock::now();
+        while (!stop) {
+            pollfd pfd = {fd_, POLLIN, 0};
+            int ready = poll(&pfd, 1, Tick_ms);
+            if (ready < 0 && errno != EINTR) {
+                perror("poll");
+                return;
+            }
+            if (ready > 0) {
+                receiveBatch();
+            }
+            housekeeping();
+        }
+    }
+
+    size_t members() const { return members_.size(); }
+
+private:
+    static constexpr int Batch = 32;                 // Datagrams per recvmmsg
+    static constexpr size_t Max_Datagram = 8192;     // Larger than any Online_AV datagram
+    static constexpr int Tick_ms = 200;
+    static constexpr int Member_Timeout_s = 15;      // Three missed HELLOs
+    static constexpr size_t Max_Send_Batch = 1024;   // Messages per sendmmsg (UIO_MAXIOV)
+    static constexpr int Socket_Buffer = 4 << 20;
+
+    struct Outgoing {
+        const uint8_t* data;
+        size_t len;
+        Member* to;
+    };
+
+    void receiveBatch() {
+        mmsghdr msgs[Batch];
+        memset(msgs, 0, sizeof(msgs));
+        for (int i = 0; i < Batch; i++) {
+            msgs[i].msg_hdr.msg_iov = &in_iov_[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &in_addr_[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        }
+        int n = recvmmsg(fd_, msgs, Batch, MSG_DONTWAIT, nullptr);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("recvmmsg");
+            }
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) continue;
+            onDatagram(in_addr_[i], static_cast<const uint8_t*>(in_iov_[i].iov_base), msgs[i].msg_len);
+        }
+        //Forwarded copies point into the receive buffers: send before the next batch
+        sendQueued();
+    }
+
+    void onDatagram(const sockaddr_in& from, const uint8_t* data, size_t len) {
+        Member& sender = member(from);
+        sender.last_seen = Clock::now();
+        sender.stats.in_packets++;
+        sender.stats.in_bytes += len;
+
+        relay::Room<Member>& room = *sender.room;
+        bool media = len == sizeof(Audio_Packet) || len == sizeof(Video_Fragment) || len == sizeof(Feedback_Packet);
+        if (media) {
+            room.stats.frames_in++;
+            room.stats.bytes_in += len;
+        }
+
+        if (len == 5 && memcmp(data, "HELLO", 5) == 0) {
+            control(sender, SFU_Welcome, sender.id, 0);
+        } else if (len == sizeof(Audio_Packet)) {
+            for (Member* to : room.members) {
+                if (to != &sender && to->audio.wants(sender.id)) queue(*to, data, len);
+            }
+        } else if (len == sizeof(Video_Fragment)) {
+            sender.sends_video = true;
+            for (Member* to : room.members) {
+                if (to != &sender && to->video.wants(sender.id)) queue(*to, data, len);
+            }
+        } else if (len == sizeof(Feedback_Packet)) {
+            //Key frame requests go to the video this member receives
+            for (Member* to : room.members) {
+                if (to != &sender && to->sends_video && sender.video.wants(to->id)) queue(*to, data, len);
+            }
+        } else if (len == sizeof(Sfu_Control)) {
+            Sfu_Control request;
+            memcpy(&request, data, sizeof(request));
+            if (request.magic == SFU_Magic) {
+                onControl(sender, request);
+            }
+        }
+    }
+
+    void onControl(Member& sender, const Sfu_Control& request) {
+        if (request.op == SFU_Subscribe || request.op == SFU_Unsubscribe) {
+            for (Subscription* sub : {&sender.audio, &sender.video}) {
+                uint32_t kind = sub == &sender.audio ? SFU_Audio : SFU_Video;
+                if (!(request.kinds & kind)) continue;
+                if (request.op == SFU_Subscribe) {
+                    sub->subscribe(request.member);
+                } else {
+                    sub->unsubscribe(request.member);
+                }
+            }
+        } else if (request.op == SFU_Join) {
+            std::string name(request.room, strnlen(request.room, SFU_Room_Max));
+            if (relay::validRoomName(name)) {
+                enterRoom(sender, name);
+            }
+        } else if (request.op == SFU_Left) {
+            sender.left = true;
+            last_sweep_ = Clock::time_point();      //Sweep now
+        }
+    }
+
+    // The member for an address, joining it on first contact
+    Member& member(const sockaddr_in& from) {
+        uint64_t key = addressKey(from);
+        auto it = members_.find(key);
+        if (it != members_.end()) return it->second;
+
+        Member& joined = members_[key];
+        joined.id = next_id_++;
+        joined.addr = from;
+        char host[INET_ADDRSTRLEN] = "?";
+        inet_ntop(AF_INET, &from.sin_addr, host, sizeof(host));
+        joined.name = std::string(host) + ":" + std::to_string(ntohs(from.sin_port));
+        enterRoom(joined, relay::Default_Room);
+        return joined;
+    }
+
+    // Move a member into a room and introduce it to the members there
+    void enterRoom(Member& member, const std::string& name) {
+        if (member.room && member.room->name == name) {
+            control(member, SFU_Welcome, member.id, 0);
+            return;
+        }
+        leaveRoom(member);
+        relay::Room<Member>& room = rooms_.join(member, name);
+        std::cout << "SFU: member " << member.id << " (" << member.name << ") in room " << name
+                  << " (" << room.members.size() << " members)\n";
+        control(member, SFU_Welcome, member.id, 0);
+        for (Member* other : room.members) {
+            if (other == &member) continue;
+            control(*other, SFU_Joined, member.id, 0);
+            control(member, SFU_Joined, other->id, 0);
+        }
+    }
+
+    // Take a member out of its room and tell the ones still there
+    void leaveRoom(Member& member) {
+        if (!member.room) return;
+        std::vector<Member*> others = member.room->members;
+        rooms_.leave(member);   //May delete the room
+        for (Member* other : others) {
+            if (other == &member) continue;
+            other->audio.remove(member.id);
+            other->video.remove(member.id);
+            control(*other, SFU_Left, member.id, 0);
+        }
+    }
+
+    // Drop members that went quiet and print the periodic report
+    void housekeeping() {
+        Clock::time_point now = Clock::now();
+        if (now - last_sweep_ >= std::chrono::seconds(1)) {
+            last_sweep_ = now;
+            for (auto it = members_.begin(); it != members_.end();) {
+                if (it->second.left || now - it->second.last_seen > std::chrono::seconds(Member_Timeout_s)) {
+                    std::cout << "SFU: member " << it->second.id << " (" << it->second.name << ") left\n";
+                    leaveRoom(it->second);
+                    it = members_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        if (opts_.stats_s <= 0 || now - last_report_ < std::chrono::seconds(opts_.stats_s)) {
+            return;
+        }
+        last_report_ = now;
+        for (auto& entry : members_) {
+            const Member& m = entry.second;
+            std::cout << "[sfu] member " << m.id << " " << m.name << " room=" << m.room->name
+                      << " in=" << m.stats.in_packets << "/" << m.stats.in_bytes << "B"
+                      << " out=" << m.stats.out_packets << "/" << m.stats.out_bytes << "B"
+                      << " errors=" << m.stats.send_errors
+                      << " audio=" << m.audio.describe() << " video=" << m.video.describe() << "\n";
+        }
+        rooms_.forEach([&](const relay::Room<Member>& room) {
+            std::cout << "[room] " << room.name << " members=" << room.members.size()
+                      << " in=" << room.stats.frames_in << "/" << room.stats.bytes_in << "B"
+                      << " out=" << room.stats.frames_out << "/" << room.stats.bytes_out << "B"
+                      << " dropped=" << room.stats.dropped_frames << "\n";
+        });
+    }
+
+    void control(Member& to, uint32_t op, uint32_t member, uint32_t kinds) {
+        Sfu_Control message = {};
+        message.magic = SFU_Magic;
+        message.op = op;
+        message.member = member;
+        message.kinds = kinds;
+        if (to.room) {
+            message.members = uint32_t(to.room->members.size());
+            memcpy(message.room, to.room->name.data(), std::min(to.room->name.size(), size_t(SFU_Room_Max)));
+        }
+        if (sendto(fd_, &message, sizeof(message), 0, reinterpret_cast<const sockaddr*>(&to.addr), sizeof(to.addr)) < 0) {
+            to.stats.send_errors++;
+        }
+    }
+
+    void queue(Member& to, const uint8_t* data, size_t len) {
+        to.room->stats.frames_out++;
+        to.room->stats.bytes_out += len;
+        out_.push_back(Outgoing{data, len, &to});
+    }
+
+    // Send everything queued, sendmmsg batches at a time
+    void sendQueued() {
+        for (size_t start = 0; start < out_.size();) {
+            size_t count = std::min(out_.size() - start, Max_Send_Batch);
+            out_iov_.resize(count);
+            out_msgs_.assign(count, mmsghdr());
+            for (size_t i = 0; i < count; i++) {
+                const Outgoing& item = out_[start + i];
+                out_iov_[i] = {const_cast<uint8_t*>(item.data), item.len};
+                out_msgs_[i].msg_hdr.msg_iov = &out_iov_[i];
+                out_msgs_[i].msg_hdr.msg_iovlen = 1;
+                out_msgs_[i].msg_hdr.msg_name = &item.to->addr;
+                out_msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            }
+            int sent = sendmmsg(fd_, out_msgs_.data(), unsigned(count), 0);
+            if (sent < 0) {
+                if (errno == EINTR) continue;
+                sent = 0;
+            }
+            for (int i = 0; i < sent; i++) {
+                out_[start + i].to->stats.out_packets++;
+                out_[start + i].to->stats.out_bytes += out_[start + i].len;
+            }
+            //The message at sent failed (e.g. no route): count it and go on after it
+            if (size_t(sent) < count) {
+                out_[start + sent].to->stats.send_errors++;
+                out_[start + sent].to->room->stats.dropped_frames++;
+                sent++;
+            }
+            start += size_t(sent);
+        }
+        out_.clear();
+    }
+
+    const relay::RelayOptions opts_;
+    int fd_;
+    std::vector<uint8_t> buffers_;
+    iovec in_iov_[Batch];
+    sockaddr_in in_addr_[Batch];
+    std::unordered_map<uint64_t, Member> members_;   // Keyed by source address
+    relay::RoomTable<Member> rooms_;
+    uint32_t next_id_ = 1;
+    std::vector<Outgoing> out_;
+    std::vector<iovec> out_iov_;
+    std::vector<mmsghdr> out_msgs_;
+    Clock::time_point last_sweep_;
+    Clock::time_point last_report_;
+};
+
+// Run the SFU on a bound UDP socket until stop is set
+inline bool serve(int fd, const relay::RelayOptions& opts, const std::atomic<bool>& stop) {
+    Forwarder forwarder(fd, opts);
+    std::cout << "SFU forwarding Online_AV datagrams.\n";
+    forwarder.run(stop);
+    return true;
+}
+
+} // namespace sfu
+
+#endif
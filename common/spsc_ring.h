@@ -0,0 +1,74 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded single-producer / single-consumer queue.
+// push() and pop() never block and never take a lock, so a real-time thread
+// can hand work to a slower one; when the ring is full push() fails and the
+// caller decides what to drop.
+
+template <typename T>
+class SpscRing {
+public:
+    // Capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity) : slots_(roundUp(capacity)), mask_(slots_.size() - 1) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Producer side
+    bool push(T&& value) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache_ > mask_) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head - tail_cache_ > mask_) {
+                return false;
+            }
+        }
+        slots_[head & mask_] = std::move(value);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool pop(T& out) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_cache_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_) {
+                return false;
+            }
+        }
+        out = std::move(slots_[tail & mask_]);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return slots_.size(); }
+
+private:
+    static size_t roundUp(size_t n) {
+        size_t p = 2;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    std::vector<T> slots_;
+    const size_t mask_;
+
+    // Producer and consumer indices live on separate cache lines
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t tail_cache_ = 0;   // Producer's view of tail
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t head_cache_ = 0;   // Consumer's view of head
+};
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <time.h>
+
+#include "spsc_ring.h"
+
+// Per-stage latency tracing for the media clients.
+// Each packet (an audio buffer, a video frame) is tagged as it passes the
+// points of the pipeline:
+//
+//   capture   read from the device          receive   recvfrom returned it
+//   encode    handed to the encoder         dequeue   taken off the jitter/playout queue
+//   send      on the socket                 playback  written to the device
+//
+// so the gap between two consecutive tags of one packet is the time it spent
+// in that stage. A tag is a CLOCK_MONOTONIC timestamp (vDSO, TSC backed on
+// x86) pushed into a ring owned by the tagging thread; only a thread's first
+// tag takes a lock and allocates, to register its ring. That lock guards the
+// list of rings alone and is never held while writing to the file. A writer
+// thread drains the rings to a text timeline every Drain_Ms; a ring that fills before it is
+// drained drops tags and counts them. Until start(), and after stop(), a tag
+// is one relaxed load and a branch.
+//
+// Timeline lines are "t_ns thread flow stage source id". Packets are keyed by
+// flow, source (the sending peer, 0 for our own) and id (the packet's sequence
+// number); monotonic clocks agree between processes on one host, so timelines
+// from both ends can be merged. common/trace_report.py turns them into
+// per-stage histograms.
+//
+// One Tracer per process: the per-thread rings hang off a thread_local.
+
+namespace tracing {
+
+// Stages, in pipeline order
+constexpr uint8_t Stage_Capture = 0;
+constexpr uint8_t Stage_Encode = 1;
+constexpr uint8_t Stage_Send = 2;
+constexpr uint8_t Stage_Receive = 3;
+constexpr uint8_t Stage_Dequeue = 4;
+constexpr uint8_t Stage_Playback = 5;
+constexpr const char* Stage_Names[] = {"capture", "encode", "send", "receive", "dequeue", "playback"};
+
+// Flows: what the packet is and which way it goes
+constexpr uint16_t Flow_Audio_Out = 0;
+constexpr uint16_t Flow_Audio_In = 1;
+constexpr uint16_t Flow_Video_Out = 2;
+constexpr uint16_t Flow_Video_In = 3;
+constexpr const char* Flow_Names[] = {"audio_out", "audio_in", "video_out", "video_in"};
+
+constexpr size_t Thread_Events = 16384;     // Ring per tagging thread
+constexpr int Drain_Ms = 50;
+
+struct Event {
+    uint64_t t_ns;
+    uint32_t id;
+    uint32_t source;
+    uint32_t thread;
+    uint16_t flow;
+    uint8_t stage;
+};
+
+inline uint64_t nowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ULL + uint64_t(ts.tv_nsec);
+}
+
+// Source key of a peer: its address and port
+inline uint32_t sourceOf(const sockaddr_in& peer) {
+    return uint32_t(peer.sin_addr.s_addr) ^ (uint32_t(peer.sin_port) << 16);
+}
+
+class Tracer {
+public:
+    Tracer() = default;
+    ~Tracer() { stop(); }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    // Opens the timeline and starts tagging
+    bool start(const std::string& path) {
+        file_ = fopen(path.c_str(), "w");
+        if (!file_) {
+            fprintf(stderr, "Trace file %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        path_ = path;
+        fprintf(file_, "# t_ns thread flow stage source id\n");
+        running_ = true;
+        writer_ = std::thread(&Tracer::writeLoop, this);
+        enabled_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Stops tagging, drains what is left and closes the timeline
+    void stop() {
+        enabled_.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mute_);
+            if (!running_) return;
+            running_ = false;
+        }
+        wake_.notify_one();
+        writer_.join();
+        uint64_t dropped = 0;
+        size_t threads = 0;
+        {
+            std::lock_guard<std::mutex> lock(registry_mute_);
+            for (const auto& buffer : buffers_) dropped += buffer->dropped.load(std::memory_order_relaxed);
+            threads = buffers_.size();
+        }
+        fclose(file_);
+        file_ = nullptr;
+        printf("[trace] %llu tags from %zu threads to %s, %llu dropped\n", (unsigned long long)written_,
+               threads, path_.c_str(), (unsigned long long)dropped);
+    }
+
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // Any thread; never blocks
+    void mark(uint8_t stage, uint16_t flow, uint32_t id, uint32_t source = 0) {
+        if (!enabled_.load(std::memory_order_relaxed)) return;
+        ThreadBuffer* buffer = local();
+        Event event{nowNs(), id, source, buffer->thread, flow, stage};
+        if (!buffer->ring.push(std::move(event))) {
+            buffer->dropped.store(buffer->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct ThreadBuffer {
+        explicit ThreadBuffer(uint32_t index) : ring(Thread_Events), thread(index) {}
+        SpscRing<Event> ring;
+        std::atomic<uint64_t> dropped{0};
+        uint32_t thread;
+    };
+
+    //First tag of a thread registers its ring; later ones find it in the thread_local
+    ThreadBuffer* local() {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(registry_mute_);
+            buffers_.emplace_back(new ThreadBuffer(uint32_t(buffers_.size())));
+            buffer = buffers_.back().get();
+        }
+        return buffer;
+    }
+
+    //Rings are copied out of the registry, then drained with no lock held
+    void writeLoop() {
+        std::vector<ThreadBuffer*> rings;
+        std::unique_lock<std::mutex> lock(mute_);
+        while (true) {
+            bool last = !running_;
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> registry(registry_mute_);
+                rings.clear();
+                for (const auto& buffer : buffers_) rings.push_back(buffer.get());
+            }
+            Event event;
+            for (ThreadBuffer* buffer : rings) {
+                while (buffer->ring.pop(event)) {
+                    fprintf(file_, "%llu %u %u %u %u %u\n", (unsigned long long)event.t_ns, event.thread, event.flow,
+                            event.stage, event.source, event.id);
+                    written_++;
+                }
+            }
+            if (last) break;
+            lock.lock();
+            if (running_) wake_.wait_for(lock, std::chrono::milliseconds(Drain_Ms));
+        }
+        fflush(file_);
+    }
+
+    std::atomic<bool> enabled_{false};
+    std::mutex mute_;               // running_ and the writer's wake-up
+    std::mutex registry_mute_;      // buffers_; taken by a thread's first tag
+    std::condition_variable wake_;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+    std::thread writer_;
+    bool running_ = false;
+    FILE* file_ = nullptr;
+    std::string path_;
+    uint64_t written_ = 0;
+};
+
+} // namespace tracing
+
+#endif
@@ -0,0 +1,88 @@
+import sys
+from collections import defaultdict
+
+# Per-stage latency histograms from trace timelines (common/trace.h)
+# Usage: python3 trace_report.py <timeline> [timeline ...]
+#
+# Within a timeline, the gap between consecutive tags of a packet (same flow,
+# source and id) is the time spent in that stage. Given the timelines of a
+# sender and a receiver on one host, each received packet is also matched to
+# the send of the same sequence number, giving the network stage.
+
+STAGES = ["capture", "encode", "send", "receive", "dequeue", "playback"]
+FLOWS = ["audio_out", "audio_in", "video_out", "video_in"]
+SEND = 2
+RECEIVE = 3
+OUTGOING = {1: 0, 3: 2}     # Incoming flow -> the flow it was sent on
+PERCENTILES = [50, 90, 99]
+
+
+def read_timeline(path):
+    """Tags of one timeline, grouped per packet"""
+    packets = defaultdict(list)
+    with open(path) as f:
+        for line in f:
+            if line.startswith("#"):
+                continue
+            t_ns, _, flow, stage, source, packet_id = (int(v) for v in line.split())
+            packets[(flow, source, packet_id)].append((t_ns, stage))
+    for tags in packets.values():
+        tags.sort()
+    return packets
+
+
+def percentile(values, p):
+    index = min(len(values) - 1, max(0, int(round(p / 100.0 * len(values))) - 1))
+    return values[index]
+
+
+def report(name, values):
+    values.sort()
+    parts = " ".join(f"p{p}={percentile(values, p) / 1000.0:.1f}" for p in PERCENTILES)
+    print(f"  {name:32s} n={len(values):<7d} min={values[0] / 1000.0:.1f} {parts} "
+          f"max={values[-1] / 1000.0:.1f} mean={sum(values) / len(values) / 1000.0:.1f} us")
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("Usage: python3 trace_report.py <timeline> [timeline ...]")
+        return
+
+    timelines = [(path, read_timeline(path)) for path in sys.argv[1:]]
+    for path, packets in timelines:
+        stages = defaultdict(list)
+        for (flow, _, _), tags in packets.items():
+            for (t0, s0), (t1, s1) in zip(tags, tags[1:]):
+                stages[(flow, s0, s1)].append(t1 - t0)
+        print(f"{path}:")
+        for (flow, s0, s1) in sorted(stages):
+            report(f"{FLOWS[flow]} {STAGES[s0]}->{STAGES[s1]}", stages[(flow, s0, s1)])
+
+    # Network: sends of the other timelines against our receives, by sequence number
+    if len(timelines) < 2:
+        return
+    print("network (send -> receive, across timelines):")
+    for path, packets in timelines:
+        sends = defaultdict(list)
+        for other, other_packets in timelines:
+            if other == path:
+                continue
+            for (flow, _, packet_id), tags in other_packets.items():
+                sends[(flow, packet_id)].extend(t for t, stage in tags if stage == SEND)
+        network = defaultdict(list)
+        for (flow, _, packet_id), tags in packets.items():
+            if flow not in OUTGOING:
+                continue
+            for t, stage in tags:
+                if stage != RECEIVE:
+                    continue
+                # With several senders the same sequence number was sent more than once: take the closest
+                gaps = [t - sent for sent in sends.get((OUTGOING[flow], packet_id), []) if sent <= t]
+                if gaps:
+                    network[flow].append(min(gaps))
+        for flow in sorted(network):
+            report(f"{FLOWS[flow]} into {path}", network[flow])
+
+
+if __name__ == "__main__":
+    main()
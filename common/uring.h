@@ -0,0 +1,318 @@
+#ifndef URING_H
+#define URING_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Minimal io_uring wrapper over the raw kernel interface (no liburing).
+// Covers what the relay and the TCP clients use: submission and completion
+// rings, waiting with a timeout, a sparse fixed-file table, registered
+// (fixed) buffers, and a group of provided buffers for multishot receive. Rings are single-threaded: one Uring
+// per thread.
+
+namespace uring {
+
+inline int sysSetup(unsigned entries, io_uring_params* params) {
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+inline int sysEnter(int fd, unsigned submit, unsigned min_complete, unsigned flags, const void* arg, size_t argsz) {
+    return int(syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, arg, argsz));
+}
+
+inline int sysRegister(int fd, unsigned opcode, const void* arg, unsigned nr) {
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, nr));
+}
+
+// True when the running kernel lets us create a ring
+inline bool available() {
+    io_uring_params params = {};
+    int fd = sysSetup(2, &params);
+    if (fd < 0) return false;
+    close(fd);
+    return true;
+}
+
+class Uring {
+public:
+    Uring() = default;
+    ~Uring() { shutdown(); }
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // flags: IORING_SETUP_* (e.g. IORING_SETUP_SQPOLL). Setup failure is
+    // left to the caller to report (errno), so it can retry with other flags.
+    bool init(unsigned entries, unsigned flags = 0) {
+        io_uring_params params = {};
+        params.flags = flags | IORING_SETUP_CQSIZE;
+        params.cq_entries = entries * 4;    //Multishot ops post many CQEs per SQE
+        if (flags & IORING_SETUP_SQPOLL) {
+            params.sq_thread_idle = 1000;
+        }
+        fd_ = sysSetup(entries, &params);
+        if (fd_ < 0) {
+            return false;
+        }
+        flags_ = params.flags;
+
+        sq_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        single_mmap_ = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap_) {
+            sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+        }
+        sq_ring_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            perror("io_uring sq mmap");
+            return false;
+        }
+        cq_ring_ = single_mmap_ ? sq_ring_
+                                : mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            perror("io_uring cq mmap");
+            return false;
+        }
+        sqes_len_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(
+            mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            perror("io_uring sqe mmap");
+            sqes_ = nullptr;
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_flags_ = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+
+        char* cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        sqe_tail_ = *sq_tail_;
+        return true;
+    }
+
+    void shutdown() {
+        if (sqes_) munmap(sqes_, sqes_len_);
+        if (cq_ring_ && cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_len_);
+        if (sq_ring_ && sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_len_);
+        if (fd_ >= 0) close(fd_);
+        sqes_ = nullptr;
+        sq_ring_ = cq_ring_ = nullptr;
+        fd_ = -1;
+    }
+
+    int fd() const { return fd_; }
+
+    // Next free submission entry, zeroed; submits first when the ring is full
+    io_uring_sqe* sqe() {
+        unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sqe_tail_ - head >= sq_entries_) {
+            submit(0);
+            head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+            if (sqe_tail_ - head >= sq_entries_) {
+                return nullptr;
+            }
+        }
+        unsigned index = sqe_tail_ & sq_mask_;
+        io_uring_sqe* entry = &sqes_[index];
+        memset(entry, 0, sizeof(*entry));
+        sq_array_[index] = index;
+        sqe_tail_++;
+        return entry;
+    }
+
+    // Entries that can still be queued before sqe() has to submit
+    unsigned spaceLeft() const {
+        return sq_entries_ - (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE));
+    }
+
+    // Publish queued entries and optionally wait for completions.
+    // With SQPOLL no syscall is made unless the poller thread went to sleep.
+    int submit(unsigned wait_nr, const __kernel_timespec* timeout = nullptr) {
+        unsigned pending = sqe_tail_ - *sq_tail_;
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+        unsigned flags = 0;
+        unsigned to_submit = pending;
+        if (flags_ & IORING_SETUP_SQPOLL) {
+            to_submit = 0;
+            if (__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP) {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+            if (wait_nr == 0 && !(flags & IORING_ENTER_SQ_WAKEUP)) {
+                return int(pending);
+            }
+        } else if (pending == 0 && wait_nr == 0) {
+            return 0;
+        }
+        if (wait_nr > 0) {
+            flags |= IORING_ENTER_GETEVENTS;
+        }
+
+        if (timeout) {
+            io_uring_getevents_arg arg = {};
+            arg.ts = reinterpret_cast<uint64_t>(timeout);
+            flags |= IORING_ENTER_EXT_ARG;
+            int ret = sysEnter(fd_, to_submit, wait_nr, flags, &arg, sizeof(arg));
+            return ret < 0 && (errno == ETIME || errno == EINTR) ? 0 : ret;
+        }
+        int ret = sysEnter(fd_, to_submit, wait_nr, flags, nullptr, 0);
+        return ret < 0 && errno == EINTR ? 0 : ret;
+    }
+
+    // Visit every available completion, then release them to the kernel
+    template <typename OnCqe>
+    unsigned forEachCqe(OnCqe&& on_cqe) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned seen = 0;
+        for (; head != tail; head++, seen++) {
+            on_cqe(cqes_[head & cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return seen;
+    }
+
+    // Sparse fixed-file table; slots are filled with updateFile()
+    bool registerFiles(unsigned slots) {
+        std::vector<int> fds(slots, -1);
+        if (sysRegister(fd_, IORING_REGISTER_FILES, fds.data(), slots) < 0) {
+            perror("io_uring register files");
+            return false;
+        }
+        file_slots_ = slots;
+        return true;
+    }
+
+    unsigned fileSlots() const { return file_slots_; }
+
+    // Put fd (or -1 to clear) into a fixed-file slot
+    bool updateFile(unsigned slot, int fd) {
+        io_uring_files_update update = {};
+        update.offset = slot;
+        update.fds = reinterpret_cast<uint64_t>(&fd);
+        return sysRegister(fd_, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+    }
+
+    // Pin memory regions for IORING_OP_*_FIXED; buf_index picks the region
+    bool registerBuffers(const iovec* regions, unsigned count) {
+        if (sysRegister(fd_, IORING_REGISTER_BUFFERS, regions, count) < 0) {
+            perror("io_uring register buffers");
+            return false;
+        }
+        return true;
+    }
+
+private:
+    int fd_ = -1;
+    unsigned flags_ = 0;
+    bool single_mmap_ = false;
+    void* sq_ring_ = nullptr;
+    void* cq_ring_ = nullptr;
+    size_t sq_len_ = 0;
+    size_t cq_len_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_len_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_flags_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sqe_tail_ = 0;     // Local tail, published by submit()
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    unsigned file_slots_ = 0;
+};
+
+// Receive buffers provided to the kernel for IOSQE_BUFFER_SELECT.
+// The kernel picks a buffer per completion; the buffer id comes back in the
+// CQE flags and the buffer must be recycled once its data is consumed.
+// Buffers are handed over with IORING_OP_PROVIDE_BUFFERS: the mapped
+// buffer-ring registration is accepted by some kernels that then never select
+// from it, and re-providing a buffer rides along with the next submit anyway.
+class BufferGroup {
+public:
+    // Provides count buffers of buffer_size bytes; waits for the kernel to take them
+    bool init(Uring& ring, uint16_t group, unsigned count, unsigned buffer_size) {
+        ring_ = &ring;
+        group_ = group;
+        buffer_size_ = buffer_size;
+        storage_.resize(size_t(count) * buffer_size);
+
+        io_uring_sqe* sqe = ring.sqe();
+        if (!sqe) return false;
+        provide(sqe, 0, count);
+        sqe->user_data = 0;
+        if (ring.submit(1) < 0) {
+            perror("io_uring provide buffers");
+            return false;
+        }
+        int res = -EAGAIN;
+        ring.forEachCqe([&](const io_uring_cqe& cqe) {
+            if (cqe.user_data == 0) res = cqe.res;
+        });
+        if (res < 0) {
+            errno = -res;
+            perror("io_uring provide buffers");
+            return false;
+        }
+        return true;
+    }
+
+    uint16_t group() const { return group_; }
+    const uint8_t* buffer(uint16_t id) const { return storage_.data() + size_t(id) * buffer_size_; }
+
+    // Hand a consumed buffer back to the kernel (queued, goes out with the next submit)
+    void recycle(uint16_t id) {
+        io_uring_sqe* sqe = ring_->sqe();
+        if (!sqe) return;
+        provide(sqe, id, 1);
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = 0;
+    }
+
+private:
+    void provide(io_uring_sqe* sqe, uint16_t first, unsigned count) {
+        sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+        sqe->fd = int(count);
+        sqe->addr = reinterpret_cast<uint64_t>(buffer(first));
+        sqe->len = buffer_size_;
+        sqe->off = first;
+        sqe->buf_group = group_;
+    }
+
+    Uring* ring_ = nullptr;
+    uint16_t group_ = 0;
+    unsigned buffer_size_ = 0;
+    std::vector<uint8_t> storage_;
+};
+
+} // namespace uring
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef URING_STREAM_H
+#define URING_STREAM_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "frame_protocol.h"
+#include "uring.h"
+
+// io_uring I/O for a client's connection to the relay.
+// FrameSender hands frames to an SQPOLL kernel thread: while audio keeps
+// flowing the thread stays awake and a send costs no system call. Each frame
+// is copied (header then payload) into one of a few slots of a buffer area
+// registered with the ring once, so the caller's buffer is free again at once
+// and the kernel writes from pinned memory with IORING_OP_WRITE_FIXED instead
+// of mapping the pages on every send. A socket write may come back short, so
+// one write is in flight at a time and the rest of a frame is resubmitted
+// before the next slot goes out; frames stay in order. A slot is reused after
+// its frame has gone out completely.
+// Plain write() has no MSG_NOSIGNAL: callers ignore SIGPIPE.
+// StreamReceiver keeps one multishot recv armed on the socket, receiving into
+// provided buffers, and hands the bytes to the caller as they complete.
+// The socket is addressed through the fixed-file table in both.
+
+namespace uring {
+
+class FrameSender {
+public:
+    bool init(int sockfd) {
+        if (!ring_.init(Slots * 2, IORING_SETUP_SQPOLL)) {
+            perror("io_uring_setup");
+            return false;
+        }
+        if (!ring_.registerFiles(1) || !ring_.updateFile(0, sockfd)) {
+            return false;
+        }
+        area_.assign(size_t(Slots) * Slot_Size, 0);
+        iovec region = {area_.data(), area_.size()};
+        return ring_.registerBuffers(&region, 1);
+    }
+
+    // Queue one frame; false once any earlier send has failed
+    bool send(const framing::FrameHeader& header, const void* payload) {
+        Slot& slot = slots_[next_];
+        while (slot.busy && !failed_) {
+            reap(true);
+        }
+        if (failed_) return false;
+        if (header.length > framing::Max_Payload) {
+            error_ = EMSGSIZE;
+            return false;
+        }
+        if (header.length > 0 && !payload) {
+            error_ = EINVAL;
+            return false;
+        }
+
+        uint8_t* data = slotData(next_);
+        framing::encodeHeader(header, data);
+        if (payload) {
+            memcpy(data + framing::Header_Size, payload, header.length);
+        }
+        slot.size = framing::Header_Size + header.length;
+        slot.sent = 0;
+        slot.busy = true;
+        next_ = (next_ + 1) % Slots;
+
+        if (!writing_) {
+            writeNext();
+        }
+        ring_.submit(0);
+        reap(false);
+        return !failed_;
+    }
+
+    // Wait until every queued frame has gone out
+    bool drain() {
+        for (Slot& slot : slots_) {
+            while (slot.busy && !failed_) {
+                reap(true);
+            }
+        }
+        return !failed_;
+    }
+
+    // errno of the failed send, 0 if none failed
+    int error() const { return error_; }
+
+private:
+    static constexpr int Slots = 4;
+    static constexpr size_t Slot_Size = framing::Header_Size + framing::Max_Payload;
+
+    struct Slot {
+        size_t size = 0;        // Header and payload
+        size_t sent = 0;
+        bool busy = false;
+    };
+
+    uint8_t* slotData(int index) { return area_.data() + size_t(index) * Slot_Size; }
+
+    // Write the unsent rest of the oldest queued frame
+    void writeNext() {
+        Slot& slot = slots_[head_];
+        if (!slot.busy) return;
+        io_uring_sqe* sqe = ring_.sqe();
+        if (!sqe) {
+            error_ = EBUSY;
+            failed_ = true;
+            return;
+        }
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = reinterpret_cast<uint64_t>(slotData(head_) + slot.sent);
+        sqe->len = unsigned(slot.size - slot.sent);
+        sqe->buf_index = 0;
+        sqe->user_data = uint64_t(head_);
+        writing_ = true;
+    }
+
+    void reap(bool wait) {
+        if (wait && ring_.submit(1) < 0) {
+            error_ = errno;
+            failed_ = true;
+            return;
+        }
+        bool queued = false;
+        ring_.forEachCqe([&](const io_uring_cqe& cqe) {
+            Slot& slot = slots_[cqe.user_data];
+            writing_ = false;
+            if (cqe.res <= 0) {
+                error_ = cqe.res < 0 ? -cqe.res : EPIPE;
+                failed_ = true;
+                slot.busy = false;
+                return;
+            }
+            slot.sent += size_t(cqe.res);
+            if (slot.sent >= slot.size) {
+                slot.busy = false;
+                head_ = (head_ + 1) % Slots;
+            }
+            if (!failed_) {
+                writeNext();
+                queued = queued || writing_;
+            }
+        });
+        if (queued) {
+            ring_.submit(0);
+        }
+    }
+
+    Uring ring_;
+    std::vector<uint8_t> area_;     // Registered: Slots frames of up to Slot_Size bytes
+    Slot slots_[Slots];
+    int next_ = 0;                  // Slot the next frame goes into
+    int head_ = 0;                  // Oldest frame not yet fully written
+    bool writing_ = false;
+    bool failed_ = false;
+    int error_ = 0;
+};
+
+class StreamReceiver {
+public:
+    bool init(int sockfd) {
+        if (!ring_.init(64)) {
+            perror("io_uring_setup");
+            return false;
+        }
+        if (!ring_.registerFiles(1) || !ring_.updateFile(0, sockfd) || !buffers_.init(ring_, 0, Buffers, Buffer_Size)) {
+            return false;
+        }
+        arm();
+        return true;
+    }
+
+    // Wait for data and pass each received chunk to on_bytes(data, len).
+    // Returns the bytes handled, 0 when the peer closed, -errno on error.
+    template <typename OnBytes>
+    int receive(OnBytes&& on_bytes) {
+        int result = 0;
+        while (result == 0 && !closed_) {
+            if (ring_.submit(1) < 0) {
+                return -errno;
+            }
+            ring_.forEachCqe([&](const io_uring_cqe& cqe) {
+                if (cqe.user_data != Recv_Tag) return;      //Buffer hand-backs
+                if (cqe.res > 0) {
+                    uint16_t id = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                    if (result >= 0) {
+                        on_bytes(buffers_.buffer(id), size_t(cqe.res));
+                        result += cqe.res;
+                    }
+                    buffers_.recycle(id);
+                } else if (cqe.res == 0) {
+                    closed_ = true;
+                } else if (cqe.res != -ENOBUFS) {
+                    result = cqe.res;
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE) && !closed_ && result >= 0) {
+                    arm();      //Ended early, e.g. out of buffers
+                }
+            });
+        }
+        return result;
+    }
+
+private:
+    static constexpr unsigned Buffers = 64;
+    static constexpr unsigned Buffer_Size = 16 * 1024;
+    static constexpr uint64_t Recv_Tag = 1;
+
+    void arm() {
+        io_uring_sqe* sqe = ring_.sqe();
+        if (!sqe) return;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->buf_group = buffers_.group();
+        sqe->user_data = Recv_Tag;
+    }
+
+    Uring ring_;
+    BufferGroup buffers_;
+    bool closed_ = false;
+};
+
+} // namespace uring
+
+#endif